@@ -0,0 +1,494 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_array.c
+//  Description   : This is the RAID array engine.  It executes raid_bus.h
+//                  requests against a set of disks held in memory, in
+//                  mmap'd image files, or in image files accessed with
+//                  O_DIRECT.  It is shared by the server and anything else
+//                  that needs to speak the protocol without the network.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/16/15
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <raid_array.h>
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define RAID_DIRECT_ALIGN 4096 // Buffer alignment for O_DIRECT transfers
+
+// Type definitions
+typedef struct {
+	char     *in;      // Next write payload
+	char     *out;     // Next read payload
+	uint32_t  inleft;  // Write payload bytes left
+	uint32_t  outleft; // Read payload room left
+} RaidPayload;
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_release_disks
+// Description  : Unmap and close every disk of the current geometry
+//
+// Inputs       : array - the array
+// Outputs      : none
+
+static void array_release_disks(RaidArray *array) {
+	int i;
+
+	for (i = 0; i < array->disks; i++) {
+		if ((array->data != NULL) && (array->data[i] != NULL)) {
+			munmap(array->data[i], (size_t)array->blocks * RAID_BLOCK_SIZE);
+		}
+		if ((array->fds != NULL) && (array->fds[i] != -1)) {
+			close(array->fds[i]);
+		}
+	}
+	free(array->data);
+	free(array->fds);
+	free(array->state);
+	free(array->head);
+	array->data = NULL;
+	array->fds = NULL;
+	array->state = NULL;
+	array->head = NULL;
+	array->disks = 0;
+	array->blocks = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_setup_disks
+// Description  : Create the disks for a new geometry
+//
+// Inputs       : array - the array
+//                disks - the number of disks
+//                blocks - the number of blocks per disk
+// Outputs      : 0 if successful, -1 if failure
+
+static int array_setup_disks(RaidArray *array, int disks, uint32_t blocks) {
+	char path[1024];
+	size_t size = (size_t)blocks * RAID_BLOCK_SIZE;
+	int i, flags;
+
+	array_release_disks(array);
+	array->disks = disks;
+	array->blocks = blocks;
+	array->state = calloc(disks, sizeof(RAID_DISK_STATE));
+	array->data = calloc(disks, sizeof(char *));
+	array->fds = malloc(disks * sizeof(int));
+	array->head = calloc(disks, sizeof(uint32_t));
+	array->transfers = array->seeks = 0;
+	if ((array->state == NULL) || (array->data == NULL) || (array->fds == NULL) || (array->head == NULL)) {
+		array_release_disks(array);
+		return( -1 );
+	}
+	for (i = 0; i < disks; i++) {
+		array->fds[i] = -1;
+	}
+
+	for (i = 0; i < disks; i++) {
+
+		// Memory backed disks
+		if (array->dir == NULL) {
+			array->data[i] = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if (array->data[i] == MAP_FAILED) {
+				array->data[i] = NULL;
+				RAID_LOG(LOG_ERROR_LEVEL, "RAID array disk %d allocation failed [%s]", i, strerror(errno));
+				array_release_disks(array);
+				return( -1 );
+			}
+			continue;
+		}
+
+		// Image file backed disks, mapped unless doing direct I/O
+		snprintf(path, sizeof(path), "%s/raid-disk%03d.img", array->dir, i);
+		flags = O_RDWR|O_CREAT|O_CLOEXEC | (array->direct ? O_DIRECT : 0);
+		if (((array->fds[i] = open(path, flags, 0644)) == -1) || (ftruncate(array->fds[i], size) == -1)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "RAID array disk image [%s] failed [%s]", path, strerror(errno));
+			array_release_disks(array);
+			return( -1 );
+		}
+		if (!array->direct) {
+			array->data[i] = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, array->fds[i], 0);
+			if (array->data[i] == MAP_FAILED) {
+				array->data[i] = NULL;
+				RAID_LOG(LOG_ERROR_LEVEL, "RAID array disk image [%s] map failed [%s]", path, strerror(errno));
+				array_release_disks(array);
+				return( -1 );
+			}
+		}
+	}
+
+	RAID_LOG(LOG_INFO_LEVEL, "RAID array initialized (%d disks, %u blocks, %s)", disks, blocks,
+			(array->dir == NULL) ? "memory" : (array->direct ? "direct" : "mmap"));
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_direct_io
+// Description  : Move blocks with O_DIRECT through an aligned bounce buffer
+//
+// Inputs       : fd - the disk image
+//                buf - the caller's buffer
+//                off - the byte offset on the disk
+//                len - the number of bytes
+//                wr - non-zero to write, zero to read
+// Outputs      : 0 if successful, -1 if failure
+
+static int array_direct_io(int fd, void *buf, off_t off, size_t len, int wr) {
+	static __thread void *bounce = NULL;
+	ssize_t rv;
+
+	if ((bounce == NULL) &&
+			posix_memalign(&bounce, RAID_DIRECT_ALIGN, (size_t)RAID_MAX_XFER * RAID_BLOCK_SIZE)) {
+		return( -1 );
+	}
+	if (wr) {
+		memcpy(bounce, buf, len);
+		rv = pwrite(fd, bounce, len, off);
+	} else {
+		rv = pread(fd, bounce, len, off);
+		memcpy(buf, bounce, len);
+	}
+	return( (rv == (ssize_t)len) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_transfer
+// Description  : Read or write consecutive blocks of one disk
+//
+// Inputs       : array - the array
+//                dsk - the disk
+//                blk - the first block
+//                blks - the number of blocks
+//                buf - the buffer to read into or write from
+//                wr - non-zero to write, zero to read
+// Outputs      : 0 if successful, -1 if failure
+
+static int array_transfer(RaidArray *array, int dsk, uint32_t blk, uint32_t blks, void *buf, int wr) {
+	size_t off = (size_t)blk * RAID_BLOCK_SIZE, len = (size_t)blks * RAID_BLOCK_SIZE;
+
+	// Count the transfers that move the disk head (workers race on the
+	// head, which only blurs the figure)
+	__atomic_add_fetch(&array->transfers, 1, __ATOMIC_RELAXED);
+	if (__atomic_exchange_n(&array->head[dsk], blk + blks, __ATOMIC_RELAXED) != blk) {
+		__atomic_add_fetch(&array->seeks, 1, __ATOMIC_RELAXED);
+	}
+
+	if (array->data[dsk] == NULL) {
+		return( array_direct_io(array->fds[dsk], buf, off, len, wr) );
+	}
+	if (wr) {
+		memcpy(array->data[dsk] + off, buf, len);
+	} else {
+		memcpy(buf, array->data[dsk] + off, len);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_format
+// Description  : Zero a disk and bring it to the ready state
+//
+// Inputs       : array - the array
+//                dsk - the disk to format
+// Outputs      : 0 if successful, -1 if failure
+
+static int array_format(RaidArray *array, int dsk) {
+	char zero[RAID_BLOCK_SIZE*16];
+	uint32_t b, n;
+
+	if (array->data[dsk] != NULL) {
+		// Drop the pages rather than writing zeros over them
+		if (madvise(array->data[dsk], (size_t)array->blocks * RAID_BLOCK_SIZE, MADV_DONTNEED) == -1) {
+			memset(array->data[dsk], 0, (size_t)array->blocks * RAID_BLOCK_SIZE);
+		}
+		if ((array->fds[dsk] != -1) && (ftruncate(array->fds[dsk], 0) == -1 ||
+				ftruncate(array->fds[dsk], (off_t)array->blocks * RAID_BLOCK_SIZE) == -1)) {
+			return( -1 );
+		}
+	} else {
+		memset(zero, 0, sizeof(zero));
+		for (b = 0; b < array->blocks; b += n) {
+			n = (array->blocks - b < 16) ? array->blocks - b : 16;
+			if (array_direct_io(array->fds[dsk], zero, (off_t)b * RAID_BLOCK_SIZE, n * RAID_BLOCK_SIZE, 1)) {
+				return( -1 );
+			}
+		}
+	}
+	array->state[dsk] = RAID_DISK_READY;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : array_execute_one
+// Description  : Execute one (non-batch) request, consuming its write
+//                payload and producing its read payload
+//
+// Inputs       : array - the array
+//                op - the request opcode
+//                pl - the payload cursors
+// Outputs      : the response opcode
+
+static RAIDOpCode array_execute_one(RaidArray *array, RAIDOpCode op, RaidPayload *pl) {
+	RAID_REQUEST_TYPES req = (op >> 56) & 0xff;
+	uint32_t blks = (op >> 48) & 0xff, blk = (uint32_t)op, i, len = 0, caps;
+	int dsk = (op >> 40) & 0xff, err = 0;
+	char *start = pl->out;
+	uint64_t hash;
+
+	// Geometry changes take the array exclusively
+	if ((req == RAID_INIT) || (req == RAID_FORMAT) || (req == RAID_DISKFAIL)) {
+		pthread_rwlock_wrlock(&array->lock);
+		if (req == RAID_INIT) {
+			caps = (op >> RAID_CAP_SHIFT) & 0x7f;
+			err = ((dsk == 0) || (blks == 0) ||
+					array_setup_disks(array, dsk, blks * RAID_TRACK_BLOCKS));
+
+			// a plain INIT is told what could be granted, a request what was
+			op = (op & ~(((uint64_t)0x7f << RAID_CAP_SHIFT) | 0xffffffffULL)) |
+					((caps == 0) ? RAID_ARRAY_CAPS : (caps & RAID_ARRAY_CAPS));
+		} else if (dsk >= array->disks) {
+			err = 1;
+		} else if (req == RAID_FORMAT) {
+			err = array_format(array, dsk);
+		} else {
+			array->state[dsk] = RAID_DISK_FAILED;
+			RAID_LOG(LOG_INFO_LEVEL, "RAID array disk %d failed by request", dsk);
+		}
+		pthread_rwlock_unlock(&array->lock);
+		return( err ? (op | RAID_OPCODE_RESULT) : op );
+	}
+
+	// Everything else runs concurrently
+	pthread_rwlock_rdlock(&array->lock);
+	switch (req) {
+
+	case RAID_CLOSE: // Nothing to tear down per client
+		break;
+
+	case RAID_STATUS: // Report the disk state in the block ID field
+		if (dsk >= array->disks) {
+			err = 1;
+		} else {
+			op = (op & ~0xffffffffULL) | array->state[dsk];
+		}
+		break;
+
+	case RAID_READ:
+	case RAID_WRITE:
+	case RAID_HASHBLOCK:
+		len = blks * ((req == RAID_HASHBLOCK) ? sizeof(uint64_t) : RAID_BLOCK_SIZE);
+		if ((dsk >= array->disks) || (array->state[dsk] != RAID_DISK_READY) || (blks == 0) ||
+				((uint64_t)blk + blks > array->blocks)) {
+			err = 1;
+		} else if (req == RAID_WRITE) {
+			if ((len > pl->inleft) || array_transfer(array, dsk, blk, blks, pl->in, 1)) {
+				err = 1;
+			} else {
+				pl->in += len;
+				pl->inleft -= len;
+			}
+		} else if (len > pl->outleft) {
+			err = 1;
+		} else if (req == RAID_READ) {
+			if (array_transfer(array, dsk, blk, blks, pl->out, 0)) {
+				err = 1;
+			} else {
+				pl->out += len;
+				pl->outleft -= len;
+			}
+		} else {
+			char tmp[RAID_BLOCK_SIZE];
+			for (i = 0; (i < blks) && !err; i++) {
+				err = array_transfer(array, dsk, blk+i, 1, tmp, 0);
+				hash = htonll64(raid_block_hash(tmp));
+				memcpy(pl->out, &hash, sizeof(hash));
+				pl->out += sizeof(hash);
+				pl->outleft -= sizeof(hash);
+			}
+		}
+		break;
+
+	default: // Unknown request
+		err = 1;
+		break;
+	}
+	pthread_rwlock_unlock(&array->lock);
+
+	// A failed read or hash still fills its payload (with zeros), so the
+	// payloads after it in a batch stay where the client expects them
+	if (err && ((req == RAID_READ) || (req == RAID_HASHBLOCK)) &&
+			(len <= (uint32_t)(pl->out - start) + pl->outleft)) {
+		pl->outleft += (uint32_t)(pl->out - start);
+		memset(start, 0, len);
+		pl->out = start + len;
+		pl->outleft -= len;
+	}
+
+	return( err ? (op | RAID_OPCODE_RESULT) : op );
+}
+
+//
+// Interface Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_array_create
+// Description  : Set up an array engine, the disks come with the first INIT
+//
+// Inputs       : array - the array to set up
+//                dir - the directory for disk images (NULL for memory)
+//                direct - non-zero to use O_DIRECT rather than mmap
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_array_create(RaidArray *array, const char *dir, int direct) {
+	memset(array, 0, sizeof(*array));
+	array->dir = dir;
+	array->direct = (dir != NULL) && direct;
+	if (pthread_rwlock_init(&array->lock, NULL)) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_array_destroy
+// Description  : Unmap and close the disks of the array
+//
+// Inputs       : array - the array
+// Outputs      : none
+
+void raid_array_destroy(RaidArray *array) {
+	pthread_rwlock_wrlock(&array->lock);
+	array_release_disks(array);
+	pthread_rwlock_unlock(&array->lock);
+	pthread_rwlock_destroy(&array->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_array_execute
+// Description  : Execute one request, or every request of a RAID_BATCH frame
+//
+// Inputs       : array - the array
+//                op - the request opcode
+//                in - the request payload
+//                inlen - the request payload length
+//                out - the response payload buffer
+//                outlen - the response buffer size in, payload length out
+// Outputs      : the response opcode
+
+RAIDOpCode raid_array_execute(RaidArray *array, RAIDOpCode op, const void *in,
+		uint32_t inlen, void *out, uint32_t *outlen) {
+	RaidPayload pl;
+	uint32_t n = (uint32_t)op, i;
+	const uint64_t *ops = in;
+	uint64_t *resps = out;
+	RAIDOpCode resp;
+
+	// Single requests
+	if (((op >> 56) & 0xff) != RAID_BATCH) {
+		pl.in = (char *)in;
+		pl.inleft = inlen;
+		pl.out = out;
+		pl.outleft = *outlen;
+		resp = array_execute_one(array, op, &pl);
+		*outlen -= pl.outleft;
+		return( resp );
+	}
+
+	// Batch frames, response vector first then the read payloads
+	if ((n == 0) || (n > RAID_MAX_BATCH) || (inlen < n * sizeof(uint64_t)) ||
+			(*outlen < n * sizeof(uint64_t))) {
+		*outlen = 0;
+		return( op | RAID_OPCODE_RESULT );
+	}
+	pl.in = (char *)&ops[n];
+	pl.inleft = inlen - n * sizeof(uint64_t);
+	pl.out = (char *)&resps[n];
+	pl.outleft = *outlen - n * sizeof(uint64_t);
+	for (i = 0; i < n; i++) {
+		resp = ntohll64(ops[i]);
+		if (((resp >> 56) & 0xff) == RAID_BATCH) {
+			resp |= RAID_OPCODE_RESULT;
+		} else {
+			resp = array_execute_one(array, resp, &pl);
+		}
+		resps[i] = htonll64(resp);
+	}
+	*outlen -= pl.outleft;
+	return( op );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_array_fail_disk
+// Description  : Fail a disk, the same as a RAID_DISKFAIL request
+//
+// Inputs       : array - the array
+//                dsk - the disk to fail
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_array_fail_disk(RaidArray *array, RAIDDiskID dsk) {
+	RaidPayload pl;
+
+	memset(&pl, 0, sizeof(pl));
+	if (array_execute_one(array, ((uint64_t)RAID_DISKFAIL << 56) | ((uint64_t)dsk << 40), &pl) &
+			RAID_OPCODE_RESULT) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_block_hash
+// Description  : Compute the RAID_HASHBLOCK digest of one block, a 64-bit
+//                multiply/rotate hash over the block's words
+//
+// Inputs       : blk - the block (RAID_BLOCK_SIZE bytes)
+// Outputs      : the digest
+
+uint64_t raid_block_hash(const void *blk) {
+	const uint64_t k1 = 0x9e3779b97f4a7c15ULL, k2 = 0xc2b2ae3d27d4eb4fULL;
+	uint64_t h[4] = { k1, k2, ~k1, ~k2 }, w;
+	const unsigned char *p = blk;
+	int i;
+
+	// Four independent lanes so the multiplies overlap
+	for (i = 0; i < RAID_BLOCK_SIZE; i += sizeof(uint64_t)) {
+		memcpy(&w, p+i, sizeof(w));
+		h[(i/8)&3] = (h[(i/8)&3] ^ (w * k2)) * k1;
+		h[(i/8)&3] = (h[(i/8)&3] << 31) | (h[(i/8)&3] >> 33);
+	}
+	w = h[0] ^ (h[1] * k1) ^ (h[2] * k2) ^ ((h[3] << 17) | (h[3] >> 47));
+	w ^= w >> 33;
+	w *= k2;
+	w ^= w >> 29;
+	return( w );
+}
@@ -0,0 +1,62 @@
+#ifndef RAID_ARRAY_INCLUDED
+#define RAID_ARRAY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_array.h
+//  Description   : This is the interface to the RAID array engine, which
+//                  executes raid_bus.h requests against a set of disk images.
+//                  Disks live in anonymous memory or in mmap'd image files
+//                  (or are accessed with O_DIRECT I/O when asked for).
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/16/15
+//
+
+// Include Files
+#include <stdint.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_OPCODE_RESULT  ((uint64_t)1 << 32)  // The R (failure) bit of a response
+#define RAID_ARRAY_CAPS     (RAID_CAP_BATCH | RAID_CAP_HASH) // Capabilities the engine grants
+#define RAID_ARRAY_MAX_DISKS 256                 // The disk field is 8 bits wide
+
+// Type definitions
+typedef struct {
+	const char      *dir;       // Directory for disk images (NULL for memory)
+	int              direct;    // Use O_DIRECT pread/pwrite rather than mmap
+	int              disks;     // Number of disks (0 before INIT)
+	uint32_t         blocks;    // Blocks per disk
+	RAID_DISK_STATE *state;     // Per-disk state
+	char           **data;      // Per-disk mapping (mmap mode)
+	int             *fds;       // Per-disk image file (file modes)
+	uint32_t        *head;      // Per-disk block after the last transfer
+	uint64_t         transfers; // Disk transfers done by READ/WRITE/HASHBLOCK
+	uint64_t         seeks;     // ... that did not start where the disk's last one ended
+	pthread_rwlock_t lock;      // Held for writing by geometry/state changes
+} RaidArray;
+
+//
+// Functional Prototypes
+
+int raid_array_create(RaidArray *array, const char *dir, int direct);
+	// Set up an (uninitialized) array engine
+
+void raid_array_destroy(RaidArray *array);
+	// Unmap and close the disks of the array
+
+RAIDOpCode raid_array_execute(RaidArray *array, RAIDOpCode op, const void *in,
+		uint32_t inlen, void *out, uint32_t *outlen);
+	// Execute one request (or a RAID_BATCH frame) against the array
+
+int raid_array_fail_disk(RaidArray *array, RAIDDiskID dsk);
+	// Fail a disk, the same as a RAID_DISKFAIL request
+
+uint64_t raid_block_hash(const void *blk);
+	// Compute the RAID_HASHBLOCK digest of one block
+
+#endif
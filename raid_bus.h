@@ -18,6 +18,14 @@
 #define RAID_BLOCK_SIZE   1024 // Block size in bytes
 #define RAID_TRACK_BLOCKS 1024  // Number of blocks per track
 #define RAID_MAX_XFER     255  // The maximum blocks per transfer
+#define RAID_MAX_BATCH    256  // The maximum opcodes per batch frame
+#define RAID_BATCH_PAYLOAD (RAID_BLOCK_SIZE*RAID_MAX_XFER) // Max payload per batch frame
+
+// Capabilities a server may advertise in its INIT response
+#define RAID_CAP_BATCH    0x01 // Server accepts RAID_BATCH frames
+#define RAID_CAP_COMPRESS 0x02 // Payloads travel compressed (raid_compress.h)
+#define RAID_CAP_HASH     0x04 // RAID_HASHBLOCK answers with 64-bit digests
+#define RAID_CAP_SHIFT    33   // Requested capabilities ride in the unused bits
 //
 // Type definitions
 
@@ -31,7 +39,8 @@ typedef enum {
 	RAID_HASHBLOCK    = 5,  // Log a hash value for blocks of a disk
 	RAID_STATUS       = 6,  // Get the status of a disk on the array
 	RAID_DISKFAIL     = 7,  // Tell a disk to fail
-	RAID_MAXVAL       = 8,  // Max value
+	RAID_BATCH        = 8,  // Carry several requests in one frame
+	RAID_MAXVAL       = 9,  // Max value
 } RAID_REQUEST_TYPES;
 extern const char *RAID_REQUEST_TYPE_LABELS[RAID_MAXVAL];
 
@@ -65,6 +74,45 @@ typedef enum {
      63 - R (result) this is the result bit (0 success, 1 is failure)
   32-63   block ID
 
+ Capability Negotiation
+
+  An INIT request may carry the capabilities the client would like to use
+  in the unused bits (24-30 above, RAID_CAP_SHIFT in the 64-bit opcode).
+  A server that supports any of them answers with the granted set in the
+  block ID field of the INIT response, and answers an INIT without any
+  with the set it offers.  The stock server aborts (an assertion on the
+  unused field) on an opcode with any of the unused bits set, and echoes
+  a plain INIT, offering nothing.  So over TCP the client sends a plain
+  INIT first and asks for capabilities in a second INIT only if some were
+  offered (see raid_bus_requested in raid_network.h); over the
+  shared-memory ring and the in-process array it asks straight away.
+
+ Block Hashes (RAID_HASHBLOCK, digests require RAID_CAP_HASH)
+
+  Once RAID_CAP_HASH is granted, a RAID_HASHBLOCK request for N blocks
+  returns N 64-bit block digests (network byte order) as its payload, one
+  per block in order.  The stock server answers with the blocks themselves,
+  so clients only send it to a server that granted the capability.  The
+  client asks for it whenever it is offered.
+
+ Batch Frame (RAID_BATCH, requires RAID_CAP_BATCH)
+
+  The header opcode has request type RAID_BATCH and the number of ops N in
+  the block ID field; the length is 8*N plus the packed payload.  The body
+  is the N request opcodes (network byte order) followed by the payloads
+  of the WRITE requests in order.  The response has the same header layout
+  and carries the N response opcodes followed by the payloads of the READ
+  and RAID_HASHBLOCK requests in order, zeros for one that failed, so the
+  payloads after it stay in place.  N is at most RAID_MAX_BATCH and the
+  payload in either direction at most RAID_BATCH_PAYLOAD bytes.
+
+ Compressed Payloads (requires RAID_CAP_COMPRESS)
+
+  Once granted, every non-empty payload in either direction is sent in
+  the encoding of raid_compress.h and the length field counts the encoded
+  bytes.  For a batch frame only the packed payload after the opcode
+  vector is encoded; the vector itself is sent as is.
+
 */
 
 // These are the fields of the RAID opcodes
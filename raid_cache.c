@@ -2,21 +2,40 @@
 //
 //  File           : raid_cache.c
 //  Description    : This is the implementation of the cache for the TAGLINE
-//                   driver.
+//                   driver, with the victim cache (raid_victim.h) behind it
+//                   when one is configured.  Once configured (tagline_client
+//                   -M), a sample of the blocks is tracked to estimate the
+//                   miss ratio curve (SHARDS): a block is sampled if its
+//                   hash falls in the first 1/sample of the hash space, and
+//                   every get of a sampled block is given its LRU stack
+//                   distance among the sampled blocks (a Fenwick tree over
+//                   the stamps of their last references), which scaled up
+//                   by the sampling rate is the distance among all blocks.
+//                   The histogram of distances gives the hit ratio of any
+//                   cache size, and it is halved every tuning interval so
+//                   it follows the workload.  The tuner resizes the cache
+//                   to the smallest size reaching the target hit ratio, or
+//                   within a point of the best the memory budget allows; it
+//                   runs on its own thread, woken by the gets once per
+//                   interval, so no get waits on a resize.
 //
 //  Author         : Dhruva Seelin
-//  Last Modified  : 11/30/15
+//  Last Modified  : 12/31/15
 //
 
 // Includes
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 // Project includes
 #include <cmpsc311_log.h>
+#include <raid_log.h>
 #include <cmpsc311_util.h>
 #include <raid_cache.h>
+#include <raid_victim.h>
 
 // Gobal Variables
 int *cacheDisk;
@@ -30,6 +49,14 @@ int cacheHit;
 int cacheMiss;
 int cacheInsert;
 int cacheGet;
+int cacheVictimHit;
+int cacheCoalesced;
+int cacheResizes;
+pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER; // Guards the slots, flights, tracker and counters
+pthread_cond_t flightDone = PTHREAD_COND_INITIALIZER;  // An in-flight miss was filled or failed
+pthread_cond_t tuneKick = PTHREAD_COND_INITIALIZER;    // A tuning interval has passed
+pthread_t tuneThread;
+int tuneRunning, tuneDue, tuneStop;
 
 // Cache struct
 struct CACHE {
@@ -40,6 +67,566 @@ struct CACHE {
 
 }*cache;
 
+// In-flight miss struct, one per block a reader is fetching from the bus
+struct FLIGHT {
+	RAIDDiskID disk;
+	RAIDBlockID diskBlock;
+	int state;		// 0 being read, 1 filled, -1 the read failed
+	int waiters;		// readers attached to it
+	char data[RAID_BLOCK_SIZE];
+	struct FLIGHT *next;
+}*flights;
+
+// Miss ratio curve tracker, the sampled blocks (disk << 32 | block, plus 1 so
+// no key is 0) in an open-addressed table
+struct MRC {
+	int tracking;		// the curve is estimated
+	uint32_t sample;	// one block in this many is sampled
+	uint64_t *keys;		// sampled blocks seen (0 empty)
+	uint32_t *stamps;	// ... the stamp of each one's last reference
+	uint32_t mask;		// ... table size - 1
+	uint32_t live;		// ... blocks in it
+	int32_t *tree;		// Fenwick tree over the stamps, 1 at each last reference
+	uint64_t *owner;	// ... the block each stamp was given to (0 if stale)
+	uint32_t cap;		// ... stamps it holds
+	uint32_t next;		// ... the next stamp
+	double *hist;		// sampled gets by stack distance (aged)
+	uint32_t nhist;		// ... distances it holds
+	double cold;		// sampled gets of blocks not referenced before
+	double total;		// all sampled gets
+	double target;		// hit ratio the tuner aims for (0 for none)
+	uint32_t budget;	// most blocks the tuner may use (0 for none)
+	uint32_t min;		// fewest blocks it may use
+	uint32_t interval;	// gets between tunings (and agings)
+	uint32_t gets;		// ... gets since the last one
+} mrc = { 0, RAID_CACHE_SAMPLE, NULL, NULL, 0, 0, NULL, NULL, 0, 0, NULL, 0, 0, 0, 0, 0,
+		RAID_CACHE_MIN, RAID_CACHE_INTERVAL, 0 };
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_slot
+// Description  : Find the slot of the tracker's table holding a block, or
+//                the empty slot that ends its probe
+//
+// Inputs       : key - the block's key
+// Outputs      : the slot
+
+static uint32_t mrc_slot(uint64_t key) {
+	uint32_t slot = (uint32_t)((key * 0xc2b2ae3d27d4eb4fULL) >> 32) & mrc.mask;
+
+	while(mrc.keys[slot] != 0 && mrc.keys[slot] != key) {
+		slot = (slot + 1) & mrc.mask;
+	}
+	return(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_tree_add
+// Description  : Add to the count of a stamp in the Fenwick tree
+//
+// Inputs       : stamp - the stamp
+//                value - what to add
+// Outputs      : none
+
+static void mrc_tree_add(uint32_t stamp, int32_t value) {
+	for(stamp++; stamp <= mrc.cap; stamp += stamp & -stamp) {
+		mrc.tree[stamp-1] += value;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_tree_sum
+// Description  : Count the last references at or before a stamp
+//
+// Inputs       : stamp - the stamp
+// Outputs      : the count
+
+static uint32_t mrc_tree_sum(uint32_t stamp) {
+	int32_t sum = 0;
+
+	for(stamp++; stamp > 0; stamp -= stamp & -stamp) {
+		sum += mrc.tree[stamp-1];
+	}
+	return((uint32_t)sum);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_renumber
+// Description  : Give the tracked blocks new stamps in the same order once
+//                the stamps run out, with room for as many more
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_renumber(void) {
+	uint32_t cap = (mrc.live * 4 > 1024) ? mrc.live * 4 : 1024, i, n = 0;
+	int32_t *tree = calloc(cap, sizeof(int32_t));
+	uint64_t *owner = calloc(cap, sizeof(uint64_t));
+
+	if(tree == NULL || owner == NULL) {
+		free(tree);
+		free(owner);
+		return(-1);
+	}
+	for(i = 0; i < mrc.next; i++) {
+		if(mrc.owner[i] != 0) {
+			mrc.stamps[mrc_slot(mrc.owner[i])] = n;
+			owner[n++] = mrc.owner[i];
+		}
+	}
+	free(mrc.tree);
+	free(mrc.owner);
+	mrc.tree = tree;
+	mrc.owner = owner;
+	mrc.cap = cap;
+	mrc.next = n;
+	for(i = 0; i < n; i++) {
+		mrc_tree_add(i, 1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_grow
+// Description  : Double the tracker's table (or the histogram) when it is
+//                half full
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int mrc_grow(void) {
+	uint64_t *keys = mrc.keys;
+	uint32_t *stamps = mrc.stamps, size = mrc.mask + 1, i, slot;
+
+	mrc.keys = calloc(2 * size, sizeof(uint64_t));
+	mrc.stamps = malloc(2 * size * sizeof(uint32_t));
+	if(mrc.keys == NULL || mrc.stamps == NULL) {
+		free(mrc.keys);
+		free(mrc.stamps);
+		mrc.keys = keys;
+		mrc.stamps = stamps;
+		return(-1);
+	}
+	mrc.mask = 2 * size - 1;
+	for(i = 0; i < size; i++) {
+		if(keys[i] != 0) {
+			slot = mrc_slot(keys[i]);
+			mrc.keys[slot] = keys[i];
+			mrc.stamps[slot] = stamps[i];
+		}
+	}
+	free(keys);
+	free(stamps);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_access
+// Description  : Track a reference to a block if it is sampled, a get
+//                adding its stack distance to the histogram (cacheLock held)
+//
+// Inputs       : dsk - this is the disk number of the block
+//                blk - this is the block number of the block
+//                get - the reference is a get (not a put)
+// Outputs      : none
+
+static void mrc_access(RAIDDiskID dsk, RAIDBlockID blk, int get) {
+	uint64_t key = (((uint64_t)dsk << 32) | blk) + 1;
+	uint32_t slot, dist, n;
+	double *hist;
+
+	if(!mrc.tracking || ((uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) % mrc.sample) != 0) {
+		return;
+	}
+	if((mrc.live + 1) * 2 > mrc.mask + 1 && mrc_grow()) {
+		return;
+	}
+	slot = mrc_slot(key);
+
+	// the distance is the sampled blocks referenced since, its mark moves up
+	if(mrc.keys[slot] == key) {
+		dist = mrc.live - mrc_tree_sum(mrc.stamps[slot]);
+		mrc_tree_add(mrc.stamps[slot], -1);
+		mrc.owner[mrc.stamps[slot]] = 0;
+		if(get) {
+			if(dist >= mrc.nhist) {
+				for(n = mrc.nhist * 2; n <= dist; n *= 2);
+				if((hist = realloc(mrc.hist, n * sizeof(double))) == NULL) {
+					return;
+				}
+				memset(hist + mrc.nhist, 0, (n - mrc.nhist) * sizeof(double));
+				mrc.hist = hist;
+				mrc.nhist = n;
+			}
+			mrc.hist[dist] += 1;
+			mrc.total += 1;
+		}
+	} else {
+		mrc.keys[slot] = key;
+		mrc.live++;
+		if(get) {
+			mrc.cold += 1;
+			mrc.total += 1;
+		}
+	}
+	if(mrc.next == mrc.cap && mrc_renumber()) {
+		return;
+	}
+	mrc.stamps[slot] = mrc.next;
+	mrc.owner[mrc.next] = key;
+	mrc_tree_add(mrc.next++, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_drop
+// Description  : Stop tracking a block the cache forgot (cacheLock held)
+//
+// Inputs       : dsk - this is the disk number of the block
+//                blk - this is the block number of the block
+// Outputs      : none
+
+static void mrc_drop(RAIDDiskID dsk, RAIDBlockID blk) {
+	uint64_t key = (((uint64_t)dsk << 32) | blk) + 1;
+	uint32_t slot, next, home;
+
+	if(!mrc.tracking || mrc.keys == NULL || mrc.keys[slot = mrc_slot(key)] != key) {
+		return;
+	}
+	mrc_tree_add(mrc.stamps[slot], -1);
+	mrc.owner[mrc.stamps[slot]] = 0;
+	mrc.live--;
+
+	// move the entries after it back so no probe runs into the hole
+	mrc.keys[slot] = 0;
+	for(next = (slot + 1) & mrc.mask; mrc.keys[next] != 0; next = (next + 1) & mrc.mask) {
+		home = (uint32_t)((mrc.keys[next] * 0xc2b2ae3d27d4eb4fULL) >> 32) & mrc.mask;
+		if(((next - home) & mrc.mask) >= ((next - slot) & mrc.mask)) {
+			mrc.keys[slot] = mrc.keys[next];
+			mrc.stamps[slot] = mrc.stamps[next];
+			mrc.keys[next] = 0;
+			slot = next;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_ratio
+// Description  : The estimated hit ratio of a cache of some size: the share
+//                of sampled gets whose scaled distance is under the size
+//                (cacheLock held)
+//
+// Inputs       : blocks - the cache size
+// Outputs      : the ratio, 0 if nothing was sampled yet
+
+static double mrc_ratio(uint32_t blocks) {
+	uint64_t limit = ((uint64_t)blocks + mrc.sample - 1) / mrc.sample;
+	double hits = 0;
+	uint32_t d;
+
+	for(d = 0; d < limit && d < mrc.nhist; d++) {
+		hits += mrc.hist[d];
+	}
+	return((mrc.total > 0) ? hits / mrc.total : 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_order
+// Description  : Order slots from the most recently used, unused ones last
+//
+// Inputs       : a, b - the slots
+// Outputs      : the qsort order
+
+static int cache_order(const void *a, const void *b) {
+	return(((const struct CACHE *)b)->time - ((const struct CACHE *)a)->time);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_resize
+// Description  : Grow or shrink the cache in place, keeping the most
+//                recently used blocks and handing the others to the victim
+//                cache (cacheLock held, dropped while the blocks of a
+//                growth are allocated so lookups go on)
+//
+// Inputs       : max_items - the new number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_resize(uint32_t max_items) {
+	struct CACHE *slots;
+	void **blocks;
+	uint32_t i, n, got;
+
+	if(max_items == 0) {
+		return(-1);
+	}
+	while(max_items > cacheSize) {
+		n = max_items - cacheSize;
+		pthread_mutex_unlock(&cacheLock);
+		blocks = malloc(n * sizeof(void *));
+		for(got = 0; (blocks != NULL) && (got < n) && ((blocks[got] = malloc(RAID_BLOCK_SIZE)) != NULL); got++);
+		pthread_mutex_lock(&cacheLock);
+
+		// another resize may have come in meanwhile, then start over
+		slots = NULL;
+		if((got == n) && (max_items - cacheSize == n)) {
+			slots = realloc(cache, sizeof(struct CACHE)*max_items);
+		}
+		if(slots == NULL) {
+			for(i = 0; i < got; i++) {
+				free(blocks[i]);
+			}
+			free(blocks);
+			if((got < n) || (max_items - cacheSize == n)) {
+				return(-1);
+			}
+			continue;
+		}
+		cache = slots;
+		for(i = 0; i < n; i++) {
+			cache[cacheSize+i].data = blocks[i];
+			cache[cacheSize+i].time = -1;
+		}
+		cacheSize = max_items;
+		cacheResizes++;
+		free(blocks);
+		return(0);
+	}
+	if(max_items == cacheSize) {
+		return(0);
+	}
+
+	// the most recent blocks (unused slots last) stay
+	qsort(cache, cacheSize, sizeof(struct CACHE), cache_order);
+	for(i = max_items; i < cacheSize; i++) {
+		if(raid_victim_enabled && cache[i].time >= 0) {
+			raid_victim_put(cache[i].disk, cache[i].diskBlock, cache[i].data);
+		}
+		free(cache[i].data);
+	}
+	cacheSize = max_items;
+	cacheResizes++;
+	if((slots = realloc(cache, sizeof(struct CACHE)*max_items)) != NULL) {
+		cache = slots;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_tune
+// Description  : Resize the cache from the estimated curve, then age the
+//                histogram (cacheLock held)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void cache_tune(void) {
+	uint32_t max, size, d;
+	double target = mrc.target, hits = 0;
+
+	// the smallest size reaching the target, or close to the best the
+	// budget allows
+	if(mrc.total > 0 && (mrc.target > 0 || mrc.budget > 0)) {
+		max = (mrc.budget > 0) ? mrc.budget : (uint32_t)((uint64_t)mrc.nhist * mrc.sample);
+		if(target == 0 || target > mrc_ratio(max)) {
+			target = mrc_ratio(max) - ((mrc.target == 0) ? 0.01 : 0.0);
+		}
+		for(d = 0; d < mrc.nhist && (hits += mrc.hist[d]) / mrc.total < target; d++);
+		size = ((uint64_t)(d + 1) * mrc.sample > max) ? max : (d + 1) * mrc.sample;
+		size = (size < mrc.min) ? mrc.min : size;
+
+		// leave small changes, they are within the sampling error
+		if(size * 8 > cacheSize * 9 || size * 8 < cacheSize * 7) {
+			RAID_LOG(LOG_INFO_LEVEL, "CACHE: resizing from %u to %u blocks (est. hit ratio %.1f%% to %.1f%%)",
+					cacheSize, size, mrc_ratio(cacheSize) * 100, mrc_ratio(size) * 100);
+			cache_resize(size);
+		}
+	}
+
+	for(d = 0; d < mrc.nhist; d++) {
+		mrc.hist[d] /= 2;
+	}
+	mrc.cold /= 2;
+	mrc.total /= 2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_tune_thread
+// Description  : The tuner, woken by the lookups once per tuning interval
+//                so no get waits on a resize
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *cache_tune_thread(void *arg) {
+	pthread_mutex_lock(&cacheLock);
+	while(!tuneStop) {
+		if(!tuneDue) {
+			pthread_cond_wait(&tuneKick, &cacheLock);
+			continue;
+		}
+		tuneDue = 0;
+		cache_tune();
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_insert
+// Description  : Put an object into the block cache, handing the block it
+//                evicts to the victim cache if there is one (cacheLock held)
+//
+// Inputs       : dsk - this is the disk number of the block to cache
+//                blk - this is the block number of the block to cache
+//                buf - the buffer to insert into the cache
+// Outputs      : the slot the block went into
+
+static int cache_insert(RAIDDiskID dsk, RAIDBlockID blk, const void *buf) {
+	int i, j;
+	int minTime;
+	int cacheReplaceIndex = 0;
+	
+	minTime = cache[0].time;
+
+	// already in cache
+	for(i = 0; i < cacheSize; i++) {
+		if(cache[i].time >= 0 && cache[i].disk == dsk && cache[i].diskBlock == blk) {
+			memcpy(cache[i].data, buf, RAID_BLOCK_SIZE);
+			cache[i].time = sysTime++;
+			cacheInsert++;
+			RAID_LOG(LOG_INFO_LEVEL,"Cache block %d updated at time %d", i, cache[i].time);
+			return(i);
+		}
+	}
+
+	// if not already in cache, search cache for lowest time
+	for(j = 0; j < cacheSize; j++) {
+		if(cache[j].time <= minTime) {
+			minTime = cache[j].time;
+			cacheReplaceIndex = j;
+		}
+	}
+	// the block in the slot is clean (write through), so it can go down a level
+	if(raid_victim_enabled && cache[cacheReplaceIndex].time >= 0) {
+		raid_victim_put(cache[cacheReplaceIndex].disk, cache[cacheReplaceIndex].diskBlock, cache[cacheReplaceIndex].data);
+	}
+	// inject
+	cache[cacheReplaceIndex].disk =  dsk;
+	cache[cacheReplaceIndex].diskBlock = blk;
+	memcpy(cache[cacheReplaceIndex].data, buf, RAID_BLOCK_SIZE);
+	cache[cacheReplaceIndex].time = sysTime++;
+	cacheInsert++;
+	RAID_LOG(LOG_INFO_LEVEL, "Cache block %d updated %d", cacheReplaceIndex, cache[cacheReplaceIndex].time);
+	return(cacheReplaceIndex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_lookup
+// Description  : Find a block in the cache and mark it used, moving it up
+//                from the victim cache on a miss (cacheLock held)
+//
+// Inputs       : dsk - this is the disk number of the block to find
+//                blk - this is the block number of the block to find
+// Outputs      : pointer to cached object or NULL if not found
+
+static void * cache_lookup(RAIDDiskID dsk, RAIDBlockID blk) {
+	int i;
+	void *cacheBlock = NULL;
+	int temp = 0;
+	char victim[RAID_BLOCK_SIZE];
+
+	if(mrc.tracking) {
+		mrc_access(dsk, blk, 1);
+		if(++mrc.gets >= mrc.interval) {
+			mrc.gets = 0;
+			tuneDue = 1;
+			pthread_cond_signal(&tuneKick);
+		}
+	}
+	for(i = 0; i < cacheSize; i++) {
+		// if found block in cache (unused slots have no time yet)
+		if(cache[i].time >= 0 && cache[i].disk == dsk && cache[i].diskBlock == blk) {
+			cacheBlock = cache[i].data;
+			cache[i].time = sysTime++;
+			RAID_LOG(LOG_INFO_LEVEL, "CACHE: read cache block %d", i);
+			temp = 1;
+			cacheGet++;
+			cacheHit++;
+			break;
+		}
+	}
+
+	// a hit in the victim cache saves the bus read as well
+	if(temp == 0 && raid_victim_enabled && raid_victim_take(dsk, blk, victim) == 0) {
+		cacheBlock = cache[cache_insert(dsk, blk, victim)].data;
+		RAID_LOG(LOG_INFO_LEVEL, "CACHE: promoted block %d/%d from L2", dsk, blk);
+		temp = 1;
+		cacheGet++;
+		cacheHit++;
+		cacheVictimHit++;
+	}
+
+	if(temp == 0) {
+		cacheMiss++;
+		cacheGet++;
+	}
+
+	return(cacheBlock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flight_finish
+// Description  : End the in-flight miss of a block, handing the block to
+//                the readers attached to it (cacheLock held)
+//
+// Inputs       : dsk - this is the disk number of the block
+//                blk - this is the block number of the block
+//                buf - the block, NULL if the read failed
+// Outputs      : none
+
+static void flight_finish(RAIDDiskID dsk, RAIDBlockID blk, const void *buf) {
+	struct FLIGHT **link, *flight;
+
+	for(link = &flights; *link != NULL; link = &(*link)->next) {
+		if((*link)->disk == dsk && (*link)->diskBlock == blk) {
+			break;
+		}
+	}
+	if((flight = *link) == NULL) {
+		return;
+	}
+	*link = flight->next;
+
+	// the last reader to copy it out frees it
+	if(flight->waiters == 0) {
+		free(flight);
+		return;
+	}
+	if(buf != NULL) {
+		memcpy(flight->data, buf, RAID_BLOCK_SIZE);
+		flight->state = 1;
+	} else {
+		flight->state = -1;
+	}
+	pthread_cond_broadcast(&flightDone);
+}
+
 //
 // TAGLINE Cache interface
 
@@ -53,6 +640,12 @@ struct CACHE {
 
 int init_raid_cache(uint32_t max_items) {
 	int i;
+
+	// the tuner's memory budget bounds the cache from the start
+	if(mrc.tracking && mrc.budget > 0 && max_items > mrc.budget) {
+		RAID_LOG(LOG_INFO_LEVEL, "CACHE: %u blocks is over the budget, starting with %u.", max_items, mrc.budget);
+		max_items = mrc.budget;
+	}
 	cacheSize = max_items;
 	
 	cache = (struct CACHE*)malloc(sizeof(struct CACHE)*max_items);	
@@ -62,6 +655,40 @@ int init_raid_cache(uint32_t max_items) {
 		cache[i].time = -1;
 	}	
 
+	// the victim cache sits behind it when configured
+	if(raid_victim_enabled && raid_victim_init()) {
+		return(-1);
+	}
+
+	// the tracker starts empty with every INIT
+	if(mrc.tracking) {
+		mrc.mask = 1023;
+		mrc.live = mrc.next = mrc.gets = 0;
+		mrc.cap = mrc.nhist = 1024;
+		mrc.cold = mrc.total = 0;
+		free(mrc.keys);
+		free(mrc.stamps);
+		free(mrc.tree);
+		free(mrc.owner);
+		free(mrc.hist);
+		mrc.keys = calloc(mrc.mask + 1, sizeof(uint64_t));
+		mrc.stamps = malloc((mrc.mask + 1) * sizeof(uint32_t));
+		mrc.tree = calloc(mrc.cap, sizeof(int32_t));
+		mrc.owner = calloc(mrc.cap, sizeof(uint64_t));
+		mrc.hist = calloc(mrc.nhist, sizeof(double));
+		if(mrc.keys == NULL || mrc.stamps == NULL || mrc.tree == NULL || mrc.owner == NULL || mrc.hist == NULL) {
+			RAID_LOG(LOG_ERROR_LEVEL, "CACHE: failed allocating the miss ratio curve tracker.");
+			return(-1);
+		}
+		cacheResizes = 0;
+		tuneDue = tuneStop = 0;
+		if(!tuneRunning && pthread_create(&tuneThread, NULL, cache_tune_thread, NULL)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "CACHE: failed starting the tuner.");
+			return(-1);
+		}
+		tuneRunning = 1;
+	}
+
 	// Return successifully
 	return(0);
 }
@@ -75,17 +702,60 @@ int init_raid_cache(uint32_t max_items) {
 // Outputs      : o if successful, -1 if failure
 
 int close_raid_cache(void) {
-	free(cache);
 	double cacheEfficiency;
+	uint64_t size;
+	uint32_t top, i;
+
+	// stop the tuner before the slots go
+	if(tuneRunning) {
+		pthread_mutex_lock(&cacheLock);
+		tuneStop = 1;
+		pthread_cond_signal(&tuneKick);
+		pthread_mutex_unlock(&cacheLock);
+		pthread_join(tuneThread, NULL);
+		tuneRunning = 0;
+	}
+
+	// every slot's block was allocated on its own (the tuner adds more)
+	for(i = 0; (cache != NULL) && (i < cacheSize); i++) {
+		free(cache[i].data);
+	}
+	free(cache);
+	cache = NULL;
 
-	cacheEfficiency = ((double) cacheHit / cacheGet) * 100;
+	// No gets at all counts as 0% rather than dividing by zero
+	cacheEfficiency = (cacheGet > 0) ? ((double) cacheHit / cacheGet) * 100 : 0.0;
 	
-	logMessage(LOG_INFO_LEVEL, "*** Cache Statistics***");
-	logMessage(LOG_INFO_LEVEL, "Total cache inserts:\t%d", cacheInsert);
-	logMessage(LOG_INFO_LEVEL, "Total cache gets: \t%d", cacheGet);
-	logMessage(LOG_INFO_LEVEL, "Total cache hits: \t%d", cacheHit);
-	logMessage(LOG_INFO_LEVEL, "Total cache misses: \t%d", cacheMiss);
-	logMessage(LOG_INFO_LEVEL, "Cache Efficiency: \t%f", cacheEfficiency);
+	RAID_LOG(LOG_INFO_LEVEL, "*** Cache Statistics***");
+	RAID_LOG(LOG_INFO_LEVEL, "Total cache inserts:\t%d", cacheInsert);
+	RAID_LOG(LOG_INFO_LEVEL, "Total cache gets: \t%d", cacheGet);
+	RAID_LOG(LOG_INFO_LEVEL, "Total cache hits: \t%d", cacheHit);
+	RAID_LOG(LOG_INFO_LEVEL, "Total cache misses: \t%d", cacheMiss);
+	RAID_LOG(LOG_INFO_LEVEL, "Cache Efficiency: \t%f", cacheEfficiency);
+	RAID_LOG(LOG_INFO_LEVEL, "Total coalesced misses: \t%d", cacheCoalesced);
+	if(raid_victim_enabled) {
+		RAID_LOG(LOG_INFO_LEVEL, "Total L2 hits: \t%d", cacheVictimHit);
+		raid_victim_close();
+	}
+
+	// the estimated curve, at doubling sizes up to the longest distance seen
+	if(mrc.tracking) {
+		RAID_LOG(LOG_INFO_LEVEL, "Cache size now: \t%u (%d resizes)", cacheSize, cacheResizes);
+		for(top = mrc.nhist; top > 0 && mrc.hist[top-1] == 0; top--);
+		for(size = 16; size < (uint64_t)top * mrc.sample * 2 && size <= (1U << 30); size *= 2) {
+			RAID_LOG(LOG_INFO_LEVEL, "MRC: %10u blocks, est. hit ratio %6.2f%%", (uint32_t)size, mrc_ratio(size) * 100);
+		}
+		free(mrc.keys);
+		free(mrc.stamps);
+		free(mrc.tree);
+		free(mrc.owner);
+		free(mrc.hist);
+		mrc.keys = NULL;
+		mrc.owner = NULL;
+		mrc.tree = NULL;
+		mrc.stamps = NULL;
+		mrc.hist = NULL;
+	}
 
 	// Return successfully
 	return(0);
@@ -102,38 +772,14 @@ int close_raid_cache(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 int put_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf)  {
-	int i, j;
-	int inCache = 0;
-	int minTime = cache[0].time;
-	int cacheReplaceIndex;
-	
-	// already in cache
-	for(i = 0; i < cacheSize; i++) {
-		if(cache[i].disk == dsk && cache[i].diskBlock == blk) {
-			memcpy(cache[i].data, buf, RAID_BLOCK_SIZE);
-			cache[i].time = sysTime++;
-			inCache = 1;
-			cacheInsert++;
-			logMessage(LOG_INFO_LEVEL,"Cache block %d updated at time %d", i, cache[i].time);
-		}
-	}
-	// if not already in cache
-	if(inCache == 0) {
-		// search cache for lowest time
-		for(j = 0; j < cacheSize; j++) {
-			if(cache[j].time <= minTime) {
-				minTime = cache[j].time;
-				cacheReplaceIndex = j;
-			}
-		}
-		// inject
-		cache[cacheReplaceIndex].disk =  dsk;
-		cache[cacheReplaceIndex].diskBlock = blk;
-		memcpy(cache[cacheReplaceIndex].data, buf, RAID_BLOCK_SIZE);
-		cache[cacheReplaceIndex].time = sysTime++;
-		cacheInsert++;
-		logMessage(LOG_INFO_LEVEL, "Cache block %d updated %d", cacheReplaceIndex, cache[cacheReplaceIndex].time);
+	pthread_mutex_lock(&cacheLock);
+	// the disk block has new data, an older copy below is stale
+	if(raid_victim_enabled) {
+		raid_victim_drop(dsk, blk);
 	}
+	mrc_access(dsk, blk, 0);
+	cache_insert(dsk, blk, buf);
+	pthread_mutex_unlock(&cacheLock);
 
 	// Return successfully
 	return(0);
@@ -142,37 +788,288 @@ int put_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf)  {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : get_raid_cache
-// Description  : Get an object from the cache (and return it)
+// Description  : Get an object from the cache (and return a copy of it, in
+//                a buffer of the calling thread that the thread's next get
+//                overwrites)
 //
 // Inputs       : dsk - this is the disk number of the block to find
 //                blk - this is the block number of the block to find
-// Outputs      : pointer to cached object or NULL if not found
+// Outputs      : pointer to the copy or NULL if not found
 
 void * get_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
-	int i;
+	static __thread char copy[RAID_BLOCK_SIZE];
+
+	return((copy_raid_cache(dsk, blk, copy) == 0) ? copy : NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_raid_cache
+// Description  : Copy an object out of the cache while it is locked
+//
+// Inputs       : dsk - this is the disk number of the block to find
+//                blk - this is the block number of the block to find
+//                buf - the buffer to copy the block into
+// Outputs      : 0 if found, -1 if not in the cache
+
+int copy_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf) {
 	void *cacheBlock;
-	int temp = 0;
-	
-	for(i = 0; i < cacheSize; i++) {
-		// if found block in cache
-		if(cache[i].disk == dsk && cache[i].diskBlock == blk) {
-			cacheBlock = cache[i].data;
-			cache[i].time = sysTime++;
-			logMessage(LOG_INFO_LEVEL, "CACHE: read cache block %d", i);
-			temp = 1;
-			cacheGet++;
-			cacheHit++;
-		}
-		else {
-			cacheBlock = NULL;
+
+	pthread_mutex_lock(&cacheLock);
+	if((cacheBlock = cache_lookup(dsk, blk)) != NULL) {
+		memcpy(buf, cacheBlock, RAID_BLOCK_SIZE);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return((cacheBlock != NULL) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : claim_raid_cache
+// Description  : Copy an object out of the cache, or on a miss either claim
+//                the read of the block (the first reader) or attach to the
+//                reader that already has it in flight.  Attached readers
+//                must not wait until the misses they claimed are filled or
+//                abandoned, or two readers can wait on each other.
+//
+// Inputs       : dsk - this is the disk number of the block to find
+//                blk - this is the block number of the block to find
+//                buf - the buffer to copy the block into
+//                flight - the in-flight miss attached to (out)
+// Outputs      : RAID_CACHE_HIT if copied, RAID_CACHE_MISS if the caller
+//                reads the block and then fills or abandons it, or
+//                RAID_CACHE_WAIT if it waits for it with wait_raid_cache
+
+int claim_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf, void **flight) {
+	struct FLIGHT *f;
+	void *cacheBlock;
+
+	pthread_mutex_lock(&cacheLock);
+	if((cacheBlock = cache_lookup(dsk, blk)) != NULL) {
+		memcpy(buf, cacheBlock, RAID_BLOCK_SIZE);
+		pthread_mutex_unlock(&cacheLock);
+		return(RAID_CACHE_HIT);
+	}
+
+	// another reader is fetching it already
+	for(f = flights; f != NULL; f = f->next) {
+		if(f->disk == dsk && f->diskBlock == blk) {
+			f->waiters++;
+			cacheCoalesced++;
+			*flight = f;
+			pthread_mutex_unlock(&cacheLock);
+			return(RAID_CACHE_WAIT);
 		}
 	}
 
-	if(temp == 0) {
-		cacheMiss++;
-		cacheGet++;
+	// first one, later readers attach to it (without memory they just
+	// read the block themselves)
+	if((f = malloc(sizeof(struct FLIGHT))) != NULL) {
+		f->disk = dsk;
+		f->diskBlock = blk;
+		f->state = 0;
+		f->waiters = 0;
+		f->next = flights;
+		flights = f;
 	}
+	pthread_mutex_unlock(&cacheLock);
+	return(RAID_CACHE_MISS);
+}
 
-	return(cacheBlock);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill_raid_cache
+// Description  : Put a block read after a miss into the cache and hand it
+//                to the readers waiting for it
+//
+// Inputs       : dsk - this is the disk number of the block to cache
+//                blk - this is the block number of the block to cache
+//                buf - the block
+// Outputs      : 0 if successful, -1 if failure
+
+int fill_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf) {
+	pthread_mutex_lock(&cacheLock);
+	if(raid_victim_enabled) {
+		raid_victim_drop(dsk, blk);
+	}
+	mrc_access(dsk, blk, 0);
+	cache_insert(dsk, blk, buf);
+	flight_finish(dsk, blk, buf);
+	pthread_mutex_unlock(&cacheLock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : abandon_raid_cache
+// Description  : Give up a claimed miss, the readers waiting for it have to
+//                read the block themselves
+//
+// Inputs       : dsk - this is the disk number of the block
+//                blk - this is the block number of the block
+// Outputs      : none
+
+void abandon_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
+	pthread_mutex_lock(&cacheLock);
+	flight_finish(dsk, blk, NULL);
+	pthread_mutex_unlock(&cacheLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wait_raid_cache
+// Description  : Wait for the miss claim_raid_cache attached to and copy the
+//                block out
+//
+// Inputs       : flight - the in-flight miss
+//                buf - the buffer to copy the block into
+// Outputs      : 0 if copied, -1 if its reader failed (read it yourself)
+
+int wait_raid_cache(void *flight, void *buf) {
+	struct FLIGHT *f = flight;
+	int state;
+
+	pthread_mutex_lock(&cacheLock);
+	while(f->state == 0) {
+		pthread_cond_wait(&flightDone, &cacheLock);
+	}
+	if((state = f->state) > 0) {
+		memcpy(buf, f->data, RAID_BLOCK_SIZE);
+	}
+	if(--f->waiters == 0) {
+		free(f);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return((state > 0) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_raid_cache
+// Description  : Forget a block, leaving its slot the first to be reused
+//
+// Inputs       : dsk - this is the disk number of the block to drop
+//                blk - this is the block number of the block to drop
+// Outputs      : 0 if it was cached, -1 if not
+
+int drop_raid_cache(RAIDDiskID dsk, RAIDBlockID blk) {
+	int i, found = -1;
+
+	pthread_mutex_lock(&cacheLock);
+	for(i = 0; i < cacheSize; i++) {
+		if(cache[i].time >= 0 && cache[i].disk == dsk && cache[i].diskBlock == blk) {
+			cache[i].time = -1;
+			found = 0;
+			break;
+		}
+	}
+	if(raid_victim_enabled) {
+		raid_victim_drop(dsk, blk);
+	}
+	mrc_drop(dsk, blk);
+	pthread_mutex_unlock(&cacheLock);
+	return(found);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stats_raid_cache
+// Description  : Read the cache get and hit counters
+//
+// Inputs       : gets - the number of gets so far (out)
+//                hits - the number of those that hit (out)
+// Outputs      : none
+
+void stats_raid_cache(int *gets, int *hits) {
+	pthread_mutex_lock(&cacheLock);
+	*gets = cacheGet;
+	*hits = cacheHit;
+	pthread_mutex_unlock(&cacheLock);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resize_raid_cache
+// Description  : Grow or shrink the cache without flushing it, the least
+//                recently used blocks going to the victim cache
+//
+// Inputs       : max_items - the new number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int resize_raid_cache(uint32_t max_items) {
+	uint32_t was, now;
+	int ret;
+
+	pthread_mutex_lock(&cacheLock);
+	was = cacheSize;
+	ret = cache_resize(max_items);
+	now = cacheSize;
+	pthread_mutex_unlock(&cacheLock);
+	RAID_LOG(LOG_INFO_LEVEL, "CACHE: resized from %u to %u blocks.", was, now);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : estimate_raid_cache
+// Description  : Estimate the hit ratio of a cache of some size from the
+//                sampled reuse distances so far
+//
+// Inputs       : max_items - the cache size
+// Outputs      : the ratio (0 to 1), -1 if the curve is not tracked
+
+double estimate_raid_cache(uint32_t max_items) {
+	double ratio = -1.0;
+
+	pthread_mutex_lock(&cacheLock);
+	if(mrc.tracking && mrc.hist != NULL) {
+		ratio = mrc_ratio(max_items);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return(ratio);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : configure_raid_cache
+// Description  : Turn the miss ratio curve tracker (and the tuner) on with
+//                a configuration
+//
+// Inputs       : spec - the configuration (see raid_cache.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int configure_raid_cache(const char *spec) {
+	char *copy, *field, *save;
+	double value;
+	uint32_t count;
+	char extra;
+	int ret = 0;
+
+	if((copy = strdup(spec)) == NULL) {
+		return(-1);
+	}
+	for(field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if((sscanf(field, "sample=%u%c", &count, &extra) == 1) && (count > 0)) {
+			mrc.sample = count;
+		} else if((sscanf(field, "target=%lf%c", &value, &extra) == 1) && (value > 0) && (value <= 100)) {
+			mrc.target = value / 100;
+		} else if((sscanf(field, "budget=%lf%c", &value, &extra) == 1) && (value > 0)) {
+			value = value * (1ULL << 20) / (RAID_BLOCK_SIZE + sizeof(struct CACHE));
+			mrc.budget = (value >= UINT32_MAX) ? UINT32_MAX : (uint32_t)value;
+		} else if((sscanf(field, "min=%u%c", &count, &extra) == 1) && (count > 0)) {
+			mrc.min = count;
+		} else if((sscanf(field, "interval=%u%c", &count, &extra) == 1) && (count > 0)) {
+			mrc.interval = count;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad cache field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	if(mrc.budget > 0 && mrc.budget < mrc.min) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Cache budget of %u blocks is under the minimum of %u", mrc.budget, mrc.min);
+		ret = -1;
+	}
+	mrc.tracking = (ret == 0);
+	return(ret);
+}
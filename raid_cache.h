@@ -5,7 +5,20 @@
 //
 //  File           : raid_cache.h
 //  Description    : This is the header file for the implementation of the
-//                   block cache for the TAGLINE driver.
+//                   block cache for the TAGLINE driver.  Once configured
+//                   (tagline_client -M), a sample of the blocks is tracked
+//                   to estimate the hit ratio of any cache size, and the
+//                   cache can be resized to it while in use.  The
+//                   configuration is comma separated:
+//
+//                     sample=<n>       track one block in n (64)
+//                     target=<pct>     resize to the smallest cache with
+//                                      this hit ratio
+//                     budget=<MiB>     memory the cache may use (without a
+//                                      target, resize to the smallest cache
+//                                      within a point of its best hit ratio)
+//                     min=<blocks>     smallest cache to resize to (16)
+//                     interval=<gets>  gets between resizes (8192)
 //
 //  Author         : Patrick McDaniel
 //  Last Modified  : Fri Oct  9 17:14:45 PDT 2015
@@ -16,6 +29,12 @@
 
 // Defines
 #define TAGLINE_CACHE_SIZE 1024
+#define RAID_CACHE_HIT  0 // claim_raid_cache copied the block
+#define RAID_CACHE_MISS 1 // ... the caller reads it, then fills or abandons it
+#define RAID_CACHE_WAIT 2 // ... another reader has it in flight, wait for it
+#define RAID_CACHE_SAMPLE   64   // Default blocks per tracked block
+#define RAID_CACHE_MIN      16   // Default smallest cache the tuner sets
+#define RAID_CACHE_INTERVAL 8192 // Default gets between tunings
 
 ///
 // Cache Interfaces
@@ -30,6 +49,36 @@ int put_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf);
 	// Put an object into the object cache, evicting other items as necessary
 
 void * get_raid_cache(RAIDDiskID dsk, RAIDBlockID blk);
-	// Get an object from the cache (and return it)
+	// Get a copy of an object from the cache (valid until this thread's next get)
+
+int copy_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf);
+	// Copy an object out of the cache (safe against concurrent eviction)
+
+int claim_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf, void **flight);
+	// Copy an object out, or claim its miss, or attach to a miss in flight
+
+int fill_raid_cache(RAIDDiskID dsk, RAIDBlockID blk, void *buf);
+	// Put a block read after a miss and hand it to the readers waiting
+
+void abandon_raid_cache(RAIDDiskID dsk, RAIDBlockID blk);
+	// Give up a claimed miss (the readers waiting read it themselves)
+
+int wait_raid_cache(void *flight, void *buf);
+	// Wait for an in-flight miss and copy the block out
+
+int drop_raid_cache(RAIDDiskID dsk, RAIDBlockID blk);
+	// Forget a block the cache may hold (its disk block now has other data)
+
+void stats_raid_cache(int *gets, int *hits);
+	// Read the cache get and hit counters
+
+int resize_raid_cache(uint32_t max_blocks);
+	// Grow or shrink the cache in place, keeping the most recent blocks
+
+double estimate_raid_cache(uint32_t max_blocks);
+	// Estimated hit ratio of a cache of this size (-1 if not tracked)
+
+int configure_raid_cache(const char *spec);
+	// Turn the miss ratio curve tracker and the tuner on with a configuration
 
 #endif
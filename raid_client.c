@@ -4,38 +4,363 @@
 //  Description   : This is the client side of the RAID communication protocol.
 //
 //  Author        : Dhruva Seelin
-//  Last Modified : 12/11/15
+//  Last Modified : 12/18/15
 //
 
 // Include Files
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
+#include <pthread.h>
 
 // Project Include Files
 #include <raid_network.h>
+#include <raid_shm.h>
+#include <raid_local.h>
+#include <raid_compress.h>
+#include <raid_trace.h>
 #include <cmpsc311_log.h>
+#include <raid_log.h>
 #include <cmpsc311_util.h>
 
+// Defines
+#define RAID_CLIENT_PAYLOAD (RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD) // Max payload
+
+// Type definitions
+typedef enum {
+	RAID_TRANSPORT_TCP = 0,  // Loopback or remote TCP connection
+	RAID_TRANSPORT_SHM = 1,  // Shared-memory ring with a co-located server
+	RAID_TRANSPORT_LOCAL = 2, // In-process array, no server at all
+} RAID_TRANSPORT_TYPES;
+
 // Global data
 unsigned char *raid_network_address = NULL; // Address of CRUD server
 unsigned short raid_network_port = 0; // Port of CRUD server
+char *raid_network_endpoint = NULL; // Endpoint URI of RAID server
+uint32_t raid_bus_requested = 0; // Capabilities to ask the server for
+uint32_t raid_bus_capabilities = 0; // Capabilities granted by the server
 char *ip = RAID_DEFAULT_IP;
-int socket_fd;
-uint64_t value;
-uint64_t opCode;
-uint64_t length;
+int socket_fd = -1;
+RAID_TRANSPORT_TYPES transport = RAID_TRANSPORT_TCP;
 struct sockaddr_in caddr;
+RaidCompressStats raid_compress_stats; // Bytes on the wire and codec time
+pthread_mutex_t transport_lock = PTHREAD_MUTEX_INITIALIZER; // One exchange on the transport at a time
+__thread uint64_t raid_bus_ops[RAID_MAXVAL]; // Requests (and batch frames) sent by this thread
+const char *RAID_REQUEST_TYPE_LABELS[RAID_MAXVAL] = {
+	"INIT", "CLOSE", "FORMAT", "READ", "WRITE", "HASHBLOCK", "STATUS", "DISKFAIL", "BATCH"
+};
+
+//
+// Functional Prototypes
+
+static RAIDOpCode raid_bus_exchange(RAIDOpCode op, void *buf);
+static int raid_batch_exchange(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n);
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_request_length
+// Description  : Work out the size of the payload that goes with a request
+//
+// Inputs       : op - the request opcode
+// Outputs      : the number of payload bytes to send
+
+static uint32_t raid_request_length(RAIDOpCode op) {
+	uint32_t blks = (op >> 48) & 0xff;
+
+	if ((op >> 56) == RAID_WRITE) {
+		return( ((blks == 0) ? 1 : blks) * RAID_BLOCK_SIZE );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_response_length
+// Description  : Work out the most response payload a request's buffer can
+//                take, so an oversized reply fails instead of overflowing it
+//                (tagline_server echoes the blocks of a WRITE back)
+//
+// Inputs       : op - the request opcode
+// Outputs      : the number of payload bytes the caller's buffer holds
+
+static uint32_t raid_response_length(RAIDOpCode op) {
+	uint32_t blks = (op >> 48) & 0xff;
+
+	if (((op >> 56) == RAID_READ) || ((op >> 56) == RAID_WRITE)) {
+		return( ((blks == 0) ? 1 : blks) * RAID_BLOCK_SIZE );
+	}
+	if ((op >> 56) == RAID_HASHBLOCK) {
+		return( blks * sizeof(uint64_t) );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_read_bytes
+// Description  : Read exactly len bytes from the server, riding out short reads
+//
+// Inputs       : buf - the place to read into
+//                len - the number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+static int tcp_read_bytes(void *buf, size_t len) {
+	ssize_t rb;
+	size_t off = 0;
+
+	while (off < len) {
+		if ((rb = read(socket_fd, (char *)buf+off, len-off)) <= 0) {
+			if ((rb == -1) && (errno == EINTR)) {
+				continue;
+			}
+			RAID_LOG(LOG_ERROR_LEVEL, "Error reading network data [%s]", strerror(errno));
+			return( -1 );
+		}
+		off += rb;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_skip_bytes
+// Description  : Read and throw away a response payload the caller cannot
+//                take, so the next reply still starts at its header
+//
+// Inputs       : len - the number of bytes to skip
+// Outputs      : 0 if successful, -1 if failure
+
+static int tcp_skip_bytes(uint64_t len) {
+	char scratch[RAID_BLOCK_SIZE];
+	size_t chunk;
+
+	while (len > 0) {
+		chunk = (len > sizeof(scratch)) ? sizeof(scratch) : (size_t)len;
+		if (tcp_read_bytes(scratch, chunk)) {
+			return( -1 );
+		}
+		len -= chunk;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_connect
+// Description  : Connect to the RAID server at host/port
+//
+// Inputs       : host - the dotted address of the server
+//                port - the port of the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int tcp_connect(const char *host, unsigned short port) {
+	int one = 1;
+
+	caddr.sin_family = AF_INET;
+	caddr.sin_port = htons(port);
+	if ( inet_aton(host, &caddr.sin_addr) == 0 ) {
+		return( -1 );
+	}
+	socket_fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (socket_fd == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Error on socket creation [%s]", strerror(errno));
+		return( -1 );
+	}
+	if ( connect(socket_fd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1 ) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Error on socket connect [%s]", strerror(errno));
+		close(socket_fd);
+		socket_fd = -1;
+		return( -1 );
+	}
+
+	// Requests are small and strictly request/response, so never let Nagle
+	// hold a header back waiting for the delayed ACK of the previous one
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_request
+// Description  : Send one request over the TCP connection and read its reply
+//
+// Inputs       : op - the request opcode
+//                buf - the request payload, receives the response payload
+//                len - the request payload length
+//                rlen - the response payload length (out)
+//                cap - the most response payload buf can take
+// Outputs      : the response opcode, or -1 if failure
+
+static RAIDOpCode tcp_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap) {
+	static uint8_t wire[RAID_COMPRESS_BOUND(RAID_CLIENT_PAYLOAD)];
+	uint64_t hdr[2];
+	struct iovec iov[2];
+	ssize_t wb;
+	size_t total;
+	RAIDOpCode resp;
+	uint64_t plen;
+	uint32_t vec, dlen;
+	int compress = (raid_bus_capabilities & RAID_CAP_COMPRESS) != 0;
+
+	// Encode the payload behind any batch opcode vector if negotiated
+	if (compress && (len > 0)) {
+		vec = raid_compress_vector(op, len);
+		memcpy(wire, buf, vec);
+		len = vec + raid_compress_payload((char *)buf + vec, len - vec, wire + vec, &raid_compress_stats);
+	}
+
+	// Send the header and payload together, one segment per request
+	hdr[0] = htonll64(op);
+	hdr[1] = htonll64(len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (compress && (len > 0)) ? (void *)wire : buf;
+	iov[1].iov_len = len;
+	total = sizeof(hdr) + len;
+	while (total > 0) {
+		if ((wb = writev(socket_fd, iov, (iov[1].iov_len > 0) ? 2 : 1)) <= 0) {
+			if ((wb == -1) && (errno == EINTR)) {
+				continue;
+			}
+			RAID_LOG(LOG_ERROR_LEVEL, "Error writing network data [%s]", strerror(errno));
+			return( -1 );
+		}
+		total -= wb;
+		if (wb < iov[0].iov_len) {
+			iov[0].iov_base = (char *)iov[0].iov_base + wb;
+			iov[0].iov_len -= wb;
+		} else {
+			iov[1].iov_base = (char *)iov[1].iov_base + (wb - iov[0].iov_len);
+			iov[1].iov_len -= wb - iov[0].iov_len;
+			iov[0].iov_len = 0;
+		}
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Sent op code [0x%llx], length [%u]", (unsigned long long)op, len);
+
+	// Read the response header and payload
+	if (tcp_read_bytes(hdr, sizeof(hdr))) {
+		return( -1 );
+	}
+	resp = ntohll64(hdr[0]);
+	plen = ntohll64(hdr[1]);
+	RAID_LOG(LOG_INFO_LEVEL, "Received op code [0x%llx], length [%llu]",
+			(unsigned long long)resp, (unsigned long long)plen);
+	if ((plen != 0) && compress) {
+		if ((buf == NULL) || (plen > sizeof(wire))) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Unexpected response payload [%llu bytes]", (unsigned long long)plen);
+			tcp_skip_bytes(plen);
+			return( -1 );
+		}
+		if (tcp_read_bytes(wire, plen)) {
+			return( -1 );
+		}
+		vec = raid_compress_vector(resp, plen);
+		if ((vec > cap) || raid_decompress_payload(wire + vec, plen - vec, (char *)buf + vec,
+				cap - vec, &dlen, &raid_compress_stats)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Malformed compressed response payload [%llu bytes]", (unsigned long long)plen);
+			return( -1 );
+		}
+		memcpy(buf, wire, vec);
+		plen = vec + dlen;
+	} else if (plen != 0) {
+		if ((buf == NULL) || (plen > cap)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Unexpected response payload [%llu bytes]", (unsigned long long)plen);
+			tcp_skip_bytes(plen);
+			return( -1 );
+		}
+		if (tcp_read_bytes(buf, plen)) {
+			return( -1 );
+		}
+	}
+	*rlen = (uint32_t)plen;
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_transport_open
+// Description  : Open the transport named by the endpoint.  Endpoints are
+//                "tcp://<ip>:<port>", "shm://<control socket path>" or an
+//                in-process array ("mem://..." or "file://<dir>...", see
+//                raid_local.h); with no endpoint the -a/-p address (or the
+//                default) is used.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int raid_transport_open(void) {
+	char host[64], *sep;
+	const char *ep = raid_network_endpoint;
+	unsigned short port;
+
+	// Shared memory ring
+	if ((ep != NULL) && (strncmp(ep, RAID_SHM_SCHEME, strlen(RAID_SHM_SCHEME)) == 0)) {
+		transport = RAID_TRANSPORT_SHM;
+		return( raid_shm_client_open(ep + strlen(RAID_SHM_SCHEME)) );
+	}
+
+	// In-process array
+	if ((ep != NULL) && ((strncmp(ep, RAID_MEM_SCHEME, strlen(RAID_MEM_SCHEME)) == 0) ||
+			(strncmp(ep, RAID_FILE_SCHEME, strlen(RAID_FILE_SCHEME)) == 0))) {
+		transport = RAID_TRANSPORT_LOCAL;
+		return( raid_local_open(ep) );
+	}
+
+	// TCP, from the endpoint or the address/port globals
+	transport = RAID_TRANSPORT_TCP;
+	snprintf(host, sizeof(host), "%s", (raid_network_address != NULL) ? (char *)raid_network_address : ip);
+	port = (raid_network_port != 0) ? raid_network_port : RAID_DEFAULT_PORT;
+	if (ep != NULL) {
+		if (strncmp(ep, RAID_TCP_SCHEME, strlen(RAID_TCP_SCHEME)) != 0) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Unknown RAID endpoint [%s]", ep);
+			return( -1 );
+		}
+		snprintf(host, sizeof(host), "%s", ep + strlen(RAID_TCP_SCHEME));
+		if ((sep = strchr(host, ':')) != NULL) {
+			*sep = 0x0;
+			port = (unsigned short)atoi(sep+1);
+		}
+	}
+	return( tcp_connect(host, port) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_transport_request
+// Description  : Send one request on whichever transport is open
+//
+// Inputs       : op - the request opcode
+//                buf - the request payload, receives the response payload
+//                len - the request payload length
+//                rlen - the response payload length (out)
+//                cap - the most response payload buf can take
+// Outputs      : the response opcode, or -1 if failure
+
+static RAIDOpCode raid_transport_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap) {
+	*rlen = 0;
+	if (transport == RAID_TRANSPORT_SHM) {
+		return( raid_shm_request(op, buf, len, rlen, cap) );
+	}
+	if (transport == RAID_TRANSPORT_LOCAL) {
+		return( raid_local_request(op, buf, len, rlen, cap) );
+	}
+	return( tcp_request(op, buf, len, rlen, cap) );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : client_raid_bus_request
@@ -51,85 +376,236 @@ struct sockaddr_in caddr;
 // Outputs      : the response structure encoded as needed
 
 RAIDOpCode client_raid_bus_request(RAIDOpCode op, void *buf) {
-	uint64_t reverseOpCode;
-	uint64_t reverseLength;
-	
-		
-	// Hanshake
+	RAIDOpCode resp;
+	uint64_t start = 0;
+
+	if ((op >> 56) < RAID_MAXVAL) {
+		raid_bus_ops[op >> 56]++;
+	}
+	pthread_mutex_lock(&transport_lock);
+	if (raid_trace_enabled) {
+		start = raid_trace_clock();
+	}
+	resp = raid_bus_exchange(op, buf);
+	if (raid_trace_enabled) {
+		raid_trace_record(&op, &resp, 1, 0, start);
+	}
+	pthread_mutex_unlock(&transport_lock);
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_bus_exchange
+// Description  : Carry out client_raid_bus_request with the transport locked
+//
+// Inputs       : op - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+static RAIDOpCode raid_bus_exchange(RAIDOpCode op, void *buf) {
+	RAIDOpCode resp;
+	uint32_t rlen, requested, offered;
+
+	// Hanshake, asking for the optional protocol features
 	if ((op >> 56) == RAID_INIT) {
-		caddr.sin_family = AF_INET;
-		caddr.sin_port = htons(RAID_DEFAULT_PORT);
-		if ( inet_aton(ip, &caddr.sin_addr) == 0 ) {
+		if (raid_transport_open()) {
 			return( -1 );
 		}
-		socket_fd = socket(PF_INET, SOCK_STREAM, 0);
-		if (socket_fd == -1) {
-			printf( "Error on socket creation [%s]\n", strerror(errno) );
-			return( -1 );
+		raid_bus_capabilities = 0;
+		memset(&raid_compress_stats, 0x0, sizeof(raid_compress_stats));
+
+		// Compression only pays for itself on a real wire, and block digests
+		// come from any server that negotiates at all (our own engine)
+		requested = raid_bus_requested | RAID_CAP_HASH;
+		if (transport != RAID_TRANSPORT_TCP) {
+			requested &= ~RAID_CAP_COMPRESS;
+		} else {
+			// The stock server aborts on capability bits, so over TCP a
+			// plain INIT first learns what the server offers (the stock
+			// one echoes none), and only an offer is asked for
+			resp = raid_transport_request(op, buf, 0, &rlen, 0);
+			if ((resp == (RAIDOpCode)-1) || ((resp >> 32) & 1)) {
+				return( resp );
+			}
+			offered = (uint32_t)resp & 0x7f;
+			if (raid_bus_requested & ~offered) {
+				RAID_LOG(LOG_WARNING_LEVEL, "RAID server offers capabilities [0x%x] of [0x%x] asked for (-b and -z need raid_server)",
+						offered & raid_bus_requested, raid_bus_requested);
+			}
+			if ((requested &= offered) == 0) {
+				return( (resp & ~0xffffffffULL) | (op & 0xffffffffULL) );
+			}
 		}
-		if ( connect(socket_fd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1 ) {
-			printf( "Error on socket connect [%s]\n", strerror(errno) );
+		resp = raid_transport_request(op | ((uint64_t)requested << RAID_CAP_SHIFT),
+				buf, 0, &rlen, 0);
+		if (resp == (RAIDOpCode)-1) {
 			return( -1 );
-		} 
-	}
-		
-	// WRITE
-	reverseOpCode = htonll64(op);
- 	if ( write( socket_fd, &reverseOpCode, sizeof(reverseOpCode)) != sizeof(reverseOpCode) ) {
-		printf( "Error writing network data [%s]\n", strerror(errno) );
- 		return( -1 );
- 	}
-	logMessage(LOG_INFO_LEVEL, "Sent a Op Code of [%d]\n", reverseOpCode); 
-	
-	if ((op >> 56) == RAID_WRITE) {
-		reverseLength = htonll64(RAID_BLOCK_SIZE);
+		}
+		raid_bus_capabilities = (uint32_t)resp & requested;
+		RAID_LOG(LOG_INFO_LEVEL, "RAID server granted capabilities [0x%x]", raid_bus_capabilities);
+		return( (resp & ~(((uint64_t)0x7f << RAID_CAP_SHIFT) | 0xffffffffULL)) | (op & 0xffffffffULL) );
 	}
-	else {
-		reverseLength = 0;
+
+	// Send the request, returning the response
+	resp = raid_transport_request(op, buf, raid_request_length(op), &rlen, raid_response_length(op));
+
+	// close the connection
+	if ((op >> 56) == RAID_CLOSE) {
+		if (transport == RAID_TRANSPORT_SHM) {
+			raid_shm_client_close();
+		} else if (transport == RAID_TRANSPORT_LOCAL) {
+			raid_local_close();
+		} else {
+			close(socket_fd);
+			socket_fd = -1;
+		}
+		if (raid_bus_capabilities & RAID_CAP_COMPRESS) {
+			raid_compress_log_stats("RAID client", &raid_compress_stats);
+		}
+		raid_bus_capabilities = 0;
 	}
 
-	if ( write( socket_fd, &reverseLength, sizeof(reverseLength)) != sizeof(reverseLength) ) {
-		printf( "Error writing network data [%s]\n", strerror(errno) );
-		return( -1 );
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_batch_frame
+// Description  : Send one batch frame of up to RAID_MAX_BATCH requests whose
+//                payloads fit in the frame, scattering the responses
+//
+// Inputs       : ops - the request opcodes
+//                bufs - the per-request payload buffers
+//                resps - the response opcodes (out)
+//                n - the number of requests in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+static int raid_batch_frame(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n) {
+	uint64_t start = 0;
+	int i, ret;
+
+	raid_bus_ops[RAID_BATCH]++;
+	for (i = 0; i < n; i++) {
+		if ((ops[i] >> 56) < RAID_MAXVAL) {
+			raid_bus_ops[ops[i] >> 56]++;
+		}
 	}
-	logMessage(LOG_INFO_LEVEL, "Sent a length of [%d]\n", reverseLength); 
-		
-	if ((op >> 56) == RAID_WRITE) {
-		if ( (write( socket_fd, buf, RAID_BLOCK_SIZE )) != RAID_BLOCK_SIZE) {
-			printf( "Error writing network data [%s]\n", strerror(errno) );
-			return( -1 );
-               	}
+	pthread_mutex_lock(&transport_lock);
+	if (raid_trace_enabled) {
+		start = raid_trace_clock();
+	}
+	ret = raid_batch_exchange(ops, bufs, resps, n);
+	if (raid_trace_enabled && (ret == 0)) {
+		raid_trace_record(ops, resps, n, 1, start);
+	}
+	pthread_mutex_unlock(&transport_lock);
+	return( ret );
+}
 
-	} 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_batch_exchange
+// Description  : Carry out raid_batch_frame with the transport (and the
+//                shared frame buffer) locked
+//
+// Inputs       : ops - the request opcodes
+//                bufs - the per-request payload buffers
+//                resps - the response opcodes (out)
+//                n - the number of requests in the frame
+// Outputs      : 0 if successful, -1 if failure
 
-	// READ
-	if ( read( socket_fd, &opCode, sizeof(opCode)) != sizeof(opCode) ) {
-		printf( "Error reading network data [%s]\n", strerror(errno) );
-		return( -1 );
+static int raid_batch_exchange(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n) {
+	static uint64_t frame[(RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD)/sizeof(uint64_t)];
+	char *payload = (char *)&frame[n];
+	uint32_t len, rlen, plen, off;
+	RAIDOpCode resp;
+	int i;
+
+	// Pack the opcodes, then the write payloads
+	off = 0;
+	for (i = 0; i < n; i++) {
+		frame[i] = htonll64(ops[i]);
+		plen = raid_request_length(ops[i]);
+		memcpy(payload+off, bufs[i], plen);
+		off += plen;
 	}
-	reverseOpCode = ntohll64(opCode);
-	logMessage(LOG_INFO_LEVEL, "Received Op Code of [%d]\n", reverseOpCode); 
+	len = n*sizeof(uint64_t) + off;
 
-	if ( read( socket_fd, &length, sizeof(length)) != sizeof(length) ) {
-		printf( "Error reading network data [%s]\n", strerror(errno) );
+	// Send it, check that we got the whole response vector back
+	resp = raid_transport_request(((uint64_t)RAID_BATCH << 56) | (uint32_t)n, frame, len, &rlen, sizeof(frame));
+	if ((resp >> 56 != RAID_BATCH) || ((resp & 0xffffffff) != n) || (rlen < n*sizeof(uint64_t))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad RAID batch response [0x%llx] for %d ops", (unsigned long long)resp, n);
 		return( -1 );
 	}
-	reverseLength = ntohll64(length);
- 	logMessage(LOG_INFO_LEVEL, "Received a length of [%d]\n", reverseLength); 	
-	
-	if ( length != 0) {
-		if ( read( socket_fd, buf, reverseLength) != reverseLength) {
-			printf( "Error writing network data [%s]\n", strerror(errno) );
-			return( -1 );
+
+	// Unpack the responses, then scatter the read and hash payloads
+	off = 0;
+	for (i = 0; i < n; i++) {
+		resps[i] = ntohll64(frame[i]);
+		if (((ops[i] >> 56) == RAID_READ) || ((ops[i] >> 56) == RAID_HASHBLOCK)) {
+			plen = ((ops[i] >> 48) & 0xff) * (((ops[i] >> 56) == RAID_READ) ? RAID_BLOCK_SIZE : sizeof(uint64_t));
+			if (n*sizeof(uint64_t) + off + plen > rlen) {
+				RAID_LOG(LOG_ERROR_LEVEL, "Short RAID batch response payload [%u bytes]", rlen);
+				return( -1 );
+			}
+			memcpy(bufs[i], payload+off, plen);
+			off += plen;
 		}
 	}
+	return( 0 );
+}
 
-	// close socket
-	if( (op >> 56) == RAID_CLOSE) {
-		close(socket_fd);
-		
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_raid_bus_batch
+// Description  : Send a vector of requests.  If the server granted batching
+//                they are packed into as few RAID_BATCH frames as the frame
+//                limits allow, otherwise they go one request at a time.
+//
+// Inputs       : ops - the request opcodes
+//                bufs - the per-request payload buffers (NULL if none)
+//                resps - the response opcodes (out)
+//                n - the number of requests
+// Outputs      : 0 if successful, -1 if failure
+
+int client_raid_bus_batch(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n) {
+	uint32_t out, in, plen;
+	int i, first;
+
+	// Without server support, fall back to single requests
+	if (!(raid_bus_capabilities & RAID_CAP_BATCH)) {
+		for (i = 0; i < n; i++) {
+			if ((resps[i] = client_raid_bus_request(ops[i], bufs[i])) == (RAIDOpCode)-1) {
+				return( -1 );
+			}
+		}
+		return( 0 );
 	}
 
-	
-    return(reverseOpCode);
+	// Cut the vector into frames that respect the op and payload limits
+	first = 0;
+	out = in = 0;
+	for (i = 0; i < n; i++) {
+		plen = ((ops[i] >> 48) & 0xff) * (((ops[i] >> 56) == RAID_HASHBLOCK) ? sizeof(uint64_t) : RAID_BLOCK_SIZE);
+		if ((i - first == RAID_MAX_BATCH) ||
+				(((ops[i] >> 56) == RAID_WRITE) && (out + plen > RAID_BATCH_PAYLOAD)) ||
+				((((ops[i] >> 56) == RAID_READ) || ((ops[i] >> 56) == RAID_HASHBLOCK)) &&
+				(in + plen > RAID_BATCH_PAYLOAD))) {
+			if (raid_batch_frame(&ops[first], &bufs[first], &resps[first], i - first)) {
+				return( -1 );
+			}
+			first = i;
+			out = in = 0;
+		}
+		if ((ops[i] >> 56) == RAID_WRITE) {
+			out += plen;
+		} else if (((ops[i] >> 56) == RAID_READ) || ((ops[i] >> 56) == RAID_HASHBLOCK)) {
+			in += plen;
+		}
+	}
+	if ((first < n) && raid_batch_frame(&ops[first], &bufs[first], &resps[first], n - first)) {
+		return( -1 );
+	}
+	return( 0 );
 }
@@ -0,0 +1,411 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_compress.c
+//  Description   : This is the block compression used on the RAID bus.  The
+//                  encoded payload is the raw length (32 bits, network order)
+//                  followed by one chunk per RAID_BLOCK_SIZE of input:
+//
+//                    codec (8 bits) | length (16 bits) | data
+//
+//                  Uniform chunks are caught by a word-at-a-time scan and
+//                  sent as their fill byte.  Everything else is tried with
+//                  an LZ4 block compressor and sent raw if that does not
+//                  win.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/18/15
+//
+
+// Include Files
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <raid_compress.h>
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+
+// Defines
+#define LZ_HASH_BITS  10                // Match finder table size (log2)
+#define LZ_MIN_MATCH  4                 // Shortest match LZ4 encodes
+#define LZ_LAST_LITS  5                 // Trailing bytes that must be literals
+#define LZ_MF_LIMIT   12                // No match may start this close to the end
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codec_nsec
+// Description  : Read the monotonic clock in nanoseconds
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+static uint64_t codec_nsec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codec_is_fill
+// Description  : Check whether a chunk is one repeated byte
+//
+// Inputs       : p - the chunk
+//                n - its length
+// Outputs      : 1 if uniform, 0 otherwise
+
+static int codec_is_fill(const uint8_t *p, uint32_t n) {
+	uint64_t pattern, w;
+	uint32_t i;
+
+	pattern = 0x0101010101010101ULL * p[0];
+	for (i = 0; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, p+i, sizeof(w));
+		if (w != pattern) {
+			return( 0 );
+		}
+	}
+	for (; i < n; i++) {
+		if (p[i] != p[0]) {
+			return( 0 );
+		}
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_length
+// Description  : Emit an LZ4 length extension (runs of 255 then remainder)
+//
+// Inputs       : dst - the output
+//                op - the output position (in/out)
+//                len - the length beyond the 4-bit token field
+//                cap - the output capacity
+// Outputs      : 0 if it fit, -1 otherwise
+
+static int lz_length(uint8_t *dst, uint32_t *op, uint32_t len, uint32_t cap) {
+	for (; len >= 255; len -= 255) {
+		if (*op >= cap) {
+			return( -1 );
+		}
+		dst[(*op)++] = 255;
+	}
+	if (*op >= cap) {
+		return( -1 );
+	}
+	dst[(*op)++] = (uint8_t)len;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_compress
+// Description  : Compress a chunk into an LZ4 block
+//
+// Inputs       : src - the chunk
+//                n - its length (at most 64 KiB)
+//                dst - the output
+//                cap - the output capacity
+// Outputs      : the compressed length, or -1 if it did not fit
+
+static int lz_compress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap) {
+	uint16_t table[1 << LZ_HASH_BITS];
+	uint32_t ip = 0, anchor = 0, op = 0, ref, seq, lit, mlen, h, token;
+
+	memset(table, 0, sizeof(table));
+	while ((n > LZ_MF_LIMIT) && (ip < n - LZ_MF_LIMIT)) {
+
+		// Look up the last position with the same four bytes
+		memcpy(&seq, src+ip, sizeof(seq));
+		h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+		ref = table[h];
+		table[h] = (uint16_t)(ip + 1);
+		if ((ref == 0) || (memcmp(src+ref-1, &seq, sizeof(seq)) != 0)) {
+			ip++;
+			continue;
+		}
+		ref--;
+
+		// Stretch the match backwards over literals and forwards
+		while ((ip > anchor) && (ref > 0) && (src[ip-1] == src[ref-1])) {
+			ip--;
+			ref--;
+		}
+		mlen = LZ_MIN_MATCH;
+		while ((ip + mlen < n - LZ_LAST_LITS) && (src[ip+mlen] == src[ref+mlen])) {
+			mlen++;
+		}
+
+		// Emit the literals, the offset and the match length
+		lit = ip - anchor;
+		if (op + 1 + lit + 2 > cap) {
+			return( -1 );
+		}
+		token = op++;
+		dst[token] = (uint8_t)(((lit >= 15) ? 15 : lit) << 4);
+		if ((lit >= 15) && lz_length(dst, &op, lit - 15, cap)) {
+			return( -1 );
+		}
+		if (op + lit + 2 > cap) {
+			return( -1 );
+		}
+		memcpy(dst+op, src+anchor, lit);
+		op += lit;
+		dst[op++] = (uint8_t)((ip - ref) & 0xff);
+		dst[op++] = (uint8_t)((ip - ref) >> 8);
+		dst[token] |= (uint8_t)((mlen - LZ_MIN_MATCH >= 15) ? 15 : mlen - LZ_MIN_MATCH);
+		if ((mlen - LZ_MIN_MATCH >= 15) && lz_length(dst, &op, mlen - LZ_MIN_MATCH - 15, cap)) {
+			return( -1 );
+		}
+		ip += mlen;
+		anchor = ip;
+	}
+
+	// The rest goes out as the closing literal run
+	lit = n - anchor;
+	if (op + 1 > cap) {
+		return( -1 );
+	}
+	token = op++;
+	dst[token] = (uint8_t)(((lit >= 15) ? 15 : lit) << 4);
+	if ((lit >= 15) && lz_length(dst, &op, lit - 15, cap)) {
+		return( -1 );
+	}
+	if (op + lit > cap) {
+		return( -1 );
+	}
+	memcpy(dst+op, src+anchor, lit);
+	return( (int)(op + lit) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_decompress
+// Description  : Decompress an LZ4 block, checking every bound
+//
+// Inputs       : src - the block
+//                n - its length
+//                dst - the output
+//                cap - the output capacity
+// Outputs      : the decompressed length, or -1 if the block is malformed
+
+static int lz_decompress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap) {
+	uint32_t ip = 0, op = 0, lit, mlen, off, i;
+	uint8_t token, b;
+
+	while (ip < n) {
+		token = src[ip++];
+
+		// Literals
+		lit = token >> 4;
+		if (lit == 15) {
+			do {
+				if (ip >= n) {
+					return( -1 );
+				}
+				b = src[ip++];
+				lit += b;
+			} while (b == 255);
+		}
+		if ((ip + lit > n) || (op + lit > cap)) {
+			return( -1 );
+		}
+		memcpy(dst+op, src+ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == n) {
+			break;
+		}
+
+		// Match, copied forwards so overlapping runs replicate
+		if (ip + 2 > n) {
+			return( -1 );
+		}
+		off = src[ip] | (src[ip+1] << 8);
+		ip += 2;
+		mlen = token & 15;
+		if (mlen == 15) {
+			do {
+				if (ip >= n) {
+					return( -1 );
+				}
+				b = src[ip++];
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += LZ_MIN_MATCH;
+		if ((off == 0) || (off > op) || (op + mlen > cap)) {
+			return( -1 );
+		}
+		for (i = 0; i < mlen; i++) {
+			dst[op+i] = dst[op-off+i];
+		}
+		op += mlen;
+	}
+	return( (int)op );
+}
+
+//
+// Interface Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_compress_vector
+// Description  : Work out how much of a payload is a batch opcode vector,
+//                which travels uncompressed ahead of the encoded bytes
+//
+// Inputs       : op - the request or response opcode
+//                len - the payload length
+// Outputs      : the number of leading vector bytes
+
+uint32_t raid_compress_vector(RAIDOpCode op, uint32_t len) {
+	uint32_t vec;
+
+	if (((op >> 56) & 0xff) != RAID_BATCH) {
+		return( 0 );
+	}
+	vec = (uint32_t)op;
+	vec = ((vec > RAID_MAX_BATCH) ? RAID_MAX_BATCH : vec) * sizeof(uint64_t);
+	return( (vec > len) ? len : vec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_compress_payload
+// Description  : Encode a payload chunk by chunk, picking the smallest of
+//                fill, LZ4 and raw for each
+//
+// Inputs       : in - the payload
+//                len - its length
+//                out - the output (RAID_COMPRESS_BOUND(len) bytes)
+//                st - the statistics to update
+// Outputs      : the encoded length
+
+uint32_t raid_compress_payload(const void *in, uint32_t len, void *out, RaidCompressStats *st) {
+	const uint8_t *src = in;
+	uint8_t *dst = out;
+	uint32_t off, n, op, rawlen = htonl(len);
+	uint64_t start = codec_nsec();
+	int clen;
+
+	memcpy(dst, &rawlen, sizeof(rawlen));
+	op = sizeof(rawlen);
+	for (off = 0; off < len; off += n) {
+		n = (len - off < RAID_BLOCK_SIZE) ? len - off : RAID_BLOCK_SIZE;
+		if (codec_is_fill(src+off, n)) {
+			dst[op] = RAID_CODEC_FILL;
+			dst[op+3] = src[off];
+			clen = 1;
+		} else if ((clen = lz_compress(src+off, n, dst+op+RAID_CODEC_HDR, n-1)) > 0) {
+			dst[op] = RAID_CODEC_LZ;
+		} else {
+			dst[op] = RAID_CODEC_RAW;
+			memcpy(dst+op+RAID_CODEC_HDR, src+off, n);
+			clen = n;
+		}
+		st->chunks[dst[op]]++;
+		dst[op+1] = (uint8_t)(clen >> 8);
+		dst[op+2] = (uint8_t)(clen & 0xff);
+		op += RAID_CODEC_HDR + clen;
+	}
+
+	st->raw_out += len;
+	st->wire_out += op;
+	st->nsec += codec_nsec() - start;
+	return( op );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_decompress_payload
+// Description  : Decode a payload produced by raid_compress_payload
+//
+// Inputs       : in - the encoded payload
+//                len - its length
+//                out - the output
+//                cap - the output capacity
+//                olen - the decoded length (out)
+//                st - the statistics to update
+// Outputs      : 0 if successful, -1 if the payload is malformed
+
+int raid_decompress_payload(const void *in, uint32_t len, void *out, uint32_t cap,
+		uint32_t *olen, RaidCompressStats *st) {
+	const uint8_t *src = in;
+	uint8_t *dst = out;
+	uint32_t ip, op, rawlen, n, clen;
+	uint64_t start = codec_nsec();
+
+	if (len < sizeof(rawlen)) {
+		return( -1 );
+	}
+	memcpy(&rawlen, src, sizeof(rawlen));
+	rawlen = ntohl(rawlen);
+	if (rawlen > cap) {
+		return( -1 );
+	}
+	for (ip = sizeof(rawlen), op = 0; op < rawlen; op += n) {
+		n = (rawlen - op < RAID_BLOCK_SIZE) ? rawlen - op : RAID_BLOCK_SIZE;
+		if (ip + RAID_CODEC_HDR > len) {
+			return( -1 );
+		}
+		clen = (src[ip+1] << 8) | src[ip+2];
+		if (ip + RAID_CODEC_HDR + clen > len) {
+			return( -1 );
+		}
+		switch (src[ip]) {
+		case RAID_CODEC_FILL:
+			if (clen != 1) {
+				return( -1 );
+			}
+			memset(dst+op, src[ip+RAID_CODEC_HDR], n);
+			break;
+		case RAID_CODEC_LZ:
+			if (lz_decompress(src+ip+RAID_CODEC_HDR, clen, dst+op, n) != (int)n) {
+				return( -1 );
+			}
+			break;
+		case RAID_CODEC_RAW:
+			if (clen != n) {
+				return( -1 );
+			}
+			memcpy(dst+op, src+ip+RAID_CODEC_HDR, n);
+			break;
+		default:
+			return( -1 );
+		}
+		ip += RAID_CODEC_HDR + clen;
+	}
+
+	*olen = rawlen;
+	st->raw_in += rawlen;
+	st->wire_in += len;
+	st->nsec += codec_nsec() - start;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_compress_log_stats
+// Description  : Log the bytes-on-wire and codec cost figures
+//
+// Inputs       : who - the side doing the logging
+//                st - the statistics
+// Outputs      : none
+
+void raid_compress_log_stats(const char *who, RaidCompressStats *st) {
+	uint64_t raw = st->raw_out + st->raw_in, wire = st->wire_out + st->wire_in;
+
+	RAID_LOG(LOG_INFO_LEVEL, "%s compression: %llu payload bytes, %llu on the wire (%.2fx), "
+			"%.3f ms codec time (%.1f MB/s)", who, (unsigned long long)raw, (unsigned long long)wire,
+			(wire > 0) ? (double)raw / wire : 0.0, st->nsec / 1000000.0,
+			(st->nsec > 0) ? raw * 1000.0 / st->nsec : 0.0);
+	RAID_LOG(LOG_INFO_LEVEL, "%s compression: %llu fill, %llu lz, %llu raw chunks", who,
+			(unsigned long long)st->chunks[RAID_CODEC_FILL], (unsigned long long)st->chunks[RAID_CODEC_LZ],
+			(unsigned long long)st->chunks[RAID_CODEC_RAW]);
+}
@@ -0,0 +1,59 @@
+#ifndef RAID_COMPRESS_INCLUDED
+#define RAID_COMPRESS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_compress.h
+//  Description   : This is the block compression used on the RAID bus when
+//                  both ends negotiate RAID_CAP_COMPRESS.  A payload is cut
+//                  into RAID_BLOCK_SIZE chunks and each chunk is sent as a
+//                  single fill byte, as an LZ4 block, or raw, whichever is
+//                  smallest.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/18/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_CODEC_RAW   0 // Chunk sent as is
+#define RAID_CODEC_FILL  1 // Chunk is one repeated byte
+#define RAID_CODEC_LZ    2 // Chunk is an LZ4 block
+#define RAID_CODEC_HDR   3 // Codec byte plus 16-bit length per chunk
+
+// Worst case encoded size of a payload of n bytes
+#define RAID_COMPRESS_BOUND(n) ((n) + sizeof(uint32_t) + \
+		RAID_CODEC_HDR*(((n) + RAID_BLOCK_SIZE - 1) / RAID_BLOCK_SIZE))
+
+// Type definitions
+typedef struct {
+	uint64_t raw_out;    // Payload bytes before encoding
+	uint64_t wire_out;   // Payload bytes after encoding
+	uint64_t raw_in;     // Payload bytes after decoding
+	uint64_t wire_in;    // Payload bytes before decoding
+	uint64_t chunks[3];  // Chunks encoded with each codec
+	uint64_t nsec;       // Time spent in the codec
+} RaidCompressStats;
+
+//
+// Functional Prototypes
+
+uint32_t raid_compress_vector(RAIDOpCode op, uint32_t len);
+	// The number of leading payload bytes (a batch opcode vector) sent raw
+
+uint32_t raid_compress_payload(const void *in, uint32_t len, void *out, RaidCompressStats *st);
+	// Encode a payload, returning the encoded length
+
+int raid_decompress_payload(const void *in, uint32_t len, void *out, uint32_t cap,
+		uint32_t *olen, RaidCompressStats *st);
+	// Decode a payload into out, returning the decoded length in olen
+
+void raid_compress_log_stats(const char *who, RaidCompressStats *st);
+	// Log the bytes-on-wire and codec cost figures
+
+#endif
@@ -0,0 +1,402 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_elevator.c
+//  Description   : This is the elevator of the bus client (see
+//                  raid_elevator.h).  Pending ops are sorted by disk, then
+//                  block ID, then arrival, so ops on the same block keep
+//                  their order and only runs of distinct adjacent blocks
+//                  of one type merge.  A merged request moves its payload
+//                  through a staging buffer unless the callers' buffers
+//                  happen to be contiguous already.  With a deadline, the
+//                  first caller to find the queues idle waits for the
+//                  others (plugs), then dispatches everything pending.
+//                  Until a second thread has used the elevator there is
+//                  nobody to wait for, and nothing plugs.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/23/15
+//
+
+// Include Files
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_array.h>
+#include <raid_network.h>
+#include <raid_elevator.h>
+
+// Type definitions
+typedef struct elevator_request {
+	RAIDOpCode              *ops;   // The requests
+	void                   **bufs;  // Their payloads
+	RAIDOpCode              *resps; // Their responses (out)
+	int                      n;     // Number of requests
+	int                      ret;   // 0, or -1 if the bus failed
+	int                      done;  // Dispatched and answered
+	struct elevator_request *link;  // Next pending request
+} ElevatorRequest;
+
+typedef struct {
+	RAIDOpCode       op;   // The request
+	void            *buf;  // Its payload
+	RAIDOpCode      *resp; // Where its response goes
+	uint32_t         seq;  // Arrival order
+} ElevatorEntry;
+
+typedef struct {
+	ElevatorEntry *entries; // Pending ops of a dispatch, in elevator order
+	RAIDOpCode    *ops;     // The merged requests
+	RAIDOpCode    *resps;   // ... their responses
+	void         **bufs;    // ... their payloads
+	int           *first;   // ... their first entry
+	int           *count;   // ... their number of entries
+	char          *stage;   // Staging for the payloads of merged requests
+	size_t         room;    // Ops the arrays above hold
+	size_t         staged;  // Bytes stage holds
+} ElevatorScratch;
+
+//
+// Global data
+int raid_elevator_enabled = 0;                       // The elevator is configured
+static uint64_t elevator_deadline = 0;               // Longest plug (nsec)
+static uint32_t elevator_depth = RAID_ELEVATOR_DEPTH; // Pending ops that end a plug
+static uint32_t elevator_merge = RAID_MAX_XFER;      // Most blocks in a merged request
+static ElevatorRequest *elevator_pending = NULL;     // Requests waiting for a dispatch
+static ElevatorRequest *elevator_pending_tail = NULL;
+static uint32_t elevator_npending = 0;               // Ops they hold
+static int elevator_plugged = 0;                     // A caller is collecting requests
+static int elevator_dispatching = 0;                 // A caller is on the bus
+static uint32_t elevator_threads = 0;                // Threads that have used the elevator
+static __thread int elevator_joined = 0;             // This thread is counted in elevator_threads
+static uint64_t elevator_in = 0;                     // Ops handed to the elevator
+static uint64_t elevator_out = 0;                    // Requests sent for them
+static uint64_t elevator_blocks = 0;                 // Blocks they moved
+static uint64_t elevator_dispatches = 0;             // Dispatches
+static pthread_mutex_t elevator_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the above
+static pthread_cond_t elevator_cond = PTHREAD_COND_INITIALIZER;   // Queues changed
+static ElevatorScratch elevator_scratch;             // The dispatch arrays (elevator_dispatching owns them)
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elevator_compare
+// Description  : Order two pending ops by disk, block ID, then arrival
+//
+// Inputs       : a, b - the entries
+// Outputs      : <0, 0 or >0
+
+static int elevator_compare(const void *a, const void *b) {
+	const ElevatorEntry *x = a, *y = b;
+	uint64_t kx = x->op & 0xff00ffffffffULL, ky = y->op & 0xff00ffffffffULL; // disk, block
+
+	if (kx != ky) {
+		return( (kx < ky) ? -1 : 1 );
+	}
+	return( (x->seq < y->seq) ? -1 : (x->seq > y->seq) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elevator_room
+// Description  : Make the dispatch arrays hold n ops and stage bytes
+//
+// Inputs       : sc - the arrays
+//                n - the ops
+//                stage - the staging bytes
+// Outputs      : 0 if successful, -1 if failure
+
+static int elevator_room(ElevatorScratch *sc, size_t n, size_t stage) {
+	void *p[6];
+
+	if (n > sc->room) {
+		p[0] = realloc(sc->entries, n * sizeof(ElevatorEntry));
+		sc->entries = (p[0] != NULL) ? p[0] : sc->entries;
+		p[1] = realloc(sc->ops, n * sizeof(RAIDOpCode));
+		sc->ops = (p[1] != NULL) ? p[1] : sc->ops;
+		p[2] = realloc(sc->resps, n * sizeof(RAIDOpCode));
+		sc->resps = (p[2] != NULL) ? p[2] : sc->resps;
+		p[3] = realloc(sc->bufs, n * sizeof(void *));
+		sc->bufs = (p[3] != NULL) ? p[3] : sc->bufs;
+		p[4] = realloc(sc->first, n * sizeof(int));
+		sc->first = (p[4] != NULL) ? p[4] : sc->first;
+		p[5] = realloc(sc->count, n * sizeof(int));
+		sc->count = (p[5] != NULL) ? p[5] : sc->count;
+		if ((p[0] == NULL) || (p[1] == NULL) || (p[2] == NULL) || (p[3] == NULL) ||
+				(p[4] == NULL) || (p[5] == NULL)) {
+			return( -1 );
+		}
+		sc->room = n;
+	}
+	if (stage > sc->staged) {
+		if ((p[0] = realloc(sc->stage, stage)) == NULL) {
+			return( -1 );
+		}
+		sc->stage = p[0];
+		sc->staged = stage;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elevator_dispatch
+// Description  : Sort and merge the pending ops of some requests, send them
+//                and answer every op (the caller owns the requests)
+//
+// Inputs       : reqs - the requests (linked)
+//                n - the ops they hold
+// Outputs      : 0 if successful, -1 if failure
+
+static int elevator_dispatch(ElevatorRequest *reqs, int n) {
+	ElevatorScratch *sc = &elevator_scratch;
+	ElevatorRequest *r;
+	ElevatorEntry *e, *prev;
+	uint32_t blks, run, type;
+	size_t stage = 0, off;
+	char *next;
+	int i, j, k, m, ret;
+
+	// Line the ops up in elevator order
+	for (r = reqs; r != NULL; r = r->link) {
+		for (i = 0; i < r->n; i++) {
+			stage += ((r->ops[i] >> 48) & 0xff) * RAID_BLOCK_SIZE;
+		}
+	}
+	if (elevator_room(sc, n, stage)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "ELEVATOR: failure allocating a dispatch of %d ops.", n);
+		return( -1 );
+	}
+	for (k = 0, r = reqs; r != NULL; r = r->link) {
+		for (i = 0; i < r->n; i++, k++) {
+			sc->entries[k].op = r->ops[i];
+			sc->entries[k].buf = r->bufs[i];
+			sc->entries[k].resp = &r->resps[i];
+			sc->entries[k].seq = k;
+		}
+	}
+	qsort(sc->entries, n, sizeof(ElevatorEntry), elevator_compare);
+
+	// Merge runs of adjacent blocks of one type on one disk
+	for (m = 0, i = 0; i < n; i = j, m++) {
+		type = sc->entries[i].op >> 56;
+		run = (sc->entries[i].op >> 48) & 0xff;
+		for (j = i + 1; j < n; j++) {
+			prev = &sc->entries[j-1];
+			e = &sc->entries[j];
+			blks = (e->op >> 48) & 0xff;
+			if (((e->op >> 56) != type) || (((e->op >> 40) & 0xff) != ((prev->op >> 40) & 0xff)) ||
+					((uint32_t)e->op != (uint32_t)prev->op + ((prev->op >> 48) & 0xff)) ||
+					(run + blks > elevator_merge)) {
+				break;
+			}
+			run += blks;
+		}
+		sc->ops[m] = (sc->entries[i].op & ~(0xffULL << 48)) | ((uint64_t)run << 48);
+		sc->first[m] = i;
+		sc->count[m] = j - i;
+		elevator_blocks += run;
+	}
+
+	// Give each merged request a payload, staging it unless it is contiguous
+	for (off = 0, k = 0; k < m; k++) {
+		e = &sc->entries[sc->first[k]];
+		sc->bufs[k] = e->buf;
+		for (next = e->buf, i = 0; (i < sc->count[k]) && (e[i].buf == next); i++) {
+			next += ((e[i].op >> 48) & 0xff) * RAID_BLOCK_SIZE;
+		}
+		if (i == sc->count[k]) {
+			continue;
+		}
+		sc->bufs[k] = sc->stage + off;
+		for (i = 0; i < sc->count[k]; i++) {
+			blks = ((e[i].op >> 48) & 0xff) * RAID_BLOCK_SIZE;
+			if ((e[i].op >> 56) == RAID_WRITE) {
+				memcpy(sc->stage + off, e[i].buf, blks);
+			}
+			off += blks;
+		}
+	}
+
+	// Send them, then hand every op its data and result
+	ret = client_raid_bus_batch(sc->ops, sc->bufs, sc->resps, m);
+	for (k = 0; k < m; k++) {
+		e = &sc->entries[sc->first[k]];
+		for (next = sc->bufs[k], i = 0; i < sc->count[k]; i++) {
+			blks = ((e[i].op >> 48) & 0xff) * RAID_BLOCK_SIZE;
+			if ((sc->bufs[k] != e->buf) && ((e[i].op >> 56) == RAID_READ) && (ret == 0)) {
+				memcpy(e[i].buf, next, blks);
+			}
+			next += blks;
+			*e[i].resp = (ret) ? (e[i].op | RAID_OPCODE_RESULT) : (e[i].op | (sc->resps[k] & RAID_OPCODE_RESULT));
+		}
+	}
+	elevator_out += m;
+	elevator_dispatches++;
+	return( ret );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_elevator_configure
+// Description  : Turn the elevator on with a configuration
+//
+// Inputs       : spec - the configuration (see raid_elevator.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_elevator_configure(const char *spec) {
+	char *copy, *field, *save;
+	unsigned int value;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if (sscanf(field, "deadline=%u%c", &value, &extra) == 1) {
+			elevator_deadline = value * 1000ULL;
+		} else if ((sscanf(field, "depth=%u%c", &value, &extra) == 1) && (value > 0)) {
+			elevator_depth = value;
+		} else if ((sscanf(field, "merge=%u%c", &value, &extra) == 1) && (value > 0) && (value <= RAID_MAX_XFER)) {
+			elevator_merge = value;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad elevator field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	raid_elevator_enabled = (ret == 0);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_elevator_batch
+// Description  : Queue a vector of requests, and sort, merge and send it
+//                with whatever else is pending
+//
+// Inputs       : ops - the request opcodes
+//                bufs - the per-request payload buffers (NULL if none)
+//                resps - the response opcodes (out)
+//                n - the number of requests
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_elevator_batch(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n) {
+	ElevatorRequest req, *reqs, *r;
+	struct timespec until;
+	uint64_t nsec;
+	int i, ret, taken;
+
+	// Only single block reads and writes (what the driver sends) are
+	// reordered, so pending ops never overlap; anything else goes as it is
+	for (i = 0; raid_elevator_enabled && (i < n); i++) {
+		if ((((ops[i] >> 56) != RAID_READ) && ((ops[i] >> 56) != RAID_WRITE)) || (((ops[i] >> 48) & 0xff) != 1)) {
+			break;
+		}
+	}
+	if (!raid_elevator_enabled || (n <= 0) || (i < n)) {
+		return( client_raid_bus_batch(ops, bufs, resps, n) );
+	}
+
+	// Join the pending queues
+	memset(&req, 0x0, sizeof(req));
+	req.ops = ops;
+	req.bufs = bufs;
+	req.resps = resps;
+	req.n = n;
+	pthread_mutex_lock(&elevator_lock);
+	if (elevator_pending_tail != NULL) {
+		elevator_pending_tail->link = &req;
+	} else {
+		elevator_pending = &req;
+	}
+	elevator_pending_tail = &req;
+	elevator_npending += n;
+	elevator_in += n;
+	if (!elevator_joined) {
+		elevator_joined = 1;
+		elevator_threads++;
+	}
+	pthread_cond_broadcast(&elevator_cond);
+
+	while (!req.done) {
+		if (elevator_plugged || elevator_dispatching) {
+			pthread_cond_wait(&elevator_cond, &elevator_lock);
+			continue;
+		}
+
+		// Plug: give other callers until the deadline to add their ops
+		// (a lone thread has nobody to wait for, so it goes at once)
+		elevator_plugged = 1;
+		if ((elevator_deadline > 0) && (elevator_threads > 1)) {
+			clock_gettime(CLOCK_REALTIME, &until);
+			nsec = until.tv_nsec + elevator_deadline;
+			until.tv_sec += nsec / 1000000000ULL;
+			until.tv_nsec = nsec % 1000000000ULL;
+			while ((elevator_npending < elevator_depth) &&
+					(pthread_cond_timedwait(&elevator_cond, &elevator_lock, &until) != ETIMEDOUT));
+		}
+
+		// Unplug, taking everything pending
+		reqs = elevator_pending;
+		taken = elevator_npending;
+		elevator_pending = elevator_pending_tail = NULL;
+		elevator_npending = 0;
+		elevator_plugged = 0;
+		elevator_dispatching = 1;
+		pthread_mutex_unlock(&elevator_lock);
+
+		ret = elevator_dispatch(reqs, taken);
+
+		pthread_mutex_lock(&elevator_lock);
+		for (r = reqs; r != NULL; r = r->link) {
+			r->ret = ret;
+			r->done = 1;
+		}
+		elevator_dispatching = 0;
+		pthread_cond_broadcast(&elevator_cond);
+	}
+	pthread_mutex_unlock(&elevator_lock);
+	return( req.ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_elevator_close
+// Description  : Log the merging figures and free the dispatch arrays
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_elevator_close(void) {
+	if (!raid_elevator_enabled) {
+		return( 0 );
+	}
+	pthread_mutex_lock(&elevator_lock);
+	RAID_LOG(LOG_INFO_LEVEL, "ELEVATOR: %llu ops sent as %llu requests (%.2f blocks each) in %llu dispatches",
+			(unsigned long long)elevator_in, (unsigned long long)elevator_out,
+			(elevator_out) ? (double)elevator_blocks / elevator_out : 0.0, (unsigned long long)elevator_dispatches);
+	elevator_in = elevator_out = elevator_blocks = elevator_dispatches = 0;
+	free(elevator_scratch.entries);
+	free(elevator_scratch.ops);
+	free(elevator_scratch.resps);
+	free(elevator_scratch.bufs);
+	free(elevator_scratch.first);
+	free(elevator_scratch.count);
+	free(elevator_scratch.stage);
+	memset(&elevator_scratch, 0x0, sizeof(elevator_scratch));
+	pthread_mutex_unlock(&elevator_lock);
+	return( 0 );
+}
@@ -0,0 +1,53 @@
+#ifndef RAID_ELEVATOR_INCLUDED
+#define RAID_ELEVATOR_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_elevator.h
+//  Description   : This is the elevator of the bus client.  Once configured
+//                  (tagline_client -E), the single block READs and WRITEs
+//                  the driver sends are put in per-disk order by block ID
+//                  and runs of adjacent blocks are merged into multi-block
+//                  requests of up to RAID_MAX_XFER blocks before they go
+//                  on the bus.
+//                  With a deadline, requests from several threads wait in
+//                  the pending queues for up to that long (or until depth
+//                  ops are pending) so they can be sorted and merged
+//                  together.  A single replay thread never waits (only
+//                  its own batch is sorted and merged).  The
+//                  configuration is comma separated:
+//
+//                    deadline=<usec>   longest an op waits to be merged (0)
+//                    depth=<ops>       pending ops that dispatch at once (256)
+//                    merge=<blocks>    most blocks in a merged request (255)
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/23/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_ELEVATOR_DEPTH RAID_MAX_BATCH // Default pending ops that dispatch at once
+
+//
+// Global data
+extern int raid_elevator_enabled; // The elevator is configured
+
+//
+// Functional Prototypes
+
+int raid_elevator_configure(const char *spec);
+	// Turn the elevator on with a configuration
+
+int raid_elevator_batch(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n);
+	// Sort, merge and send a vector of requests (as client_raid_bus_batch)
+
+int raid_elevator_close(void);
+	// Log the merging figures
+
+#endif
@@ -0,0 +1,375 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_local.c
+//  Description   : This is the in-process RAID backend.  Requests go
+//                  straight to the RAID array engine; a simple disk model
+//                  (fixed per-op latency plus size/bandwidth) is applied
+//                  by sleeping to a deadline, or only accounted for when
+//                  the model is run without real time.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/30/15
+//
+
+// Include Files
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Project Include Files
+#include <raid_local.h>
+#include <raid_array.h>
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define RAID_LOCAL_SPIN_NSEC 50000 // Deadlines closer than this are spun for
+#define RAID_LOCAL_DISKS     256   // Disks an opcode can address
+
+// Type definitions
+typedef struct {
+	RaidArray array;       // The in-process array
+	char     *dir;         // Image directory (NULL for memory)
+	uint64_t  lat_nsec;    // Per-op latency
+	uint64_t  bw_bps;      // Bandwidth in bytes/sec (0 for unlimited)
+	uint64_t  seek_nsec;   // Latency of a seek
+	int       fail_disk;   // Disk to fail (-1 for none)
+	uint64_t  fail_at;     // Data op number to fail it at
+	uint32_t  err_ppm;     // Injected READ/WRITE errors per million ops
+	uint32_t  rot_ppm;     // Written blocks silently corrupted per million
+	uint64_t  rng;         // Error injection generator state
+	int       model;       // Account delays without sleeping
+	int       par;         // The disks of a batch work in parallel
+	uint64_t  ops;         // Data ops executed
+	uint64_t  errors;      // Errors injected
+	uint64_t  rotted;      // Blocks corrupted
+	uint64_t  modelled;    // Total modelled device time (nsec)
+	char     *scratch;     // Batch response staging
+	int       open;        // Non-zero while the backend is in use
+} RaidLocal;
+
+// Global data
+static RaidLocal local;
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_random
+// Description  : The next value of the error injection generator (xorshift),
+//                stepped atomically so concurrent requests never draw the
+//                same value
+//
+// Inputs       : none
+// Outputs      : a pseudo-random 64-bit value
+
+static uint64_t local_random(void) {
+	uint64_t old = __atomic_load_n(&local.rng, __ATOMIC_RELAXED), next;
+
+	do {
+		next = old ^ (old << 13);
+		next ^= next >> 7;
+		next ^= next << 17;
+	} while (!__atomic_compare_exchange_n(&local.rng, &old, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return( next );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_parse_options
+// Description  : Parse the '&' separated options of the endpoint
+//
+// Inputs       : opts - the option string (modified)
+// Outputs      : 0 if successful, -1 if failure
+
+static int local_parse_options(char *opts) {
+	char *opt, *save = NULL;
+	unsigned long long v1, v2;
+	double bw;
+
+	for (opt = strtok_r(opts, "&", &save); opt != NULL; opt = strtok_r(NULL, "&", &save)) {
+		if (sscanf(opt, "lat=%llu", &v1) == 1) {
+			local.lat_nsec = v1 * 1000;
+		} else if (sscanf(opt, "seek=%llu", &v1) == 1) {
+			local.seek_nsec = v1 * 1000;
+		} else if (sscanf(opt, "bw=%lf", &bw) == 1) {
+			local.bw_bps = (uint64_t)(bw * 1000000.0);
+		} else if (sscanf(opt, "fail=%llu@%llu", &v1, &v2) == 2) {
+			local.fail_disk = (int)v1;
+			local.fail_at = v2;
+		} else if (sscanf(opt, "err=%llu", &v1) == 1) {
+			local.err_ppm = (uint32_t)v1;
+		} else if (sscanf(opt, "rot=%llu", &v1) == 1) {
+			local.rot_ppm = (uint32_t)v1;
+		} else if (sscanf(opt, "seed=%llu", &v1) == 1) {
+			local.rng = v1 ? v1 : 1;
+		} else if (sscanf(opt, "model=%llu", &v1) == 1) {
+			local.model = (v1 != 0);
+		} else if (sscanf(opt, "par=%llu", &v1) == 1) {
+			local.par = (v1 != 0);
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Unknown in-process RAID option [%s]", opt);
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_data_op
+// Description  : Account for one data op: fire any scheduled disk failure,
+//                decide whether to inject an error and add its device time
+//
+// Inputs       : op - the request opcode
+//                delay - the accumulated device time (in/out)
+// Outputs      : 1 if an error should be injected, 0 otherwise
+
+static int local_data_op(RAIDOpCode op, uint64_t *delay) {
+	RAID_REQUEST_TYPES req = (op >> 56) & 0xff;
+	uint64_t bytes;
+
+	if ((req != RAID_READ) && (req != RAID_WRITE) && (req != RAID_HASHBLOCK)) {
+		return( 0 );
+	}
+	local.ops++;
+	if ((local.fail_disk >= 0) && (local.ops == local.fail_at)) {
+		RAID_LOG(LOG_INFO_LEVEL, "In-process RAID failing disk %d at op %llu",
+				local.fail_disk, (unsigned long long)local.ops);
+		raid_array_fail_disk(&local.array, (RAIDDiskID)local.fail_disk);
+	}
+	bytes = ((op >> 48) & 0xff) * RAID_BLOCK_SIZE;
+	*delay += local.lat_nsec;
+	if (local.bw_bps > 0) {
+		*delay += bytes * 1000000000ULL / local.bw_bps;
+	}
+	return( (req != RAID_HASHBLOCK) && (local.err_ppm > 0) &&
+			((local_random() % 1000000) < local.err_ppm) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_rot
+// Description  : Flip a bit in some of the blocks a WRITE has just stored,
+//                without telling anyone (disks in memory or mmap'd only)
+//
+// Inputs       : op - the request opcode
+//                resp - its response
+// Outputs      : none
+
+static void local_rot(RAIDOpCode op, RAIDOpCode resp) {
+	RAIDDiskID dsk = (RAIDDiskID)((op >> 40) & 0xff);
+	RAIDBlockID blk = (RAIDBlockID)op;
+	uint64_t bit;
+	uint32_t i;
+
+	if ((local.rot_ppm == 0) || (((op >> 56) & 0xff) != RAID_WRITE) || (resp & RAID_OPCODE_RESULT) ||
+			(local.array.data == NULL) || (dsk >= local.array.disks) || (local.array.data[dsk] == NULL)) {
+		return;
+	}
+	for (i = 0; (i < ((op >> 48) & 0xff)) && (blk+i < local.array.blocks); i++) {
+		if ((local_random() % 1000000) < local.rot_ppm) {
+			bit = local_random() % (RAID_BLOCK_SIZE*8);
+			local.array.data[dsk][(uint64_t)(blk+i)*RAID_BLOCK_SIZE + bit/8] ^= (char)(1 << (bit%8));
+			local.rotted++;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_delay
+// Description  : Hold the caller for the modelled device time, sleeping to
+//                an absolute deadline (spinning for the last stretch)
+//
+// Inputs       : start - when the request arrived
+//                delay - the modelled device time (nsec)
+// Outputs      : none
+
+static void local_delay(struct timespec *start, uint64_t delay) {
+	struct timespec deadline, now;
+	uint64_t nsec;
+
+	local.modelled += delay;
+	if (local.model || (delay == 0)) {
+		return;
+	}
+	nsec = start->tv_nsec + delay;
+	deadline.tv_sec = start->tv_sec + nsec / 1000000000ULL;
+	deadline.tv_nsec = nsec % 1000000000ULL;
+	if (delay > RAID_LOCAL_SPIN_NSEC) {
+		nsec = delay - RAID_LOCAL_SPIN_NSEC + start->tv_nsec;
+		now.tv_sec = start->tv_sec + nsec / 1000000000ULL;
+		now.tv_nsec = nsec % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &now, NULL) == EINTR);
+	}
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec < deadline.tv_sec) ||
+			((now.tv_sec == deadline.tv_sec) && (now.tv_nsec < deadline.tv_nsec)));
+}
+
+//
+// Interface Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_open
+// Description  : Create the in-process array described by the endpoint
+//
+// Inputs       : uri - the mem:// or file:// endpoint
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_open(const char *uri) {
+	char *spec, *opts;
+
+	// Reset the backend, then pull apart the endpoint
+	if (local.open) {
+		raid_local_close();
+	}
+	memset(&local, 0, sizeof(local));
+	local.fail_disk = -1;
+	local.rng = 0x2545f4914f6cdd1dULL;
+	if (strncmp(uri, RAID_MEM_SCHEME, strlen(RAID_MEM_SCHEME)) == 0) {
+		spec = strdup(uri + strlen(RAID_MEM_SCHEME));
+	} else if (strncmp(uri, RAID_FILE_SCHEME, strlen(RAID_FILE_SCHEME)) == 0) {
+		spec = strdup(uri + strlen(RAID_FILE_SCHEME));
+	} else {
+		RAID_LOG(LOG_ERROR_LEVEL, "Unknown in-process RAID endpoint [%s]", uri);
+		return( -1 );
+	}
+	if ((opts = strchr(spec, '?')) != NULL) {
+		*opts++ = 0x0;
+		if (local_parse_options(opts)) {
+			free(spec);
+			return( -1 );
+		}
+	}
+	if (uri[0] == 'f') {
+		local.dir = spec;
+	} else {
+		free(spec);
+	}
+
+	// Create the engine and the batch staging area
+	local.scratch = malloc(RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD);
+	if ((local.scratch == NULL) || raid_array_create(&local.array, local.dir, 0)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "In-process RAID array creation failed");
+		free(local.scratch);
+		free(local.dir);
+		return( -1 );
+	}
+	local.open = 1;
+	RAID_LOG(LOG_INFO_LEVEL, "In-process RAID (%s, lat=%lluns, bw=%lluB/s, seek=%lluns, err=%uppm, rot=%uppm%s%s)",
+			(local.dir == NULL) ? "memory" : local.dir, (unsigned long long)local.lat_nsec,
+			(unsigned long long)local.bw_bps, (unsigned long long)local.seek_nsec, local.err_ppm,
+			local.rot_ppm, local.model ? ", modelled" : "", local.par ? ", parallel disks" : "");
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_request
+// Description  : Execute a request in-process, injecting the configured
+//                delays and faults
+//
+// Inputs       : op - the request opcode
+//                buf - the request payload, receives the response payload
+//                len - the request payload length
+//                rlen - the response payload length (out)
+//                cap - the most response payload buf can take
+// Outputs      : the response opcode, or -1 if failure
+
+RAIDOpCode raid_local_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap) {
+	struct timespec start = { 0, 0 };
+	uint64_t delay = 0, seeks = local.array.seeks, *resps, busy[RAID_LOCAL_DISKS], d;
+	uint8_t inject[RAID_MAX_BATCH];
+	uint32_t i, n;
+	RAIDOpCode resp;
+
+	if (!local.open) {
+		return( -1 );
+	}
+	if (!local.model) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+
+	// Single requests run against the caller's buffer directly
+	*rlen = cap;
+	if (((op >> 56) & 0xff) != RAID_BATCH) {
+		if (local_data_op(op, &delay)) {
+			local.errors++;
+			*rlen = 0;
+			resp = op | RAID_OPCODE_RESULT;
+		} else {
+			resp = raid_array_execute(&local.array, op, buf, len, buf, rlen);
+			local_rot(op, resp);
+		}
+		delay += (local.array.seeks - seeks) * local.seek_nsec;
+		local_delay(&start, delay);
+		return( resp );
+	}
+
+	// Batches are staged (reads would overwrite unread write payloads),
+	// injected errors are flagged on the individual responses afterwards.
+	// With par=1 a batch takes as long as its busiest disk.
+	n = (uint32_t)op;
+	memset(inject, 0, sizeof(inject));
+	memset(busy, 0, sizeof(busy));
+	for (i = 0; (i < n) && (i < RAID_MAX_BATCH) && ((i+1) * sizeof(uint64_t) <= len); i++) {
+		d = 0;
+		if (local_data_op(ntohll64(((uint64_t *)buf)[i]), &d)) {
+			local.errors++;
+			inject[i] = 1;
+		}
+		if (local.par) {
+			busy[(ntohll64(((uint64_t *)buf)[i]) >> 40) & 0xff] += d;
+		} else {
+			delay += d;
+		}
+	}
+	for (i = 0; local.par && (i < RAID_LOCAL_DISKS); i++) {
+		delay = (busy[i] > delay) ? busy[i] : delay;
+	}
+	*rlen = (cap < RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD) ? cap :
+			RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD;
+	resp = raid_array_execute(&local.array, op, buf, len, local.scratch, rlen);
+	resps = (uint64_t *)local.scratch;
+	for (i = 0; (i < n) && (i < RAID_MAX_BATCH) && ((i+1) * sizeof(uint64_t) <= *rlen); i++) {
+		if (inject[i]) {
+			resps[i] |= htonll64(RAID_OPCODE_RESULT);
+		} else {
+			local_rot(ntohll64(resps[i]), ntohll64(resps[i]));
+		}
+	}
+	memcpy(buf, local.scratch, *rlen);
+	delay += (local.array.seeks - seeks) * local.seek_nsec;
+	local_delay(&start, delay);
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_local_close
+// Description  : Report the modelled time and release the in-process array
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_local_close(void) {
+	if (!local.open) {
+		return( -1 );
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "In-process RAID: %llu data ops, %llu seeks, %llu injected errors, %llu corrupted blocks, %.3f ms modelled device time",
+			(unsigned long long)local.ops, (unsigned long long)local.array.seeks,
+			(unsigned long long)local.errors, (unsigned long long)local.rotted, local.modelled / 1000000.0);
+	raid_array_destroy(&local.array);
+	free(local.scratch);
+	free(local.dir);
+	local.open = 0;
+	return( 0 );
+}
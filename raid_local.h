@@ -0,0 +1,59 @@
+#ifndef RAID_LOCAL_INCLUDED
+#define RAID_LOCAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_local.h
+//  Description   : This is the in-process RAID backend.  It runs the RAID
+//                  array engine inside the client so the driver can be
+//                  exercised without a server or sockets, with optional
+//                  latency, bandwidth and failure injection.
+//
+//                  Endpoints look like
+//
+//                    mem://[?options]            disks in memory
+//                    file://<dir>[?options]      disks in mmap'd images
+//
+//                  where options are '&' separated:
+//
+//                    lat=<usec>     per-op latency
+//                    bw=<MB/s>      transfer bandwidth
+//                    seek=<usec>    extra latency of a transfer that does not
+//                                   start where the disk's last one ended
+//                    fail=<d>@<n>   fail disk d before the n-th data op
+//                    err=<ppm>      failed READ/WRITE ops per million
+//                    rot=<ppm>      written blocks silently corrupted per
+//                                   million (a flipped bit)
+//                    seed=<n>       seed for the error injection
+//                    model=1        account the delays without sleeping
+//                    par=1          the disks of a batch work in parallel, so
+//                                   it takes as long as its busiest disk
+//                                   (seeks are still added up)
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/30/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_MEM_SCHEME  "mem://"
+#define RAID_FILE_SCHEME "file://"
+
+//
+// Functional Prototypes
+
+int raid_local_open(const char *uri);
+	// Create the in-process array described by the endpoint
+
+RAIDOpCode raid_local_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap);
+	// Execute a request in-process, injecting the configured delays/faults
+
+int raid_local_close(void);
+	// Report the modelled time and release the in-process array
+
+#endif
@@ -0,0 +1,540 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_log.c
+//  Description   : This is the asynchronous half of the hot-path logging
+//                  layer.  Each logging thread owns a single-producer byte
+//                  ring of variable length events:
+//
+//                    size (32) | level (32) | timestamp (64) | format | args
+//
+//                  where the arguments are the raw 8-byte values of the
+//                  conversions in the format, in order, with strings
+//                  copied in as a 16-bit length and their bytes.  The
+//                  drainer merges the rings by timestamp, rebuilds each
+//                  message conversion by conversion and hands it to
+//                  logMessage().  A producer that finds its ring full
+//                  drains the rings itself rather than drop events.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/19/15
+//
+
+// Include Files
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Project Include Files
+#include <raid_log.h>
+
+// Defines
+#define RAID_LOG_MAX_EVENT 1024 // Largest single event (strings are cut to fit)
+#define RAID_LOG_MAX_TEXT (MAX_LOG_MESSAGE_SIZE - 64) // Longest text handed to logMessage(),
+                                                       // which adds its prefix in a fixed buffer
+
+// Type definitions
+typedef enum {
+	LOG_ARG_NONE    = 0, // Literal "%%"
+	LOG_ARG_INT     = 1, // int (and everything promoted to it)
+	LOG_ARG_LONG    = 2, // long
+	LOG_ARG_LLONG   = 3, // long long
+	LOG_ARG_SIZE    = 4, // size_t
+	LOG_ARG_INTMAX  = 5, // intmax_t
+	LOG_ARG_PTRDIFF = 6, // ptrdiff_t
+	LOG_ARG_DOUBLE  = 7, // double
+	LOG_ARG_PTR     = 8, // void *
+	LOG_ARG_STR     = 9, // string, copied into the event
+	LOG_ARG_BAD     = 10, // Anything else (event is formatted eagerly)
+} LOG_ARG_TYPES;
+
+typedef struct {
+	uint32_t    size;  // Event bytes, padded to 8 (0 level marks ring padding)
+	uint32_t    level; // The log level
+	uint64_t    nsec;  // When it was recorded
+	const char *fmt;   // The format (NULL if the payload is preformatted text)
+} RaidLogEvent;
+
+typedef struct {
+	uint64_t head;                     // Bytes consumed (drainer)
+	char     pad[56];                  // Keep producer and consumer apart
+	uint64_t tail;                     // Bytes produced (owning thread)
+	char     data[RAID_LOG_RING_BYTES]; // The events
+} RaidLogRing;
+
+//
+// Global data
+unsigned long raid_log_levels = ~0UL; // Levels enabled at run time
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER; // Ring list and consumers
+static RaidLogRing *log_rings[RAID_LOG_MAX_RINGS];
+static int log_nrings = 0;
+static __thread RaidLogRing *log_ring = NULL;
+static __thread int log_ring_failed = 0;
+static int log_async = 0;     // Events go to the rings (atomic)
+static int log_stopping = 0;  // The drainer should finish (atomic)
+static pthread_t log_drainer;
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_spec
+// Description  : Parse one conversion specification
+//
+// Inputs       : fmt - points at the '%', left just past the specification
+//                spec - receives the specification text (64 bytes)
+//                stars - receives the number of '*' width/precision args
+//                prec - receives the precision (-1 if none, -2 if '*')
+// Outputs      : the type of the converted argument
+
+static LOG_ARG_TYPES log_spec(const char **fmt, char *spec, int *stars, int *prec) {
+	const char *p = *fmt + 1;
+	int len = 0;
+
+	*stars = 0;
+	*prec = -1;
+	while (strchr("-+ #0'", *p) && *p) {
+		p++;
+	}
+	for (; (*p >= '0' && *p <= '9') || (*p == '*'); p++) {
+		*stars += (*p == '*');
+	}
+	if (*p == '.') {
+		if (*++p == '*') {
+			*prec = -2;
+			*stars += 1;
+			p++;
+		} else {
+			for (*prec = 0; (*p >= '0' && *p <= '9'); p++) {
+				*prec = *prec * 10 + (*p - '0');
+			}
+		}
+	}
+	if ((p[0] == 'h') || (p[0] == 'l')) {
+		len = (p[1] == p[0]) ? 2 : 1;
+		len = (p[0] == 'l') ? len : -len;
+		p += (len < 0) ? -len : len;
+	} else if ((*p == 'z') || (*p == 'j') || (*p == 't') || (*p == 'L')) {
+		len = *p++;
+	}
+	if ((*p == 0x0) || (p - *fmt >= 63)) {
+		*fmt = p;
+		return( LOG_ARG_BAD );
+	}
+	memcpy(spec, *fmt, p - *fmt + 1);
+	spec[p - *fmt + 1] = 0x0;
+	*fmt = p + 1;
+
+	switch (*p) {
+	case '%':
+		return( LOG_ARG_NONE );
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		return( (len == 1) ? LOG_ARG_LONG : (len == 2) ? LOG_ARG_LLONG : (len == 'z') ? LOG_ARG_SIZE :
+				(len == 'j') ? LOG_ARG_INTMAX : (len == 't') ? LOG_ARG_PTRDIFF :
+				(len == 'L') ? LOG_ARG_BAD : LOG_ARG_INT );
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		return( (len == 0) || (len == 1) ? LOG_ARG_DOUBLE : LOG_ARG_BAD );
+	case 'p':
+		return( LOG_ARG_PTR );
+	case 's':
+		return( (len == 0) ? LOG_ARG_STR : LOG_ARG_BAD );
+	}
+	return( LOG_ARG_BAD );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_encode
+// Description  : Pack the arguments of a message behind its event header
+//
+// Inputs       : ev - the event buffer (RAID_LOG_MAX_EVENT bytes)
+//                fmt - the format
+//                args - the arguments
+// Outputs      : the packed event size, or 0 if it must be formatted eagerly
+
+static uint32_t log_encode(char *ev, const char *fmt, va_list args) {
+	char spec[64], *p = ev + sizeof(RaidLogEvent), *end = ev + RAID_LOG_MAX_EVENT;
+	LOG_ARG_TYPES type;
+	const char *s;
+	uint64_t v;
+	uint16_t n;
+	size_t max;
+	double d;
+	int stars, prec, star = 0;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		if ((type = log_spec(&fmt, spec, &stars, &prec)) == LOG_ARG_BAD) {
+			return( 0 );
+		}
+		if (p + (stars + 1) * sizeof(v) > end) {
+			return( 0 );
+		}
+		for (; stars > 0; stars--) {
+			star = va_arg(args, int);
+			v = (uint64_t)(int64_t)star;
+			memcpy(p, &v, sizeof(v));
+			p += sizeof(v);
+		}
+		switch (type) {
+		case LOG_ARG_NONE:
+			continue;
+		case LOG_ARG_INT:
+			v = (uint64_t)(int64_t)va_arg(args, int);
+			break;
+		case LOG_ARG_LONG:
+			v = (uint64_t)va_arg(args, long);
+			break;
+		case LOG_ARG_LLONG:
+			v = (uint64_t)va_arg(args, long long);
+			break;
+		case LOG_ARG_SIZE:
+			v = (uint64_t)va_arg(args, size_t);
+			break;
+		case LOG_ARG_INTMAX:
+			v = (uint64_t)va_arg(args, intmax_t);
+			break;
+		case LOG_ARG_PTRDIFF:
+			v = (uint64_t)va_arg(args, ptrdiff_t);
+			break;
+		case LOG_ARG_DOUBLE:
+			d = va_arg(args, double);
+			memcpy(&v, &d, sizeof(v));
+			break;
+		case LOG_ARG_PTR:
+			v = (uint64_t)(uintptr_t)va_arg(args, void *);
+			break;
+		case LOG_ARG_STR:
+
+			// Only the bytes the precision allows (they may not be terminated)
+			s = va_arg(args, const char *);
+			s = (s == NULL) ? "(null)" : s;
+			max = end - p - sizeof(n);
+			prec = (prec == -2) ? star : prec;
+			if ((prec >= 0) && (prec < max)) {
+				max = prec;
+			}
+			n = (uint16_t)strnlen(s, max);
+			memcpy(p, &n, sizeof(n));
+			memcpy(p + sizeof(n), s, n);
+			p += sizeof(n) + n;
+			continue;
+		default:
+			return( 0 );
+		}
+		memcpy(p, &v, sizeof(v));
+		p += sizeof(v);
+	}
+	return( (uint32_t)((p - ev + 7) & ~7) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_decode
+// Description  : Rebuild the text of a packed event
+//
+// Inputs       : ev - the event
+//                out - the message buffer
+//                size - its size
+// Outputs      : none
+
+static void log_decode(const RaidLogEvent *ev, char *out, size_t size) {
+	const char *fmt = ev->fmt, *p = (const char *)(ev + 1), *pct;
+	char spec[64], *o = out;
+	size_t left = size;
+	LOG_ARG_TYPES type;
+	int stars, prec, st[2], i, w;
+	uint64_t v;
+	uint16_t n;
+	double d;
+
+	// Preformatted text is a single string
+	if (fmt == NULL) {
+		memcpy(&n, p, sizeof(n));
+		snprintf(out, size, "%.*s", (int)n, p + sizeof(n));
+		return;
+	}
+
+#define LOG_EMIT(val) ((stars == 0) ? snprintf(o, left, spec, val) : (stars == 1) ? \
+		snprintf(o, left, spec, st[0], val) : snprintf(o, left, spec, st[0], st[1], val))
+
+	while ((left > 1) && (*fmt != 0x0)) {
+
+		// Literal text up to the next conversion
+		pct = strchr(fmt, '%');
+		w = (pct == NULL) ? (int)strlen(fmt) : (int)(pct - fmt);
+		w = (w < left) ? w : (int)left - 1;
+		memcpy(o, fmt, w);
+		o[w] = 0x0;
+		fmt += w;
+		o += w;
+		left -= w;
+		if ((pct == NULL) || (*fmt != '%')) {
+			break;
+		}
+
+		// The conversion, against the recorded value
+		type = log_spec(&fmt, spec, &stars, &prec);
+		for (i = 0; i < stars; i++) {
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			st[i] = (int)(int64_t)v;
+		}
+		if (type == LOG_ARG_STR) {
+
+			// The recorded bytes replace any precision
+			memcpy(&n, p, sizeof(n));
+			p += sizeof(n);
+			*strpbrk(spec, ".s") = 0x0;
+			strcat(spec, ".*s");
+			stars -= (prec == -2);
+			w = (stars == 0) ? snprintf(o, left, spec, (int)n, p) :
+					snprintf(o, left, spec, st[0], (int)n, p);
+			p += n;
+		} else if (type == LOG_ARG_NONE) {
+			w = snprintf(o, left, "%%");
+		} else {
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			switch (type) {
+			case LOG_ARG_INT:     w = LOG_EMIT((int)v); break;
+			case LOG_ARG_LONG:    w = LOG_EMIT((long)v); break;
+			case LOG_ARG_LLONG:   w = LOG_EMIT((long long)v); break;
+			case LOG_ARG_SIZE:    w = LOG_EMIT((size_t)v); break;
+			case LOG_ARG_INTMAX:  w = LOG_EMIT((intmax_t)v); break;
+			case LOG_ARG_PTRDIFF: w = LOG_EMIT((ptrdiff_t)v); break;
+			case LOG_ARG_PTR:     w = LOG_EMIT((void *)(uintptr_t)v); break;
+			default:
+				memcpy(&d, &v, sizeof(d));
+				w = LOG_EMIT(d);
+				break;
+			}
+		}
+		if (w >= left) {
+			break;
+		}
+		o += w;
+		left -= w;
+	}
+#undef LOG_EMIT
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_ring_get
+// Description  : Find (or create and register) the calling thread's ring
+//
+// Inputs       : none
+// Outputs      : the ring, or NULL if none is available
+
+static RaidLogRing *log_ring_get(void) {
+	if ((log_ring != NULL) || log_ring_failed) {
+		return( log_ring );
+	}
+	pthread_mutex_lock(&log_lock);
+	if ((log_nrings < RAID_LOG_MAX_RINGS) && ((log_ring = calloc(1, sizeof(RaidLogRing))) != NULL)) {
+		log_rings[log_nrings++] = log_ring;
+	} else {
+		log_ring_failed = 1;
+	}
+	pthread_mutex_unlock(&log_lock);
+	return( log_ring );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_ring_peek
+// Description  : Return the next real event of a ring, skipping padding
+//
+// Inputs       : ring - the ring
+//                tail - the producer position snapshot
+// Outputs      : the event, or NULL if the ring is drained
+
+static RaidLogEvent *log_ring_peek(RaidLogRing *ring, uint64_t tail) {
+	RaidLogEvent *ev;
+
+	while (ring->head < tail) {
+		ev = (RaidLogEvent *)&ring->data[ring->head & (RAID_LOG_RING_BYTES-1)];
+		if (ev->level != 0) {
+			return( ev );
+		}
+		__atomic_store_n(&ring->head, ring->head + ev->size, __ATOMIC_RELEASE);
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_drain
+// Description  : The background drainer
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *log_drain(void *arg) {
+	struct timespec ts = { 0, RAID_LOG_DRAIN_USEC * 1000 };
+
+	while (!__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE)) {
+		nanosleep(&ts, NULL);
+		raid_log_flush();
+	}
+	return( NULL );
+}
+
+//
+// Interface Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_log_record
+// Description  : Record a message in the calling thread's ring, or log it
+//                directly if the drainer is not running
+//
+// Inputs       : lvl - the log level
+//                fmt - the printf-style format
+// Outputs      : none
+
+void raid_log_record(unsigned long lvl, const char *fmt, ...) {
+	char buf[RAID_LOG_MAX_EVENT];
+	RaidLogEvent *ev = (RaidLogEvent *)buf;
+	RaidLogRing *ring;
+	struct timespec ts;
+	uint64_t pos, room, head;
+	uint32_t size;
+	uint16_t n;
+	va_list args;
+
+	// Without the drainer this is just logMessage() (of text that fits it)
+	va_start(args, fmt);
+	if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE) || ((ring = log_ring_get()) == NULL)) {
+		vsnprintf(buf, RAID_LOG_MAX_TEXT, fmt, args);
+		logMessage(lvl, "%s", buf);
+		va_end(args);
+		return;
+	}
+
+	// Pack the event, formatting now only what cannot be deferred
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ev->level = (uint32_t)lvl;
+	ev->nsec = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	ev->fmt = fmt;
+	if ((size = log_encode(buf, fmt, args)) == 0) {
+		va_end(args);
+		va_start(args, fmt);
+		n = (uint16_t)vsnprintf(buf + sizeof(*ev) + sizeof(n), RAID_LOG_MAX_EVENT - sizeof(*ev) - sizeof(n), fmt, args);
+		n = (n >= RAID_LOG_MAX_EVENT - sizeof(*ev) - sizeof(n)) ? RAID_LOG_MAX_EVENT - sizeof(*ev) - sizeof(n) - 1 : n;
+		memcpy(buf + sizeof(*ev), &n, sizeof(n));
+		ev->fmt = NULL;
+		size = (sizeof(*ev) + sizeof(n) + n + 7) & ~7;
+	}
+	va_end(args);
+	ev->size = size;
+
+	// Events never wrap; pad to the end of the ring instead
+	pos = ring->tail;
+	room = RAID_LOG_RING_BYTES - (pos & (RAID_LOG_RING_BYTES-1));
+	room = (room < size) ? room : 0;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (pos + room + size - head > RAID_LOG_RING_BYTES) {
+		raid_log_flush();
+	}
+	if (room > 0) {
+		((RaidLogEvent *)&ring->data[pos & (RAID_LOG_RING_BYTES-1)])->size = (uint32_t)room;
+		((RaidLogEvent *)&ring->data[pos & (RAID_LOG_RING_BYTES-1)])->level = 0;
+		pos += room;
+	}
+	memcpy(&ring->data[pos & (RAID_LOG_RING_BYTES-1)], buf, size);
+	__atomic_store_n(&ring->tail, pos + size, __ATOMIC_RELEASE);
+
+	// Errors go out straight away in case the process is about to die
+	if (lvl & LOG_ERROR_LEVEL) {
+		raid_log_flush();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_log_start
+// Description  : Snapshot the enabled levels and start the drainer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_log_start(void) {
+	unsigned long lvl;
+
+	raid_log_levels = 0;
+	for (lvl = 1; lvl < MAX_LOG_LEVEL; lvl <<= 1) {
+		if (levelEnabled(lvl)) {
+			raid_log_levels |= lvl;
+		}
+	}
+	__atomic_store_n(&log_stopping, 0, __ATOMIC_RELEASE);
+	if (pthread_create(&log_drainer, NULL, log_drain, NULL)) {
+		return( -1 );
+	}
+	__atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_log_flush
+// Description  : Format and write every recorded event, oldest first
+//
+// Inputs       : none
+// Outputs      : none
+
+void raid_log_flush(void) {
+	char msg[MAX_LOG_MESSAGE_SIZE];
+	uint64_t tails[RAID_LOG_MAX_RINGS];
+	RaidLogEvent *ev, *next;
+	int i, nrings, which;
+
+	pthread_mutex_lock(&log_lock);
+	nrings = log_nrings;
+	for (i = 0; i < nrings; i++) {
+		tails[i] = __atomic_load_n(&log_rings[i]->tail, __ATOMIC_ACQUIRE);
+	}
+	for (;;) {
+
+		// Merge the rings on their timestamps
+		ev = NULL;
+		which = -1;
+		for (i = 0; i < nrings; i++) {
+			next = log_ring_peek(log_rings[i], tails[i]);
+			if ((next != NULL) && ((ev == NULL) || (next->nsec < ev->nsec))) {
+				ev = next;
+				which = i;
+			}
+		}
+		if (ev == NULL) {
+			break;
+		}
+		log_decode(ev, msg, RAID_LOG_MAX_TEXT);
+		logMessage(ev->level, "%s", msg);
+		__atomic_store_n(&log_rings[which]->head, log_rings[which]->head + ev->size, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_log_stop
+// Description  : Stop the drainer and flush what is left
+//
+// Inputs       : none
+// Outputs      : none
+
+void raid_log_stop(void) {
+	if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	__atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(log_drainer, NULL);
+	__atomic_store_n(&log_async, 0, __ATOMIC_RELEASE);
+	raid_log_flush();
+}
@@ -0,0 +1,68 @@
+#ifndef RAID_LOG_INCLUDED
+#define RAID_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_log.h
+//  Description   : This is the hot-path logging layer for the tagline
+//                  client.  RAID_LOG() takes the same arguments as
+//                  logMessage(), but:
+//
+//                  - levels outside RAID_LOG_COMPILED are removed at
+//                    compile time (arguments are never evaluated),
+//                  - levels disabled at run time cost one mask test, and
+//                  - once raid_log_start() has run, enabled messages are
+//                    recorded as binary events (format pointer plus raw
+//                    arguments) in a per-thread ring and formatted by a
+//                    background drainer thread.
+//
+//                  Build with e.g. LOG_FLAGS=-DRAID_LOG_COMPILED=11 (errors, warnings
+//                  and output only) to strip INFO logging entirely.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/19/15
+//
+
+// Include Files
+#include <stdarg.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+
+// Defines
+#ifndef RAID_LOG_COMPILED
+#define RAID_LOG_COMPILED (LOG_ERROR_LEVEL|LOG_WARNING_LEVEL|LOG_INFO_LEVEL|LOG_OUTPUT_LEVEL)
+#endif
+#define RAID_LOG_RING_BYTES  (64*1024) // Per-thread event ring (power of 2)
+#define RAID_LOG_MAX_RINGS   64        // Threads that can log asynchronously
+#define RAID_LOG_DRAIN_USEC  1000      // Drainer polling interval
+
+// Log a message at level lvl, as logMessage() would
+#define RAID_LOG(lvl, ...) \
+	do { \
+		if (((lvl) & RAID_LOG_COMPILED) && ((lvl) & raid_log_levels)) { \
+			raid_log_record((lvl), __VA_ARGS__); \
+		} \
+	} while (0)
+
+//
+// Global data
+extern unsigned long raid_log_levels; // Levels enabled at run time
+
+//
+// Functional Prototypes
+
+void raid_log_record(unsigned long lvl, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+	// Record (or, before raid_log_start, directly log) a message
+
+int raid_log_start(void);
+	// Snapshot the enabled levels and start the background drainer
+
+void raid_log_flush(void);
+	// Format and write every event recorded so far
+
+void raid_log_stop(void);
+	// Stop the drainer, flushing what is left
+
+#endif
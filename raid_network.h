@@ -18,10 +18,15 @@
 // Defines
 #define RAID_DEFAULT_IP "127.0.0.1"
 #define RAID_DEFAULT_PORT 19878
+#define RAID_TCP_SCHEME "tcp://"
 
 // Address information
 extern unsigned char *raid_network_address;  // Address of RAID server
 extern unsigned short raid_network_port;     // Port of RAID server
+extern char *raid_network_endpoint;          // Endpoint URI (tcp:// or shm://)
+extern uint32_t raid_bus_requested;          // Capabilities to ask for at INIT
+extern uint32_t raid_bus_capabilities;       // Capabilities granted at INIT
+extern __thread uint64_t raid_bus_ops[RAID_MAXVAL]; // Requests sent by this thread, by type
 
 //
 // Functional Prototypes
@@ -29,4 +34,7 @@ extern unsigned short raid_network_port;     // Port of RAID server
 RAIDOpCode client_raid_bus_request(RAIDOpCode op, void *buf);
     // This is the implementation of the client operation (raid_client.c)
 
+int client_raid_bus_batch(RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n);
+    // Send a vector of requests, in batch frames when the server allows it
+
 #endif
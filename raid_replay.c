@@ -0,0 +1,402 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_replay.c
+//  Description   : This is the RAID bus replayer.  It plays a bus trace
+//                  recorded with tagline_client -T back against a server,
+//                  at the original timing (optionally scaled) or as fast as
+//                  possible, and compares the latency and results it sees
+//                  with the recorded ones.  The requests go out in the
+//                  order they were sent; batch frames are sent as frames
+//                  again when the server grants batching.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/21/15
+//
+
+// Include Files
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_bus.h>
+#include <raid_network.h>
+#include <raid_trace.h>
+
+// Defines
+#define REPLAY_ARGUMENTS "hvfbza:p:e:x:"
+#define USAGE \
+	"USAGE: raid_replay [-h] [-v] [-a <ip addr>] [-p <port>] [-e <endpoint>] [-b] [-z] [-f] [-x <speed>] <bus-trace>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -a - IP address of server to connect to.\n" \
+	"    -p - port number of server to connect to.\n" \
+	"    -e - server endpoint (as for tagline_client)\n" \
+	"    -b - ask the server for batched requests (RAID_BATCH)\n" \
+	"    -z - ask the server to compress payloads on the wire (TCP only)\n" \
+	"    -f - replay as fast as possible instead of at the recorded times\n" \
+	"    -x - replay at <speed> times the recorded rate (default 1)\n" \
+	"\n" \
+	"    <bus-trace> - the trace recorded with tagline_client -T\n" \
+	"\n" \
+
+//
+// Type definitions
+typedef struct {
+	uint64_t start; // When it was sent (trace clock)
+	uint32_t first; // Its first record
+	uint32_t n;     // Its records (more than one for a batch frame)
+} ReplayRequest;
+
+typedef struct {
+	uint32_t  count;      // Requests of this type
+	uint32_t  mismatches; // Result bits that differ from the recording
+	uint32_t *recorded;   // Recorded latencies (nsec)
+	uint32_t *replayed;   // Replayed latencies (nsec)
+} ReplayStats;
+
+//
+// Global data
+static char replay_buf[2*RAID_BATCH_PAYLOAD]; // Payloads of one request or frame
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_now
+// Description  : Read the replay clock
+//
+// Inputs       : none
+// Outputs      : nsec since an arbitrary point
+
+static uint64_t replay_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return( (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_compare_request
+// Description  : Order requests by send time, then by place in the file
+//
+// Inputs       : a, b - the requests
+// Outputs      : <0, 0 or >0 as for qsort
+
+static int replay_compare_request(const void *a, const void *b) {
+	const ReplayRequest *ra = a, *rb = b;
+
+	if (ra->start != rb->start) {
+		return( (ra->start < rb->start) ? -1 : 1 );
+	}
+	return( (ra->first < rb->first) ? -1 : (ra->first > rb->first) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_compare_latency
+// Description  : Order latencies for the percentiles
+//
+// Inputs       : a, b - the latencies
+// Outputs      : <0, 0 or >0 as for qsort
+
+static int replay_compare_latency(const void *a, const void *b) {
+	uint32_t la = *(const uint32_t *)a, lb = *(const uint32_t *)b;
+
+	return( (la < lb) ? -1 : (la > lb) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_summary
+// Description  : Print the mean, median and 99th percentile of latencies
+//
+// Inputs       : lat - the latencies (nsec, sorted here)
+//                n - how many
+// Outputs      : none
+
+static void replay_summary(uint32_t *lat, uint32_t n) {
+	uint64_t sum = 0;
+	uint32_t i;
+
+	qsort(lat, n, sizeof(uint32_t), replay_compare_latency);
+	for (i = 0; i < n; i++) {
+		sum += lat[i];
+	}
+	printf("  %9.1f %9.1f %9.1f", (double)sum / n / 1000.0, lat[n/2] / 1000.0, lat[(uint64_t)n*99/100] / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_index
+// Description  : Group the records into requests (a batch frame is one
+//                request) and sort them into the order they were sent
+//
+// Inputs       : tr - the trace
+//                nreqs - the number of requests (out)
+// Outputs      : the requests, or NULL if failure
+
+static ReplayRequest *replay_index(RaidTrace *tr, uint32_t *nreqs) {
+	ReplayRequest *reqs;
+	RaidTraceRecord *rec;
+	uint32_t i, n;
+
+	if ((reqs = malloc(tr->count * sizeof(ReplayRequest) + 1)) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure allocating the replay index.");
+		return( NULL );
+	}
+	*nreqs = 0;
+	for (i = 0; i < tr->count; i += n) {
+		rec = &tr->records[i];
+		for (n = 1; (n < rec->batch) && (i + n < tr->count) &&
+				(rec[n].thread == rec->thread) && (rec[n].start == rec->start); n++);
+		reqs[*nreqs].start = rec->start;
+		reqs[*nreqs].first = i;
+		reqs[*nreqs].n = n;
+		(*nreqs)++;
+	}
+	qsort(reqs, *nreqs, sizeof(ReplayRequest), replay_compare_request);
+	return( reqs );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_trace
+// Description  : Send the recorded requests, timing each one
+//
+// Inputs       : tr - the trace
+//                speed - the rate against the recording (0 for flat out)
+//                stats - the per request type figures (out)
+// Outputs      : the number of requests replayed, or -1 if failure
+
+static long replay_trace(RaidTrace *tr, double speed, ReplayStats *stats) {
+	RAIDOpCode ops[RAID_MAX_BATCH], resps[RAID_MAX_BATCH];
+	void *bufs[RAID_MAX_BATCH];
+	ReplayRequest *reqs;
+	RaidTraceRecord *rec;
+	struct timespec due;
+	uint64_t t0, sent, when;
+	uint32_t nreqs, r, i, type, out, in, len;
+
+	if ((reqs = replay_index(tr, &nreqs)) == NULL) {
+		return( -1 );
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Replaying %u requests (%lu ops).", nreqs, (unsigned long)tr->count);
+
+	t0 = replay_now();
+	for (r = 0; r < nreqs; r++) {
+		rec = &tr->records[reqs[r].first];
+
+		// Hold the request until its (scaled) time comes round
+		if ((speed > 0) && (r > 0)) {
+			when = t0 + (uint64_t)((reqs[r].start - reqs[0].start) / speed);
+			due.tv_sec = when / 1000000000ULL;
+			due.tv_nsec = when % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+		}
+
+		// Lay out the payloads, writes first and reads after them
+		out = 0;
+		in = RAID_BATCH_PAYLOAD;
+		for (i = 0; i < reqs[r].n; i++) {
+			ops[i] = rec[i].request;
+			len = ((ops[i] >> 48) & 0xff) * (((ops[i] >> 56) == RAID_HASHBLOCK) ? sizeof(uint64_t) : RAID_BLOCK_SIZE);
+			if ((ops[i] >> 56) == RAID_WRITE) {
+				bufs[i] = &replay_buf[out];
+				memset(bufs[i], 'a' + (ops[i] & 0xf), (len == 0) ? RAID_BLOCK_SIZE : len);
+				out += len;
+			} else {
+				bufs[i] = &replay_buf[in];
+				in += len;
+			}
+		}
+
+		// Send it as it went out the first time
+		sent = replay_now();
+		if (rec->batch == 0) {
+			if ((resps[0] = client_raid_bus_request(ops[0], bufs[0])) == (RAIDOpCode)-1) {
+				RAID_LOG(LOG_ERROR_LEVEL, "RAID bus request %u failed, aborting replay.", r);
+				free(reqs);
+				return( -1 );
+			}
+		} else if (client_raid_bus_batch(ops, bufs, resps, reqs[r].n)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "RAID batch request %u failed, aborting replay.", r);
+			free(reqs);
+			return( -1 );
+		}
+		sent = replay_now() - sent;
+
+		// Match it up with the recording
+		for (i = 0; i < reqs[r].n; i++) {
+			type = ops[i] >> 56;
+			if (type >= RAID_MAXVAL) {
+				continue;
+			}
+			stats[type].recorded[stats[type].count] = rec[i].latency;
+			stats[type].replayed[stats[type].count] = (sent > UINT32_MAX) ? UINT32_MAX : (uint32_t)sent;
+			stats[type].count++;
+			if (((resps[i] ^ rec[i].response) >> 32) & 0x1) {
+				stats[type].mismatches++;
+				RAID_LOG(LOG_INFO_LEVEL, "Result of %s [0x%llx] differs (recorded 0x%llx, replayed 0x%llx)",
+						RAID_REQUEST_TYPE_LABELS[type], (unsigned long long)ops[i],
+						(unsigned long long)rec[i].response, (unsigned long long)resps[i]);
+			}
+		}
+	}
+	free(reqs);
+	return( (long)nreqs );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the RAID bus replayer
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	ReplayStats stats[RAID_MAXVAL];
+	RaidTrace trace;
+	double speed = 1.0, elapsed, span;
+	uint64_t start, first, last;
+	size_t r;
+	long nreqs = 0;
+	int ch, verbose = 0, fast = 0, i, ret = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, REPLAY_ARGUMENTS)) != -1) {
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf(stderr, USAGE);
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'f': // Flat out
+			fast = 1;
+			break;
+
+		case 'b': // Ask for batch frames
+			raid_bus_requested |= RAID_CAP_BATCH;
+			break;
+
+		case 'z': // Ask for compressed payloads
+			raid_bus_requested |= RAID_CAP_COMPRESS;
+			break;
+
+		case 'a': // Get the IP address
+			if (inet_addr(optarg) == INADDR_NONE) {
+				fprintf(stderr, "Bad IP address [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			raid_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'p': // Set the network port number
+			if (sscanf(optarg, "%hu", &raid_network_port) != 1) {
+				fprintf(stderr, "Bad port number [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'e': // Set the server endpoint
+			raid_network_endpoint = strdup(optarg);
+			break;
+
+		case 'x': // Scale the recorded timing
+			if ((sscanf(optarg, "%lf", &speed) != 1) || (speed <= 0)) {
+				fprintf(stderr, "Bad replay speed [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+			return( -1 );
+		}
+	}
+	if (optind + 1 != argc) {
+		fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+		return( -1 );
+	}
+	initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+	if (verbose) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	// Load the trace and room for the figures
+	if (raid_trace_load(argv[optind], &trace)) {
+		return( -1 );
+	}
+	memset(stats, 0x0, sizeof(stats));
+	for (i = 0; i < RAID_MAXVAL; i++) {
+		stats[i].recorded = malloc(trace.count * sizeof(uint32_t) + 1);
+		stats[i].replayed = malloc(trace.count * sizeof(uint32_t) + 1);
+		if ((stats[i].recorded == NULL) || (stats[i].replayed == NULL)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Failure allocating the replay figures.");
+			ret = -1;
+		}
+	}
+
+	// Replay it
+	start = replay_now();
+	if ((ret == 0) && ((nreqs = replay_trace(&trace, fast ? 0 : speed, stats)) == -1)) {
+		ret = -1;
+	}
+	elapsed = (replay_now() - start) / 1e9;
+
+	// Report how the replay compares with the recording
+	if (ret == 0) {
+		for (first = UINT64_MAX, last = 0, r = 0; r < trace.count; r++) {
+			first = (trace.records[r].start < first) ? trace.records[r].start : first;
+			last = (trace.records[r].start > last) ? trace.records[r].start : last;
+		}
+		span = (trace.count > 0) ? (last - first) / 1e9 : 0;
+		printf("Replayed %ld requests (%lu ops) in %.3f sec, %.0f ops/sec (recorded over %.3f sec)\n",
+				nreqs, (unsigned long)trace.count, elapsed, (elapsed > 0) ? trace.count / elapsed : 0, span);
+		printf("%-10s %8s  %29s  %29s  %10s\n", "", "", "recorded usec", "replayed usec", "");
+		printf("%-10s %8s  %9s %9s %9s  %9s %9s %9s  %10s\n", "request", "count",
+				"mean", "p50", "p99", "mean", "p50", "p99", "mismatches");
+		for (i = 0; i < RAID_MAXVAL; i++) {
+			if (stats[i].count == 0) {
+				continue;
+			}
+			printf("%-10s %8u", RAID_REQUEST_TYPE_LABELS[i], stats[i].count);
+			replay_summary(stats[i].recorded, stats[i].count);
+			replay_summary(stats[i].replayed, stats[i].count);
+			printf("  %10u\n", stats[i].mismatches);
+			if (stats[i].mismatches) {
+				ret = -1;
+			}
+		}
+	}
+
+	// Clean up
+	for (i = 0; i < RAID_MAXVAL; i++) {
+		free(stats[i].recorded);
+		free(stats[i].replayed);
+	}
+	raid_trace_free(&trace);
+	return( ret );
+}
@@ -0,0 +1,505 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_sched.c
+//  Description   : This is the RAID op scheduler (see raid_sched.h).  There
+//                  is no dispatcher thread: the thread whose chunk finishes
+//                  on the bus picks the next chunk and wakes its owner,
+//                  which sends it itself.  Without a configuration every
+//                  call goes straight to the bus client.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/23/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_network.h>
+#include <raid_elevator.h>
+#include <raid_sched.h>
+
+// Type definitions
+typedef struct sched_request {
+	RAIDOpCode           *ops;      // The requests
+	void                **bufs;     // Their payloads
+	RAIDOpCode           *resps;    // Their responses (out)
+	int                   n;        // Number of requests
+	int                   next;     // First request not sent yet
+	int                   ret;      // 0, or -1 once the bus fails
+	uint64_t              ready;    // When the next chunk could have gone
+	uint64_t              deadline; // When the next chunk is past its target (0 if none)
+	RAID_SCHED_CLASSES    cls;      // Traffic class
+	pthread_cond_t        cond;     // Signalled when a chunk is granted
+	struct sched_request *link;     // Next request of the flow
+} SchedRequest;
+
+typedef struct sched_flow {
+	SchedRequest       *head;    // Queued requests, oldest first
+	SchedRequest       *tail;
+	int64_t             deficit; // Ops the flow may still send this turn
+	uint32_t            weight;  // Share of the bus
+	uint64_t            target;  // Latency target (nsec, 0 if none)
+	struct sched_round *round;   // The round the flow is on (NULL if idle)
+	struct sched_flow  *next;    // Next flow on the round
+} SchedFlow;
+
+typedef struct sched_round {
+	SchedFlow *head; // Flows waiting, head is next
+	SchedFlow *tail;
+} SchedRound;
+
+typedef struct {
+	uint32_t first, last; // The taglines the rule covers
+	uint32_t weight;      // Their weight (0 to leave it)
+	uint64_t target;      // Their latency target (nsec, UINT64_MAX to leave it)
+} SchedRule;
+
+typedef struct {
+	uint64_t requests; // Requests scheduled
+	uint64_t chunks;   // Chunks sent
+	uint64_t late;     // Chunks sent ahead of the round (past their target or limit)
+	uint64_t wait;     // Total time chunks waited for the bus (nsec)
+	uint64_t maxwait;  // Longest wait
+} SchedStats;
+
+//
+// Global data
+int raid_sched_enabled = 0;                         // The scheduler is configured
+static uint32_t sched_quantum = RAID_SCHED_QUANTUM; // Ops per round at weight 1
+static uint32_t sched_chunk = RAID_SCHED_CHUNK;     // Most ops sent at once
+static uint64_t sched_rebuild = RAID_SCHED_REBUILD * 1000ULL; // Longest rebuild wait
+static SchedRule sched_rules[RAID_SCHED_RULES];     // Weight and target rules
+static int sched_nrules = 0;
+static SchedFlow *sched_flows = NULL;               // A flow per tagline
+static uint32_t sched_nflows = 0;
+static SchedFlow sched_background;                  // Rebuild traffic
+static SchedRound sched_new;                        // Flows that just got busy
+static SchedRound sched_old;                        // Flows that used a quantum
+static SchedRequest *sched_granted = NULL;          // Request whose chunk goes next
+static int sched_busy = 0;                          // A chunk is on the bus
+static SchedStats sched_stats[RAID_SCHED_MAXVAL];
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the above
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_now
+// Description  : Read the scheduler clock
+//
+// Inputs       : none
+// Outputs      : the time in nsec
+
+static uint64_t sched_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_parse_rule
+// Description  : Parse a weight or target value with an optional tagline
+//                range in front of it
+//
+// Inputs       : str - the value
+//                rule - the rule (out, value in weight)
+// Outputs      : 0 if successful, -1 if failure
+
+static int sched_parse_rule(const char *str, SchedRule *rule) {
+	unsigned int first, last, value;
+	char extra;
+
+	if (sscanf(str, "%u-%u:%u%c", &first, &last, &value, &extra) == 3) {
+		rule->first = first;
+		rule->last = last;
+	} else if (sscanf(str, "%u:%u%c", &first, &value, &extra) == 2) {
+		rule->first = rule->last = first;
+	} else if (sscanf(str, "%u%c", &value, &extra) == 1) {
+		rule->first = 0;
+		rule->last = UINT32_MAX;
+	} else {
+		return( -1 );
+	}
+	rule->weight = value;
+	return( (rule->first <= rule->last) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_round_add
+// Description  : Put a flow at the back of a round (sched_lock held)
+//
+// Inputs       : round - the round
+//                flow - the flow (on no round)
+// Outputs      : none
+
+static void sched_round_add(SchedRound *round, SchedFlow *flow) {
+	flow->next = NULL;
+	flow->round = round;
+	if (round->tail != NULL) {
+		round->tail->next = flow;
+	} else {
+		round->head = flow;
+	}
+	round->tail = flow;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_round_remove
+// Description  : Take a flow off its round (sched_lock held)
+//
+// Inputs       : flow - the flow
+// Outputs      : none
+
+static void sched_round_remove(SchedFlow *flow) {
+	SchedRound *round = flow->round;
+	SchedFlow **f, *prev = NULL;
+
+	for (f = &round->head; *f != NULL; prev = *f, f = &(*f)->next) {
+		if (*f == flow) {
+			*f = flow->next;
+			if (round->tail == flow) {
+				round->tail = prev;
+			}
+			break;
+		}
+	}
+	flow->next = NULL;
+	flow->round = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_pick
+// Description  : Choose the request whose chunk goes next (sched_lock held).
+//                Flows that just got busy (a small read, typically) go
+//                before the flows already round, until they have used a
+//                quantum; that keeps sparse taglines quick while the busy
+//                ones share the rest by their weights.
+//
+// Inputs       : now - the time
+//                late - set if it goes ahead of the rounds (out)
+// Outputs      : the request, or NULL if nothing is queued
+
+static SchedRequest *sched_pick(uint64_t now, int *late) {
+	SchedRound *rounds[2] = { &sched_new, &sched_old };
+	SchedFlow *f, *best = NULL;
+	int64_t cost;
+	int r;
+
+	// Foreground chunks past their latency target, earliest first
+	*late = 1;
+	for (r = 0; r < 2; r++) {
+		for (f = rounds[r]->head; f != NULL; f = f->next) {
+			if ((f->head != NULL) && f->head->deadline && (f->head->deadline <= now) &&
+					((best == NULL) || (f->head->deadline < best->head->deadline))) {
+				best = f;
+			}
+		}
+	}
+	if (best != NULL) {
+		cost = best->head->n - best->head->next;
+		best->deficit -= (cost < sched_chunk) ? cost : sched_chunk;
+		return( best->head );
+	}
+
+	// Rebuild traffic when no tagline waits, or once it has waited too long
+	for (f = sched_old.head; (f != NULL) && (f->head == NULL); f = f->next);
+	if ((sched_background.head != NULL) && (((sched_new.head == NULL) && (f == NULL)) ||
+			(now - sched_background.head->ready >= sched_rebuild))) {
+		*late = (sched_new.head != NULL) || (f != NULL);
+		return( sched_background.head );
+	}
+
+	// Deficit round-robin over the taglines waiting
+	*late = 0;
+	while ((f = (sched_new.head != NULL) ? sched_new.head : sched_old.head) != NULL) {
+		if (f->head == NULL) {
+			sched_round_remove(f);
+			continue;
+		}
+		cost = f->head->n - f->head->next;
+		cost = (cost < sched_chunk) ? cost : sched_chunk;
+		if (f->deficit >= cost) {
+			f->deficit -= cost;
+			return( f->head );
+		}
+
+		// Out of quantum, to the back of the old round with another
+		sched_round_remove(f);
+		f->deficit += (int64_t)sched_quantum * f->weight;
+		sched_round_add(&sched_old, f);
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sched_grant
+// Description  : Hand the bus to the next chunk, if any (sched_lock held,
+//                bus idle)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sched_grant(void) {
+	SchedStats *st;
+	uint64_t now = sched_now(), wait;
+	int late;
+
+	if ((sched_granted = sched_pick(now, &late)) != NULL) {
+		st = &sched_stats[sched_granted->cls];
+		wait = now - sched_granted->ready;
+		st->chunks++;
+		st->late += late;
+		st->wait += wait;
+		st->maxwait = (wait > st->maxwait) ? wait : st->maxwait;
+		pthread_cond_signal(&sched_granted->cond);
+	}
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_sched_configure
+// Description  : Turn the scheduler on with a configuration
+//
+// Inputs       : spec - the configuration (see raid_sched.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_sched_configure(const char *spec) {
+	SchedRule rule;
+	char *copy, *field, *save;
+	unsigned int value;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if (strncmp(field, "quantum=", 8) == 0) {
+			ret = ((sscanf(field + 8, "%u%c", &value, &extra) == 1) && (value > 0)) ? 0 : -1;
+			sched_quantum = value;
+		} else if (strncmp(field, "chunk=", 6) == 0) {
+			ret = ((sscanf(field + 6, "%u%c", &value, &extra) == 1) && (value > 0)) ? 0 : -1;
+			sched_chunk = value;
+		} else if (strncmp(field, "rebuild=", 8) == 0) {
+			ret = (sscanf(field + 8, "%u%c", &value, &extra) == 1) ? 0 : -1;
+			sched_rebuild = value * 1000ULL;
+		} else if ((strncmp(field, "weight=", 7) == 0) || (strncmp(field, "target=", 7) == 0)) {
+			if ((sched_nrules == RAID_SCHED_RULES) || sched_parse_rule(field + 7, &rule) ||
+					((field[0] == 'w') && (rule.weight == 0))) {
+				ret = -1;
+			} else {
+				if (field[0] == 't') {
+					rule.target = rule.weight * 1000ULL;
+					rule.weight = 0;
+				} else {
+					rule.target = UINT64_MAX;
+				}
+				sched_rules[sched_nrules++] = rule;
+			}
+		} else {
+			ret = -1;
+		}
+		if (ret) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad scheduler field [%s]", field);
+		}
+	}
+	free(copy);
+	raid_sched_enabled = (ret == 0);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_sched_init
+// Description  : Create the queues, a flow per tagline
+//
+// Inputs       : flows - the number of taglines
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_sched_init(uint32_t flows) {
+	uint32_t i;
+	int r;
+
+	if (!raid_sched_enabled) {
+		return( 0 );
+	}
+	free(sched_flows);
+	if ((sched_flows = calloc((flows > 0) ? flows : 1, sizeof(SchedFlow))) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure allocating the scheduler queues.");
+		return( -1 );
+	}
+	sched_nflows = (flows > 0) ? flows : 1;
+	for (i = 0; i < sched_nflows; i++) {
+		sched_flows[i].weight = 1;
+		for (r = 0; r < sched_nrules; r++) {
+			if ((i >= sched_rules[r].first) && (i <= sched_rules[r].last)) {
+				sched_flows[i].weight = (sched_rules[r].weight) ? sched_rules[r].weight : sched_flows[i].weight;
+				sched_flows[i].target = (sched_rules[r].target != UINT64_MAX) ? sched_rules[r].target : sched_flows[i].target;
+			}
+		}
+	}
+	memset(&sched_background, 0x0, sizeof(sched_background));
+	memset(sched_stats, 0x0, sizeof(sched_stats));
+	memset(&sched_new, 0x0, sizeof(sched_new));
+	memset(&sched_old, 0x0, sizeof(sched_old));
+	RAID_LOG(LOG_INFO_LEVEL, "SCHED: %u flows, quantum %u ops, chunks of %u ops", sched_nflows, sched_quantum, sched_chunk);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_sched_batch
+// Description  : Queue a vector of requests on a flow and send it a chunk
+//                at a time as the scheduler grants the bus
+//
+// Inputs       : flow - the tagline (ignored for background traffic)
+//                cls - the traffic class
+//                ops - the request opcodes
+//                bufs - the per-request payload buffers (NULL if none)
+//                resps - the response opcodes (out)
+//                n - the number of requests
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_sched_batch(uint32_t flow, RAID_SCHED_CLASSES cls, RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n) {
+	SchedRequest req;
+	SchedFlow *f;
+	int chunk, ret;
+
+	if (!raid_sched_enabled || (sched_flows == NULL) || (n <= 0)) {
+		return( raid_elevator_batch(ops, bufs, resps, n) );
+	}
+
+	// Join the flow's queue, and its flow the round
+	memset(&req, 0x0, sizeof(req));
+	req.ops = ops;
+	req.bufs = bufs;
+	req.resps = resps;
+	req.n = n;
+	req.cls = cls;
+	pthread_cond_init(&req.cond, NULL);
+	pthread_mutex_lock(&sched_lock);
+	f = (cls == RAID_SCHED_BACKGROUND) ? &sched_background : &sched_flows[flow % sched_nflows];
+	req.ready = sched_now();
+	req.deadline = (f->target) ? req.ready + f->target : 0;
+	if (f->tail != NULL) {
+		f->tail->link = &req;
+	} else {
+		f->head = &req;
+	}
+	f->tail = &req;
+	if ((cls == RAID_SCHED_FOREGROUND) && (f->round == NULL)) {
+		f->deficit = (int64_t)sched_quantum * f->weight;
+		sched_round_add(&sched_new, f);
+	}
+	sched_stats[cls].requests++;
+	if (!sched_busy && (sched_granted == NULL)) {
+		sched_grant();
+	}
+
+	// Send a chunk each time one is granted
+	while (req.next < req.n) {
+		while (sched_granted != &req) {
+			pthread_cond_wait(&req.cond, &sched_lock);
+		}
+		sched_granted = NULL;
+		sched_busy = 1;
+		chunk = (req.n - req.next < sched_chunk) ? req.n - req.next : sched_chunk;
+		pthread_mutex_unlock(&sched_lock);
+
+		ret = raid_elevator_batch(&ops[req.next], &bufs[req.next], &resps[req.next], chunk);
+
+		pthread_mutex_lock(&sched_lock);
+		sched_busy = 0;
+		req.next = (ret) ? req.n : req.next + chunk;
+		req.ret = (ret) ? -1 : req.ret;
+		req.ready = sched_now();
+		req.deadline = (f->target) ? req.ready + f->target : 0;
+
+		// Done, leave the queue; a flow that runs dry stays on the old
+		// round until its turn comes, so it cannot count as new again
+		// by sending its requests one at a time
+		if (req.next >= req.n) {
+			f->head = req.link;
+			if (f->head == NULL) {
+				f->tail = NULL;
+				if (f->round == &sched_new) {
+					sched_round_remove(f);
+					sched_round_add(&sched_old, f);
+				}
+			}
+		}
+		sched_grant();
+	}
+	pthread_mutex_unlock(&sched_lock);
+	pthread_cond_destroy(&req.cond);
+	return( req.ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_sched_request
+// Description  : Send one request on a flow when the scheduler allows it
+//
+// Inputs       : flow - the tagline (ignored for background traffic)
+//                cls - the traffic class
+//                op - the request opcode
+//                buf - the request payload (NULL if none)
+// Outputs      : the response opcode, or -1 if failure
+
+RAIDOpCode raid_sched_request(uint32_t flow, RAID_SCHED_CLASSES cls, RAIDOpCode op, void *buf) {
+	RAIDOpCode resp;
+
+	if (!raid_sched_enabled || (sched_flows == NULL)) {
+		return( client_raid_bus_request(op, buf) );
+	}
+	return( raid_sched_batch(flow, cls, &op, &buf, &resp, 1) ? (RAIDOpCode)-1 : resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_sched_close
+// Description  : Log the scheduling figures and release the queues
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_sched_close(void) {
+	const char *labels[RAID_SCHED_MAXVAL] = { "foreground", "background" };
+	SchedStats *st;
+	int i;
+
+	if (!raid_sched_enabled || (sched_flows == NULL)) {
+		return( 0 );
+	}
+	for (i = 0; i < RAID_SCHED_MAXVAL; i++) {
+		st = &sched_stats[i];
+		if (st->requests == 0) {
+			continue;
+		}
+		RAID_LOG(LOG_INFO_LEVEL, "SCHED: %s %llu requests in %llu chunks, %llu ahead of the round, "
+				"mean wait %.1f usec, max %.1f usec", labels[i], (unsigned long long)st->requests,
+				(unsigned long long)st->chunks, (unsigned long long)st->late,
+				(st->chunks) ? st->wait / 1000.0 / st->chunks : 0.0, st->maxwait / 1000.0);
+	}
+	free(sched_flows);
+	sched_flows = NULL;
+	sched_nflows = 0;
+	return( 0 );
+}
@@ -0,0 +1,75 @@
+#ifndef RAID_SCHED_INCLUDED
+#define RAID_SCHED_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_sched.h
+//  Description   : This is the RAID op scheduler that sits between the
+//                  tagline driver and the bus client (through the
+//                  elevator, raid_elevator.h).  Once configured
+//                  (tagline_client -Q), the reads and writes of every
+//                  tagline queue on their own flow, and the bus is handed
+//                  out a chunk of ops at a time by deficit round-robin
+//                  over the flows, so a 255 block write cannot hold it
+//                  while small reads of other taglines wait.  A flow gets
+//                  quantum * weight ops per round, and a chunk that has
+//                  waited past its flow's latency target goes ahead of the
+//                  round.  Rebuild traffic is background: it only goes
+//                  when no tagline is waiting, or once it has waited the
+//                  rebuild limit.  The configuration is comma separated:
+//
+//                    quantum=<ops>              ops per round at weight 1 (32)
+//                    chunk=<ops>                most ops sent at once (32)
+//                    weight=[<tags>:]<w>        weight of taglines (1)
+//                    target=[<tags>:]<usec>     longest wait of a chunk (none)
+//                    rebuild=<usec>             longest rebuild wait (100000)
+//
+//                  where <tags> is a tagline or a range <first>-<last>,
+//                  and the last rule for a tagline wins.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/23/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_SCHED_QUANTUM 32     // Default ops per round at weight 1
+#define RAID_SCHED_CHUNK   32     // Default most ops sent at once
+#define RAID_SCHED_REBUILD 100000 // Default longest rebuild wait (usec)
+#define RAID_SCHED_RULES   64     // Most weight and target rules
+
+// Type definitions
+typedef enum {
+	RAID_SCHED_FOREGROUND = 0, // Tagline reads and writes
+	RAID_SCHED_BACKGROUND = 1, // Disk rebuild traffic
+	RAID_SCHED_MAXVAL     = 2, // Max value
+} RAID_SCHED_CLASSES;
+
+//
+// Global data
+extern int raid_sched_enabled; // The scheduler is configured
+
+//
+// Functional Prototypes
+
+int raid_sched_configure(const char *spec);
+	// Turn the scheduler on with a configuration (before raid_sched_init)
+
+int raid_sched_init(uint32_t flows);
+	// Create the queues for flows taglines
+
+int raid_sched_batch(uint32_t flow, RAID_SCHED_CLASSES cls, RAIDOpCode *ops, void **bufs, RAIDOpCode *resps, int n);
+	// Send a vector of requests on a flow when the scheduler allows it
+
+RAIDOpCode raid_sched_request(uint32_t flow, RAID_SCHED_CLASSES cls, RAIDOpCode op, void *buf);
+	// Send one request on a flow when the scheduler allows it
+
+int raid_sched_close(void);
+	// Log the scheduling figures and release the queues (no requests queued)
+
+#endif
@@ -0,0 +1,590 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_server.c
+//  Description   : This is the RAID server.  It serves the raid_bus.h
+//                  protocol over TCP (and over the shared-memory ring for
+//                  co-located clients) from the RAID array engine.  Each
+//                  worker thread owns a SO_REUSEPORT listener and an epoll
+//                  set, so accepts and requests are spread across cores;
+//                  requests are buffered so pipelined clients get their
+//                  responses coalesced into as few writes as possible.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/18/15
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <raid_array.h>
+#include <raid_network.h>
+#include <raid_shm.h>
+#include <raid_compress.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define RAID_SERVER_ARGUMENTS "hvDl:p:t:d:s:"
+#define USAGE \
+	"USAGE: raid_server [-h] [-v] [-l <logfile>] [-p <port>] [-t <threads>] [-d <image dir> [-D]] [-s <shm socket>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on (default 19878)\n" \
+	"    -t - number of worker threads (default one per core)\n" \
+	"    -d - keep disks in mmap'd image files in <image dir> (default memory)\n" \
+	"    -D - access the image files with O_DIRECT instead of mmap\n" \
+	"    -s - also accept shared-memory ring clients on <shm socket>\n" \
+	"\n"
+#define RAID_SERVER_HDR      (2*sizeof(uint64_t))                      // Opcode plus length
+#define RAID_SERVER_PAYLOAD  (RAID_MAX_BATCH*sizeof(uint64_t) + RAID_BATCH_PAYLOAD) // Max payload
+#define RAID_SERVER_WIRE     RAID_COMPRESS_BOUND(RAID_SERVER_PAYLOAD)  // Max payload on the wire
+#define RAID_SERVER_FRAME    (RAID_SERVER_HDR + RAID_SERVER_WIRE)      // Max frame
+#define RAID_SERVER_BUFSZ    (2*RAID_SERVER_FRAME)                     // Per-connection buffers
+#define RAID_SERVER_EVENTS   64                                        // Events per epoll_wait
+
+// Type definitions
+typedef struct {
+	int      fd;       // The client socket
+	char    *in;       // Buffered request bytes
+	uint32_t inoff;    // First unprocessed request byte
+	uint32_t inlen;    // End of the buffered request bytes
+	char    *out;      // Pending response bytes
+	uint32_t outoff;   // First unsent response byte
+	uint32_t outlen;   // End of the pending response bytes
+	int      closing;  // Close once the output drains (after RAID_CLOSE)
+	int      compress; // Payloads are compressed (RAID_CAP_COMPRESS granted)
+	char    *scratch;  // Decoded payload staging (compressed clients only)
+	RaidCompressStats stats; // Bytes on the wire and codec time
+} RaidConnection;
+
+//
+// Global Data
+RaidArray raid_array;                 // The array being served
+volatile sig_atomic_t server_stop = 0; // Set by the signal handler
+unsigned short server_port = RAID_DEFAULT_PORT;
+
+//
+// Functional Prototypes
+
+int raid_server_worker_listen(void);
+void *raid_server_worker(void *arg);
+void *raid_server_shm_acceptor(void *arg);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_server_signal
+// Description  : Ask the workers to stop
+//
+// Inputs       : sig - the signal received
+// Outputs      : none
+
+static void raid_server_signal(int sig) {
+	server_stop = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the RAID server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	int ch, i, log_initialized = 0, verbose = 0, direct = 0, threads = 0;
+	char *dir = NULL, *shm_path = NULL;
+	struct sigaction sa;
+	pthread_t *workers, shm_thread;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, RAID_SERVER_ARGUMENTS)) != -1) {
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf(stderr, USAGE);
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename(optarg);
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if (sscanf(optarg, "%hu", &server_port) != 1) {
+				fprintf(stderr, "Bad port number [%s]\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 't': // Set the number of workers
+			if ((sscanf(optarg, "%d", &threads) != 1) || (threads <= 0)) {
+				fprintf(stderr, "Bad thread count [%s]\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'd': // Disk image directory
+			dir = optarg;
+			break;
+
+		case 'D': // Direct I/O on the images
+			direct = 1;
+			break;
+
+		case 's': // Shared memory ring socket
+			shm_path = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if (! log_initialized) {
+		initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+	}
+	if (verbose) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	if (direct && (dir == NULL)) {
+		fprintf(stderr, "Direct I/O (-D) needs an image directory (-d), aborting.\n");
+		return( -1 );
+	}
+	if (threads == 0) {
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (threads > 0) ? threads : 1;
+	}
+
+	// Stop cleanly on interrupt so image mappings are flushed
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = raid_server_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Create the array, then start the workers
+	if (raid_array_create(&raid_array, dir, direct)) {
+		logMessage(LOG_ERROR_LEVEL, "RAID server failed to create the array, aborting.");
+		return( -1 );
+	}
+	if (shm_path != NULL) {
+		if (pthread_create(&shm_thread, NULL, raid_server_shm_acceptor, shm_path)) {
+			logMessage(LOG_ERROR_LEVEL, "RAID server failed to start the shm acceptor.");
+			return( -1 );
+		}
+		pthread_detach(shm_thread);
+	}
+	workers = malloc(threads * sizeof(pthread_t));
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i], NULL, raid_server_worker, NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "RAID server failed to start worker %d.", i);
+			return( -1 );
+		}
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "RAID server listening on port %u (%d workers)", server_port, threads);
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	// Clean up and leave
+	free(workers);
+	logMessage(LOG_INFO_LEVEL, "RAID server did %llu disk transfers, %llu of them seeks.",
+			(unsigned long long)raid_array.transfers, (unsigned long long)raid_array.seeks);
+	raid_array_destroy(&raid_array);
+	logMessage(LOG_OUTPUT_LEVEL, "RAID server shut down.");
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_server_worker_listen
+// Description  : Create this worker's listener, the kernel spreads incoming
+//                connections over all of the SO_REUSEPORT listeners
+//
+// Inputs       : none
+// Outputs      : the listening descriptor, -1 if failure
+
+int raid_server_worker_listen(void) {
+	struct sockaddr_in saddr;
+	int lfd, one = 1;
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(server_port);
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (((lfd = socket(PF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) == -1) ||
+			(setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) ||
+			(setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) ||
+			(bind(lfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) ||
+			(listen(lfd, 128) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "RAID server listen on port %u failed [%s]", server_port, strerror(errno));
+		if (lfd != -1) {
+			close(lfd);
+		}
+		return( -1 );
+	}
+	return( lfd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_connection_close
+// Description  : Tear down a client connection
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+static void server_connection_close(RaidConnection *conn) {
+	if (conn->compress) {
+		raid_compress_log_stats("RAID server", &conn->stats);
+	}
+	close(conn->fd);
+	free(conn->in);
+	free(conn->out);
+	free(conn->scratch);
+	free(conn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_connection_flush
+// Description  : Write as much pending response data as the socket takes
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if drained, 1 if data is still pending, -1 if failure
+
+static int server_connection_flush(RaidConnection *conn) {
+	ssize_t wb;
+
+	while (conn->outoff < conn->outlen) {
+		wb = write(conn->fd, conn->out + conn->outoff, conn->outlen - conn->outoff);
+		if (wb == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return( ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 1 : -1 );
+		}
+		conn->outoff += wb;
+	}
+	conn->outoff = conn->outlen = 0;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_connection_process
+// Description  : Execute every complete request in the input buffer while
+//                there is room to stage its response
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the client sent a bad frame
+
+static int server_connection_process(RaidConnection *conn) {
+	uint64_t hdr[2];
+	RAIDOpCode op, resp;
+	uint32_t plen, rlen, vec;
+	char *payload, *rbuf;
+
+	while (conn->inlen - conn->inoff >= RAID_SERVER_HDR) {
+
+		// Wait for the whole frame
+		memcpy(hdr, conn->in + conn->inoff, sizeof(hdr));
+		op = ntohll64(hdr[0]);
+		if (ntohll64(hdr[1]) > RAID_SERVER_WIRE) {
+			logMessage(LOG_ERROR_LEVEL, "RAID server bad request length [%llu]",
+					(unsigned long long)ntohll64(hdr[1]));
+			return( -1 );
+		}
+		plen = (uint32_t)ntohll64(hdr[1]);
+		if (conn->inlen - conn->inoff < RAID_SERVER_HDR + plen) {
+			break;
+		}
+
+		// Stage the response behind any others still queued
+		if (RAID_SERVER_BUFSZ - conn->outlen < RAID_SERVER_FRAME) {
+			if ((server_connection_flush(conn) == -1) ||
+					(RAID_SERVER_BUFSZ - conn->outlen < RAID_SERVER_FRAME)) {
+				break;
+			}
+		}
+		payload = conn->in + conn->inoff + RAID_SERVER_HDR;
+		rbuf = conn->out + conn->outlen + RAID_SERVER_HDR;
+		conn->inoff += RAID_SERVER_HDR + plen;
+
+		// Decode a compressed payload into the staging area first
+		if (conn->compress && (plen > 0)) {
+			vec = raid_compress_vector(op, plen);
+			memcpy(conn->scratch, payload, vec);
+			if (raid_decompress_payload(payload + vec, plen - vec, conn->scratch + vec,
+					RAID_SERVER_PAYLOAD - vec, &plen, &conn->stats)) {
+				logMessage(LOG_ERROR_LEVEL, "RAID server malformed compressed payload");
+				return( -1 );
+			}
+			payload = conn->scratch;
+			plen += vec;
+		}
+		rlen = RAID_SERVER_PAYLOAD;
+		resp = raid_array_execute(&raid_array, op, payload, plen, rbuf, &rlen);
+
+		// The TCP front end grants (and offers) compression on top of what
+		// the array does
+		if (((op >> 56) & 0xff) == RAID_INIT) {
+			conn->compress = 0;
+			if (((op >> RAID_CAP_SHIFT) & 0x7f) == 0) {
+				resp |= (resp & RAID_OPCODE_RESULT) ? 0 : RAID_CAP_COMPRESS;
+			} else if (((op >> RAID_CAP_SHIFT) & RAID_CAP_COMPRESS) && !(resp & RAID_OPCODE_RESULT) &&
+					((conn->scratch != NULL) || ((conn->scratch = malloc(RAID_SERVER_PAYLOAD)) != NULL))) {
+				resp |= RAID_CAP_COMPRESS;
+				conn->compress = 1;
+			}
+		} else if (conn->compress && (rlen > 0)) {
+			vec = raid_compress_vector(resp, rlen);
+			memcpy(conn->scratch, rbuf + vec, rlen - vec);
+			rlen = vec + raid_compress_payload(conn->scratch, rlen - vec, rbuf + vec, &conn->stats);
+		}
+		hdr[0] = htonll64(resp);
+		hdr[1] = htonll64(rlen);
+		memcpy(conn->out + conn->outlen, hdr, sizeof(hdr));
+		conn->outlen += RAID_SERVER_HDR + rlen;
+		if (((op >> 56) & 0xff) == RAID_CLOSE) {
+			conn->closing = 1;
+			break;
+		}
+	}
+
+	// Slide any partial frame to the front of the buffer
+	if (conn->inoff > 0) {
+		memmove(conn->in, conn->in + conn->inoff, conn->inlen - conn->inoff);
+		conn->inlen -= conn->inoff;
+		conn->inoff = 0;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_connection_service
+// Description  : Handle readiness on a connection: drain output, read and
+//                process requests, then flush the coalesced responses
+//
+// Inputs       : conn - the connection
+//                epfd - the worker's epoll set
+// Outputs      : 0 if the connection stays open, -1 if it should be closed
+
+static int server_connection_service(RaidConnection *conn, int epfd) {
+	struct epoll_event ev;
+	ssize_t rb;
+	int pending;
+
+	// Finish any earlier responses before taking more work
+	if ((pending = server_connection_flush(conn)) == -1) {
+		return( -1 );
+	}
+
+	// Read whatever has arrived and work through it
+	while (!pending && !conn->closing && (conn->inlen < RAID_SERVER_BUFSZ)) {
+		rb = read(conn->fd, conn->in + conn->inlen, RAID_SERVER_BUFSZ - conn->inlen);
+		if (rb == 0) {
+			return( -1 );
+		}
+		if (rb == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				return( -1 );
+			}
+			break;
+		}
+		conn->inlen += rb;
+		if (server_connection_process(conn)) {
+			return( -1 );
+		}
+		if ((pending = server_connection_flush(conn)) == -1) {
+			return( -1 );
+		}
+	}
+	if (!pending && (conn->inlen > 0) && !conn->closing) {
+		if (server_connection_process(conn) || ((pending = server_connection_flush(conn)) == -1)) {
+			return( -1 );
+		}
+	}
+	if (conn->closing && !pending) {
+		return( -1 );
+	}
+
+	// Only wait for writability while responses are backed up
+	ev.events = pending ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = conn;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_server_worker
+// Description  : The per-core worker, accepting and serving its own clients
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *raid_server_worker(void *arg) {
+	struct epoll_event ev, evs[RAID_SERVER_EVENTS];
+	RaidConnection *conn;
+	int lfd, epfd, cfd, n, i, one = 1;
+
+	if (((lfd = raid_server_worker_listen()) == -1) || ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)) {
+		server_stop = 1;
+		return( NULL );
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	while (!server_stop) {
+		if ((n = epoll_wait(epfd, evs, RAID_SERVER_EVENTS, 500)) == -1) {
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+
+			// New clients
+			if (evs[i].data.ptr == NULL) {
+				while ((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) != -1) {
+					setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+					conn = calloc(1, sizeof(RaidConnection));
+					conn->fd = cfd;
+					conn->in = malloc(RAID_SERVER_BUFSZ);
+					conn->out = malloc(RAID_SERVER_BUFSZ);
+					ev.events = EPOLLIN;
+					ev.data.ptr = conn;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+					logMessage(LOG_INFO_LEVEL, "RAID server accepted client on handle %d", cfd);
+				}
+				continue;
+			}
+
+			// Client traffic
+			conn = evs[i].data.ptr;
+			if (server_connection_service(conn, epfd)) {
+				logMessage(LOG_INFO_LEVEL, "RAID server closing client on handle %d", conn->fd);
+				epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+				server_connection_close(conn);
+			}
+		}
+	}
+
+	close(epfd);
+	close(lfd);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_shm_handler
+// Description  : Execute a ring request against the array.  Batch responses
+//                would overwrite write payloads still to be consumed, so
+//                they are built aside and copied back into the slot.
+//
+// Inputs       : op - the request opcode
+//                buf - the payload slot
+//                len - the request length in, the response length out
+//                arg - unused
+// Outputs      : the response opcode
+
+static RAIDOpCode server_shm_handler(RAIDOpCode op, void *buf, uint32_t *len, void *arg) {
+	static __thread char *scratch = NULL;
+	RAIDOpCode resp;
+	uint32_t rlen = RAID_SERVER_PAYLOAD;
+
+	if (((op >> 56) & 0xff) != RAID_BATCH) {
+		resp = raid_array_execute(&raid_array, op, buf, *len, buf, &rlen);
+	} else {
+		if ((scratch == NULL) && ((scratch = malloc(RAID_SERVER_PAYLOAD)) == NULL)) {
+			*len = 0;
+			return( op | RAID_OPCODE_RESULT );
+		}
+		resp = raid_array_execute(&raid_array, op, buf, *len, scratch, &rlen);
+		memcpy(buf, scratch, rlen);
+	}
+	*len = rlen;
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_shm_client
+// Description  : Serve one attached ring until its client goes away
+//
+// Inputs       : arg - the attached ring
+// Outputs      : NULL
+
+static void *server_shm_client(void *arg) {
+	RaidShmRing *ring = arg;
+
+	raid_shm_serve(ring, server_shm_handler, NULL);
+	raid_shm_release(ring);
+	free(ring);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_server_shm_acceptor
+// Description  : Accept shared-memory ring clients, one thread per ring
+//
+// Inputs       : arg - the control socket path
+// Outputs      : NULL
+
+void *raid_server_shm_acceptor(void *arg) {
+	RaidShmRing *ring;
+	pthread_t tid;
+	int lfd;
+
+	if ((lfd = raid_shm_listen((char *)arg)) == -1) {
+		return( NULL );
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "RAID server accepting shm rings on [%s]", (char *)arg);
+	while (!server_stop) {
+		ring = malloc(sizeof(RaidShmRing));
+		if (raid_shm_accept(lfd, ring)) {
+			free(ring);
+			continue;
+		}
+		if (pthread_create(&tid, NULL, server_shm_client, ring)) {
+			raid_shm_release(ring);
+			free(ring);
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	close(lfd);
+	return( NULL );
+}
@@ -0,0 +1,496 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_shm.c
+//  Description   : This is the shared-memory ring transport for the RAID
+//                  protocol.  Requests and responses are exchanged through
+//                  a submission and completion ring in a memfd mapped by
+//                  both processes; payloads stay in the per-entry slots so
+//                  nothing crosses the kernel after the ring is attached.
+//                  Waiters spin adaptively and then sleep on a futex.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/14/15
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// Project Include Files
+#include <raid_shm.h>
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+
+// Defines
+#define RAID_SHM_MASK (RAID_SHM_SLOTS-1)
+#if defined(__x86_64__) || defined(__i386__)
+#define RAID_SHM_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define RAID_SHM_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+// Global data
+static RaidShmRing client_ring = { NULL, NULL, 0, -1, -1, RAID_SHM_SPIN_MIN };
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_futex_wait
+// Description  : Sleep while the futex word still holds the expected value
+//
+// Inputs       : addr - the futex word
+//                val - the value observed before sleeping
+//                msec - the timeout in milliseconds (-1 for none)
+// Outputs      : 0 if woken, -1 on timeout or spurious return
+
+static int shm_futex_wait(uint32_t *addr, uint32_t val, int msec) {
+	struct timespec ts;
+
+	ts.tv_sec = msec / 1000;
+	ts.tv_nsec = (msec % 1000) * 1000000L;
+	return( syscall(SYS_futex, addr, FUTEX_WAIT, val, (msec < 0) ? NULL : &ts, NULL, 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_spin_budget
+// Description  : Pick the initial spin budget, spinning only pays when the
+//                peer can run on another CPU at the same time
+//
+// Inputs       : none
+// Outputs      : the initial number of spin iterations
+
+static uint32_t shm_spin_budget(void) {
+	return( (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RAID_SHM_SPIN_MIN : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_publish
+// Description  : Produce an entry on one side of the ring and wake the
+//                consumer if it went to sleep
+//
+// Inputs       : q - the queue to produce on
+//                e - the entry to publish
+// Outputs      : none
+
+static void shm_publish(RaidShmQueue *q, RaidShmEntry *e) {
+	uint32_t tail = q->tail;
+
+	q->entries[tail & RAID_SHM_MASK] = *e;
+	__atomic_store_n(&q->tail, tail+1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&q->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->waiting, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &q->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_consume
+// Description  : Consume the next entry of a queue, spinning for up to the
+//                ring's adaptive budget before sleeping on the futex.  The
+//                budget doubles when spinning paid off and halves otherwise.
+//
+// Inputs       : ring - the ring the queue belongs to
+//                q - the queue to consume from
+//                e - the entry consumed (out)
+//                msec - the maximum time to sleep (-1 for none)
+// Outputs      : 0 if an entry was consumed, 1 on timeout
+
+static int shm_consume(RaidShmRing *ring, RaidShmQueue *q, RaidShmEntry *e, int msec) {
+	uint32_t head = q->head, seq, i;
+
+	// Spin first, the server normally answers within the budget (a
+	// zero budget means a uniprocessor where spinning can never win)
+	for (i = 0; i < ring->spin; i++) {
+		if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) != head) {
+			if (ring->spin < RAID_SHM_SPIN_MAX) {
+				ring->spin <<= 1;
+			}
+			goto consume;
+		}
+		RAID_SHM_CPU_RELAX();
+	}
+	if (ring->spin > RAID_SHM_SPIN_MIN) {
+		ring->spin >>= 1;
+	}
+
+	// Sleep until the producer bumps the sequence word
+	while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head) {
+		seq = __atomic_load_n(&q->seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&q->waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) != head) {
+			__atomic_store_n(&q->waiting, 0, __ATOMIC_SEQ_CST);
+			break;
+		}
+		if ((shm_futex_wait(&q->seq, seq, msec) == -1) && (errno == ETIMEDOUT)) {
+			__atomic_store_n(&q->waiting, 0, __ATOMIC_SEQ_CST);
+			return( 1 );
+		}
+		__atomic_store_n(&q->waiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+consume:
+	*e = q->entries[head & RAID_SHM_MASK];
+	__atomic_store_n(&q->head, head+1, __ATOMIC_RELEASE);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_unix_address
+// Description  : Fill in a UNIX domain socket address for the control path
+//
+// Inputs       : path - the socket path
+//                addr - the address to fill in (out)
+// Outputs      : 0 if successful, -1 if the path is too long
+
+static int shm_unix_address(const char *path, struct sockaddr_un *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm socket path too long [%s]", path);
+		return( -1 );
+	}
+	strcpy(addr->sun_path, path);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_peer_gone
+// Description  : Check whether the other end of the ring has gone away, the
+//                control socket reads EOF/hangup once its process exits
+//
+// Inputs       : ring - the ring to check
+// Outputs      : 1 if the peer detached, 0 otherwise
+
+static int shm_peer_gone(RaidShmRing *ring) {
+	struct pollfd pfd;
+
+	if (__atomic_load_n(&ring->hdr->closed, __ATOMIC_SEQ_CST)) {
+		return( 1 );
+	}
+	pfd.fd = ring->ctlfd;
+	pfd.events = POLLIN;
+	return( (poll(&pfd, 1, 0) == 1) && (pfd.revents & (POLLHUP|POLLIN|POLLERR)) );
+}
+
+//
+// Client Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_client_open
+// Description  : Create the ring in a memfd and pass it to the server over
+//                the control socket at path
+//
+// Inputs       : path - the server's control socket
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_shm_client_open(const char *path) {
+	RaidShmRing *ring = &client_ring;
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))], ack = 0;
+
+	// Create and map the shared region
+	ring->size = sizeof(RaidShmHeader) + (size_t)RAID_SHM_SLOTS * RAID_SHM_SLOT_SIZE;
+	if ((ring->memfd = memfd_create("raid-ring", MFD_CLOEXEC)) == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm memfd creation failed [%s]", strerror(errno));
+		return( -1 );
+	}
+	if (ftruncate(ring->memfd, ring->size) == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm ring sizing failed [%s]", strerror(errno));
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	ring->hdr = mmap(NULL, ring->size, PROT_READ|PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+	if (ring->hdr == MAP_FAILED) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm ring map failed [%s]", strerror(errno));
+		ring->hdr = NULL;
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	ring->slots = (char *)ring->hdr + sizeof(RaidShmHeader);
+	ring->hdr->slots = RAID_SHM_SLOTS;
+	ring->hdr->slot_size = RAID_SHM_SLOT_SIZE;
+	ring->hdr->magic = RAID_SHM_MAGIC;
+	ring->spin = shm_spin_budget();
+
+	// Connect to the server and hand over the descriptor
+	if ((shm_unix_address(path, &addr) == -1) ||
+			((ring->ctlfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1) ||
+			(connect(ring->ctlfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm connect to [%s] failed [%s]", path, strerror(errno));
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &ack;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &ring->memfd, sizeof(int));
+	if ((sendmsg(ring->ctlfd, &msg, 0) != 1) || (read(ring->ctlfd, &ack, 1) != 1)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm ring handoff failed [%s]", strerror(errno));
+		raid_shm_release(ring);
+		return( -1 );
+	}
+
+	// Return successfully
+	RAID_LOG(LOG_INFO_LEVEL, "RAID shm ring attached to [%s] (%u slots)", path, RAID_SHM_SLOTS);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_request
+// Description  : Place a request in the next free slot, publish it and wait
+//                for the server's completion
+//
+// Inputs       : op - the request opcode
+//                buf - the request payload, receives the response payload
+//                len - the request payload length
+//                rlen - the response payload length (out)
+//                cap - the most response payload buf can take
+// Outputs      : the response opcode, or -1 if failure
+
+RAIDOpCode raid_shm_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap) {
+	RaidShmRing *ring = &client_ring;
+	RaidShmEntry e;
+	char *slot;
+
+	// Sanity check the request
+	if ((ring->hdr == NULL) || (len > RAID_SHM_SLOT_SIZE)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm bad request (ring %p, length %u)", ring->hdr, len);
+		return( -1 );
+	}
+
+	// Stage the payload and submit
+	e.op = op;
+	e.length = len;
+	e.slot = ring->hdr->sq.tail & RAID_SHM_MASK;
+	slot = ring->slots + (size_t)e.slot * RAID_SHM_SLOT_SIZE;
+	if (len > 0) {
+		memcpy(slot, buf, len);
+	}
+	shm_publish(&ring->hdr->sq, &e);
+
+	// Wait for the completion, copy out the response payload
+	while (shm_consume(ring, &ring->hdr->cq, &e, RAID_SHM_POLL_MSEC)) {
+		if (shm_peer_gone(ring)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "RAID shm server detached with request outstanding");
+			return( -1 );
+		}
+	}
+	if ((e.length > cap) || ((e.length > 0) && (buf == NULL))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm unexpected response payload [%u bytes]", e.length);
+		return( -1 );
+	}
+	if (e.length > 0) {
+		memcpy(buf, ring->slots + (size_t)e.slot * RAID_SHM_SLOT_SIZE, e.length);
+	}
+	*rlen = e.length;
+	return( e.op );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_client_close
+// Description  : Detach from the server and release the ring
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_shm_client_close(void) {
+	if (client_ring.hdr != NULL) {
+		__atomic_store_n(&client_ring.hdr->closed, 1, __ATOMIC_SEQ_CST);
+	}
+	raid_shm_release(&client_ring);
+	return( 0 );
+}
+
+//
+// Server Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_listen
+// Description  : Create the server control socket for ring attachment
+//
+// Inputs       : path - the socket path to bind
+// Outputs      : the listening descriptor, -1 if failure
+
+int raid_shm_listen(const char *path) {
+	struct sockaddr_un addr;
+	int lfd;
+
+	if (shm_unix_address(path, &addr) == -1) {
+		return( -1 );
+	}
+	unlink(path);
+	if (((lfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1) ||
+			(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+			(listen(lfd, 16) == -1)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm listen on [%s] failed [%s]", path, strerror(errno));
+		if (lfd != -1) {
+			close(lfd);
+		}
+		return( -1 );
+	}
+	return( lfd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_accept
+// Description  : Accept a client, receive its ring descriptor and map it
+//
+// Inputs       : lfd - the listening control socket
+//                ring - the ring to fill in (out)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_shm_accept(int lfd, RaidShmRing *ring) {
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))], ack;
+	off_t size;
+
+	// Accept the connection and pull the descriptor off of it
+	memset(ring, 0, sizeof(*ring));
+	ring->memfd = -1;
+	ring->spin = shm_spin_budget();
+	if ((ring->ctlfd = accept(lfd, NULL, NULL)) == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm accept failed [%s]", strerror(errno));
+		return( -1 );
+	}
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &ack;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	if ((recvmsg(ring->ctlfd, &msg, 0) != 1) || ((cmsg = CMSG_FIRSTHDR(&msg)) == NULL) ||
+			(cmsg->cmsg_type != SCM_RIGHTS)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm client did not pass a ring");
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	memcpy(&ring->memfd, CMSG_DATA(cmsg), sizeof(int));
+
+	// Map and validate the ring
+	if ((size = lseek(ring->memfd, 0, SEEK_END)) < (off_t)sizeof(RaidShmHeader)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm ring too small (%ld bytes)", (long)size);
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	ring->size = size;
+	ring->hdr = mmap(NULL, ring->size, PROT_READ|PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+	if ((ring->hdr == MAP_FAILED) || (ring->hdr->magic != RAID_SHM_MAGIC) ||
+			(ring->hdr->slots != RAID_SHM_SLOTS) ||
+			(sizeof(RaidShmHeader) + (size_t)ring->hdr->slots * ring->hdr->slot_size > ring->size)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID shm ring is malformed");
+		if (ring->hdr == MAP_FAILED) {
+			ring->hdr = NULL;
+		}
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	ring->slots = (char *)ring->hdr + sizeof(RaidShmHeader);
+
+	// Tell the client we are attached
+	if (write(ring->ctlfd, &ack, 1) != 1) {
+		raid_shm_release(ring);
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_serve
+// Description  : Process ring requests until the client closes or detaches
+//
+// Inputs       : ring - the attached ring
+//                handler - the request handler
+//                arg - the handler's context
+// Outputs      : 0 if the client closed cleanly, -1 if failure
+
+int raid_shm_serve(RaidShmRing *ring, raid_shm_handler handler, void *arg) {
+	RaidShmHeader *hdr = ring->hdr;
+	RaidShmEntry e;
+	uint32_t len;
+
+	while (1) {
+
+		// Wait for work, checking that the client is still there
+		if (shm_consume(ring, &hdr->sq, &e, RAID_SHM_POLL_MSEC)) {
+			if (shm_peer_gone(ring)) {
+				return( 0 );
+			}
+			continue;
+		}
+
+		// Run the request against the payload slot, then complete it
+		if ((e.slot >= hdr->slots) || (e.length > hdr->slot_size)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "RAID shm bad entry (slot %u, length %u)", e.slot, e.length);
+			return( -1 );
+		}
+		len = e.length;
+		e.op = handler(e.op, ring->slots + (size_t)e.slot * hdr->slot_size, &len, arg);
+		e.length = (len > hdr->slot_size) ? 0 : len;
+		shm_publish(&hdr->cq, &e);
+		if (((e.op >> 56) & 0xff) == RAID_CLOSE) {
+			return( 0 );
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_shm_release
+// Description  : Unmap a ring and close its descriptors
+//
+// Inputs       : ring - the ring to release
+// Outputs      : none
+
+void raid_shm_release(RaidShmRing *ring) {
+	if (ring->hdr != NULL) {
+		munmap(ring->hdr, ring->size);
+		ring->hdr = NULL;
+		ring->slots = NULL;
+	}
+	if (ring->memfd != -1) {
+		close(ring->memfd);
+		ring->memfd = -1;
+	}
+	if (ring->ctlfd != -1) {
+		close(ring->ctlfd);
+		ring->ctlfd = -1;
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef RAID_SHM_INCLUDED
+#define RAID_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_shm.h
+//  Description   : This is the shared-memory ring transport for a RAID server
+//                  co-located on the same host as the driver.  The client
+//                  creates a memfd holding a submission ring, a completion
+//                  ring and one payload slot per ring entry, then hands the
+//                  descriptor to the server over a UNIX domain socket.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/14/15
+//
+
+// Include Files
+#include <stddef.h>
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_SHM_SCHEME      "shm://"                          // Endpoint prefix
+#define RAID_SHM_MAGIC       0x52414944u                       // "RAID"
+#define RAID_SHM_SLOTS       16                                // Ring entries (power of 2)
+#define RAID_SHM_SLOT_SIZE   (RAID_MAX_BATCH*8+RAID_BATCH_PAYLOAD) // Payload bytes per slot
+#define RAID_SHM_SPIN_MIN    64                                // Minimum spin before sleep
+#define RAID_SHM_SPIN_MAX    (1<<16)                           // Maximum spin before sleep
+#define RAID_SHM_POLL_MSEC   100                               // Server liveness poll period
+
+// Type definitions
+
+// A single submission or completion entry
+typedef struct {
+	RAIDOpCode op;      // The request (or response) opcode
+	uint32_t   length;  // Payload bytes carried in the entry's slot
+	uint32_t   slot;    // The payload slot index
+} RaidShmEntry;
+
+// One direction of the ring (producer index, consumer index, wakeup word)
+typedef struct {
+	uint32_t     head;      // Next entry to consume (consumer owned)
+	uint32_t     tail;      // Next entry to produce (producer owned)
+	uint32_t     seq;       // Futex word, bumped on every publish
+	uint32_t     waiting;   // Non-zero when the consumer is asleep on seq
+	RaidShmEntry entries[RAID_SHM_SLOTS];
+} RaidShmQueue;
+
+// The shared region layout, payload slots follow the header
+typedef struct {
+	uint32_t     magic;     // RAID_SHM_MAGIC once initialized
+	uint32_t     slots;     // Number of entries/slots
+	uint32_t     slot_size; // Bytes per payload slot
+	uint32_t     closed;    // Set by the client when it detaches
+	RaidShmQueue sq;        // Client -> server submissions
+	RaidShmQueue cq;        // Server -> client completions
+} RaidShmHeader;
+
+// A process-local handle on a mapped ring
+typedef struct {
+	RaidShmHeader *hdr;     // The mapped header
+	char          *slots;   // The first payload slot
+	size_t         size;    // The total mapping size
+	int            memfd;   // The memory descriptor backing the ring
+	int            ctlfd;   // The control socket the descriptor was passed on
+	uint32_t       spin;    // Adaptive spin budget for this side
+} RaidShmRing;
+
+// The server side request handler, rewrites the payload/length in place
+typedef RAIDOpCode (*raid_shm_handler)(RAIDOpCode op, void *buf, uint32_t *len, void *arg);
+
+//
+// Functional Prototypes
+
+int raid_shm_client_open(const char *path);
+	// Create the ring and attach it to the server listening on path
+
+RAIDOpCode raid_shm_request(RAIDOpCode op, void *buf, uint32_t len, uint32_t *rlen, uint32_t cap);
+	// Send a request through the ring and wait for its completion
+
+int raid_shm_client_close(void);
+	// Detach from the server and release the ring
+
+int raid_shm_listen(const char *path);
+	// Create the server control socket for ring attachment
+
+int raid_shm_accept(int lfd, RaidShmRing *ring);
+	// Accept a client and map the ring descriptor it passes
+
+int raid_shm_serve(RaidShmRing *ring, raid_shm_handler handler, void *arg);
+	// Process ring requests until the client detaches
+
+void raid_shm_release(RaidShmRing *ring);
+	// Unmap a ring and close its descriptors
+
+#endif
@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_trace.c
+//  Description   : This is the RAID bus trace recorder (see raid_trace.h).
+//                  The hot path only touches the calling thread's buffer;
+//                  the file lock is taken once per RAID_TRACE_BUFFER
+//                  records.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/21/15
+//
+
+// Include Files
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_trace.h>
+
+// Type definitions
+typedef struct {
+	uint32_t        used;                       // Records buffered
+	uint16_t        thread;                     // Registration number
+	RaidTraceRecord records[RAID_TRACE_BUFFER]; // The buffered records
+} RaidTraceBuffer;
+
+//
+// Global data
+volatile int raid_trace_enabled = 0;              // Recording is on
+static FILE *trace_fh = NULL;                     // The trace file
+static struct timespec trace_epoch;               // Time zero of the trace
+static RaidTraceBuffer *trace_buffers[RAID_TRACE_THREADS]; // Every thread's buffer
+static int trace_nbuffers = 0;
+static uint64_t trace_records = 0;                // Records written
+static int trace_failed = 0;                      // A write failed
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the above
+static __thread RaidTraceBuffer *trace_buffer = NULL; // This thread's buffer
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_flush
+// Description  : Append a buffer to the trace file (trace_lock held)
+//
+// Inputs       : buf - the buffer
+// Outputs      : none
+
+static void trace_flush(RaidTraceBuffer *buf) {
+	if (buf->used && !trace_failed) {
+		if (fwrite(buf->records, sizeof(RaidTraceRecord), buf->used, trace_fh) != buf->used) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Failure writing the bus trace, recording stopped: %s", strerror(errno));
+			trace_failed = 1;
+		}
+		trace_records += buf->used;
+	}
+	buf->used = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_get_buffer
+// Description  : Find (or create and register) the calling thread's buffer
+//
+// Inputs       : none
+// Outputs      : the buffer, or NULL if none is available
+
+static RaidTraceBuffer *trace_get_buffer(void) {
+	RaidTraceBuffer *buf;
+
+	if (trace_buffer != NULL) {
+		return( trace_buffer );
+	}
+	pthread_mutex_lock(&trace_lock);
+	if ((trace_nbuffers < RAID_TRACE_THREADS) && ((buf = malloc(sizeof(RaidTraceBuffer))) != NULL)) {
+		buf->used = 0;
+		buf->thread = trace_nbuffers;
+		trace_buffers[trace_nbuffers++] = buf;
+		trace_buffer = buf;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return( trace_buffer );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_open
+// Description  : Start recording the bus to a trace file
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_trace_open(const char *path) {
+	RaidTraceHeader hdr;
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, RAID_TRACE_MAGIC, sizeof(RAID_TRACE_MAGIC));
+	hdr.version = RAID_TRACE_VERSION;
+	if (((trace_fh = fopen(path, "w")) == NULL) || (fwrite(&hdr, sizeof(hdr), 1, trace_fh) != 1)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure opening the bus trace [%s]: %s", path, strerror(errno));
+		if (trace_fh != NULL) {
+			fclose(trace_fh);
+			trace_fh = NULL;
+		}
+		return( -1 );
+	}
+	trace_records = 0;
+	trace_failed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+	raid_trace_enabled = 1;
+	RAID_LOG(LOG_INFO_LEVEL, "Recording the RAID bus to [%s]", path);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_clock
+// Description  : The trace clock
+//
+// Inputs       : none
+// Outputs      : nsec since the trace was opened
+
+uint64_t raid_trace_clock(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return( (uint64_t)(now.tv_sec - trace_epoch.tv_sec) * 1000000000ULL + now.tv_nsec - trace_epoch.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_record
+// Description  : Record requests sent at start and answered now
+//
+// Inputs       : ops - the request opcodes
+//                resps - the response opcodes
+//                n - the number of ops
+//                batched - the ops went in one batch frame
+//                start - when they were sent (raid_trace_clock)
+// Outputs      : none
+
+void raid_trace_record(RAIDOpCode *ops, RAIDOpCode *resps, int n, int batched, uint64_t start) {
+	RaidTraceBuffer *buf;
+	RaidTraceRecord *rec;
+	uint64_t latency = raid_trace_clock() - start;
+	int i;
+
+	if ((buf = trace_get_buffer()) == NULL) {
+		return;
+	}
+
+	// Keep the ops of a frame together in the file
+	if (buf->used + n > RAID_TRACE_BUFFER) {
+		pthread_mutex_lock(&trace_lock);
+		trace_flush(buf);
+		pthread_mutex_unlock(&trace_lock);
+	}
+	for (i = 0; (i < n) && (buf->used < RAID_TRACE_BUFFER); i++) {
+		rec = &buf->records[buf->used++];
+		rec->start = start;
+		rec->request = ops[i];
+		rec->response = resps[i];
+		rec->latency = (latency > UINT32_MAX) ? UINT32_MAX : (uint32_t)latency;
+		rec->thread = buf->thread;
+		rec->batch = batched ? n : 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_close
+// Description  : Stop recording, flushing every thread's buffer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_trace_close(void) {
+	int i, ret;
+
+	if (trace_fh == NULL) {
+		return( 0 );
+	}
+	raid_trace_enabled = 0;
+	pthread_mutex_lock(&trace_lock);
+	for (i = 0; i < trace_nbuffers; i++) {
+		trace_flush(trace_buffers[i]);
+	}
+	ret = (fclose(trace_fh) || trace_failed) ? -1 : 0;
+	trace_fh = NULL;
+	pthread_mutex_unlock(&trace_lock);
+	RAID_LOG(LOG_INFO_LEVEL, "Recorded %llu RAID bus requests", (unsigned long long)trace_records);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_load
+// Description  : Map a bus trace for reading
+//
+// Inputs       : path - the trace file
+//                tr - the trace (out)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_trace_load(const char *path, RaidTrace *tr) {
+	RaidTraceHeader *hdr;
+	struct stat st;
+	int fd;
+
+	memset(tr, 0x0, sizeof(*tr));
+	if (((fd = open(path, O_RDONLY)) == -1) || fstat(fd, &st)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure opening the bus trace [%s]: %s", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return( -1 );
+	}
+	if ((st.st_size < sizeof(RaidTraceHeader)) ||
+			((tr->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure mapping the bus trace [%s]", path);
+		tr->map = NULL;
+		close(fd);
+		return( -1 );
+	}
+	close(fd);
+	tr->maplen = st.st_size;
+	hdr = tr->map;
+	if (memcmp(hdr->magic, RAID_TRACE_MAGIC, sizeof(RAID_TRACE_MAGIC)) ||
+			(hdr->version != RAID_TRACE_VERSION) ||
+			((tr->maplen - sizeof(RaidTraceHeader)) % sizeof(RaidTraceRecord))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad bus trace [%s]", path);
+		raid_trace_free(tr);
+		return( -1 );
+	}
+	tr->records = (RaidTraceRecord *)(hdr + 1);
+	tr->count = (tr->maplen - sizeof(RaidTraceHeader)) / sizeof(RaidTraceRecord);
+	RAID_LOG(LOG_INFO_LEVEL, "Loaded bus trace [%s] (%lu requests)", path, (unsigned long)tr->count);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_trace_free
+// Description  : Release a loaded trace
+//
+// Inputs       : tr - the trace
+// Outputs      : none
+
+void raid_trace_free(RaidTrace *tr) {
+	if (tr->map != NULL) {
+		munmap(tr->map, tr->maplen);
+	}
+	memset(tr, 0x0, sizeof(*tr));
+}
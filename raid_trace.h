@@ -0,0 +1,85 @@
+#ifndef RAID_TRACE_INCLUDED
+#define RAID_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_trace.h
+//  Description   : This is the RAID bus trace recorder.  Once opened, every
+//                  request the client sends (client_raid_bus_request, and
+//                  each op of a batch frame) is recorded with its response,
+//                  start time and latency into a per-thread buffer, which
+//                  is appended to the trace file when full.  A trace is
+//
+//                    header | records (RaidTraceRecord, host byte order)
+//
+//                  Records from different threads are not in time order
+//                  in the file; the ops of one batch frame are always
+//                  contiguous.  raid_replay plays a trace back against a
+//                  server.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/21/15
+//
+
+// Include Files
+#include <stddef.h>
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_TRACE_MAGIC   "RAIDBUS"  // First 8 bytes of a bus trace
+#define RAID_TRACE_VERSION 1          // Bus trace layout version
+#define RAID_TRACE_BUFFER  4096       // Records buffered per thread
+#define RAID_TRACE_THREADS 64         // Threads that can record
+
+// Type definitions
+typedef struct {
+	char     magic[8]; // RAID_TRACE_MAGIC
+	uint32_t version;  // RAID_TRACE_VERSION
+	uint32_t reserved; // Zero
+} RaidTraceHeader;
+
+typedef struct {
+	uint64_t start;    // When the request was sent (nsec since the trace opened)
+	uint64_t request;  // The request opcode (type, blocks, disk, block ID)
+	uint64_t response; // The response opcode (with the result bit)
+	uint32_t latency;  // Nsec until the response (the whole frame, if batched)
+	uint16_t thread;   // The recording thread
+	uint16_t batch;    // Ops in the batch frame (0 if sent on its own)
+} RaidTraceRecord;
+
+typedef struct {
+	RaidTraceRecord *records; // The records
+	size_t           count;   // Number of records
+	void            *map;     // The mapped file
+	size_t           maplen;  // Size of the mapping
+} RaidTrace;
+
+//
+// Global data
+extern volatile int raid_trace_enabled; // Recording is on
+
+//
+// Functional Prototypes
+
+int raid_trace_open(const char *path);
+	// Start recording the bus to a trace file
+
+uint64_t raid_trace_clock(void);
+	// The trace clock (nsec since the trace opened)
+
+void raid_trace_record(RAIDOpCode *ops, RAIDOpCode *resps, int n, int batched, uint64_t start);
+	// Record n ops sent at start, answered now
+
+int raid_trace_close(void);
+	// Flush every thread's buffer and close the trace (recording threads done)
+
+int raid_trace_load(const char *path, RaidTrace *tr);
+	// Map a trace for reading
+
+void raid_trace_free(RaidTrace *tr);
+	// Release a loaded trace
+
+#endif
@@ -0,0 +1,444 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_victim.c
+//  Description   : This is the second level (victim) cache behind the block
+//                  cache (see raid_victim.h).  The file is cut into slots of
+//                  RAID_BLOCK_SIZE, each tagged with the disk and block it
+//                  holds.  A compact in-memory index, an open-addressed
+//                  table of slot numbers probed linearly from a hash of the
+//                  disk and block and compacted on removal, finds them.
+//                  Evictions are copied into a queue, and the writer thread
+//                  moves each one into the slot at the hand, forgetting what
+//                  was there.  The copy into the file is made outside the
+//                  lock, and a victim dropped meanwhile is never indexed.
+//                  The block cache calls in with its own lock held, so the
+//                  levels never disagree about which one holds a block.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/29/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_victim.h>
+
+// Defines
+#define VICTIM_EMPTY UINT64_MAX // Key of a free slot or a dropped victim
+
+// Type definitions
+typedef struct {
+	uint64_t key;                  // Disk and block of the victim (VICTIM_EMPTY if dropped)
+	uint8_t data[RAID_BLOCK_SIZE]; // Its content
+} VictimPending;
+
+//
+// Global data
+int raid_victim_enabled = 0;                       // The victim cache is configured
+static double victim_gib = RAID_VICTIM_SIZE;       // Size of the file (GiB)
+static char *victim_dir = NULL;                    // Directory of the file (NULL for default)
+static uint8_t *victim_map = NULL;                 // The mapped file
+static size_t victim_bytes = 0;                    // ... its size
+static uint32_t victim_slots = 0;                  // Blocks it holds
+static uint64_t *victim_keys = NULL;               // Disk and block in each slot
+static uint32_t victim_hand = 0;                   // Next slot the writer fills
+static uint32_t *victim_table = NULL;              // The index, slot + 1 (0 empty)
+static uint32_t victim_mask = 0;                   // ... its size - 1
+static VictimPending *victim_pending = NULL;       // Victims waiting for the writer
+static uint32_t victim_head = 0;                   // ... the oldest
+static uint32_t victim_count = 0;                  // ... how many
+static int victim_stop = 0;                        // The writer should exit
+static int victim_running = 0;                     // The writer was started
+static pthread_t victim_writer;                    // The writer thread
+static pthread_mutex_t victimLock = PTHREAD_MUTEX_INITIALIZER; // Guards all of the above
+static pthread_cond_t victimWork = PTHREAD_COND_INITIALIZER;   // Victims were queued
+static uint64_t victim_queued = 0;                 // Victims queued
+static uint64_t victim_full = 0;                   // ... dropped, the queue was full
+static uint64_t victim_written = 0;                // ... written into the file
+static uint64_t victim_evicted = 0;                // ... forgotten to make room
+static uint64_t victim_invalid = 0;                // ... dropped, their block was rewritten
+static uint64_t victim_lookups = 0;                // Misses of the block cache looked up
+static uint64_t victim_hits = 0;                   // ... found here
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_key
+// Description  : The key of a disk block
+//
+// Inputs       : dsk - the disk
+//                blk - the block
+// Outputs      : the key
+
+static inline uint64_t victim_key(RAIDDiskID dsk, RAIDBlockID blk) {
+	return( ((uint64_t)dsk << 32) | blk );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_home
+// Description  : The slot of the index a key's probe starts from
+//
+// Inputs       : key - the key
+// Outputs      : the slot of the index
+
+static inline uint32_t victim_home(uint64_t key) {
+	return( (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & victim_mask );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_find
+// Description  : Find the slot of the index holding a key, or the empty
+//                slot that ends its probe (victimLock held)
+//
+// Inputs       : key - the key
+// Outputs      : the slot of the index
+
+static uint32_t victim_find(uint64_t key) {
+	uint32_t pos = victim_home(key);
+
+	while ((victim_table[pos] != 0) && (victim_keys[victim_table[pos] - 1] != key)) {
+		pos = (pos + 1) & victim_mask;
+	}
+	return( pos );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_remove
+// Description  : Free the slot an entry of the index points at and take the
+//                entry out, moving the ones after it back so no probe runs
+//                into the hole (victimLock held)
+//
+// Inputs       : pos - the slot of the index
+// Outputs      : none
+
+static void victim_remove(uint32_t pos) {
+	uint32_t next, home;
+
+	victim_keys[victim_table[pos] - 1] = VICTIM_EMPTY;
+	victim_table[pos] = 0;
+	for (next = (pos + 1) & victim_mask; victim_table[next] != 0; next = (next + 1) & victim_mask) {
+		// an entry moves back if the hole lies between its home and it
+		home = victim_home(victim_keys[victim_table[next] - 1]);
+		if (((next - home) & victim_mask) >= ((next - pos) & victim_mask)) {
+			victim_table[pos] = victim_table[next];
+			victim_table[next] = 0;
+			pos = next;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_forget
+// Description  : Drop every copy of a block, queued or in the file
+//                (victimLock held)
+//
+// Inputs       : key - the block's key
+// Outputs      : none
+
+static void victim_forget(uint64_t key) {
+	uint32_t i, pos;
+
+	for (i = 0; i < victim_count; i++) {
+		if (victim_pending[(victim_head + i) % RAID_VICTIM_PENDING].key == key) {
+			victim_pending[(victim_head + i) % RAID_VICTIM_PENDING].key = VICTIM_EMPTY;
+			victim_invalid++;
+		}
+	}
+	pos = victim_find(key);
+	if (victim_table[pos] != 0) {
+		victim_remove(pos);
+		victim_invalid++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim_write
+// Description  : The writer thread, moving queued victims into the file
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void * victim_write(void *arg) {
+	VictimPending *victim;
+	uint32_t slot;
+
+	pthread_mutex_lock(&victimLock);
+	while (! victim_stop) {
+		if (victim_count == 0) {
+			pthread_cond_wait(&victimWork, &victimLock);
+			continue;
+		}
+
+		// Take the slot at the hand, forgetting its block, and copy the
+		// victim in without the lock (producers never touch the head)
+		victim = &victim_pending[victim_head];
+		if (victim->key != VICTIM_EMPTY) {
+			slot = victim_hand;
+			victim_hand = (victim_hand + 1) % victim_slots;
+			if (victim_keys[slot] != VICTIM_EMPTY) {
+				victim_remove(victim_find(victim_keys[slot]));
+				victim_evicted++;
+			}
+			pthread_mutex_unlock(&victimLock);
+			memcpy(victim_map + (size_t)slot * RAID_BLOCK_SIZE, victim->data, RAID_BLOCK_SIZE);
+			pthread_mutex_lock(&victimLock);
+
+			// Only index it if it was not dropped or taken meanwhile
+			if (victim->key != VICTIM_EMPTY) {
+				victim_keys[slot] = victim->key;
+				victim_table[victim_find(victim->key)] = slot + 1;
+				victim_written++;
+			}
+		}
+		victim_head = (victim_head + 1) % RAID_VICTIM_PENDING;
+		victim_count--;
+	}
+	pthread_mutex_unlock(&victimLock);
+	return( NULL );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_configure
+// Description  : Turn the victim cache on with a configuration
+//
+// Inputs       : spec - the configuration (see raid_victim.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_victim_configure(const char *spec) {
+	char *copy, *field, *save;
+	double size;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if ((sscanf(field, "size=%lf%c", &size, &extra) == 1) && (size * (1ULL << 30) >= RAID_BLOCK_SIZE)) {
+			victim_gib = size;
+		} else if ((strncmp(field, "dir=", 4) == 0) && (field[4] != '\0')) {
+			free(victim_dir);
+			victim_dir = strdup(field + 4);
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad victim cache field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	raid_victim_enabled = (ret == 0);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_init
+// Description  : Create and map the file, size the index and start the
+//                writer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int raid_victim_init(void) {
+	char path[4096];
+	uint32_t size;
+	int fd;
+
+	raid_victim_close();
+	victim_slots = (uint32_t)(victim_gib * (1ULL << 30) / RAID_BLOCK_SIZE);
+	victim_bytes = (size_t)victim_slots * RAID_BLOCK_SIZE;
+	snprintf(path, sizeof(path), "%s/raid_victim.XXXXXX", (victim_dir != NULL) ? victim_dir : RAID_VICTIM_DIR);
+	if ((fd = mkstemp(path)) == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "L2 : failed creating [%s] : %s", path, strerror(errno));
+		return( -1 );
+	}
+	if (ftruncate(fd, victim_bytes) == -1) {
+		RAID_LOG(LOG_ERROR_LEVEL, "L2 : failed sizing [%s] : %s", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return( -1 );
+	}
+	victim_map = mmap(NULL, victim_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	unlink(path);
+	if (victim_map == MAP_FAILED) {
+		RAID_LOG(LOG_ERROR_LEVEL, "L2 : failed mapping [%s] : %s", path, strerror(errno));
+		victim_map = NULL;
+		return( -1 );
+	}
+
+	// The index is twice the slots so it never fills
+	for (size = 1; size < 2 * victim_slots; size *= 2);
+	victim_mask = size - 1;
+	victim_keys = malloc((size_t)victim_slots * sizeof(uint64_t));
+	victim_table = calloc(size, sizeof(uint32_t));
+	victim_pending = malloc(RAID_VICTIM_PENDING * sizeof(VictimPending));
+	if ((victim_keys == NULL) || (victim_table == NULL) || (victim_pending == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "L2 : failed allocating the index of %u slots.", victim_slots);
+		raid_victim_close();
+		return( -1 );
+	}
+	memset(victim_keys, 0xff, (size_t)victim_slots * sizeof(uint64_t));
+	victim_hand = victim_head = victim_count = 0;
+	victim_stop = 0;
+	victim_queued = victim_full = victim_written = victim_evicted = victim_invalid = 0;
+	victim_lookups = victim_hits = 0;
+	if (pthread_create(&victim_writer, NULL, victim_write, NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "L2 : failed starting the writer.");
+		raid_victim_close();
+		return( -1 );
+	}
+	victim_running = 1;
+	RAID_LOG(LOG_INFO_LEVEL, "L2 : %u slots (%.2f GiB) mapped from [%s].", victim_slots,
+			(double)victim_bytes / (1ULL << 30), path);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_close
+// Description  : Stop the writer, log the figures and unmap the file
+//
+// Inputs       : none
+// Outputs      : none
+
+void raid_victim_close(void) {
+	if (victim_map == NULL) {
+		return;
+	}
+	if (victim_running) {
+		pthread_mutex_lock(&victimLock);
+		victim_stop = 1;
+		pthread_cond_signal(&victimWork);
+		pthread_mutex_unlock(&victimLock);
+		pthread_join(victim_writer, NULL);
+		RAID_LOG(LOG_INFO_LEVEL, "L2 : %llu victims queued, %llu written, %llu evicted, %llu invalidated, %llu dropped (queue full).",
+				(unsigned long long)victim_queued, (unsigned long long)victim_written,
+				(unsigned long long)victim_evicted, (unsigned long long)victim_invalid,
+				(unsigned long long)victim_full);
+		RAID_LOG(LOG_INFO_LEVEL, "L2 : %llu hits of %llu lookups (%.2f%%).",
+				(unsigned long long)victim_hits, (unsigned long long)victim_lookups,
+				(victim_lookups > 0) ? 100.0 * victim_hits / victim_lookups : 0.0);
+	}
+	munmap(victim_map, victim_bytes);
+	free(victim_keys);
+	free(victim_table);
+	free(victim_pending);
+	victim_map = NULL;
+	victim_keys = NULL;
+	victim_table = NULL;
+	victim_pending = NULL;
+	victim_slots = 0;
+	victim_running = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_put
+// Description  : Queue a block the block cache evicted for the writer, or
+//                drop it if the queue is full
+//
+// Inputs       : dsk - the disk of the block
+//                blk - the block
+//                buf - its content
+// Outputs      : none
+
+void raid_victim_put(RAIDDiskID dsk, RAIDBlockID blk, const void *buf) {
+	uint64_t key = victim_key(dsk, blk);
+	VictimPending *victim;
+
+	pthread_mutex_lock(&victimLock);
+	if (victim_pending != NULL) {
+		victim_forget(key);
+		if (victim_count == RAID_VICTIM_PENDING) {
+			victim_full++;
+		} else {
+			victim = &victim_pending[(victim_head + victim_count++) % RAID_VICTIM_PENDING];
+			victim->key = key;
+			memcpy(victim->data, buf, RAID_BLOCK_SIZE);
+			victim_queued++;
+			pthread_cond_signal(&victimWork);
+		}
+	}
+	pthread_mutex_unlock(&victimLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_take
+// Description  : Copy a block out, queued or in the file, and forget it (it
+//                moves back up into the block cache)
+//
+// Inputs       : dsk - the disk of the block
+//                blk - the block
+//                buf - the buffer to copy it into
+// Outputs      : 0 if found, -1 if not
+
+int raid_victim_take(RAIDDiskID dsk, RAIDBlockID blk, void *buf) {
+	uint64_t key = victim_key(dsk, blk);
+	uint32_t i, pos;
+	int found = -1;
+
+	pthread_mutex_lock(&victimLock);
+	if (victim_pending == NULL) {
+		pthread_mutex_unlock(&victimLock);
+		return( -1 );
+	}
+	victim_lookups++;
+
+	// The newest queued copy first, then the file
+	for (i = victim_count; (i > 0) && (found != 0); i--) {
+		if (victim_pending[(victim_head + i - 1) % RAID_VICTIM_PENDING].key == key) {
+			memcpy(buf, victim_pending[(victim_head + i - 1) % RAID_VICTIM_PENDING].data, RAID_BLOCK_SIZE);
+			victim_pending[(victim_head + i - 1) % RAID_VICTIM_PENDING].key = VICTIM_EMPTY;
+			found = 0;
+		}
+	}
+	if (found != 0) {
+		pos = victim_find(key);
+		if (victim_table[pos] != 0) {
+			memcpy(buf, victim_map + (size_t)(victim_table[pos] - 1) * RAID_BLOCK_SIZE, RAID_BLOCK_SIZE);
+			victim_remove(pos);
+			found = 0;
+		}
+	}
+	victim_hits += (found == 0);
+	pthread_mutex_unlock(&victimLock);
+	return( found );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : raid_victim_drop
+// Description  : Forget a block (its disk block now has other data)
+//
+// Inputs       : dsk - the disk of the block
+//                blk - the block
+// Outputs      : none
+
+void raid_victim_drop(RAIDDiskID dsk, RAIDBlockID blk) {
+	pthread_mutex_lock(&victimLock);
+	if (victim_pending != NULL) {
+		victim_forget(victim_key(dsk, blk));
+	}
+	pthread_mutex_unlock(&victimLock);
+}
@@ -0,0 +1,65 @@
+#ifndef RAID_VICTIM_INCLUDED
+#define RAID_VICTIM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : raid_victim.h
+//  Description   : This is the second level (victim) cache behind the block
+//                  cache.  Once configured (tagline_client -C), the blocks
+//                  the block cache evicts are kept in a large local file,
+//                  memory-mapped, so a later miss is served from there
+//                  instead of the bus.  The block cache writes through,
+//                  so every victim is clean and can be forgotten at any
+//                  time.  An evicted block is queued and copied into the
+//                  file by a writer thread, a hit moves the block back up
+//                  into the block cache (the two levels hold no block
+//                  twice), and the file's slots are reused in turn once
+//                  it is full.  The configuration is comma separated:
+//
+//                    size=<GiB>    size of the file, decimals allowed (1)
+//                    dir=<path>    directory to create it in (/dev/shm)
+//
+//                  The file is unlinked as soon as it is mapped, so nothing
+//                  is left behind.  Put it on tmpfs or a local NVMe drive.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/29/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+
+// Defines
+#define RAID_VICTIM_SIZE    1.0        // Default size of the file (GiB)
+#define RAID_VICTIM_DIR     "/dev/shm" // Default directory of the file
+#define RAID_VICTIM_PENDING 1024       // Victims queued for the writer
+
+//
+// Global data
+extern int raid_victim_enabled; // The victim cache is configured
+
+//
+// Functional Prototypes
+
+int raid_victim_configure(const char *spec);
+	// Turn the victim cache on with a configuration
+
+int raid_victim_init(void);
+	// Create and map the file and start the writer
+
+void raid_victim_close(void);
+	// Stop the writer, log the figures and unmap the file
+
+void raid_victim_put(RAIDDiskID dsk, RAIDBlockID blk, const void *buf);
+	// Queue a block the block cache evicted
+
+int raid_victim_take(RAIDDiskID dsk, RAIDBlockID blk, void *buf);
+	// Copy a block out and forget it, 0 if found, -1 if not
+
+void raid_victim_drop(RAIDDiskID dsk, RAIDBlockID blk);
+	// Forget a block (its disk block now has other data)
+
+#endif
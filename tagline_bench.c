@@ -0,0 +1,392 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_bench.c
+//  Description   : This is the benchmark recorder for the tagline simulator.
+//                  Recorders are per thread and merged at the end of the
+//                  replay; only the cache timeline is shared.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/20/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_cache.h>
+#include <raid_network.h>
+#include <tagline_driver.h>
+#include <tagline_bench.h>
+
+// Type definitions
+typedef struct {
+	uint64_t ops;     // Ops completed when sampled
+	uint64_t nsec;    // Time into the replay
+	int      gets;    // Cache gets so far
+	int      hits;    // Cache hits so far
+} TaglineBenchSample;
+
+//
+// Global data
+static struct timespec bench_begin;            // Start of the replay
+static uint64_t bench_ops = 0;                 // Ops completed (all threads)
+static uint64_t bench_interval = 1;            // Ops between cache samples
+static uint32_t bench_granted = 0;             // Bus capabilities granted at INIT
+static TaglineBenchSample *bench_samples = NULL;
+static int bench_nsamples = 0, bench_maxsamples = 0;
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the samples
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_elapsed
+// Description  : Nanoseconds between two times
+//
+// Inputs       : from - the earlier time
+//                to - the later time
+// Outputs      : the difference in nsec
+
+static uint64_t bench_elapsed(struct timespec *from, struct timespec *to) {
+	return( (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hist_index / hist_value
+// Description  : Map a value to its histogram bucket, and a bucket to the
+//                highest value it holds.  Values below 2^(SUBBITS+1) get a
+//                bucket each; above that every power of two is split into
+//                2^SUBBITS equal buckets.
+//
+// Inputs       : v - the value / idx - the bucket
+// Outputs      : the bucket / the value
+
+static int hist_index(uint64_t v) {
+	int shift;
+
+	if (v < (1ULL << (TAGLINE_BENCH_SUBBITS+1))) {
+		return( (int)v );
+	}
+	shift = 63 - __builtin_clzll(v) - TAGLINE_BENCH_SUBBITS;
+	return( (shift << TAGLINE_BENCH_SUBBITS) + (int)(v >> shift) );
+}
+
+static uint64_t hist_value(int idx) {
+	int shift;
+
+	if (idx < (1 << (TAGLINE_BENCH_SUBBITS+1))) {
+		return( (uint64_t)idx );
+	}
+	shift = (idx >> TAGLINE_BENCH_SUBBITS) - 1;
+	return( ((((uint64_t)(idx & ((1 << TAGLINE_BENCH_SUBBITS) - 1)) + (1 << TAGLINE_BENCH_SUBBITS)) + 1)
+			<< shift) - 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hist_percentile
+// Description  : The value at or below which a fraction of the recorded
+//                values lie (to the histogram's precision)
+//
+// Inputs       : h - the histogram
+//                q - the fraction (0-1)
+// Outputs      : the value
+
+static uint64_t hist_percentile(TaglineHistogram *h, double q) {
+	uint64_t want, seen = 0;
+	int i;
+
+	if (h->count == 0) {
+		return( 0 );
+	}
+	want = (uint64_t)(q * h->count + 0.999999);
+	want = (want == 0) ? 1 : want;
+	for (i = 0; i < TAGLINE_BENCH_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= want) {
+			return( (hist_value(i) < h->max) ? hist_value(i) : h->max );
+		}
+	}
+	return( h->max );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_begin
+// Description  : Start the benchmark clock for a replay
+//
+// Inputs       : nops - the number of ops in the workload
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_bench_begin(uint32_t nops) {
+	bench_ops = 0;
+	bench_nsamples = 0;
+	bench_granted = 0;
+	bench_interval = (nops > TAGLINE_BENCH_SAMPLES) ? nops / TAGLINE_BENCH_SAMPLES : 1;
+	bench_maxsamples = nops / bench_interval + 1;
+	free(bench_samples);
+	if ((bench_samples = malloc(sizeof(TaglineBenchSample) * bench_maxsamples)) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failed allocating the benchmark samples");
+		return( -1 );
+	}
+	clock_gettime(CLOCK_MONOTONIC, &bench_begin);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_alloc
+// Description  : Allocate a zeroed recorder (release with free)
+//
+// Inputs       : none
+// Outputs      : the recorder, or NULL on failure
+
+TaglineBench *tagline_bench_alloc(void) {
+	TaglineBench *b;
+	int i;
+
+	if ((b = calloc(1, sizeof(TaglineBench))) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failed allocating a benchmark recorder");
+		return( NULL );
+	}
+	for (i = 0; i < TAGLINE_OP_MAXVAL; i++) {
+		b->lat[i].min = UINT64_MAX;
+	}
+	return( b );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_start
+// Description  : Note the time and bus request counts at the start of an op
+//
+// Inputs       : b - the recorder of the thread running the op
+// Outputs      : none
+
+void tagline_bench_start(TaglineBench *b) {
+	memcpy(b->busmark, raid_bus_ops, sizeof(b->busmark));
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_stop
+// Description  : Record the latency, bus requests and bytes of a finished
+//                op, sampling the cache every bench_interval ops
+//
+// Inputs       : b - the recorder of the thread that ran the op
+//                op - the op
+// Outputs      : none
+
+void tagline_bench_stop(TaglineBench *b, TaglineTraceOp *op) {
+	TaglineHistogram *h = &b->lat[op->cmd];
+	TaglineBenchSample *s;
+	struct timespec now;
+	uint64_t nsec, done;
+	int i;
+
+	// Latency
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	nsec = bench_elapsed(&b->start, &now);
+	h->counts[hist_index(nsec)]++;
+	h->count++;
+	h->sum += nsec;
+	h->min = (nsec < h->min) ? nsec : h->min;
+	h->max = (nsec > h->max) ? nsec : h->max;
+
+	// The capabilities are dropped again at CLOSE, so note them here
+	if (op->cmd == TAGLINE_OP_INIT) {
+		bench_granted = raid_bus_capabilities;
+	}
+
+	// Bus requests and bytes (validation reads one block per data byte)
+	for (i = 0; i < RAID_MAXVAL; i++) {
+		b->busops[op->cmd][i] += raid_bus_ops[i] - b->busmark[i];
+	}
+	if ((op->cmd == TAGLINE_OP_READ) || (op->cmd == TAGLINE_OP_WRITE)) {
+		b->bytes[op->cmd] += (uint64_t)op->blocks * TAGLINE_BLOCK_SIZE;
+	} else if (op->cmd == TAGLINE_OP_VALIDATE) {
+		b->bytes[op->cmd] += (uint64_t)op->datalen * TAGLINE_BLOCK_SIZE;
+	}
+
+	// Cache timeline
+	done = __atomic_add_fetch(&bench_ops, 1, __ATOMIC_RELAXED);
+	if ((done % bench_interval) == 0) {
+		pthread_mutex_lock(&bench_lock);
+		if (bench_nsamples < bench_maxsamples) {
+			s = &bench_samples[bench_nsamples++];
+			s->ops = done;
+			s->nsec = bench_elapsed(&bench_begin, &now);
+			stats_raid_cache(&s->gets, &s->hits);
+		}
+		pthread_mutex_unlock(&bench_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_merge
+// Description  : Add the recordings of one recorder into another
+//
+// Inputs       : dst - the recorder to add to
+//                src - the recorder to add
+// Outputs      : none
+
+void tagline_bench_merge(TaglineBench *dst, TaglineBench *src) {
+	int i, j;
+
+	for (i = 0; i < TAGLINE_OP_MAXVAL; i++) {
+		for (j = 0; j < TAGLINE_BENCH_BUCKETS; j++) {
+			dst->lat[i].counts[j] += src->lat[i].counts[j];
+		}
+		dst->lat[i].count += src->lat[i].count;
+		dst->lat[i].sum += src->lat[i].sum;
+		dst->lat[i].min = (src->lat[i].min < dst->lat[i].min) ? src->lat[i].min : dst->lat[i].min;
+		dst->lat[i].max = (src->lat[i].max > dst->lat[i].max) ? src->lat[i].max : dst->lat[i].max;
+		dst->bytes[i] += src->bytes[i];
+		for (j = 0; j < RAID_MAXVAL; j++) {
+			dst->busops[i][j] += src->busops[i][j];
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : json_string
+// Description  : Write a JSON string literal
+//
+// Inputs       : fh - the output
+//                str - the string (NULL is written as null)
+// Outputs      : none
+
+static void json_string(FILE *fh, const char *str) {
+	if (str == NULL) {
+		fputs("null", fh);
+		return;
+	}
+	fputc('"', fh);
+	for (; *str; str++) {
+		if ((*str == '"') || (*str == '\\')) {
+			fprintf(fh, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(fh, "\\u%04x", *str);
+		} else {
+			fputc(*str, fh);
+		}
+	}
+	fputc('"', fh);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bench_report
+// Description  : Stop the benchmark clock and write the JSON report
+//
+// Inputs       : path - the file to write ("-" for stdout)
+//                b - the (merged) recorder
+//                wload - the workload replayed
+//                jobs - the number of replay threads
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_bench_report(const char *path, TaglineBench *b, const char *wload, int jobs) {
+	TaglineHistogram *h;
+	TaglineBenchSample *s, *prev;
+	struct timespec now;
+	uint64_t ops = 0, bytes = 0, bus[RAID_MAXVAL];
+	double secs;
+	FILE *fh;
+	int i, j, gets, hits, first, err;
+
+	// Totals over all op types
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = bench_elapsed(&bench_begin, &now) / 1e9;
+	memset(bus, 0, sizeof(bus));
+	for (i = 0; i < TAGLINE_OP_MAXVAL; i++) {
+		ops += b->lat[i].count;
+		bytes += b->bytes[i];
+		for (j = 0; j < RAID_MAXVAL; j++) {
+			bus[j] += b->busops[i][j];
+		}
+	}
+	stats_raid_cache(&gets, &hits);
+
+	if (strcmp(path, "-") == 0) {
+		fh = stdout;
+	} else if ((fh = fopen(path, "w")) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure opening the benchmark report [%s]", path);
+		return( -1 );
+	}
+
+	// The run
+	fprintf(fh, "{\n  \"workload\": ");
+	json_string(fh, wload);
+	fprintf(fh, ",\n  \"endpoint\": ");
+	json_string(fh, raid_network_endpoint);
+	fprintf(fh, ",\n  \"jobs\": %d,\n  \"capabilities\": { \"requested\": %u, \"granted\": %u },\n",
+			jobs, raid_bus_requested, bench_granted);
+	fprintf(fh, "  \"elapsed_sec\": %.6f,\n  \"ops\": %llu,\n  \"ops_per_sec\": %.1f,\n"
+			"  \"bytes\": %llu,\n  \"mb_per_sec\": %.3f,\n", secs, (unsigned long long)ops,
+			(secs > 0) ? ops / secs : 0.0, (unsigned long long)bytes,
+			(secs > 0) ? bytes / secs / (1024.0*1024.0) : 0.0);
+
+	// Per op type latency, bytes and bus requests per op
+	fprintf(fh, "  \"op_types\": {");
+	for (i = 0, first = 1; i < TAGLINE_OP_MAXVAL; i++) {
+		h = &b->lat[i];
+		if (h->count == 0) {
+			continue;
+		}
+		fprintf(fh, "%s\n    \"%s\": {\n      \"count\": %llu,\n      \"bytes\": %llu,\n",
+				first ? "" : ",", tagline_trace_opname(i), (unsigned long long)h->count,
+				(unsigned long long)b->bytes[i]);
+		fprintf(fh, "      \"latency_usec\": { \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, "
+				"\"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f },\n", h->min / 1e3,
+				(double)h->sum / h->count / 1e3, hist_percentile(h, 0.5) / 1e3,
+				hist_percentile(h, 0.99) / 1e3, hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+		fprintf(fh, "      \"bus_ops_per_op\": {");
+		for (j = 0; j < RAID_MAXVAL; j++) {
+			fprintf(fh, "%s \"%s\": %.3f", j ? "," : "", RAID_REQUEST_TYPE_LABELS[j],
+					(double)b->busops[i][j] / h->count);
+		}
+		fprintf(fh, " }\n    }");
+		first = 0;
+	}
+	fprintf(fh, "\n  },\n");
+
+	// Bus request totals
+	fprintf(fh, "  \"bus_ops\": {");
+	for (j = 0; j < RAID_MAXVAL; j++) {
+		fprintf(fh, "%s \"%s\": %llu", j ? "," : "", RAID_REQUEST_TYPE_LABELS[j],
+				(unsigned long long)bus[j]);
+	}
+	fprintf(fh, " },\n");
+
+	// Cache hit ratio, overall and per sampling window
+	fprintf(fh, "  \"cache\": {\n    \"gets\": %d,\n    \"hits\": %d,\n    \"hit_ratio\": %.4f,\n"
+			"    \"timeline\": [", gets, hits, (gets > 0) ? (double)hits / gets : 0.0);
+	for (i = 0, prev = NULL; i < bench_nsamples; prev = s, i++) {
+		s = &bench_samples[i];
+		gets = s->gets - (prev ? prev->gets : 0);
+		hits = s->hits - (prev ? prev->hits : 0);
+		fprintf(fh, "%s\n      { \"ops\": %llu, \"elapsed_sec\": %.6f, \"gets\": %d, \"hits\": %d, "
+				"\"hit_ratio\": %.4f }", i ? "," : "", (unsigned long long)s->ops, s->nsec / 1e9,
+				gets, hits, (gets > 0) ? (double)hits / gets : 0.0);
+	}
+	fprintf(fh, "\n    ]\n  }\n}\n");
+
+	err = ferror(fh);
+	if (((fh != stdout) && fclose(fh)) || err) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure writing the benchmark report [%s]", path);
+		return( -1 );
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Benchmark: %llu ops in %.3f sec (%.1f ops/s)", (unsigned long long)ops,
+			secs, (secs > 0) ? ops / secs : 0.0);
+	return( 0 );
+}
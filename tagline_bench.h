@@ -0,0 +1,70 @@
+#ifndef TAGLINE_BENCH_INCLUDED
+#define TAGLINE_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_bench.h
+//  Description   : This is the benchmark recorder for the tagline simulator
+//                  (tagline_client -B).  Every replayed op records its
+//                  latency in a log-linear (HDR style) histogram, the RAID
+//                  bus requests it caused and the bytes it moved, and the
+//                  cache hit ratio is sampled as the replay goes.  The
+//                  report is written as JSON so runs can be compared
+//                  across builds.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/20/15
+//
+
+// Include Files
+#include <stdint.h>
+#include <time.h>
+
+// Project Include Files
+#include <raid_bus.h>
+#include <tagline_trace.h>
+
+// Defines
+#define TAGLINE_BENCH_SUBBITS 7   // 128 linear buckets per power of two (<1% error)
+#define TAGLINE_BENCH_BUCKETS ((64 - TAGLINE_BENCH_SUBBITS + 1) << TAGLINE_BENCH_SUBBITS)
+#define TAGLINE_BENCH_SAMPLES 100 // Cache hit ratio samples over a replay
+
+// Type definitions
+typedef struct {
+	uint64_t count;                         // Values recorded
+	uint64_t sum;                           // Their total (for the mean)
+	uint64_t min;                           // Smallest value
+	uint64_t max;                           // Largest value
+	uint64_t counts[TAGLINE_BENCH_BUCKETS]; // Values per bucket
+} TaglineHistogram;
+
+typedef struct {
+	TaglineHistogram lat[TAGLINE_OP_MAXVAL];         // Latency (nsec) per op type
+	uint64_t bytes[TAGLINE_OP_MAXVAL];               // Block bytes moved per op type
+	uint64_t busops[TAGLINE_OP_MAXVAL][RAID_MAXVAL]; // Bus requests per op type
+	uint64_t busmark[RAID_MAXVAL];                   // raid_bus_ops at the op start
+	struct timespec start;                           // Time of the op start
+} TaglineBench;
+
+//
+// Functional Prototypes
+
+int tagline_bench_begin(uint32_t nops);
+	// Start the benchmark clock for a replay of nops ops
+
+TaglineBench *tagline_bench_alloc(void);
+	// Allocate a (per-thread) recorder
+
+void tagline_bench_start(TaglineBench *b);
+	// Note the start of an op on this thread
+
+void tagline_bench_stop(TaglineBench *b, TaglineTraceOp *op);
+	// Record a completed op
+
+void tagline_bench_merge(TaglineBench *dst, TaglineBench *src);
+	// Add the recordings of src into dst
+
+int tagline_bench_report(const char *path, TaglineBench *b, const char *wload, int jobs);
+	// Stop the clock and write the JSON report ("-" for stdout)
+
+#endif
@@ -0,0 +1,237 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_check.c
+//  Description   : This is the end-to-end block checking of the tagline
+//                  driver (see tagline_check.h): the CRC32C kernels, picked
+//                  once at run time, and the scrubber's configuration.  The
+//                  crc32 instruction takes three cycles to give its result
+//                  but can start one every cycle, so the SSE4.2 kernel runs
+//                  three chains over adjacent stretches of a block and
+//                  joins them by advancing a CRC over a stretch of zeros
+//                  (a table lookup, the CRC being linear).
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/27/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECK_X86 1
+#endif
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_check.h>
+
+// Defines
+#define CRC32C_POLY 0x82f63b78 // Castagnoli, reflected
+#define CRC_STRIDE  336        // Bytes per chain of the SSE4.2 kernel (3 fit a block)
+
+// Type definitions
+typedef uint32_t (*TaglineCrcFn)(uint32_t crc, const uint8_t *buf, size_t len);
+
+//
+// Global data
+int tagline_scrub_enabled = 0;                     // The scrubber is configured
+uint32_t tagline_scrub_rate = TAGLINE_SCRUB_RATE;  // Tagline blocks it checks a second
+uint32_t tagline_scrub_passes = 0;                 // Passes it makes, 0 for no end
+int tagline_scrub_hashing = 1;                     // Compare the copies' digests first
+static uint32_t crc_table[8][256];                 // Slicing-by-8 tables
+static uint32_t crc_shift[4][256];                 // Advance a CRC over CRC_STRIDE zeros
+static TaglineCrcFn crc_fn = NULL;                 // The kernel in use
+static const char *crc_name = "slice8";            // Its name
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_slice8
+// Description  : The portable kernel, eight bytes a step through eight
+//                tables
+//
+// Inputs       : crc - the running CRC (inverted)
+//                buf - the data
+//                len - its length
+// Outputs      : the running CRC
+
+static uint32_t crc_slice8(uint32_t crc, const uint8_t *buf, size_t len) {
+	uint64_t word;
+
+	for (; len >= sizeof(word); len -= sizeof(word), buf += sizeof(word)) {
+		memcpy(&word, buf, sizeof(word));
+		word ^= crc;
+		crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+			crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+			crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+			crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+	}
+	while (len--) {
+		crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	}
+	return( crc );
+}
+
+#ifdef CHECK_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_advance
+// Description  : Advance a running CRC over CRC_STRIDE zero bytes
+//
+// Inputs       : crc - the running CRC
+// Outputs      : the running CRC
+
+static inline uint32_t crc_advance(uint32_t crc) {
+	return( crc_shift[0][crc & 0xff] ^ crc_shift[1][(crc >> 8) & 0xff] ^
+		crc_shift[2][(crc >> 16) & 0xff] ^ crc_shift[3][crc >> 24] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_sse42
+// Description  : The SSE4.2 kernel, three interleaved crc32 chains over
+//                each 3 * CRC_STRIDE bytes, one chain for the rest
+//
+// Inputs       : crc - the running CRC (inverted)
+//                buf - the data
+//                len - its length
+// Outputs      : the running CRC
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *buf, size_t len) {
+	uint64_t word, acc = crc, acc1, acc2;
+	uint32_t i;
+
+	for (; len >= 3*CRC_STRIDE; len -= 3*CRC_STRIDE, buf += 3*CRC_STRIDE) {
+		for (acc1 = acc2 = 0, i = 0; i < CRC_STRIDE; i += sizeof(word)) {
+			memcpy(&word, buf + i, sizeof(word));
+			acc = _mm_crc32_u64(acc, word);
+			memcpy(&word, buf + CRC_STRIDE + i, sizeof(word));
+			acc1 = _mm_crc32_u64(acc1, word);
+			memcpy(&word, buf + 2*CRC_STRIDE + i, sizeof(word));
+			acc2 = _mm_crc32_u64(acc2, word);
+		}
+		acc = crc_advance(crc_advance((uint32_t)acc) ^ (uint32_t)acc1) ^ (uint32_t)acc2;
+	}
+	for (; len >= sizeof(word); len -= sizeof(word), buf += sizeof(word)) {
+		memcpy(&word, buf, sizeof(word));
+		acc = _mm_crc32_u64(acc, word);
+	}
+	crc = (uint32_t)acc;
+	while (len--) {
+		crc = _mm_crc32_u8(crc, *buf++);
+	}
+	return( crc );
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_select
+// Description  : Build the tables and pick the kernel for this CPU
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crc_select(void) {
+	static const uint8_t zeros[CRC_STRIDE];
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		for (crc = i, j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+		}
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crc_table[j][i] = crc_table[0][crc_table[j-1][i] & 0xff] ^ (crc_table[j-1][i] >> 8);
+		}
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 4; j++) {
+			crc_shift[j][i] = crc_slice8(i << (8*j), zeros, CRC_STRIDE);
+		}
+	}
+	crc_fn = crc_slice8;
+#ifdef CHECK_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc_fn = crc_sse42;
+		crc_name = "sse4.2";
+	}
+#endif
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_crc32c
+// Description  : The CRC32C (Castagnoli) of a buffer
+//
+// Inputs       : buf - the data
+//                len - its length
+// Outputs      : the CRC
+
+uint32_t tagline_crc32c(const void *buf, size_t len) {
+	pthread_once(&crc_once, crc_select);
+	return( ~crc_fn(~0U, (const uint8_t *)buf, len) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_crc_kernel
+// Description  : The name of the kernel in use
+//
+// Inputs       : none
+// Outputs      : "sse4.2" or "slice8"
+
+const char *tagline_crc_kernel(void) {
+	pthread_once(&crc_once, crc_select);
+	return( crc_name );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_scrub_configure
+// Description  : Turn the scrubber on with a configuration
+//
+// Inputs       : spec - the configuration (see tagline_check.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_scrub_configure(const char *spec) {
+	char *copy, *field, *save;
+	unsigned int value;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if ((sscanf(field, "rate=%u%c", &value, &extra) == 1) && (value > 0)) {
+			tagline_scrub_rate = value;
+		} else if (sscanf(field, "passes=%u%c", &value, &extra) == 1) {
+			tagline_scrub_passes = value;
+		} else if ((sscanf(field, "hash=%u%c", &value, &extra) == 1) && (value <= 1)) {
+			tagline_scrub_hashing = value;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad scrub field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	tagline_scrub_enabled = (ret == 0);
+	return( ret );
+}
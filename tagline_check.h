@@ -0,0 +1,54 @@
+#ifndef TAGLINE_CHECK_INCLUDED
+#define TAGLINE_CHECK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_check.h
+//  Description   : This is the end-to-end block checking of the tagline
+//                  driver.  Every tagline block keeps the CRC32C of what
+//                  was last written to it next to its physical block in
+//                  the tagline map, and each copy read off the array is
+//                  checked against it before it is used or cached.  The
+//                  kernel is the SSE4.2 crc32 instruction where the CPU
+//                  has it, or slicing-by-8 tables.  The driver's scrubber
+//                  (tagline_client -S) walks every live block and checks
+//                  both copies in the background, first by comparing the
+//                  digests the array computes for them (RAID_HASHBLOCK) and
+//                  only reading the blocks whose copies differ, configured
+//                  with comma separated fields:
+//
+//                    rate=<blocks/s>   tagline blocks checked a second (1000)
+//                    passes=<n>        passes over the array, 0 for no end (0)
+//                    hash=<0|1>        compare digests before reading (1)
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/27/15
+//
+
+// Include Files
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+#define TAGLINE_SCRUB_RATE 1000 // Default tagline blocks scrubbed a second
+
+//
+// Global data
+extern int tagline_scrub_enabled;      // The scrubber is configured
+extern uint32_t tagline_scrub_rate;    // Tagline blocks it checks a second
+extern uint32_t tagline_scrub_passes;  // Passes it makes, 0 for no end
+extern int tagline_scrub_hashing;      // Compare the copies' digests first
+
+//
+// Functional Prototypes
+
+uint32_t tagline_crc32c(const void *buf, size_t len);
+	// The CRC32C (Castagnoli) of a buffer
+
+const char *tagline_crc_kernel(void);
+	// The name of the kernel in use
+
+int tagline_scrub_configure(const char *spec);
+	// Turn the scrubber on with a configuration
+
+#endif
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_convert.c
+//  Description   : This is the workload converter.  It turns a text
+//                  workload into the binary trace format of tagline_trace.h
+//                  (or, with -d, any workload back into text) so large
+//                  workloads can be replayed without parsing them.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/19/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_trace.h>
+
+// Defines
+#define CONVERT_ARGUMENTS "hvd"
+#define USAGE \
+	"USAGE: tagline_convert [-h] [-v] [-d] <workload-file> <output-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -d - write the output as a text workload instead of a binary trace\n" \
+	"\n" \
+	"    <workload-file> - the text workload or binary trace to convert\n" \
+	"    <output-file> - the file to write\n" \
+	"\n" \
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload converter
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	TaglineTrace trace;
+	int ch, verbose = 0, text = 0, ret;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CONVERT_ARGUMENTS)) != -1) {
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf(stderr, USAGE);
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'd': // Write text
+			text = 1;
+			break;
+
+		default:  // Default (unknown)
+			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+			return( -1 );
+		}
+	}
+	if (optind + 2 != argc) {
+		fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+		return( -1 );
+	}
+	initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+	if (verbose) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	// Load, then write in the other format
+	if (tagline_trace_load(argv[optind], &trace)) {
+		return( -1 );
+	}
+	ret = text ? tagline_trace_save_text(argv[optind+1], &trace) : tagline_trace_save(argv[optind+1], &trace);
+	tagline_trace_free(&trace);
+	return( ret );
+}
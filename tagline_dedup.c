@@ -0,0 +1,364 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_dedup.c
+//  Description   : This is the block deduplication of the tagline driver
+//                  (see tagline_dedup.h).  Every block of the array (the
+//                  even disk of its pair, or an odd last disk) has a
+//                  reference count and the fingerprint of what was last
+//                  written to it (the counts alone when the driver only
+//                  shares blocks between snapshots and clones).  The index
+//                  is an open-addressed table
+//                  of block numbers, twice the array's size so it never
+//                  fills, probed linearly from the low bits of the digest
+//                  and compacted on removal (no tombstones).  A block is
+//                  only indexed once its write is on the array, so no
+//                  tagline is mapped to content still in flight.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/31/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_dedup.h>
+
+//
+// Global data
+int tagline_dedup_enabled = 0;            // Deduplication is turned on
+int tagline_dedup_counting = 0;           // Blocks are reference counted
+static uint32_t dedup_disk_blocks = 0;    // Blocks per disk
+static uint32_t dedup_nblocks = 0;        // Blocks of the array that can be mapped
+static uint32_t *dedup_refs = NULL;       // Tagline blocks mapping each block
+static uint64_t *dedup_digest = NULL;     // ... the digest of its content
+static uint32_t *dedup_crc = NULL;        // ... its CRC32C
+static uint8_t *dedup_indexed = NULL;     // ... it is in the index
+static uint32_t *dedup_table = NULL;      // The index, block index + 1 (0 empty)
+static uint32_t dedup_mask = 0;           // ... its size - 1
+static uint32_t *dedup_free = NULL;       // Stack of blocks nothing maps
+static uint32_t dedup_nfree = 0;          // ... its depth
+static uint64_t dedup_blocks = 0;         // Tagline blocks written
+static uint64_t dedup_stored = 0;         // ... already stored, not written again
+static uint64_t dedup_copied = 0;         // ... copied on write off a shared block
+static uint64_t dedup_reused = 0;         // Blocks reused after nothing mapped them
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_index_of
+// Description  : Turn a physical block into an index of the tables
+//
+// Inputs       : block - the physical block
+// Outputs      : the index
+
+static inline uint32_t dedup_index_of(uint64_t block) {
+	return( (uint32_t)((block / dedup_disk_blocks / 2) * dedup_disk_blocks + block % dedup_disk_blocks) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_block_of
+// Description  : Turn an index of the tables back into a physical block
+//
+// Inputs       : index - the index
+// Outputs      : the physical block
+
+static inline uint64_t dedup_block_of(uint32_t index) {
+	return( (uint64_t)(index / dedup_disk_blocks) * 2 * dedup_disk_blocks + index % dedup_disk_blocks );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_slot
+// Description  : Find the slot of the index holding a fingerprint, or the
+//                empty slot that ends its probe
+//
+// Inputs       : digest - the content's digest
+//                crc - its CRC32C
+// Outputs      : the slot
+
+static uint32_t dedup_slot(uint64_t digest, uint32_t crc) {
+	uint32_t slot = (uint32_t)digest & dedup_mask, index;
+
+	while (dedup_table[slot] != 0) {
+		index = dedup_table[slot] - 1;
+		if ((dedup_digest[index] == digest) && (dedup_crc[index] == crc)) {
+			break;
+		}
+		slot = (slot + 1) & dedup_mask;
+	}
+	return( slot );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_remove
+// Description  : Take a block out of the index, moving the entries after
+//                it back so no probe runs into the hole
+//
+// Inputs       : index - the block's index
+// Outputs      : none
+
+static void dedup_remove(uint32_t index) {
+	uint32_t slot = dedup_slot(dedup_digest[index], dedup_crc[index]), next, home;
+
+	dedup_indexed[index] = 0;
+	dedup_table[slot] = 0;
+	for (next = (slot + 1) & dedup_mask; dedup_table[next] != 0; next = (next + 1) & dedup_mask) {
+		// an entry moves back if the hole lies between its home and it
+		home = (uint32_t)dedup_digest[dedup_table[next] - 1] & dedup_mask;
+		if (((next - home) & dedup_mask) >= ((next - slot) & dedup_mask)) {
+			dedup_table[slot] = dedup_table[next];
+			dedup_table[next] = 0;
+			slot = next;
+		}
+	}
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_init
+// Description  : Size the reference counts and, with deduplication, the
+//                index for the array
+//
+// Inputs       : geo - the array geometry
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_dedup_init(const TaglineGeometry *geo) {
+	uint32_t size;
+
+	tagline_dedup_close();
+	dedup_disk_blocks = geo->disk_blocks;
+	dedup_nblocks = ((geo->disks + 1) / 2) * geo->disk_blocks;
+	for (size = 1; size < 2 * dedup_nblocks; size *= 2);
+	dedup_mask = size - 1;
+	dedup_refs = calloc(dedup_nblocks, sizeof(uint32_t));
+	dedup_indexed = calloc(dedup_nblocks, sizeof(uint8_t));
+	dedup_free = malloc(dedup_nblocks * sizeof(uint32_t));
+	if (tagline_dedup_enabled) {
+		dedup_digest = malloc(dedup_nblocks * sizeof(uint64_t));
+		dedup_crc = malloc(dedup_nblocks * sizeof(uint32_t));
+		dedup_table = calloc(size, sizeof(uint32_t));
+	}
+	if ((dedup_refs == NULL) || (dedup_indexed == NULL) || (dedup_free == NULL) || (tagline_dedup_enabled &&
+			((dedup_digest == NULL) || (dedup_crc == NULL) || (dedup_table == NULL)))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "DEDUP : failed allocating the index of %u blocks.", dedup_nblocks);
+		tagline_dedup_close();
+		return( -1 );
+	}
+	dedup_nfree = 0;
+	dedup_blocks = dedup_stored = dedup_copied = dedup_reused = 0;
+	tagline_dedup_counting = 1;
+	if (tagline_dedup_enabled) {
+		RAID_LOG(LOG_INFO_LEVEL, "DEDUP : indexing %u blocks in %u slots.", dedup_nblocks, size);
+	} else {
+		RAID_LOG(LOG_INFO_LEVEL, "DEDUP : counting the references to %u blocks.", dedup_nblocks);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_close
+// Description  : Log the deduplication figures and release the index
+//
+// Inputs       : none
+// Outputs      : none
+
+void tagline_dedup_close(void) {
+	uint64_t unique;
+	uint32_t i, mapped = 0;
+
+	if (dedup_refs != NULL) {
+		for (i = 0; i < dedup_nblocks; i++) {
+			mapped += (dedup_refs[i] > 0);
+		}
+		unique = dedup_blocks - dedup_stored;
+		if (tagline_dedup_enabled) {
+			RAID_LOG(LOG_INFO_LEVEL, "DEDUP : %llu blocks written, %llu already stored (dedup ratio %.2f, %llu bus writes saved), "
+					"%llu copied on write, %llu blocks reused, %u blocks mapped.",
+					(unsigned long long)dedup_blocks, (unsigned long long)dedup_stored,
+					(unique > 0) ? (double)dedup_blocks / unique : 0.0, (unsigned long long)(2 * dedup_stored),
+					(unsigned long long)dedup_copied, (unsigned long long)dedup_reused, mapped);
+		} else {
+			RAID_LOG(LOG_INFO_LEVEL, "DEDUP : %llu shared blocks copied on write, %llu blocks reused, %u blocks mapped.",
+					(unsigned long long)dedup_copied, (unsigned long long)dedup_reused, mapped);
+		}
+	}
+	free(dedup_refs);
+	free(dedup_digest);
+	free(dedup_crc);
+	free(dedup_indexed);
+	free(dedup_table);
+	free(dedup_free);
+	dedup_refs = NULL;
+	dedup_digest = NULL;
+	dedup_crc = NULL;
+	dedup_indexed = NULL;
+	dedup_table = NULL;
+	dedup_free = NULL;
+	dedup_nblocks = dedup_nfree = 0;
+	tagline_dedup_counting = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_find
+// Description  : The stored block with this content
+//
+// Inputs       : digest - the content's RAID_HASHBLOCK digest
+//                crc - its CRC32C
+// Outputs      : the physical block, TAGLINE_UNMAPPED if none
+
+uint64_t tagline_dedup_find(uint64_t digest, uint32_t crc) {
+	uint32_t slot = dedup_slot(digest, crc);
+
+	if (dedup_table[slot] == 0) {
+		return( TAGLINE_UNMAPPED );
+	}
+	return( dedup_block_of(dedup_table[slot] - 1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_refs
+// Description  : The tagline blocks mapping a physical block
+//
+// Inputs       : block - the physical block
+// Outputs      : the count
+
+uint32_t tagline_dedup_refs(uint64_t block) {
+	return( dedup_refs[dedup_index_of(block)] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_ref
+// Description  : Another tagline block maps a physical block
+//
+// Inputs       : block - the physical block
+// Outputs      : none
+
+void tagline_dedup_ref(uint64_t block) {
+	dedup_refs[dedup_index_of(block)]++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_release
+// Description  : A tagline block no longer maps a physical block, the last
+//                one leaving takes it out of the index and frees it
+//
+// Inputs       : block - the physical block
+// Outputs      : 1 if nothing maps the block any more, 0 if not
+
+int tagline_dedup_release(uint64_t block) {
+	uint32_t index = dedup_index_of(block);
+
+	if ((dedup_refs[index] == 0) || (--dedup_refs[index] > 0)) {
+		return( 0 );
+	}
+	if (dedup_indexed[index]) {
+		dedup_remove(index);
+	}
+	dedup_free[dedup_nfree++] = index;
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_index
+// Description  : A block's content landed on the array, make it findable
+//                (unless other content is found there by now, or another
+//                block already holds the same)
+//
+// Inputs       : block - the physical block
+//                digest - the content's digest
+//                crc - its CRC32C
+// Outputs      : none
+
+void tagline_dedup_index(uint64_t block, uint64_t digest, uint32_t crc) {
+	uint32_t index = dedup_index_of(block), slot;
+
+	if ((dedup_refs[index] == 0) || dedup_indexed[index]) {
+		return;
+	}
+	slot = dedup_slot(digest, crc);
+	if (dedup_table[slot] == 0) {
+		dedup_digest[index] = digest;
+		dedup_crc[index] = crc;
+		dedup_indexed[index] = 1;
+		dedup_table[slot] = index + 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_unindex
+// Description  : A block is about to be overwritten in place, stop finding
+//                its old content there
+//
+// Inputs       : block - the physical block
+// Outputs      : none
+
+void tagline_dedup_unindex(uint64_t block) {
+	uint32_t index = dedup_index_of(block);
+
+	if (dedup_indexed[index]) {
+		dedup_remove(index);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_reuse
+// Description  : Take a block nothing maps, the most recently freed first
+//
+// Inputs       : none
+// Outputs      : the physical block, TAGLINE_UNMAPPED if none
+
+uint64_t tagline_dedup_reuse(void) {
+	if (dedup_nfree == 0) {
+		return( TAGLINE_UNMAPPED );
+	}
+	dedup_reused++;
+	return( dedup_block_of(dedup_free[--dedup_nfree]) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_free_blocks
+// Description  : Blocks nothing maps, ready for reuse
+//
+// Inputs       : none
+// Outputs      : the number of blocks
+
+uint32_t tagline_dedup_free_blocks(void) {
+	return( dedup_nfree );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_written
+// Description  : Count a tagline write
+//
+// Inputs       : blocks - the blocks written
+//                stored - those already stored, mapped to the stored copy
+//                copied - those copied on write off a shared block
+// Outputs      : none
+
+void tagline_dedup_written(uint32_t blocks, uint32_t stored, uint32_t copied) {
+	dedup_blocks += blocks;
+	dedup_stored += stored;
+	dedup_copied += copied;
+}
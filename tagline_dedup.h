@@ -0,0 +1,80 @@
+#ifndef TAGLINE_DEDUP_INCLUDED
+#define TAGLINE_DEDUP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_dedup.h
+//  Description   : This is the block deduplication of the tagline driver.
+//                  Once turned on (tagline_client -D), every physical block
+//                  keeps a count of the tagline blocks mapping it, and an
+//                  index finds a stored block by its content, the 64-bit
+//                  RAID_HASHBLOCK digest and the CRC32C together.  A write
+//                  of content already stored maps the tagline block to the
+//                  stored copy instead of writing it again, an overwrite of
+//                  a shared block goes to a new one (copy-on-write), and a
+//                  block nothing maps any more is reused.  The cache is
+//                  keyed by physical block, so taglines holding the same
+//                  content share its cache entry.  Deduplication needs the
+//                  in-place allocator (no -L).
+//
+//                  Snapshots and clones (tagline_snapshot, tagline_clone)
+//                  share blocks the same way.  Without deduplication, the
+//                  driver starts the reference counts (and nothing else) on
+//                  the first one, and overwrites of a shared block go to a
+//                  new one.
+//
+//                  The index does no locking of its own, the driver calls
+//                  it with allocLock held.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/31/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <tagline_driver.h>
+
+//
+// Global data
+extern int tagline_dedup_enabled;  // Deduplication is turned on
+extern int tagline_dedup_counting; // Blocks are reference counted (dedup, snapshots)
+
+//
+// Functional Prototypes
+
+int tagline_dedup_init(const TaglineGeometry *geo);
+	// Size the reference counts and (with deduplication) the index for the array
+
+void tagline_dedup_close(void);
+	// Log the deduplication figures and release the index
+
+uint64_t tagline_dedup_find(uint64_t digest, uint32_t crc);
+	// The stored block with this content, TAGLINE_UNMAPPED if none
+
+uint32_t tagline_dedup_refs(uint64_t block);
+	// The tagline blocks mapping a physical block
+
+void tagline_dedup_ref(uint64_t block);
+	// Another tagline block maps a physical block
+
+int tagline_dedup_release(uint64_t block);
+	// A tagline block no longer maps a physical block, 1 if nothing does
+
+void tagline_dedup_index(uint64_t block, uint64_t digest, uint32_t crc);
+	// A block's content landed on the array, make it findable
+
+void tagline_dedup_unindex(uint64_t block);
+	// A block is about to be overwritten in place, stop finding it
+
+uint64_t tagline_dedup_reuse(void);
+	// Take a block nothing maps, TAGLINE_UNMAPPED if none
+
+uint32_t tagline_dedup_free_blocks(void);
+	// Blocks nothing maps, ready for reuse
+
+void tagline_dedup_written(uint32_t blocks, uint32_t stored, uint32_t copied);
+	// Count a tagline write, its blocks already stored and copied on write
+
+#endif
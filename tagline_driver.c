@@ -8,219 +8,1976 @@
 //  Created        : 11/27/15
 
 // Include Files
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <cmpsc311_log.h>
+#include "raid_log.h"
 
 // Project Includes
 #include "raid_bus.h"
+#include "raid_array.h"
+#include "raid_network.h"
+#include "raid_sched.h"
+#include "raid_elevator.h"
 #include "tagline_driver.h"
+#include "tagline_log.h"
+#include "tagline_check.h"
+#include "tagline_dedup.h"
+#include "tagline_layout.h"
 #include "raid_cache.h"
 
-//temptemptempkdfks
+// Type definitions
+typedef struct {
+	uint64_t *block;     // Physical block of each tagline block (TAGLINE_UNMAPPED if unwritten)
+	uint32_t *crc;       // CRC32C of what was last written to each tagline block
+	uint32_t  size;      // Entries in block and crc, grown as the tagline grows
+	uint32_t  writing;   // Writes of the tagline in flight
+	int       scrubbing; // The scrubber is checking one of its blocks
+	int       snapshot;  // A read-only snapshot, until it is deleted
+} TaglineMap;
+
+typedef struct {
+	uint64_t   *blocks; // Live blocks of the segment being cleaned
+	uint64_t   *owners; // ... the tagline blocks they hold
+	uint64_t   *moved;  // ... where they were moved to
+	char       *data;   // ... their contents
+	RAIDOpCode *ops;    // Bus requests moving them
+	RAIDOpCode *resps;  // ... their responses
+	void      **bufs;   // ... their payloads
+	uint32_t   *sums;   // ... the CRC32C of each block
+} TaglineCleaner;
+
+typedef struct {
+	TagLineNumber      tag;      // Next tagline block to check
+	TagLineBlockNumber bnum;     // ...
+	uint32_t           passes;   // Passes over the array finished
+	uint64_t           found;    // Tagline blocks checked in this pass
+	uint64_t           checked;  // Tagline blocks checked
+	uint64_t           repaired; // Bad copies rewritten from the good one
+	uint64_t           lost;     // Blocks with no good copy
+	uint64_t           hashed;   // Bytes of digests the array sent
+	uint64_t           copied;   // Bytes of blocks read and rewritten
+	uint64_t           blocks[RAID_MAX_XFER];     // Physical blocks being checked
+	uint32_t           sums[RAID_MAX_XFER];       // ... the CRC32C of each
+	uint64_t           digests[2][RAID_MAX_XFER]; // ... the digests of both copies
+	uint8_t            differ[RAID_MAX_XFER];     // ... the copies may differ
+	RAIDOpCode         ops[2*RAID_MAX_XFER];      // Bus requests hashing them
+	RAIDOpCode         resps[2*RAID_MAX_XFER];    // ... their responses
+	void              *bufs[2*RAID_MAX_XFER];     // ... their payloads
+	char               data[2*RAID_BLOCK_SIZE];   // Both copies of a block
+} TaglineScrubber;
 
 // Global Variables
-int diskNum = 0;
-int diskBlockNum = 0;
-int **diskArray_ptr;
-int **diskBlockArray_ptr;
-// number of blocks written on specific disk
-int numOfBlocksArray[9];
-int cacheInsert = 0;
-int cacheGet = 0;
-int cacheHit = 0;
-int cacheMiss = 0;
+TaglineGeometry geometry;
+uint32_t maxLines = 0;
+uint32_t diskNum = 0;
+uint32_t diskBlockNum = 0;
+// physical block (disk * blocks per disk + block) of every tagline block
+TaglineMap *taglineMap = NULL;
+// number of blocks written on specific disk (and the partner of an odd last disk)
+uint32_t *numOfBlocksArray = NULL;
+// guards block allocation (the tables above) between replay threads
+pthread_mutex_t allocLock = PTHREAD_MUTEX_INITIALIZER;
+// the log cleaner (log-structured allocation), its flags are guarded by allocLock
+TaglineCleaner cleaner;
+pthread_t cleanThread;
+int cleanRunning = 0, cleanStop = 0, cleanPaused = 0, cleanBusy = 0, cleanStuck = 0, cleanWaiters = 0;
+pthread_cond_t cleanKick = PTHREAD_COND_INITIALIZER; // the cleaner may have work
+pthread_cond_t cleanDone = PTHREAD_COND_INITIALIZER; // the cleaner freed space, gave up or stopped
+// the scrubber, its flags and the read checks' counts are guarded by allocLock
+TaglineScrubber scrubber;
+pthread_t scrubThread;
+int scrubRunning = 0, scrubStop = 0, scrubPaused = 0, scrubBusy = 0;
+uint64_t checkFailed = 0, checkRepaired = 0;
+pthread_cond_t scrubKick = PTHREAD_COND_INITIALIZER; // stop or pause the scrubber
+pthread_cond_t scrubDone = PTHREAD_COND_INITIALIZER; // the scrubber is done with a block
+pthread_cond_t writeDone = PTHREAD_COND_INITIALIZER; // a tagline has no more writes in flight
+
+//
+// Functional Prototypes
+
+static int tagline_map_range(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks);
+static int tagline_map_grow(TaglineMap *map, uint32_t size);
+static int tagline_read_misses(TagLineNumber tag, TagLineBlockNumber bnum, RAIDOpCode *ops, void **bufs,
+		int *miss, uint64_t *placed, uint32_t *sums, int n);
+static int tagline_bus_runs(RAID_REQUEST_TYPES type, uint64_t *blocks, uint32_t n, char *data,
+		RAIDOpCode *ops, void **bufs, char *mirror, int merge);
+static int tagline_write_landed(TagLineNumber tag, uint64_t *placed, uint32_t blks, RAIDOpCode *ops, void **bufs,
+		char *mirror, RAIDOpCode *resps, int n, int *landed);
+static void tagline_write_install(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *old,
+		uint64_t *mapped, uint64_t *placed, uint32_t *sums, int *landed);
+static int tagline_write_release(uint64_t block);
+static uint64_t tagline_place_room(void);
+static uint64_t tagline_place(void);
+static void tagline_place_full(TagLineNumber tag, uint64_t needed);
+static int tagline_dedup_map(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *digests,
+		uint32_t *sums, uint64_t *mapped, uint64_t *placed);
+static uint64_t tagline_log_place(TAGLINE_LOG_HEADS head, TagLineNumber tag, TagLineBlockNumber bnum);
+static int tagline_log_append(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *placed);
+static void tagline_log_released(void);
+static void tagline_log_finish(uint64_t *blocks, uint32_t n);
+static int tagline_clean_start(void);
+static void tagline_clean_stop(void);
+static void tagline_clean_pause(int pause);
+static void *tagline_clean_thread(void *arg);
+static int tagline_clean_segment(uint32_t seg);
+static int tagline_check_mirror(TagLineNumber tag, RAID_SCHED_CLASSES cls, uint64_t block, uint32_t sum,
+		char *buf, int repair);
+static int tagline_scrub_start(void);
+static void tagline_scrub_stop(void);
+static void tagline_scrub_pause(int pause);
+static void *tagline_scrub_thread(void *arg);
+static void tagline_scrub_hash(uint32_t n);
+static int tagline_scrub_block(uint64_t block, uint32_t sum);
+static int tagline_mirror_sync(RAIDDiskID src, RAIDDiskID dst, uint32_t blocks, uint32_t *copied);
+static int tagline_decluster_rebuild(RAIDDiskID failed);
+static int tagline_share(TagLineNumber src, TagLineNumber dst, int snapshot);
+static void tagline_free_tables(void);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_driver_init
+// Description  : Initialize the driver with a number of maximum lines to process
+//
+// Inputs       : maxlines - the maximum number of tag lines in the system
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_driver_init(uint32_t maxlines) {
+	return(tagline_driver_init_geometry(maxlines, &tagline_geometry_default));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_driver_init_geometry
+// Description  : Initialize the driver for an array of the given geometry
+//
+// Inputs       : maxlines - the maximum number of tag lines in the system
+//                geo - the array geometry
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_driver_init_geometry(uint32_t maxlines, const TaglineGeometry *geo) {
+	RAIDOpCode raidOpCode;
+	RAIDOpCode returnOpCode;
+	uint32_t i;
+	uint8_t temp;
+
+	// size the tables for the geometry, taglines are mapped as they grow
+	tagline_free_tables();
+	taglineMap = (TaglineMap *) calloc(maxlines, sizeof(TaglineMap));
+	numOfBlocksArray = (uint32_t *) calloc(geo->disks, sizeof(uint32_t));
+	if((taglineMap == NULL) || (numOfBlocksArray == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : failed allocating the tables for %u taglines.", maxlines);
+		tagline_free_tables();
+		return(-1);
+	}
+	geometry = *geo;
+	maxLines = maxlines;
+	diskNum = 0;
+	diskBlockNum = 0;
+	
+	// initialize driver
+	temp = (uint8_t) (geometry.disk_blocks / RAID_TRACK_BLOCKS);
+	raidOpCode = create_raid_request(RAID_INIT, temp, (RAIDDiskID) geometry.disks, (RAIDBlockID) 0);
+	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
+	if(extract_raid_response(raidOpCode, returnOpCode)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : array failed INIT of %u disks of %u blocks.", geometry.disks, geometry.disk_blocks);
+		tagline_free_tables();
+		return(-1);
+	}
+	
+	// format each disk
+	for(i = 0; i < geometry.disks; i++) {
+		raidOpCode = create_raid_request(RAID_FORMAT, 0, i, 0);
+        	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
+		
+        	//extract raid opcode
+        	if(extract_raid_response(raidOpCode, returnOpCode)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : array failed FORMAT of disk %u.", i);
+			tagline_close();
+			return(-1);
+		}
+	}
+	
+	// initliaze cache, the layout of the copies, the op queues if they are
+	// scheduled, the log and its cleaner if allocation is log-structured,
+	// and the scrubber, undoing it all (as a close does) if any fails
+	if(init_raid_cache(geometry.cache_blocks) || tagline_layout_init(&geometry) || raid_sched_init(maxlines) ||
+			(tagline_log_enabled && (tagline_log_init(&geometry) || tagline_clean_start())) ||
+			(tagline_dedup_enabled && tagline_dedup_init(&geometry)) ||
+			(tagline_scrub_enabled && tagline_scrub_start())) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : failed initializing the driver for %u taglines.", maxlines);
+		tagline_close();
+		return(-1);
+	}
+	
+	RAID_LOG(LOG_INFO_LEVEL, "CACHE: initialized storage (maxsize = %u", geometry.cache_blocks);	
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE: array of %u disks of %u blocks, %u blocks per tagline",
+			geometry.disks, geometry.disk_blocks, geometry.tagline_blocks);
+
+	// Return successfully
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE: initialized storage (maxline=%u)", maxlines);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_read
+// Description  : Read a number of blocks from the tagline driver
+//
+// Inputs       : tag - the number of the tagline to read from
+//                bnum -<F3> the starting block to read from
+//                blks - the number of blocks to read
+//                bug - memory block to read the blocks into
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
+	RAIDOpCode ops[TAGLINE_MAX_XFER];
+	void *bufs[TAGLINE_MAX_XFER];
+	RAIDDiskID diskLocation;
+	RAIDBlockID diskBlockLocation;
+	uint64_t placed[TAGLINE_MAX_XFER];
+	uint32_t sums[TAGLINE_MAX_XFER];
+	int miss[TAGLINE_MAX_XFER];
+	int waits[TAGLINE_MAX_XFER];
+	void *flights[TAGLINE_MAX_XFER];
+	int i, n, w, reads, bad;
+
+	if(tagline_map_range(tag, bnum, blks)) {
+		return(-1);
+	}
+
+	// retreive disk and diskBlock location(number) of every block, a log
+	// holds them so the cleaner does not move them under the read
+	if(tagline_log_enabled) {
+		pthread_mutex_lock(&allocLock);
+	}
+	for(i = 0; i < blks; i++) {
+		if(tagline_map_lookup(tag, bnum+i, &diskLocation, &diskBlockLocation)) {
+			if(tagline_log_enabled) {
+				tagline_log_finish(placed, i);
+				pthread_mutex_unlock(&allocLock);
+			}
+			RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : read of unwritten block %u of tagline %u.", bnum+i, tag);
+			return(-1);
+		}
+		placed[i] = (uint64_t)diskLocation*geometry.disk_blocks + diskBlockLocation;
+		sums[i] = taglineMap[tag].crc[bnum+i];
+		if(tagline_log_enabled) {
+			tagline_log_hold(placed[i]);
+		}
+	}
+	if(tagline_log_enabled) {
+		pthread_mutex_unlock(&allocLock);
+	}
+
+	// serve what we can from the cache, queue a read for the misses no
+	// other reader has in flight and wait for the rest
+	n = 0;
+	w = 0;
+	for(i = 0; i < blks; i++) {
+		diskLocation = (RAIDDiskID) (placed[i] / geometry.disk_blocks);
+		diskBlockLocation = (RAIDBlockID) (placed[i] % geometry.disk_blocks);
+
+		// hits are copied straight into buf
+		switch(claim_raid_cache(diskLocation, diskBlockLocation, buf+i*RAID_BLOCK_SIZE, &flights[w])) {
+		case RAID_CACHE_MISS:
+			tagline_layout_locate(placed[i], 0, &diskLocation, &diskBlockLocation);
+			ops[n] = create_raid_request(RAID_READ, 1, diskLocation, diskBlockLocation);
+			miss[n] = i;
+			bufs[n++] = buf+i*RAID_BLOCK_SIZE;
+			break;
+		case RAID_CACHE_WAIT:
+			waits[w++] = i;
+			break;
+		}
+	}
+
+	// read our misses in one go before waiting on anyone else's, then read
+	// the blocks whose other reader failed
+	reads = n;
+	bad = (n > 0) && tagline_read_misses(tag, bnum, ops, bufs, miss, placed, sums, n);
+	for(n = 0, i = 0; i < w; i++) {
+		if(wait_raid_cache(flights[i], buf+waits[i]*RAID_BLOCK_SIZE)) {
+			tagline_layout_locate(placed[waits[i]], 0, &diskLocation, &diskBlockLocation);
+			ops[n] = create_raid_request(RAID_READ, 1, diskLocation, diskBlockLocation);
+			miss[n] = waits[i];
+			bufs[n++] = buf+waits[i]*RAID_BLOCK_SIZE;
+		}
+	}
+	reads += n;
+	if((n > 0) && !bad) {
+		bad = tagline_read_misses(tag, bnum, ops, bufs, miss, placed, sums, n);
+	}
+	if(tagline_log_enabled) {
+		pthread_mutex_lock(&allocLock);
+		tagline_log_finish(placed, blks);
+		pthread_mutex_unlock(&allocLock);
+	}
+	if(bad) {
+		return(-1);
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : read %u blocks from tagline %u, starting block %u (%d from disk).", blks, tag, bnum, reads);
+
+	// Return successfully
+	return(0);
+}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write
+// Description  : Write a number of blocks from the tagline driver
+//
+// Inputs       : tag - the number of the tagline to write from
+//                bnum - the starting block to write from
+//                blks - the number of blocks to write
+//                bug - the place to write the blocks into
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
+	RAIDOpCode ops[2*TAGLINE_MAX_XFER];
+	RAIDOpCode resps[2*TAGLINE_MAX_XFER];
+	void *bufs[2*TAGLINE_MAX_XFER];
+	char mirror[2*TAGLINE_MAX_XFER];
+	uint64_t *block, placed[TAGLINE_MAX_XFER], mapped[TAGLINE_MAX_XFER], old[TAGLINE_MAX_XFER], digests[TAGLINE_MAX_XFER], needed;
+	uint32_t sums[TAGLINE_MAX_XFER], copied = 0;
+	int landed[TAGLINE_MAX_XFER], i, n, ret;
+
+	if(tagline_map_range(tag, bnum, blks)) {
+		return(-1);
+	}
+	for(i = 0; i < blks; i++) {
+		sums[i] = tagline_crc32c(buf+i*RAID_BLOCK_SIZE, RAID_BLOCK_SIZE);
+		if(tagline_dedup_enabled) {
+			digests[i] = raid_block_hash(buf+i*RAID_BLOCK_SIZE);
+		}
+	}
+
+	// make room in the map and check the array can take the new blocks
+	pthread_mutex_lock(&allocLock);
+	if(taglineMap[tag].snapshot) {
+		pthread_mutex_unlock(&allocLock);
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : tagline %u is a snapshot, not written.", tag);
+		return(-1);
+	}
+	if(tagline_map_grow(&taglineMap[tag], bnum+blks)) {
+		pthread_mutex_unlock(&allocLock);
+		return(-1);
+	}
+
+	// a log puts every block at its head, overwrites included
+	if(tagline_log_enabled) {
+		if(tagline_log_append(tag, bnum, blks, placed)) {
+			pthread_mutex_unlock(&allocLock);
+			return(-1);
+		}
+		memcpy(mapped, placed, blks*sizeof(uint64_t));
+	}
+	else {
+		// overwrites go in place, so not under the scrubber's reads
+		while(taglineMap[tag].scrubbing) {
+			pthread_cond_wait(&scrubDone, &allocLock);
+		}
+
+		// content already stored is mapped rather than written again
+		if(tagline_dedup_enabled) {
+			if(tagline_dedup_map(tag, bnum, blks, digests, sums, mapped, placed)) {
+				pthread_mutex_unlock(&allocLock);
+				return(-1);
+			}
+		}
+		else {
+			block = &taglineMap[tag].block[bnum];
+			for(needed = 0, i = 0; i < blks; i++) {
+				needed += (block[i] == TAGLINE_UNMAPPED) ||
+						(tagline_dedup_counting && (tagline_dedup_refs(block[i]) > 1));
+			}
+			if(needed > tagline_place_room() + (tagline_dedup_counting ? tagline_dedup_free_blocks() : 0)) {
+				pthread_mutex_unlock(&allocLock);
+				tagline_place_full(tag, needed);
+				return(-1);
+			}
+
+			// place every new block, overwrites go back to where the block already lives
+			// unless a snapshot or clone shares it (copy-on-write, whole blocks
+			// so nothing is read)
+			for(i = 0; i < blks; i++) {	
+				mapped[i] = block[i];
+				if(tagline_dedup_counting && (block[i] != TAGLINE_UNMAPPED) && (tagline_dedup_refs(block[i]) > 1)) {
+					mapped[i] = TAGLINE_UNMAPPED;
+					copied++;
+				}
+				if(mapped[i] == TAGLINE_UNMAPPED) {
+					mapped[i] = tagline_dedup_counting ? tagline_dedup_reuse() : TAGLINE_UNMAPPED;
+					if(mapped[i] == TAGLINE_UNMAPPED) {
+						mapped[i] = tagline_place();
+					}
+					if(tagline_dedup_counting) {
+						tagline_dedup_ref(mapped[i]);
+					}
+				}
+				placed[i] = mapped[i];
+			}
+			if(tagline_dedup_counting) {
+				tagline_dedup_written(blks, 0, copied);
+			}
+		}
+	}
+	// the map and checksums keep what they had until the blocks are written
+	memcpy(&old[0], &taglineMap[tag].block[bnum], blks*sizeof(uint64_t));
+	taglineMap[tag].writing++;
+	pthread_mutex_unlock(&allocLock);
+
+	// ship the primary and backup writes together (appends to a log go as
+	// runs of adjacent blocks), then update the cache
+	n = tagline_bus_runs(RAID_WRITE, placed, blks, buf, ops, bufs, mirror, tagline_log_enabled);
+	ret = (n > 0) ? raid_sched_batch(tag, RAID_SCHED_FOREGROUND, ops, bufs, resps, n) : 0;
+	if(ret == 0) {
+		ret = tagline_write_landed(tag, placed, blks, ops, bufs, mirror, resps, n, landed);
+	}
+	else {
+		memset(landed, 0, sizeof(landed));
+	}
+
+	// map the blocks that landed, and they are found by their content
+	// once every copy is on the array
+	pthread_mutex_lock(&allocLock);
+	tagline_write_install(tag, bnum, blks, old, mapped, placed, sums, landed);
+	if(--taglineMap[tag].writing == 0) {
+		pthread_cond_broadcast(&writeDone);
+	}
+	if(tagline_log_enabled) {
+		tagline_log_finish(placed, blks);
+	}
+	for(i = 0; tagline_dedup_enabled && (i < blks); i++) {
+		if((placed[i] != TAGLINE_UNMAPPED) && (landed[i] == tagline_layout_copies(placed[i]))) {
+			tagline_dedup_index(placed[i], digests[i], sums[i]);
+		}
+	}
+	pthread_mutex_unlock(&allocLock);
+
+	// what the cache held for these blocks may no longer be on the array,
+	// and what was written may not be either
+	if(ret) {
+		for(i = 0; i < blks; i++) {
+			drop_raid_cache((RAIDDiskID) (mapped[i] / geometry.disk_blocks), (RAIDBlockID) (mapped[i] % geometry.disk_blocks));
+			if(!tagline_dedup_enabled && (tagline_layout_copies(mapped[i]) == 2)) {
+				drop_raid_cache((RAIDDiskID) (mapped[i] / geometry.disk_blocks + 1), (RAIDBlockID) (mapped[i] % geometry.disk_blocks));
+			}
+		}
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : write of tagline %u failed on the bus.", tag);
+		return(-1);
+	}
+
+	// a block shared by several taglines takes one cache entry
+	for(i = 0; i < blks; i++) {
+		put_raid_cache((RAIDDiskID) (mapped[i] / geometry.disk_blocks), (RAIDBlockID) (mapped[i] % geometry.disk_blocks), buf+i*RAID_BLOCK_SIZE);
+		if(!tagline_dedup_enabled && (tagline_layout_copies(mapped[i]) == 2)) {
+			put_raid_cache((RAIDDiskID) (mapped[i] / geometry.disk_blocks + 1), (RAIDBlockID) (mapped[i] % geometry.disk_blocks), buf+i*RAID_BLOCK_SIZE);
+		}
+	}
+
+	//successfully
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
+			blks, tag, bnum);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trim
+// Description  : Unmap blocks of a tagline, which then read as unwritten.
+//                A log reuses the blocks once its cleaner gets to them,
+//                deduplication (or sharing with snapshots and clones) once
+//                nothing else maps them, the default allocator never
+//                places anything there again.
+//
+// Inputs       : tag - the tagline
+//                bnum - the starting block
+//                blks - the number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_trim(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks) {
+	TaglineMap *map;
+	uint32_t i, trimmed = 0;
+
+	if(tagline_map_range(tag, bnum, blks)) {
+		return(-1);
+	}
+
+	pthread_mutex_lock(&allocLock);
+	map = &taglineMap[tag];
+	if(map->snapshot) {
+		pthread_mutex_unlock(&allocLock);
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : tagline %u is a snapshot, not trimmed.", tag);
+		return(-1);
+	}
+	while(tagline_dedup_counting && map->scrubbing) {
+		// the blocks may be reused once trimmed, so not under the scrubber's reads
+		pthread_cond_wait(&scrubDone, &allocLock);
+	}
+	for(i = bnum; (i < bnum+blks) && (i < map->size); i++) {
+		if(map->block[i] != TAGLINE_UNMAPPED) {
+			if(tagline_log_enabled) {
+				tagline_log_release(map->block[i]);
+			}
+			if(tagline_dedup_counting) {
+				tagline_dedup_release(map->block[i]);
+			}
+			map->block[i] = TAGLINE_UNMAPPED;
+			trimmed++;
+		}
+	}
+	if(tagline_log_enabled && (trimmed > 0)) {
+		tagline_log_released();
+	}
+	pthread_mutex_unlock(&allocLock);
+
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : trimmed %u blocks of tagline %u, starting block %u (%u were written).",
+			blks, tag, bnum, trimmed);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_delete
+// Description  : Trim a whole tagline (a snapshot too) and drop its map
+//
+// Inputs       : tag - the tagline
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_delete(TagLineNumber tag) {
+	if(tagline_map_range(tag, 0, 0)) {
+		return(-1);
+	}
+	pthread_mutex_lock(&allocLock);
+	taglineMap[tag].snapshot = 0;
+	pthread_mutex_unlock(&allocLock);
+	if(tagline_trim(tag, 0, geometry.tagline_blocks)) {
+		return(-1);
+	}
+
+	pthread_mutex_lock(&allocLock);
+	free(taglineMap[tag].block);
+	free(taglineMap[tag].crc);
+	taglineMap[tag].block = NULL;
+	taglineMap[tag].crc = NULL;
+	taglineMap[tag].size = 0;
+	pthread_mutex_unlock(&allocLock);
+
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : deleted tagline %u.", tag);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_snapshot
+// Description  : Make a tagline a read-only copy of another, sharing all its
+//                blocks, until the snapshot is deleted
+//
+// Inputs       : src - the tagline to copy
+//                snap - the tagline taking the snapshot (its blocks dropped)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_snapshot(TagLineNumber src, TagLineNumber snap) {
+	return(tagline_share(src, snap, 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_clone
+// Description  : Make a tagline a writable copy of another, sharing all its
+//                blocks until either side overwrites them
+//
+// Inputs       : src - the tagline to copy
+//                dst - the tagline taking the copy (its blocks dropped)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_clone(TagLineNumber src, TagLineNumber dst) {
+	return(tagline_share(src, dst, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_share
+// Description  : Copy a tagline's map to another, counting one more
+//                reference to each of its blocks, with no bus I/O.  The
+//                reference counts start on the first copy (every block
+//                mapped so far counted once), and from then on an
+//                overwrite of a shared block goes to a new one.
+//
+// Inputs       : src - the tagline to copy
+//                dst - the tagline taking the copy (its blocks dropped)
+//                snapshot - the copy is read-only
+// Outputs      : 0 if successful, -1 if failure
+
+static int tagline_share(TagLineNumber src, TagLineNumber dst, int snapshot) {
+	TaglineMap *from, *to;
+	uint32_t i, t, shared = 0;
+
+	if(tagline_map_range(src, 0, 0) || tagline_map_range(dst, 0, 0)) {
+		return(-1);
+	}
+	if(src == dst) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : tagline %u cannot be copied onto itself.", src);
+		return(-1);
+	}
+	if(tagline_log_enabled) {
+		// the cleaner moves a block for the one tagline block it belongs to
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : snapshots and clones need in-place allocation (no -L).");
+		return(-1);
+	}
+
+	// the source's writes land before it is copied, and the copy's old
+	// blocks may be reused, so not under its writes or the scrubber's reads
+	pthread_mutex_lock(&allocLock);
+	from = &taglineMap[src];
+	to = &taglineMap[dst];
+	while(from->writing || to->writing || to->scrubbing) {
+		pthread_cond_wait(to->scrubbing ? &scrubDone : &writeDone, &allocLock);
+	}
+	if(!tagline_dedup_counting) {
+		if(tagline_dedup_init(&geometry)) {
+			pthread_mutex_unlock(&allocLock);
+			return(-1);
+		}
+		for(t = 0; t < maxLines; t++) {
+			for(i = 0; i < taglineMap[t].size; i++) {
+				if(taglineMap[t].block[i] != TAGLINE_UNMAPPED) {
+					tagline_dedup_ref(taglineMap[t].block[i]);
+				}
+			}
+		}
+	}
+
+	// drop what the copy held, then take the source's blocks
+	for(i = 0; i < to->size; i++) {
+		if(to->block[i] != TAGLINE_UNMAPPED) {
+			tagline_dedup_release(to->block[i]);
+			to->block[i] = TAGLINE_UNMAPPED;
+		}
+	}
+	if(tagline_map_grow(to, from->size)) {
+		pthread_mutex_unlock(&allocLock);
+		return(-1);
+	}
+	for(i = 0; i < from->size; i++) {
+		if((to->block[i] = from->block[i]) != TAGLINE_UNMAPPED) {
+			tagline_dedup_ref(to->block[i]);
+			shared++;
+		}
+		to->crc[i] = from->crc[i];
+	}
+	to->snapshot = snapshot;
+	pthread_mutex_unlock(&allocLock);
+
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : %s tagline %u as tagline %u, %u blocks shared.",
+			snapshot ? "took a snapshot of" : "cloned", src, dst, shared);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_map_lookup
+// Description  : Find where a tagline block is stored on the array
+//
+// Inputs       : tag - the tagline
+//                bnum - the block of the tagline
+//                dsk - the disk holding it (out)
+//                blk - the block of that disk (out)
+// Outputs      : 0 if successful, -1 if the block was never written
+
+int tagline_map_lookup(TagLineNumber tag, TagLineBlockNumber bnum, RAIDDiskID *dsk, RAIDBlockID *blk) {
+	uint64_t block;
+
+	if((tag >= maxLines) || (bnum >= taglineMap[tag].size) ||
+			((block = taglineMap[tag].block[bnum]) == TAGLINE_UNMAPPED)) {
+		return(-1);
+	}
+	*dsk = (RAIDDiskID) (block / geometry.disk_blocks);
+	*blk = (RAIDBlockID) (block % geometry.disk_blocks);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_map_range
+// Description  : Check a read or write falls inside the driver's taglines
+//
+// Inputs       : tag - the tagline
+//                bnum - the starting block
+//                blks - the number of blocks
+// Outputs      : 0 if it does, -1 if not
+
+static int tagline_map_range(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks) {
+	if((taglineMap == NULL) || (tag >= maxLines) || ((uint64_t)bnum + blks > geometry.tagline_blocks)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : blocks %u-%u of tagline %u are outside the driver (%u taglines of %u blocks).",
+				bnum, bnum+blks, tag, maxLines, geometry.tagline_blocks);
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_map_grow
+// Description  : Make a tagline's map at least size entries long, doubling
+//                it up to the geometry's tagline size (allocLock held)
+//
+// Inputs       : map - the tagline's map
+//                size - the entries needed
+// Outputs      : 0 if successful, -1 if failure
+
+static int tagline_map_grow(TaglineMap *map, uint32_t size) {
+	uint64_t *block;
+	uint32_t *crc, i, grown;
+
+	if(size <= map->size) {
+		return(0);
+	}
+	for(grown = (map->size == 0) ? 16 : map->size; grown < size; grown *= 2);
+	if(grown > geometry.tagline_blocks) {
+		grown = geometry.tagline_blocks;
+	}
+	if((block = (uint64_t *) realloc(map->block, sizeof(uint64_t)*grown)) != NULL) {
+		map->block = block;
+	}
+	if((block == NULL) || ((crc = (uint32_t *) realloc(map->crc, sizeof(uint32_t)*grown)) == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : failed growing a tagline map to %u blocks.", grown);
+		return(-1);
+	}
+	for(i = map->size; i < grown; i++) {
+		block[i] = TAGLINE_UNMAPPED;
+		crc[i] = 0;
+	}
+	map->crc = crc;
+	map->size = grown;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_read_misses
+// Description  : Read the blocks of a tagline read that missed the cache in
+//                one go, then fill the cache with them once they pass their
+//                checksum (or the mirror's copy does), handing them to any
+//                readers waiting for them
+//
+// Inputs       : tag - the tagline read
+//                bnum - its starting block
+//                ops - the single block READs
+//                bufs - where each block goes
+//                miss - the block of the read each one is for
+//                placed - the physical blocks of the read
+//                sums - their checksums
+//                n - the number of READs
+// Outputs      : 0 if successful, -1 if a block could not be read
+
+static int tagline_read_misses(TagLineNumber tag, TagLineBlockNumber bnum, RAIDOpCode *ops, void **bufs,
+		int *miss, uint64_t *placed, uint32_t *sums, int n) {
+	RAIDOpCode resps[TAGLINE_MAX_XFER];
+	int i, bad = 0;
+
+	if(raid_sched_batch(tag, RAID_SCHED_FOREGROUND, ops, bufs, resps, n)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : read of tagline %u failed on the bus.", tag);
+		for(i = 0; i < n; i++) {
+			abandon_raid_cache((RAIDDiskID) (placed[miss[i]] / geometry.disk_blocks), (RAIDBlockID) (placed[miss[i]] % geometry.disk_blocks));
+		}
+		return(-1);
+	}
+	for(i = 0; i < n; i++) {
+		if((extract_raid_response(ops[i], resps[i]) || (tagline_crc32c(bufs[i], RAID_BLOCK_SIZE) != sums[miss[i]])) &&
+				tagline_check_mirror(tag, RAID_SCHED_FOREGROUND, placed[miss[i]], sums[miss[i]], bufs[i], 1)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : block %u of tagline %u has no good copy.", bnum+miss[i], tag);
+			abandon_raid_cache((RAIDDiskID) (placed[miss[i]] / geometry.disk_blocks), (RAIDBlockID) (placed[miss[i]] % geometry.disk_blocks));
+			bad = 1;
+			continue;
+		}
+		fill_raid_cache((RAIDDiskID) (placed[miss[i]] / geometry.disk_blocks), (RAIDBlockID) (placed[miss[i]] % geometry.disk_blocks), bufs[i]);
+	}
+	return(bad ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_bus_runs
+// Description  : Build the bus requests for a list of physical blocks,
+//                a run of adjacent ones on a disk (in a chunk when the
+//                layout is declustered) in one request if asked to merge,
+//                writes going to the mirror as well (an odd last disk has
+//                none)
+//
+// Inputs       : type - RAID_READ, RAID_WRITE or RAID_HASHBLOCK
+//                blocks - the physical blocks (TAGLINE_UNMAPPED ones skipped)
+//                n - the number of blocks
+//                data - their contents, a block (a digest) each in list order
+//                ops - the requests (out, 2*n for writes)
+//                bufs - their payloads (out)
+//                mirror - set for the requests to a mirror, each right
+//                         after its primary's (out, NULL if not wanted)
+//                merge - put runs of adjacent blocks in one request
+// Outputs      : the number of requests
+
+static int tagline_bus_runs(RAID_REQUEST_TYPES type, uint64_t *blocks, uint32_t n, char *data,
+		RAIDOpCode *ops, void **bufs, char *mirror, int merge) {
+	RAIDDiskID dsk;
+	RAIDBlockID blk;
+	uint32_t i, run;
+	int k = 0;
+
+	for(i = 0; i < n; i += run) {
+		run = 1;
+		if(blocks[i] == TAGLINE_UNMAPPED) {
+			continue;
+		}
+		while(merge && (i+run < n) && (run < RAID_MAX_XFER) && (blocks[i+run] == blocks[i]+run) &&
+				!tagline_layout_split(blocks[i+run])) {
+			run++;
+		}
+		tagline_layout_locate(blocks[i], 0, &dsk, &blk);
+		if(mirror != NULL) {
+			mirror[k] = 0;
+		}
+		ops[k] = create_raid_request(type, run, dsk, blk);
+		bufs[k++] = data+i*((type == RAID_HASHBLOCK) ? sizeof(uint64_t) : RAID_BLOCK_SIZE);
+		if((type == RAID_WRITE) && (tagline_layout_copies(blocks[i]) == 2)) {
+			tagline_layout_locate(blocks[i], 1, &dsk, &blk);
+			if(mirror != NULL) {
+				mirror[k] = 1;
+			}
+			ops[k] = create_raid_request(type, run, dsk, blk);
+			bufs[k++] = data+i*RAID_BLOCK_SIZE;
+		}
+	}
+	return(k);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write_landed
+// Description  : Check the responses to the writes tagline_bus_runs built,
+//                trying a failed one once more, and count the copies of
+//                each block that landed.  Either copy of a mirrored block
+//                will do: one that missed a failed disk is put back by the
+//                rebuild, one that missed a live disk fails its checksum
+//                and is rewritten from the other when next read or
+//                scrubbed.
+//
+// Inputs       : tag - the tagline (its scheduler flow)
+//                placed - the physical blocks (TAGLINE_UNMAPPED ones not written)
+//                blks - the number of blocks
+//                ops - the write requests
+//                bufs - their payloads
+//                mirror - which requests are to a mirror
+//                resps - their responses
+//                n - the number of requests
+//                landed - the copies of each block that landed (out)
+// Outputs      : 0 if every block has a copy on the array, -1 if not
+
+static int tagline_write_landed(TagLineNumber tag, uint64_t *placed, uint32_t blks, RAIDOpCode *ops, void **bufs,
+		char *mirror, RAIDOpCode *resps, int n, int *landed) {
+	RAIDDiskID dsk;
+	uint32_t i, j, first = 0, run;
+	int k, ok, ret = 0;
+
+	memset(landed, 0, blks*sizeof(int));
+	for(i = 0, k = 0; k < n; k++) {
+		run = (uint32_t) ((ops[k] >> 48) & 0xff);
+		dsk = (RAIDDiskID) ((ops[k] >> 40) & 0xff);
+
+		// a mirror's request is for the blocks of the one before it
+		if(!mirror[k]) {
+			while(placed[i] == TAGLINE_UNMAPPED) {
+				i++;
+			}
+			first = i;
+			i += run;
+		}
+		ok = (extract_raid_response(ops[k], resps[k]) == 0) ||
+				(extract_raid_response(ops[k], raid_sched_request(tag, RAID_SCHED_FOREGROUND, ops[k], bufs[k])) == 0);
+		for(j = first; ok && (j < first+run); j++) {
+			landed[j]++;
+		}
+		if(!ok) {
+			RAID_LOG(LOG_WARNING_LEVEL, "TAGLINE : write of %u blocks to disk %u of tagline %u failed.", run, dsk, tag);
+		}
+	}
+	for(i = 0; i < blks; i++) {
+		if((placed[i] != TAGLINE_UNMAPPED) && (landed[i] == 0)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : no copy of physical block %llu of tagline %u landed.",
+					(unsigned long long)placed[i], tag);
+			ret = -1;
+		}
+	}
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write_install
+// Description  : Map the blocks of a write once it is done.  A block with
+//                a copy on the array takes its new place and checksum, and
+//                drops what it mapped before; one without keeps both and
+//                the new place is let go (allocLock held).
+//
+// Inputs       : tag - the tagline
+//                bnum - the starting block
+//                blks - the number of blocks
+//                old - what each block mapped when the write was placed
+//                mapped - what each block is to map
+//                placed - the physical blocks written (TAGLINE_UNMAPPED if not)
+//                sums - the CRC32C of each block
+//                landed - the copies of each written block that landed
+// Outputs      : none
+
+static void tagline_write_install(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *old,
+		uint64_t *mapped, uint64_t *placed, uint32_t *sums, int *landed) {
+	uint64_t *block = &taglineMap[tag].block[bnum];
+	uint32_t *crc = &taglineMap[tag].crc[bnum];
+	int i, j, ok, released = 0;
+
+	for(i = 0; i < blks; i++) {
+		// content found stored needs no write, unless another block of
+		// this write is storing it
+		for(j = 0; (j < blks) && (placed[j] != mapped[i]); j++);
+		ok = (j == blks) || (landed[j] > 0);
+		if(ok && (mapped[i] != old[i])) {
+			released |= tagline_write_release(block[i]);
+			block[i] = mapped[i];
+		}
+		else if(!ok && (mapped[i] != old[i])) {
+			released |= tagline_write_release(mapped[i]);
+		}
+		if(ok && (block[i] == mapped[i])) {
+			crc[i] = sums[i];
+		}
+	}
+	if(released) {
+		tagline_log_released();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_write_release
+// Description  : Let a physical block go from a tagline block, its place
+//                in the log or its reference (allocLock held)
+//
+// Inputs       : block - the physical block (TAGLINE_UNMAPPED for none)
+// Outputs      : 1 if a place in the log was released, 0 if not
+
+static int tagline_write_release(uint64_t block) {
+	if(block == TAGLINE_UNMAPPED) {
+		return(0);
+	}
+	if(tagline_log_enabled) {
+		tagline_log_release(block);
+		return(1);
+	}
+	if(tagline_dedup_counting) {
+		tagline_dedup_release(block);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_place_room
+// Description  : Blocks the in-place allocator has left, an odd last disk
+//                taking blocks too once the pairs are full (unmirrored)
+//                (allocLock held)
+//
+// Inputs       : none
+// Outputs      : the number of blocks
+
+static uint64_t tagline_place_room(void) {
+	// a declustered layout holds fewer mirrored blocks, none unmirrored
+	if(tagline_layout_declustered) {
+		return(tagline_layout_capacity() - ((uint64_t)(diskNum/2)*geometry.disk_blocks + diskBlockNum));
+	}
+	return((uint64_t)((geometry.disks+1)/2 - diskNum/2)*geometry.disk_blocks - diskBlockNum);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_place_full
+// Description  : Log that a write does not fit the in-place allocator,
+//                with what a declustered layout holds (its spare space
+//                takes the rest of every disk)
+//
+// Inputs       : tag - the tagline
+//                needed - the blocks the write needs
+// Outputs      : none
+
+static void tagline_place_full(TagLineNumber tag, uint64_t needed) {
+	if(tagline_layout_declustered) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : array full, no room for %llu blocks of tagline %u (the declustered layout holds %llu mirrored blocks, "
+				"the rest is spare, see -g blocks=).", (unsigned long long)needed, tag, (unsigned long long)tagline_layout_capacity());
+		return;
+	}
+	RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : array full, no room for %llu blocks of tagline %u.",
+			(unsigned long long)needed, tag);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_place
+// Description  : Place a new block with the in-place allocator, in order
+//                down the disk pairs (allocLock held, room checked)
+//
+// Inputs       : none
+// Outputs      : the physical block
+
+static uint64_t tagline_place(void) {
+	uint64_t block = (uint64_t)diskNum*geometry.disk_blocks + diskBlockNum;
+
+	// an odd last disk has no mirror to count for
+	numOfBlocksArray[diskNum] += 1;
+	if(diskNum+1 < geometry.disks) {
+		numOfBlocksArray[diskNum+1] += 1;
+	}
+			
+	// if disk is full, put next block at the start of next available disk
+	if(diskBlockNum + 1 >= geometry.disk_blocks) {
+		diskNum += 2;
+		diskBlockNum = 0;
+	}		
+	else {
+		// increment disk block array pointer
+		diskBlockNum += 1;
+	}
+	return(block);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_dedup_map
+// Description  : Map the blocks of a write with deduplication.  A block
+//                whose content is stored already (or comes earlier in the
+//                write) is mapped to that copy and not written, one that
+//                only this tagline block maps is overwritten in place, and
+//                anything else goes to a new block, a shared one being
+//                copied on write.  The map takes them once the write lands
+//                (allocLock held, the map already grown).
+//
+// Inputs       : tag - the tagline
+//                bnum - the starting block
+//                blks - the number of blocks
+//                digests - the RAID_HASHBLOCK digest of each block
+//                sums - the CRC32C of each block
+//                mapped - what each block is to map once written (out)
+//                placed - the physical blocks to write (out, TAGLINE_UNMAPPED if stored)
+// Outputs      : 0 if successful, -1 if the array is full
+
+static int tagline_dedup_map(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *digests,
+		uint32_t *sums, uint64_t *mapped, uint64_t *placed) {
+	uint64_t *block = &taglineMap[tag].block[bnum], found, needed;
+	uint32_t stored = 0, copied = 0;
+	int i, j;
+
+	// only new content that cannot go in place needs room
+	for(needed = 0, i = 0; i < blks; i++) {
+		if((tagline_dedup_find(digests[i], sums[i]) == TAGLINE_UNMAPPED) &&
+				((block[i] == TAGLINE_UNMAPPED) || (tagline_dedup_refs(block[i]) > 1))) {
+			for(j = 0; (j < i) && ((digests[j] != digests[i]) || (sums[j] != sums[i])); j++);
+			needed += (j == i);
+		}
+	}
+	if(needed > tagline_place_room() + tagline_dedup_free_blocks()) {
+		tagline_place_full(tag, needed);
+		return(-1);
+	}
+
+	for(i = 0; i < blks; i++) {
+		placed[i] = TAGLINE_UNMAPPED;
+		found = tagline_dedup_find(digests[i], sums[i]);
+		for(j = 0; (found == TAGLINE_UNMAPPED) && (j < i); j++) {
+			if((placed[j] != TAGLINE_UNMAPPED) && (digests[j] == digests[i]) && (sums[j] == sums[i])) {
+				found = placed[j];
+			}
+		}
+		if(found != TAGLINE_UNMAPPED) {
+			stored++;
+			if(found != block[i]) {
+				tagline_dedup_ref(found);
+			}
+			mapped[i] = found;
+		}
+		else if((block[i] != TAGLINE_UNMAPPED) && (tagline_dedup_refs(block[i]) == 1)) {
+			tagline_dedup_unindex(block[i]);
+			placed[i] = mapped[i] = block[i];
+		}
+		else {
+			copied += (block[i] != TAGLINE_UNMAPPED);
+			if((placed[i] = tagline_dedup_reuse()) == TAGLINE_UNMAPPED) {
+				placed[i] = tagline_place();
+			}
+			tagline_dedup_ref(placed[i]);
+			mapped[i] = placed[i];
+		}
+	}
+	tagline_dedup_written(blks, stored, copied);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_place
+// Description  : Append a tagline block to the log, keeping the rebuild's
+//                count of the blocks used on each disk (allocLock held)
+//
+// Inputs       : head - the log head
+//                tag - the tagline
+//                bnum - the block of the tagline
+// Outputs      : the physical block
+
+static uint64_t tagline_log_place(TAGLINE_LOG_HEADS head, TagLineNumber tag, TagLineBlockNumber bnum) {
+	uint64_t block = tagline_log_alloc(head, tag, bnum);
+	uint32_t dsk = (uint32_t) (block / geometry.disk_blocks), blk = (uint32_t) (block % geometry.disk_blocks);
+
+	// an odd last disk has no mirror to count for
+	if(blk+1 > numOfBlocksArray[dsk]) {
+		numOfBlocksArray[dsk] = blk+1;
+		if(dsk+1 < geometry.disks) {
+			numOfBlocksArray[dsk+1] = blk+1;
+		}
+	}
+	return(block);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_append
+// Description  : Place blocks of a tagline at the head of the log, waiting
+//                for the cleaner if the log is short of room, the blocks
+//                overwritten being released once the write lands (allocLock
+//                held, the map already grown)
+//
+// Inputs       : tag - the tagline
+//                bnum - the starting block
+//                blks - the number of blocks
+//                placed - the physical blocks (out)
+// Outputs      : 0 if successful, -1 if the array is full
+
+static int tagline_log_append(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, uint64_t *placed) {
+	int i;
+
+	while(tagline_log_room(TAGLINE_LOG_USER) < blks) {
+		if(cleanStuck || !cleanRunning) {
+			RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : array full, no room for %u blocks of tagline %u.", blks, tag);
+			return(-1);
+		}
+		cleanWaiters++;
+		pthread_cond_signal(&cleanKick);
+		pthread_cond_wait(&cleanDone, &allocLock);
+		cleanWaiters--;
+	}
+
+	for(i = 0; i < blks; i++) {
+		placed[i] = tagline_log_place(TAGLINE_LOG_USER, tag, bnum+i);
+	}
+	if(tagline_log_free_segments() < tagline_log_clean) {
+		pthread_cond_signal(&cleanKick);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_released
+// Description  : Blocks were released, so a cleaner that found nothing
+//                worth cleaning may now (allocLock held)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void tagline_log_released(void) {
+	if(cleanStuck) {
+		cleanStuck = 0;
+		pthread_cond_signal(&cleanKick);
+	}
+}
 
+////////////////////////////////////////////////////////////////////////////////
 //
-// Functions
+// Function     : tagline_log_finish
+// Description  : The reads or writes of held blocks are done, waking the
+//                cleaner if that left a segment it can clean (allocLock held)
+//
+// Inputs       : blocks - the physical blocks
+//                n - the number of blocks
+// Outputs      : none
+
+static void tagline_log_finish(uint64_t *blocks, uint32_t n) {
+	uint32_t i;
+	int kick = 0;
+
+	for(i = 0; i < n; i++) {
+		kick |= tagline_log_done(blocks[i]);
+	}
+	if(kick) {
+		pthread_cond_signal(&cleanKick);
+	}
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : tagline_driver_init
-// Description  : Initialize the driver with a number of maximum lines to process
+// Function     : tagline_clean_start
+// Description  : Start the log cleaner
 //
-// Inputs       : maxlines - the maximum number of tag lines in the system
+// Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
-int tagline_driver_init(uint32_t maxlines) {
-	RAIDOpCode raidOpCode;
-	RAIDOpCode returnOpCode;
-	int i, j;
-	uint8_t temp;
+static int tagline_clean_start(void) {
+	uint32_t seg = tagline_log_segment;
 
-	// initialize 2d Array pointers
-	diskArray_ptr = (int **) malloc(sizeof(int*)* (int) maxlines);
-	for(j = 0; j < maxlines; j++) {
-		diskArray_ptr[j] = (int *) malloc(sizeof(int)*MAX_TAGLINE_BLOCK_NUMBER);
+	memset(&cleaner, 0x0, sizeof(cleaner));
+	cleaner.blocks = (uint64_t *) malloc(seg*sizeof(uint64_t));
+	cleaner.owners = (uint64_t *) malloc(seg*sizeof(uint64_t));
+	cleaner.moved = (uint64_t *) malloc(seg*sizeof(uint64_t));
+	cleaner.data = (char *) malloc((size_t)seg*RAID_BLOCK_SIZE);
+	cleaner.ops = (RAIDOpCode *) malloc(2*seg*sizeof(RAIDOpCode));
+	cleaner.resps = (RAIDOpCode *) malloc(2*seg*sizeof(RAIDOpCode));
+	cleaner.bufs = (void **) malloc(2*seg*sizeof(void *));
+	cleaner.sums = (uint32_t *) malloc(seg*sizeof(uint32_t));
+	cleanStop = cleanPaused = cleanBusy = cleanStuck = cleanWaiters = 0;
+	if((cleaner.blocks == NULL) || (cleaner.owners == NULL) || (cleaner.moved == NULL) ||
+			(cleaner.data == NULL) || (cleaner.ops == NULL) || (cleaner.resps == NULL) ||
+			(cleaner.bufs == NULL) || (cleaner.sums == NULL) || pthread_create(&cleanThread, NULL, tagline_clean_thread, NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : failed starting the log cleaner.");
+		tagline_clean_stop();
+		return(-1);
 	}
+	cleanRunning = 1;
+	return(0);
+}
 
-	diskBlockArray_ptr = (int **) malloc(sizeof(int*)* (int) maxlines);
-	for(j = 0; j < maxlines; j++) {
-		diskBlockArray_ptr[j] = (int *) malloc(sizeof(int)*MAX_TAGLINE_BLOCK_NUMBER);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_clean_stop
+// Description  : Stop the log cleaner (if it runs) and release its buffers
+//
+// Inputs       : none
+// Outputs      : none
+
+static void tagline_clean_stop(void) {
+	if(cleanRunning) {
+		pthread_mutex_lock(&allocLock);
+		cleanStop = 1;
+		pthread_cond_signal(&cleanKick);
+		pthread_mutex_unlock(&allocLock);
+		pthread_join(cleanThread, NULL);
+
+		pthread_mutex_lock(&allocLock);
+		cleanRunning = 0;
+		pthread_cond_broadcast(&cleanDone);
+		pthread_mutex_unlock(&allocLock);
 	}
-	
-	// fills both arrays with -1 as default
-	for(i = 0; i < maxlines; i++) {
-		for(j = 0; j < MAX_TAGLINE_BLOCK_NUMBER; j++) {
-			diskBlockArray_ptr[i][j] = -1;
-			diskArray_ptr[i][j] = -1;
+	free(cleaner.blocks);
+	free(cleaner.owners);
+	free(cleaner.moved);
+	free(cleaner.data);
+	free(cleaner.ops);
+	free(cleaner.resps);
+	free(cleaner.bufs);
+	free(cleaner.sums);
+	memset(&cleaner, 0x0, sizeof(cleaner));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_clean_pause
+// Description  : Hold the log cleaner off (waiting for the segment it is
+//                on), or let it go again
+//
+// Inputs       : pause - 1 to hold it, 0 to let it go
+// Outputs      : none
+
+static void tagline_clean_pause(int pause) {
+	pthread_mutex_lock(&allocLock);
+	cleanPaused = pause;
+	while(pause && cleanBusy) {
+		pthread_cond_wait(&cleanDone, &allocLock);
+	}
+	if(!pause) {
+		pthread_cond_signal(&cleanKick);
+	}
+	pthread_mutex_unlock(&allocLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_clean_thread
+// Description  : The log cleaner, cleaning segments while fewer than the
+//                configured number are free or a write waits for room
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *tagline_clean_thread(void *arg) {
+	uint32_t seg;
+	int ret;
+
+	pthread_mutex_lock(&allocLock);
+	while(!cleanStop) {
+		// sleep while held off, out of victims, or with enough free
+		if(cleanPaused || cleanStuck || ((tagline_log_free_segments() >= tagline_log_clean) && (cleanWaiters == 0))) {
+			pthread_cond_wait(&cleanKick, &allocLock);
+			continue;
+		}
+
+		// wait for the writes of a segment to land before cleaning it,
+		// give up on the waiting writes if no segment would free anything
+		if((ret = tagline_log_victim(&seg)) > 0) {
+			pthread_cond_wait(&cleanKick, &allocLock);
+			continue;
+		}
+		if((ret < 0) || tagline_clean_segment(seg)) {
+			cleanStuck = 1;
 		}
+		pthread_cond_broadcast(&cleanDone);
 	}
-	
-	
-	// initialize driver
-	temp = (uint8_t) (RAID_DISKBLOCKS / RAID_TRACK_BLOCKS);
-	raidOpCode = create_raid_request(RAID_INIT, temp, RAID_DISKS, (RAIDBlockID) 0);
-	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
-	
-	extract_raid_response(raidOpCode, returnOpCode); 	
-	
-	// format each disk
-	for(i = 0; i < RAID_DISKS; i++) {
-		raidOpCode = create_raid_request(RAID_FORMAT, 0, i, 0);
-        	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
-		
-        	//extract raid opcode
-        	extract_raid_response(raidOpCode, returnOpCode);
+	pthread_mutex_unlock(&allocLock);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_clean_segment
+// Description  : Move the live blocks of a segment to the cleaner's head
+//                of the log with multi-block reads and writes, taking the
+//                mirror's copy of any that fails its checksum.  A block is
+//                only remapped if its tagline still maps it where it was
+//                read from once the copy is written (allocLock held,
+//                dropped for the bus).
+//
+// Inputs       : seg - the segment
+// Outputs      : 0 if successful, -1 if failure
+
+static int tagline_clean_segment(uint32_t seg) {
+	TagLineNumber tag;
+	TagLineBlockNumber bnum;
+	uint32_t i, n, k;
+	int ret;
+
+	// read the live blocks and check them
+	n = tagline_log_live(seg, cleaner.blocks, cleaner.owners);
+	for(i = 0; i < n; i++) {
+		tag = (TagLineNumber) (cleaner.owners[i] >> 32);
+		bnum = (TagLineBlockNumber) cleaner.owners[i];
+		cleaner.sums[i] = ((tag < maxLines) && (bnum < taglineMap[tag].size)) ? taglineMap[tag].crc[bnum] : 0;
 	}
-	
-	// initliaze cache
-	init_raid_cache(TAGLINE_CACHE_SIZE);
-	
-	logMessage(LOG_INFO_LEVEL, "CACHE: initialized storage (maxsize = %u", TAGLINE_CACHE_SIZE);	
+	cleanBusy = 1;
+	pthread_mutex_unlock(&allocLock);
+	k = tagline_bus_runs(RAID_READ, cleaner.blocks, n, cleaner.data, cleaner.ops, cleaner.bufs, NULL, 1);
+	ret = raid_sched_batch(0, RAID_SCHED_BACKGROUND, cleaner.ops, cleaner.bufs, cleaner.resps, k);
+	for(i = 0; (ret == 0) && (i < k); i++) {
+		ret = extract_raid_response(cleaner.ops[i], cleaner.resps[i]);
+	}
+	for(i = 0; (ret == 0) && (i < n); i++) {
+		if(tagline_crc32c(cleaner.data+i*RAID_BLOCK_SIZE, RAID_BLOCK_SIZE) != cleaner.sums[i]) {
+			tagline_check_mirror(0, RAID_SCHED_BACKGROUND, cleaner.blocks[i], cleaner.sums[i],
+					cleaner.data+i*RAID_BLOCK_SIZE, 0);
+		}
+	}
+	pthread_mutex_lock(&allocLock);
 
-	// Return successfully
-	logMessage(LOG_INFO_LEVEL, "TAGLINE: initialized storage (maxline=%u)", maxlines);
+	// give the ones still mapped a place at the cleaner's head, then write them
+	for(i = 0; (ret == 0) && (i < n); i++) {
+		tag = (TagLineNumber) (cleaner.owners[i] >> 32);
+		bnum = (TagLineBlockNumber) cleaner.owners[i];
+		if((tag < maxLines) && (bnum < taglineMap[tag].size) && (taglineMap[tag].block[bnum] == cleaner.blocks[i])) {
+			cleaner.moved[i] = tagline_log_place(TAGLINE_LOG_CLEANER, tag, bnum);
+		}
+		else {
+			cleaner.moved[i] = TAGLINE_UNMAPPED;
+		}
+	}
+	if(ret == 0) {
+		pthread_mutex_unlock(&allocLock);
+		k = tagline_bus_runs(RAID_WRITE, cleaner.moved, n, cleaner.data, cleaner.ops, cleaner.bufs, NULL, 1);
+		ret = raid_sched_batch(0, RAID_SCHED_BACKGROUND, cleaner.ops, cleaner.bufs, cleaner.resps, k);
+		for(i = 0; (ret == 0) && (i < k); i++) {
+			ret = extract_raid_response(cleaner.ops[i], cleaner.resps[i]);
+		}
+
+		// the cache may still hold what used to be at the new places
+		for(i = 0; i < n; i++) {
+			if(cleaner.moved[i] != TAGLINE_UNMAPPED) {
+				drop_raid_cache((RAIDDiskID) (cleaner.moved[i] / geometry.disk_blocks), (RAIDBlockID) (cleaner.moved[i] % geometry.disk_blocks));
+				drop_raid_cache((RAIDDiskID) (cleaner.moved[i] / geometry.disk_blocks + 1), (RAIDBlockID) (cleaner.moved[i] % geometry.disk_blocks));
+			}
+		}
+		pthread_mutex_lock(&allocLock);
+
+		// remap the blocks nobody overwrote or trimmed meanwhile
+		for(i = 0; i < n; i++) {
+			if(cleaner.moved[i] == TAGLINE_UNMAPPED) {
+				continue;
+			}
+			tagline_log_done(cleaner.moved[i]);
+			tag = (TagLineNumber) (cleaner.owners[i] >> 32);
+			bnum = (TagLineBlockNumber) cleaner.owners[i];
+			if((ret == 0) && (bnum < taglineMap[tag].size) && (taglineMap[tag].block[bnum] == cleaner.blocks[i])) {
+				taglineMap[tag].block[bnum] = cleaner.moved[i];
+				tagline_log_release(cleaner.blocks[i]);
+			}
+			else {
+				tagline_log_release(cleaner.moved[i]);
+			}
+		}
+	}
+	if(ret) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : cleaning log segment %u failed on the bus.", seg);
+	}
+	tagline_log_cleaned(seg);
+	cleanBusy = 0;
+	return(ret ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_check_mirror
+// Description  : The primary copy of a block was not read or failed its
+//                checksum, so read the mirror's copy over it and, if that
+//                one checks out, rewrite the primary from it
+//
+// Inputs       : tag - the tagline (the scheduler's flow)
+//                cls - the scheduler's class
+//                block - the physical block
+//                sum - the CRC32C it should have
+//                buf - the block read (in/out)
+//                repair - rewrite the primary copy
+// Outputs      : 0 if buf holds a good copy, -1 if neither is
+
+static int tagline_check_mirror(TagLineNumber tag, RAID_SCHED_CLASSES cls, uint64_t block, uint32_t sum,
+		char *buf, int repair) {
+	RAIDDiskID dsk, mirror;
+	RAIDBlockID blk, mirrorBlk;
+	RAIDOpCode raidOpCode;
+	int good = 0, repaired = 0;
+
+	// an odd last disk has no mirror
+	tagline_layout_locate(block, 0, &dsk, &blk);
+	tagline_layout_locate(block, 1, &mirror, &mirrorBlk);
+	if(tagline_layout_copies(block) == 2) {
+		raidOpCode = create_raid_request(RAID_READ, 1, mirror, mirrorBlk);
+		good = (extract_raid_response(raidOpCode, raid_sched_request(tag, cls, raidOpCode, buf)) == 0) &&
+				(tagline_crc32c(buf, RAID_BLOCK_SIZE) == sum);
+	}
+	if(good && repair) {
+		raidOpCode = create_raid_request(RAID_WRITE, 1, dsk, blk);
+		repaired = (extract_raid_response(raidOpCode, raid_sched_request(tag, cls, raidOpCode, buf)) == 0);
+	}
+
+	pthread_mutex_lock(&allocLock);
+	checkFailed++;
+	checkRepaired += repaired;
+	pthread_mutex_unlock(&allocLock);
+	if(!good) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : block %u of disk %u failed its checksum, and so did its mirror.", blk, dsk);
+		return(-1);
+	}
+	RAID_LOG(LOG_WARNING_LEVEL, "TAGLINE : block %u of disk %u failed its checksum, %s from disk %u.",
+			blk, dsk, repaired ? "rewritten" : "read", mirror);
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : tagline_read
-// Description  : Read a number of blocks from the tagline driver
+// Function     : tagline_scrub_start
+// Description  : Start the scrubber
 //
-// Inputs       : tag - the number of the tagline to read from
-//                bnum -<F3> the starting block to read from
-//                blks - the number of blocks to read
-//                bug - memory block to read the blocks into
+// Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
-int tagline_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
-	RAIDOpCode raidOpCode;
-	RAIDOpCode returnOpCode;
-	int i, diskLocation, diskBlockLocation;
-	char *cacheBuf;
+static int tagline_scrub_start(void) {
+	memset(&scrubber, 0x0, sizeof(scrubber));
+	scrubStop = scrubPaused = scrubBusy = 0;
+	if(pthread_create(&scrubThread, NULL, tagline_scrub_thread, NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : failed starting the scrubber.");
+		return(-1);
+	}
+	scrubRunning = 1;
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : scrubbing %u blocks a second (CRC32C %s%s).",
+			tagline_scrub_rate, tagline_crc_kernel(),
+			(tagline_scrub_hashing && (raid_bus_capabilities & RAID_CAP_HASH)) ? ", copies compared by digest" : "");
+	return(0);
+}
 
-	// reads one block at a time
-	for(i = 0; i < blks; i++) {
-		
-		// retreive disk and diskBlock location(number) of current block
-		diskLocation = diskArray_ptr[(int)tag][i+bnum];
-		diskBlockLocation = diskBlockArray_ptr[(int)tag][i+bnum];
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_scrub_stop
+// Description  : Stop the scrubber (if it runs) and log what it found
+//
+// Inputs       : none
+// Outputs      : none
+
+static void tagline_scrub_stop(void) {
+	if(!scrubRunning) {
+		return;
+	}
+	pthread_mutex_lock(&allocLock);
+	scrubStop = 1;
+	pthread_cond_signal(&scrubKick);
+	pthread_mutex_unlock(&allocLock);
+	pthread_join(scrubThread, NULL);
+	scrubRunning = 0;
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : scrubbed %llu blocks in %u passes (%llu bytes of digests, %llu of blocks), "
+			"%llu bad copies rewritten, %llu blocks lost.",
+			(unsigned long long)scrubber.checked, scrubber.passes, (unsigned long long)scrubber.hashed,
+			(unsigned long long)scrubber.copied, (unsigned long long)scrubber.repaired,
+			(unsigned long long)scrubber.lost);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_scrub_pause
+// Description  : Hold the scrubber off (waiting for the block it is on),
+//                or let it go again
+//
+// Inputs       : pause - 1 to hold it, 0 to let it go
+// Outputs      : none
+
+static void tagline_scrub_pause(int pause) {
+	pthread_mutex_lock(&allocLock);
+	scrubPaused = pause;
+	while(pause && scrubBusy) {
+		pthread_cond_wait(&scrubDone, &allocLock);
+	}
+	if(!pause) {
+		pthread_cond_signal(&scrubKick);
+	}
+	pthread_mutex_unlock(&allocLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_scrub_thread
+// Description  : The scrubber, checking the written blocks of one tagline
+//                at a time in order, at the configured rate.  Taglines with
+//                writes in flight are left for the next pass, and
+//                overwrites in place wait for the blocks being checked.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
 
-		cacheBuf = get_raid_cache((RAIDDiskID) diskLocation, (RAIDBlockID) diskBlockLocation);
+static void *tagline_scrub_thread(void *arg) {
+	struct timespec next, now;
+	uint64_t period = 1000000000ULL / tagline_scrub_rate, nsec;
+	TaglineMap *map;
+	uint32_t i, n;
+	int ret;
 
-		// if block is not in cache
-		if(cacheBuf == NULL) {
-			raidOpCode = create_raid_request(RAID_READ, 1, (RAIDDiskID) diskLocation, (RAIDBlockID) diskBlockLocation);
-        		returnOpCode = client_raid_bus_request(raidOpCode, buf+i*RAID_BLOCK_SIZE);
-			extract_raid_response(raidOpCode, returnOpCode);
+	clock_gettime(CLOCK_REALTIME, &next);
+	pthread_mutex_lock(&allocLock);
+	while(!scrubStop) {
+		// sleep while held off, after the last pass, or until the next turn
+		if(scrubPaused || (tagline_scrub_passes && (scrubber.passes >= tagline_scrub_passes))) {
+			pthread_cond_wait(&scrubKick, &allocLock);
+			continue;
+		}
+		if((pthread_cond_timedwait(&scrubKick, &allocLock, &next) != ETIMEDOUT) || scrubPaused || scrubStop) {
+			continue;
+		}
 
-			logMessage(LOG_INFO_LEVEL, "TAGLINE : read %u blocks from tagline %u, starting block %u.", blks, tag, bnum);
+		// find the next written block of a tagline not being written
+		for(map = NULL; scrubber.tag < maxLines; scrubber.tag++, scrubber.bnum = 0) {
+			map = &taglineMap[scrubber.tag];
+			while((map->writing == 0) && (scrubber.bnum < map->size) && (map->block[scrubber.bnum] == TAGLINE_UNMAPPED)) {
+				scrubber.bnum++;
+			}
+			if((map->writing == 0) && (scrubber.bnum < map->size)) {
+				break;
+			}
+		}
+		if(scrubber.tag >= maxLines) {
+			if(scrubber.found > 0) {
+				RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : scrub pass %u checked %llu blocks.",
+						scrubber.passes+1, (unsigned long long)scrubber.found);
+			}
+			scrubber.passes++;
+			scrubber.found = 0;
+			scrubber.tag = 0;
+			scrubber.bnum = 0;
+			n = 1;
 		}
-		// if block is in cache
 		else {
-			memcpy(buf, cacheBuf, RAID_BLOCK_SIZE);
-			//logMessage(LOG_INFO_LEVEL, "Cache : read block %d from cache.", i);
+			// take it and the tagline's written blocks after it, held where they are
+			for(n = 0; (n < RAID_MAX_XFER) && (scrubber.bnum < map->size); scrubber.bnum++) {
+				if(map->block[scrubber.bnum] != TAGLINE_UNMAPPED) {
+					scrubber.blocks[n] = map->block[scrubber.bnum];
+					scrubber.sums[n++] = map->crc[scrubber.bnum];
+					if(tagline_log_enabled) {
+						tagline_log_hold(map->block[scrubber.bnum]);
+					}
+				}
+			}
+			map->scrubbing = 1;
+			scrubBusy = 1;
+			pthread_mutex_unlock(&allocLock);
+
+			// only blocks whose copies hash differently are read and checked
+			tagline_scrub_hash(n);
+			for(i = 0; i < n; i++) {
+				if(scrubber.differ[i]) {
+					ret = tagline_scrub_block(scrubber.blocks[i], scrubber.sums[i]);
+					scrubber.lost += (ret < 0);
+					scrubber.repaired += (ret > 0) ? ret : 0;
+				}
+			}
+			pthread_mutex_lock(&allocLock);
+			if(tagline_log_enabled) {
+				tagline_log_finish(scrubber.blocks, n);
+			}
+			map->scrubbing = 0;
+			scrubBusy = 0;
+			pthread_cond_broadcast(&scrubDone);
+			scrubber.found += n;
+			scrubber.checked += n;
+		}
+
+		// the next turn comes once the rate allows for these blocks, a turn
+		// missed by more than a second (paused) is not made up for
+		clock_gettime(CLOCK_REALTIME, &now);
+		if(now.tv_sec > next.tv_sec+1) {
+			next = now;
 		}
+		nsec = next.tv_nsec + n*period;
+		next.tv_sec += nsec / 1000000000ULL;
+		next.tv_nsec = nsec % 1000000000ULL;
 	}
+	pthread_mutex_unlock(&allocLock);
+	return(NULL);
+}
 
-	// Return successfully
-	return(0);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_scrub_hash
+// Description  : Ask the array for the RAID_HASHBLOCK digests of both
+//                copies of the blocks taken, a request per run of adjacent
+//                blocks and all in one batch, and flag the blocks whose
+//                copies differ.  With hashing turned off every block is
+//                flagged, and so is it when the server does not send
+//                digests (no RAID_CAP_HASH).
+//
+// Inputs       : n - the blocks taken
+// Outputs      : none
+
+static void tagline_scrub_hash(uint32_t n) {
+	RAIDDiskID dsk;
+	RAIDBlockID blk;
+	int i, j, k, m;
+
+	// a copy that is not hashed (no mirror, failed, or no digests sent back)
+	// keeps a digest the other copy's cannot match
+	memset(scrubber.differ, 1, n);
+	if(!tagline_scrub_hashing || !(raid_bus_capabilities & RAID_CAP_HASH)) {
+		return;
+	}
+	memset(scrubber.digests[0], 0x00, n*sizeof(uint64_t));
+	memset(scrubber.digests[1], 0xff, n*sizeof(uint64_t));
+	k = m = tagline_bus_runs(RAID_HASHBLOCK, scrubber.blocks, n, (char *)scrubber.digests[0], scrubber.ops, scrubber.bufs, NULL, 1);
+	for(i = 0; i < k; i++) {
+		j = (int)((uint64_t *)scrubber.bufs[i] - scrubber.digests[0]);
+		if(tagline_layout_copies(scrubber.blocks[j]) == 2) {
+			tagline_layout_locate(scrubber.blocks[j], 1, &dsk, &blk);
+			scrubber.ops[m] = create_raid_request(RAID_HASHBLOCK, (uint8_t) (scrubber.ops[i] >> 48), dsk, blk);
+			scrubber.bufs[m++] = scrubber.digests[1] + j;
+		}
+	}
+	if(raid_sched_batch(0, RAID_SCHED_BACKGROUND, scrubber.ops, scrubber.bufs, scrubber.resps, m) == 0) {
+		for(i = 0; i < m; i++) {
+			if(extract_raid_response(scrubber.ops[i], scrubber.resps[i])) {
+				memset(scrubber.bufs[i], (i < k) ? 0x00 : 0xff, ((scrubber.ops[i] >> 48) & 0xff)*sizeof(uint64_t));
+			}
+		}
+		for(i = 0; i < (int)n; i++) {
+			scrubber.differ[i] = (scrubber.digests[0][i] != scrubber.digests[1][i]);
+		}
+	}
+	scrubber.hashed += 2*n*sizeof(uint64_t);
 }
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : tagline_write
-// Description  : Write a number of blocks from the tagline driver
+// Function     : tagline_scrub_block
+// Description  : Read both copies of a block as background traffic and
+//                rewrite any that fails its checksum from one that passes
 //
-// Inputs       : tag - the number of the tagline to write from
-//                bnum - the starting block to write from
-//                blks - the number of blocks to write
-//                bug - the place to write the blocks into
+// Inputs       : block - the physical block
+//                sum - the CRC32C it should have
+// Outputs      : the copies rewritten, -1 if neither copy is good
+
+static int tagline_scrub_block(uint64_t block, uint32_t sum) {
+	RAIDOpCode ops[2], resps[2];
+	void *bufs[2];
+	RAIDDiskID dsk[2];
+	RAIDBlockID blk[2];
+	int good[2] = { 0, 0 }, copies, i, repaired = 0;
+
+	// an odd last disk has no mirror
+	copies = tagline_layout_copies(block);
+	for(i = 0; i < copies; i++) {
+		tagline_layout_locate(block, i, &dsk[i], &blk[i]);
+		ops[i] = create_raid_request(RAID_READ, 1, dsk[i], blk[i]);
+		bufs[i] = scrubber.data+i*RAID_BLOCK_SIZE;
+	}
+	scrubber.copied += copies*RAID_BLOCK_SIZE;
+	if(raid_sched_batch(0, RAID_SCHED_BACKGROUND, ops, bufs, resps, copies) == 0) {
+		for(i = 0; i < copies; i++) {
+			good[i] = (extract_raid_response(ops[i], resps[i]) == 0) &&
+					(tagline_crc32c(bufs[i], RAID_BLOCK_SIZE) == sum);
+		}
+	}
+	if(!good[0] && !good[1]) {
+		RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : scrub found no good copy of block %u of disk %u.", blk[0], dsk[0]);
+		return(-1);
+	}
+
+	// rewrite the bad copy from the good one
+	for(i = 0; i < copies; i++) {
+		if(!good[i]) {
+			ops[0] = create_raid_request(RAID_WRITE, 1, dsk[i], blk[i]);
+			scrubber.copied += RAID_BLOCK_SIZE;
+			if(extract_raid_response(ops[0], raid_sched_request(0, RAID_SCHED_BACKGROUND, ops[0], bufs[1-i])) == 0) {
+				RAID_LOG(LOG_WARNING_LEVEL, "TAGLINE : scrub found block %u of disk %u failed its checksum, rewritten from disk %u.",
+						blk[i], dsk[i], dsk[1-i]);
+				repaired++;
+			}
+		}
+	}
+	return(repaired);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_mirror_sync
+// Description  : Make a disk a copy of its mirror partner, comparing the
+//                digests of both (RAID_HASHBLOCK, TAGLINE_SYNC_RANGES ranges
+//                a batch) and copying only the runs of blocks that differ.
+//                A server that does not send digests (no RAID_CAP_HASH)
+//                gets every block copied.
+//
+// Inputs       : src - the disk to copy from
+//                dst - the disk to copy to
+//                blocks - the blocks of each disk in use
+//                copied - the blocks copied (out)
 // Outputs      : 0 if successful, -1 if failure
 
-int tagline_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf) {
-	RAIDOpCode raidOpCode;
-	RAIDOpCode returnOpCode;
-	int i, diskLocation, diskBlockLocation;
-		for(i = 0; i < blks; i++) {	
-			if(diskArray_ptr[(int)tag][i+bnum] == -1) {
-				// write blocks to disk
-				raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) diskNum, (RAIDBlockID) diskBlockNum);
-				returnOpCode = client_raid_bus_request(raidOpCode, buf+i*RAID_BLOCK_SIZE);
-				extract_raid_response(raidOpCode, returnOpCode);
-
-				// write to cache
-				put_raid_cache((RAIDDiskID) diskNum, (RAIDBlockID) diskBlockNum, buf);
-				cacheInsert++;
-		
-				// set disk and block value to block for given tagline and block #
-				diskArray_ptr[(int)tag][i+bnum] = diskNum;
-				diskBlockArray_ptr[(int)tag][i+bnum] = diskBlockNum;
-
-				numOfBlocksArray[diskNum] += 1;
-
-				// write blocks to backup Disk
-				raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) diskNum+1, (RAIDBlockID) diskBlockNum);
-        	       		returnOpCode = client_raid_bus_request(raidOpCode, buf+i*RAID_BLOCK_SIZE);
-       		         	extract_raid_response(raidOpCode, returnOpCode);
-
-				// write to cache
-				put_raid_cache((RAIDDiskID) diskNum+1, (RAIDBlockID) diskBlockNum, buf);
-				cacheInsert++;
-				
-				numOfBlocksArray[diskNum+1] += 1;
-		
-				// if disk is full, put next block at the start of next available disk
-				if(diskBlockNum + 1 >= RAID_DISKBLOCKS) {
-					diskNum += 2;
-					diskBlockNum = 0;
-				}		
-				else {
-					// increment disk block array pointer
-                        		diskBlockNum += 1;
+static int tagline_mirror_sync(RAIDDiskID src, RAIDDiskID dst, uint32_t blocks, uint32_t *copied) {
+	RAIDOpCode ops[2*TAGLINE_SYNC_RANGES], resps[2*TAGLINE_SYNC_RANGES], op;
+	void *bufs[2*TAGLINE_SYNC_RANGES];
+	uint32_t span = TAGLINE_SYNC_RANGES*RAID_MAX_XFER, base, end, blk, run, i, n;
+	uint64_t *digests = malloc(2*span*sizeof(uint64_t));
+	char *data = malloc(RAID_MAX_XFER*RAID_BLOCK_SIZE);
+	int ret = 0;
+
+	*copied = 0;
+	if((digests == NULL) || (data == NULL)) {
+		ret = -1;
+	}
+	for(base = 0; (base < blocks) && (ret == 0); base += span) {
+		// hash the ranges on both disks, a failed range differing
+		end = (blocks-base < span) ? blocks : base+span;
+		memset(digests, 0x00, span*sizeof(uint64_t));
+		memset(digests+span, 0xff, span*sizeof(uint64_t));
+		if(raid_bus_capabilities & RAID_CAP_HASH) {
+			for(n = 0, blk = base; blk < end; blk += run, n += 2) {
+				run = (end-blk < RAID_MAX_XFER) ? end-blk : RAID_MAX_XFER;
+				ops[n] = create_raid_request(RAID_HASHBLOCK, run, src, blk);
+				bufs[n] = digests+(blk-base);
+				ops[n+1] = create_raid_request(RAID_HASHBLOCK, run, dst, blk);
+				bufs[n+1] = digests+span+(blk-base);
+			}
+			if(raid_sched_batch(0, RAID_SCHED_BACKGROUND, ops, bufs, resps, n)) {
+				ret = -1;
+				break;
+			}
+			for(i = 0; i < n; i++) {
+				if(extract_raid_response(ops[i], resps[i])) {
+					memset(bufs[i], (i % 2) ? 0xff : 0x00, ((ops[i] >> 48) & 0xff)*sizeof(uint64_t));
 				}
 			}
+		}
 
-			// Overwrite
-			else {
-				diskLocation = diskArray_ptr[(int)tag][i+bnum];
-		                diskBlockLocation = diskBlockArray_ptr[(int)tag][i+bnum];
-				
-        	        	raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) diskLocation, (RAIDBlockID) diskBlockLocation);
-                		returnOpCode = client_raid_bus_request(raidOpCode, buf+i*RAID_BLOCK_SIZE);
-        		        extract_raid_response(raidOpCode, returnOpCode);
-				
-				// write to cache
-				put_raid_cache((RAIDDiskID) diskLocation, (RAIDBlockID) diskBlockLocation, buf);
-                                cacheInsert++;
-
-				raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) diskLocation+1, (RAIDBlockID) diskBlockLocation);
-                                returnOpCode = client_raid_bus_request(raidOpCode, buf+i*RAID_BLOCK_SIZE);
-                                extract_raid_response(raidOpCode, returnOpCode);
-				
-				// write to cache
-				put_raid_cache((RAIDDiskID) diskLocation+1, (RAIDBlockID) diskBlockLocation, buf);
-                                cacheInsert++;
-			}
-
-		}	
-	//successfully
-	logMessage(LOG_INFO_LEVEL, "TAGLINE : wrote %u blocks to tagline %u, starting block %u.",
-			blks, tag, bnum);
-	return(0);
+		// copy each run of blocks that differ
+		for(blk = base; (blk < end) && (ret == 0); blk += run) {
+			for(run = 0; (blk+run < end) && (run < RAID_MAX_XFER) &&
+					(digests[blk+run-base] != digests[span+blk+run-base]); run++);
+			if(run == 0) {
+				run = 1;
+				continue;
+			}
+			op = create_raid_request(RAID_READ, run, src, blk);
+			if(extract_raid_response(op, raid_sched_request(0, RAID_SCHED_BACKGROUND, op, data)) == 0) {
+				op = create_raid_request(RAID_WRITE, run, dst, blk);
+				ret = extract_raid_response(op, raid_sched_request(0, RAID_SCHED_BACKGROUND, op, data)) ? -1 : 0;
+			} else {
+				ret = -1;
+			}
+			*copied += run;
+		}
+	}
+	free(digests);
+	free(data);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_decluster_rebuild
+// Description  : Rebuild a failed (and formatted) disk of the declustered
+//                layout: every chunk with a copy on it is read from the
+//                other copy, spread over all the surviving disks, and
+//                written to the spare space of a third disk, a wave of
+//                chunks at a time so every disk works at once.  The copies
+//                are then moved back to the replaced disk and the spares
+//                freed.  Both phases are timed.
+//
+// Inputs       : failed - the failed disk
+// Outputs      : 0 if successful, -1 if a chunk could not be rebuilt
+
+static int tagline_decluster_rebuild(RAIDDiskID failed) {
+	RAIDOpCode ops[RAID_MAX_XFER], resps[RAID_MAX_XFER];
+	void *bufs[RAID_MAX_XFER];
+	RAIDDiskID dsk;
+	RAIDBlockID blk;
+	uint32_t chunk = tagline_layout_chunk, wave = RAID_MAX_XFER / tagline_layout_chunk, n, i, j, k, m;
+	uint32_t moved = 0, lost = 0, max = 2 * (geometry.disk_blocks / tagline_layout_chunk + 1);
+	uint64_t *chunks = malloc(max*sizeof(uint64_t)), used;
+	int *copies = malloc(max*sizeof(int)), which[RAID_MAX_XFER], good[RAID_MAX_XFER], phase, ret = 0;
+	char *data = malloc((size_t)wave*chunk*RAID_BLOCK_SIZE);
+	struct timespec start, spared, end;
+
+	if((chunks == NULL) || (copies == NULL) || (data == NULL)) {
+		free(chunks);
+		free(copies);
+		free(data);
+		return(-1);
+	}
+
+	// the chunks of the mirrored blocks placed so far with a copy on the disk
+	pthread_mutex_lock(&allocLock);
+	used = (uint64_t)(diskNum/2)*geometry.disk_blocks + diskBlockNum;
+	pthread_mutex_unlock(&allocLock);
+	n = tagline_layout_lost(failed, used, chunks, copies);
+
+	// first read each lost copy from the other copy and write it into a
+	// spare, then read it back out of the spare and write it home
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	spared = start;
+	for(phase = 0; phase < 2; phase++) {
+		for(i = 0; i < n; i += k) {
+			k = (n-i < wave) ? n-i : wave;
+			for(j = m = 0; j < k; j++) {
+				good[j] = 0;
+				if(phase == 0) {
+					tagline_layout_locate(chunks[i+j], 1-copies[i+j], &dsk, &blk);
+				} else {
+					// a copy still at home never made it into a spare
+					tagline_layout_locate(chunks[i+j], copies[i+j], &dsk, &blk);
+					if(dsk == failed) {
+						good[j] = 2;
+						continue;
+					}
+				}
+				ops[m] = create_raid_request(RAID_READ, chunk, dsk, blk);
+				bufs[m] = data+(size_t)j*chunk*RAID_BLOCK_SIZE;
+				which[m++] = j;
+			}
+			if((m > 0) && (raid_sched_batch(0, RAID_SCHED_BACKGROUND, ops, bufs, resps, m) == 0)) {
+				for(j = 0; j < m; j++) {
+					good[which[j]] = (extract_raid_response(ops[j], resps[j]) == 0);
+				}
+			}
+
+			// write the copies read to their new place
+			for(j = m = 0; j < k; j++) {
+				if(good[j] != 1) {
+					continue;
+				}
+				if(phase == 0) {
+					if(tagline_layout_spare(chunks[i+j], copies[i+j], failed)) {
+						good[j] = 0;
+						continue;
+					}
+					tagline_layout_locate(chunks[i+j], copies[i+j], &dsk, &blk);
+				} else {
+					tagline_layout_home(chunks[i+j], copies[i+j], &dsk, &blk);
+				}
+				ops[m] = create_raid_request(RAID_WRITE, chunk, dsk, blk);
+				bufs[m] = data+(size_t)j*chunk*RAID_BLOCK_SIZE;
+				which[m++] = j;
+			}
+			if((m > 0) && raid_sched_batch(0, RAID_SCHED_BACKGROUND, ops, bufs, resps, m)) {
+				for(j = 0; j < m; j++) {
+					resps[j] = ~ops[j];
+				}
+			}
+			for(j = 0; j < m; j++) {
+				if(extract_raid_response(ops[j], resps[j])) {
+					good[which[j]] = 0;
+					if(phase == 0) {
+						tagline_layout_restore(chunks[i+which[j]], copies[i+which[j]]);
+					}
+				} else if(phase == 1) {
+					tagline_layout_restore(chunks[i+which[j]], copies[i+which[j]]);
+				}
+			}
+			for(j = 0; j < k; j++) {
+				if(good[j] == 0) {
+					lost++;
+					ret = -1;
+				} else if(phase == 0) {
+					moved++;
+				}
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, (phase == 0) ? &spared : &end);
+	}
+
+	RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : rebuilt %u chunks of disk %u from %u disks into spares in %.3f ms, "
+			"copied back in %.3f ms, %u failed.", moved, failed, geometry.disks-1,
+			(spared.tv_sec-start.tv_sec)*1e3 + (spared.tv_nsec-start.tv_nsec)/1e6,
+			(end.tv_sec-spared.tv_sec)*1e3 + (end.tv_nsec-spared.tv_nsec)/1e6, lost);
+	free(chunks);
+	free(copies);
+	free(data);
+	return(ret);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_free_tables
+// Description  : Stop the log cleaner and the scrubber, release the
+//                tagline maps and disk counts
+//
+// Inputs       : none
+// Outputs      : none
+
+static void tagline_free_tables(void) {
+	uint32_t i;
+
+	tagline_clean_stop();
+	tagline_scrub_stop();
+	if(taglineMap != NULL) {
+		for(i = 0; i < maxLines; i++) {
+			free(taglineMap[i].block);
+			free(taglineMap[i].crc);
+		}
+	}
+	free(taglineMap);
+	free(numOfBlocksArray);
+	taglineMap = NULL;
+	numOfBlocksArray = NULL;
+	maxLines = 0;
+	memset(&geometry, 0x0, sizeof(geometry));
+}
 
 // FUNCTION: Create_raid_request
 // input: request type, number of blocks, Raid disk ID, Raid block id
@@ -254,13 +2011,10 @@ int raid_disk_signal(void) {
 	RAIDOpCode raidOpCode;
         RAIDOpCode returnOpCode;
 	uint32_t diskStatus;
-	int i, j;
-	char *bufHolder;
+	uint32_t i, mirror, copied;
 
-	char *buffer = malloc(sizeof(char*) *TAGLINE_BLOCK_SIZE);	
-	
 	// check all disks for failure
-	for(i = 0; i < (int)RAID_DISKS; i++) {
+	for(i = 0; i < geometry.disks; i++) {
 		raidOpCode = create_raid_request(RAID_STATUS, 0, (RAIDDiskID) i, (RAIDBlockID) 0);
         	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
 		extract_raid_response(raidOpCode, returnOpCode);
@@ -268,64 +2022,37 @@ int raid_disk_signal(void) {
 		// find disk with failed status
 		diskStatus = returnOpCode & 3;
 		if(diskStatus == RAID_DISK_FAILED) {
+			// hold the cleaner and the scrubber off the pair until the
+			// disk is rebuilt
+			tagline_clean_pause(1);
+			tagline_scrub_pause(1);
 			raidOpCode = create_raid_request(RAID_FORMAT, 0, (RAIDDiskID) i, 0);
 	                returnOpCode = client_raid_bus_request(raidOpCode, NULL);
 
         	        //extract raid opcode
                 	extract_raid_response(raidOpCode, returnOpCode);
 
-			// For all even disks
-			if(i % 2 == 0) {
-				// replace numOfBlks with RAID_DISKBLOCKS
-				for(j = 0; j < numOfBlocksArray[i]; j++) {
-					// put in cache
-					bufHolder = get_raid_cache((RAIDDiskID) i+1, (RAIDBlockID) j);
-					
-					// If block is not in cache	
-					if(bufHolder == NULL) {
-						raidOpCode = create_raid_request(RAID_READ, 1, (RAIDDiskID) i+1, (RAIDBlockID) j);
-						returnOpCode = client_raid_bus_request(raidOpCode, buffer);
-        	                                extract_raid_response(raidOpCode, returnOpCode);
-
-						raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) i, (RAIDBlockID) j);
-                	                        returnOpCode = client_raid_bus_request(raidOpCode, buffer);
-		                                extract_raid_response(raidOpCode, returnOpCode);
-						// update cache
-						put_raid_cache((RAIDDiskID) i, (RAIDBlockID) j, buffer);
-					}
-					// if block is already in cache
-					else {
-						memcpy(buffer, bufHolder, RAID_BLOCK_SIZE);
-						
-					}
+			// copy the blocks that differ back from the mirror partner
+			// (an odd last disk has none), or spread the rebuild over all
+			// the disks if the layout is declustered
+			mirror = (i % 2 == 0) ? i+1 : i-1;
+			if(tagline_layout_declustered) {
+				if(tagline_decluster_rebuild((RAIDDiskID) i)) {
+					RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : declustered rebuild of disk %u failed.", i);
 				}
-			}
-			// For all odd disks
-			else {
-				for(j = 0; j < numOfBlocksArray[i]; j++) {				
-					// put in cache
-                                        bufHolder = get_raid_cache((RAIDDiskID) i+1, (RAIDBlockID) j);
-
-					// if block is not in cache
-					if(bufHolder == NULL) {
-						raidOpCode = create_raid_request(RAID_READ, 1, (RAIDDiskID) i-1, (RAIDBlockID) j);
-                                        	returnOpCode = client_raid_bus_request(raidOpCode, buffer);
-                                        	extract_raid_response(raidOpCode, returnOpCode);
-						
-						raidOpCode = create_raid_request(RAID_WRITE, 1, (RAIDDiskID) i, (RAIDBlockID) j);
-                                	        returnOpCode = client_raid_bus_request(raidOpCode, buffer);
-                                	        extract_raid_response(raidOpCode, returnOpCode);
-						
-						// update cache
-                                                put_raid_cache((RAIDDiskID) i, (RAIDBlockID) j, buffer);
-					}
-					// if block is already in cache
-					else {
-						memcpy(buffer, bufHolder, RAID_BLOCK_SIZE);
-					}
-					
+			} else if(mirror >= geometry.disks) {
+				if(numOfBlocksArray[i] > 0) {
+					RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : disk %u failed and has no mirror to rebuild from.", i);
+				}
+			} else {
+				if(tagline_mirror_sync((RAIDDiskID) mirror, (RAIDDiskID) i, numOfBlocksArray[i], &copied)) {
+					RAID_LOG(LOG_ERROR_LEVEL, "TAGLINE : rebuild of disk %u from disk %u failed.", i, mirror);
 				}
+				RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : rebuilt disk %u from disk %u, %u of %u blocks differed.",
+						i, mirror, copied, numOfBlocksArray[i]);
 			}
+			tagline_scrub_pause(0);
+			tagline_clean_pause(0);
 		}
 	}
 	
@@ -338,8 +2065,28 @@ int raid_disk_signal(void) {
 // output:
 // Function closes raid cache and free's disk and diskblock arrays
 int tagline_close() {
-	free(diskArray_ptr);
-	free(diskBlockArray_ptr);
+	RAIDOpCode raidOpCode;
+	RAIDOpCode returnOpCode;
+
+	// stop the cleaner and the scrubber, then tell the array we are done
+	// so the transport is torn down
+	tagline_clean_stop();
+	tagline_scrub_stop();
+	if(checkFailed > 0) {
+		RAID_LOG(LOG_INFO_LEVEL, "TAGLINE : %llu copies failed their checksum, %llu rewritten from the mirror.",
+				(unsigned long long)checkFailed, (unsigned long long)checkRepaired);
+	}
+	checkFailed = checkRepaired = 0;
+	raidOpCode = create_raid_request(RAID_CLOSE, 0, 0, 0);
+	returnOpCode = client_raid_bus_request(raidOpCode, NULL);
+	extract_raid_response(raidOpCode, returnOpCode);
+
+	raid_sched_close();
+	raid_elevator_close();
+	tagline_log_close();
+	tagline_dedup_close();
+	tagline_layout_close();
+	tagline_free_tables();
 	close_raid_cache();
         return(0);
 }
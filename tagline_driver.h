@@ -20,11 +20,27 @@
 #define TAGLINE_BLOCK_SIZE        RAID_BLOCK_SIZE
 #define RAID_DISKS                9
 #define RAID_DISKBLOCKS           4096
+#define TAGLINE_MAX_XFER          UINT8_MAX // Most blocks in one read or write
+#define TAGLINE_MAX_DISKS         255       // INIT carries the disk count in 8 bits
+#define TAGLINE_MAX_TRACKS        255       // ... and the tracks per disk in 8 bits
+#define TAGLINE_UNMAPPED          UINT64_MAX // Physical block of an unwritten block
+#define TAGLINE_SYNC_RANGES       16        // Digest ranges per batch of a mirror rebuild
 
 // Type definitions
 typedef uint16_t TagLineNumber;
 typedef uint32_t TagLineBlockNumber;
 
+// The array geometry, tagline_driver_init uses the defaults above (RAID_DISKS,
+// RAID_DISKBLOCKS, MAX_TAGLINE_BLOCK_NUMBER and TAGLINE_CACHE_SIZE)
+typedef struct {
+	uint32_t disks;          // Disks in the array, mirrored in pairs (2-255)
+	uint32_t disk_blocks;    // Blocks per disk, in whole tracks (at most 255)
+	uint32_t tagline_blocks; // Most blocks in one tagline
+	uint32_t cache_blocks;   // Blocks the driver cache holds
+} TaglineGeometry;
+
+extern const TaglineGeometry tagline_geometry_default;
+
 //
 // Interface functions
 
@@ -32,12 +48,36 @@ typedef uint32_t TagLineBlockNumber;
 int tagline_driver_init(uint32_t maxlines);
         // Initialize the driver with a number of maximum lines to process
 
+int tagline_driver_init_geometry(uint32_t maxlines, const TaglineGeometry *geo);
+        // Initialize the driver for an array of the given geometry
+
+int tagline_geometry_parse(const char *spec, TaglineGeometry *geo);
+        // Apply "disks=N,blocks=N,tagline=N,cache=N" to a geometry (tagline_geometry.c)
+
+uint64_t tagline_geometry_capacity(const TaglineGeometry *geo);
+        // The number of tagline blocks the geometry can place (tagline_geometry.c)
+
 int tagline_read(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf);
         // Read a number of blocks from the tagline driver
 
 int tagline_write(TagLineNumber tag, TagLineBlockNumber bnum, uint8_t blks, char *buf);
         // Write a number of blocks from the tagline driver
 
+int tagline_map_lookup(TagLineNumber tag, TagLineBlockNumber bnum, RAIDDiskID *dsk, RAIDBlockID *blk);
+        // Find the disk and block a written tagline block is stored at
+
+int tagline_trim(TagLineNumber tag, TagLineBlockNumber bnum, uint32_t blks);
+        // Unmap blocks of a tagline (a log reuses them, see tagline_log.h)
+
+int tagline_delete(TagLineNumber tag);
+        // Trim a whole tagline and drop its map
+
+int tagline_snapshot(TagLineNumber src, TagLineNumber snap);
+        // Make a tagline a read-only copy of another, sharing its blocks (no I/O)
+
+int tagline_clone(TagLineNumber src, TagLineNumber dst);
+        // Make a tagline a writable copy of another, its blocks copied on overwrite
+
 int tagline_close(void);
         // Close the tagline interface
 
@@ -0,0 +1,614 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_gen.c
+//  Description   : This is the synthetic workload generator.  It writes
+//                  workloads in the text format of the shipped workload-*.dat
+//                  files (or, with -b, the binary trace format) for any
+//                  number of taglines, mix of reads and writes, access
+//                  pattern, trims, copies and disk failure schedule.  Every read
+//                  expects the data last written, so the simulator
+//                  validates the whole run.  The output depends only on
+//                  the options and the seed.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/31/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_driver.h>
+#include <tagline_trace.h>
+
+// Defines
+#define GEN_ARGUMENTS "hvbVs:n:t:k:m:r:o:x:c:a:f:P:d:g:"
+#define GEN_ALPHABET "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+#define USAGE \
+	"USAGE: tagline_gen [-h] [-v] [-b] [-V] [-s <seed>] [-n <ops>] [-t <tags>] [-k <blocks>]\n" \
+	"                   [-m <blocks>] [-r <pct>] [-o <pct>] [-x <pct>] [-c <pct>] [-a <pattern>]\n" \
+	"                   [-f <fails>] [-P <placement>] [-d <disk>] [-g <geometry>] <output-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -b - write a binary trace instead of a text workload\n" \
+	"    -V - finish with a validation pass over every tagline\n" \
+	"    -s - random seed (default 1)\n" \
+	"    -n - number of READ/WRITE ops (default 10000)\n" \
+	"    -t - number of taglines (default 64)\n" \
+	"    -k - blocks per tagline (default 16, at most the geometry's tagline size)\n" \
+	"    -m - most blocks per op (default 8, at most 255)\n" \
+	"    -r - percentage of ops that are reads (default 50)\n" \
+	"    -o - percentage of writes that overwrite written blocks while the\n" \
+	"         tagline still has room to grow (default 50)\n" \
+	"    -x - percentage of writes that trim the end of the tagline instead,\n" \
+	"         one in four of them a DELETE of all of it (default 0)\n" \
+	"    -c - percentage of writes that copy another tagline over this one\n" \
+	"         instead, half a CLONE and half a read-only SNAPSHOT, which is\n" \
+	"         deleted rather than written or trimmed (default 0)\n" \
+	"    -a - access pattern: uniform, zipf[:<theta>] (default theta 0.99) or\n" \
+	"         seq (default uniform)\n" \
+	"    -f - number of DISKFAIL ops (default 0)\n" \
+	"    -P - where the failures go: spread (evenly), random or burst (all at\n" \
+	"         the midpoint) (default spread)\n" \
+	"    -d - the disk to fail (default a random disk each time)\n" \
+	"    -g - the array geometry the workload is for (as for tagline_client)\n" \
+	"\n" \
+	"    <output-file> - the workload to write\n" \
+	"\n" \
+
+// Type definitions
+typedef enum {
+	GEN_UNIFORM    = 0, // Every tagline equally likely
+	GEN_ZIPF       = 1, // Taglines by Zipf rank
+	GEN_SEQUENTIAL = 2, // Taglines in turn, blocks in order
+} GEN_PATTERNS;
+
+typedef enum {
+	GEN_SPREAD = 0, // Failures evenly spaced
+	GEN_RANDOM = 1, // Failures at random ops
+	GEN_BURST  = 2, // Failures back to back at the midpoint
+} GEN_PLACEMENTS;
+
+//
+// Global Data
+uint64_t gen_state;               // Random number generator state
+uint32_t gen_ops = 10000;         // READ/WRITE ops to generate
+uint32_t gen_tags = 64;           // Taglines
+uint32_t gen_blocks = 16;         // Blocks per tagline
+uint32_t gen_maxop = 8;           // Most blocks per op
+uint32_t gen_reads = 50;          // Read percentage
+uint32_t gen_overwrites = 50;     // Overwrite percentage
+uint32_t gen_trims = 0;           // Trim percentage (of writes)
+uint32_t gen_copies = 0;          // Copy percentage (of writes)
+double gen_theta = 0.99;          // Zipf skew
+GEN_PATTERNS gen_pattern = GEN_UNIFORM;
+uint32_t gen_fails = 0;           // DISKFAIL ops
+GEN_PLACEMENTS gen_placement = GEN_SPREAD;
+int gen_disk = -1;                // Disk to fail, -1 for random
+TaglineGeometry gen_geometry;     // The array the workload is for
+
+TaglineTrace gen_trace;           // The workload being built
+char *gen_patterns = NULL;        // Its text
+uint32_t gen_patbytes = 0, gen_patcap = 0, gen_opcap = 0;
+uint32_t gen_names[TAGLINE_OP_MAXVAL]; // Offsets of the command texts
+
+//
+// Functional Prototypes
+
+uint32_t gen_uniform(uint32_t n);
+int gen_text(const char *text, uint32_t len, uint32_t *off);
+int gen_op(TAGLINE_OP_TYPES cmd, uint32_t tag, uint32_t blocks, uint32_t start,
+		const char *data, uint32_t datalen);
+int generate_workload(int validate);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	unsigned long long seed = 1;
+	char *geometry_spec = NULL;
+	int ch, verbose = 0, binary = 0, validate = 0, ret;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, GEN_ARGUMENTS)) != -1) {
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf(stderr, USAGE);
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'b': // Write a binary trace
+			binary = 1;
+			break;
+
+		case 'V': // Validate at the end
+			validate = 1;
+			break;
+
+		case 's': // Seed
+			if (sscanf(optarg, "%llu", &seed) != 1) {
+				fprintf(stderr, "Bad seed [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'n': // Op count
+			if (sscanf(optarg, "%u", &gen_ops) != 1) {
+				fprintf(stderr, "Bad op count [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 't': // Tagline count
+			if ((sscanf(optarg, "%u", &gen_tags) != 1) || (gen_tags < 1) || (gen_tags > UINT16_MAX)) {
+				fprintf(stderr, "Bad tagline count [%s] (1-%u), aborting.\n", optarg, UINT16_MAX);
+				return( -1 );
+			}
+			break;
+
+		case 'k': // Blocks per tagline
+			if ((sscanf(optarg, "%u", &gen_blocks) != 1) || (gen_blocks < 1) || (gen_blocks > UINT16_MAX)) {
+				fprintf(stderr, "Bad blocks per tagline [%s] (1-%u), aborting.\n", optarg, UINT16_MAX);
+				return( -1 );
+			}
+			break;
+
+		case 'm': // Blocks per op
+			if ((sscanf(optarg, "%u", &gen_maxop) != 1) || (gen_maxop < 1) || (gen_maxop > RAID_MAX_XFER)) {
+				fprintf(stderr, "Bad blocks per op [%s] (1-%u), aborting.\n", optarg, RAID_MAX_XFER);
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Read percentage
+			if ((sscanf(optarg, "%u", &gen_reads) != 1) || (gen_reads > 100)) {
+				fprintf(stderr, "Bad read percentage [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'o': // Overwrite percentage
+			if ((sscanf(optarg, "%u", &gen_overwrites) != 1) || (gen_overwrites > 100)) {
+				fprintf(stderr, "Bad overwrite percentage [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'x': // Trim percentage
+			if ((sscanf(optarg, "%u", &gen_trims) != 1) || (gen_trims > 100)) {
+				fprintf(stderr, "Bad trim percentage [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'c': // Copy percentage
+			if ((sscanf(optarg, "%u", &gen_copies) != 1) || (gen_copies > 100)) {
+				fprintf(stderr, "Bad copy percentage [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'a': // Access pattern
+			if (strcmp(optarg, "uniform") == 0) {
+				gen_pattern = GEN_UNIFORM;
+			} else if (strcmp(optarg, "seq") == 0) {
+				gen_pattern = GEN_SEQUENTIAL;
+			} else if ((strncmp(optarg, "zipf", 4) == 0) && ((optarg[4] == 0x0) ||
+					((optarg[4] == ':') && (sscanf(optarg+5, "%lf", &gen_theta) == 1) && (gen_theta > 0)))) {
+				gen_pattern = GEN_ZIPF;
+			} else {
+				fprintf(stderr, "Bad access pattern [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'f': // Disk failures
+			if (sscanf(optarg, "%u", &gen_fails) != 1) {
+				fprintf(stderr, "Bad failure count [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'P': // Failure placement
+			if (strcmp(optarg, "spread") == 0) {
+				gen_placement = GEN_SPREAD;
+			} else if (strcmp(optarg, "random") == 0) {
+				gen_placement = GEN_RANDOM;
+			} else if (strcmp(optarg, "burst") == 0) {
+				gen_placement = GEN_BURST;
+			} else {
+				fprintf(stderr, "Bad failure placement [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'd': // Disk to fail
+			if ((sscanf(optarg, "%d", &gen_disk) != 1) || (gen_disk < 0)) {
+				fprintf(stderr, "Bad disk [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'g': // Array geometry
+			geometry_spec = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+			return( -1 );
+		}
+	}
+	if (optind + 1 != argc) {
+		fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+		return( -1 );
+	}
+	initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+	if (verbose) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	gen_geometry = tagline_geometry_default;
+	if ((geometry_spec != NULL) && tagline_geometry_parse(geometry_spec, &gen_geometry)) {
+		fprintf(stderr, "Bad array geometry [%s], aborting.\n", geometry_spec);
+		return( -1 );
+	}
+	if (gen_blocks > gen_geometry.tagline_blocks) {
+		fprintf(stderr, "Taglines of %u blocks are longer than the geometry allows (%u), aborting.\n",
+				gen_blocks, gen_geometry.tagline_blocks);
+		return( -1 );
+	}
+	if (gen_disk >= (int)gen_geometry.disks) {
+		fprintf(stderr, "Disk %d is not in the array (0-%u), aborting.\n", gen_disk, gen_geometry.disks-1);
+		return( -1 );
+	}
+	if ((uint64_t)gen_tags * gen_blocks > tagline_geometry_capacity(&gen_geometry)) {
+		fprintf(stderr, "%u taglines of %u blocks need more than the %llu blocks the array holds, aborting.\n",
+				gen_tags, gen_blocks, (unsigned long long)tagline_geometry_capacity(&gen_geometry));
+		return( -1 );
+	}
+
+	// Build the workload, then write it out
+	gen_state = seed;
+	if (generate_workload(validate)) {
+		return( -1 );
+	}
+	gen_trace.patterns = gen_patterns;
+	gen_trace.patbytes = gen_patbytes;
+	ret = binary ? tagline_trace_save(argv[optind], &gen_trace) :
+			tagline_trace_save_text(argv[optind], &gen_trace);
+	tagline_trace_free(&gen_trace);
+	free(gen_patterns);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_uniform
+// Description  : A uniform random number below n (splitmix64, so the
+//                sequence is the same on every platform)
+//
+// Inputs       : n - the bound
+// Outputs      : the number
+
+uint32_t gen_uniform(uint32_t n) {
+	uint64_t z = (gen_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return( (uint32_t)(((z >> 32) * n) >> 32) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_text
+// Description  : Append text to the workload's pattern table
+//
+// Inputs       : text - the text
+//                len - its length
+//                off - where it was put (out)
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_text(const char *text, uint32_t len, uint32_t *off) {
+	char *grown;
+
+	if (gen_patbytes + len > gen_patcap) {
+		for (gen_patcap = gen_patcap ? gen_patcap : 4096; gen_patbytes + len > gen_patcap; gen_patcap *= 2);
+		if ((grown = realloc(gen_patterns, gen_patcap)) == NULL) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Out of memory generating the workload");
+			return( -1 );
+		}
+		gen_patterns = grown;
+	}
+	memcpy(gen_patterns + gen_patbytes, text, len);
+	*off = gen_patbytes;
+	gen_patbytes += len;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_op
+// Description  : Append an op to the workload
+//
+// Inputs       : cmd - the op type
+//                tag - the tagline (or disk, or tagline count)
+//                blocks - the number of blocks
+//                start - the first block
+//                data - the data text
+//                datalen - its length
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_op(TAGLINE_OP_TYPES cmd, uint32_t tag, uint32_t blocks, uint32_t start,
+		const char *data, uint32_t datalen) {
+	TaglineTraceOp *op;
+
+	if (gen_trace.nops == gen_opcap) {
+		gen_opcap = gen_opcap ? gen_opcap * 2 : 1024;
+		if ((op = realloc(gen_trace.ops, gen_opcap * sizeof(TaglineTraceOp))) == NULL) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Out of memory generating the workload");
+			return( -1 );
+		}
+		gen_trace.ops = op;
+	}
+	op = &gen_trace.ops[gen_trace.nops];
+	if (gen_text(data, datalen, &op->data)) {
+		return( -1 );
+	}
+	op->cmd = cmd;
+	op->name = gen_names[cmd];
+	op->namelen = strlen(tagline_trace_opname(cmd));
+	op->tag = tag;
+	op->blocks = blocks;
+	op->datalen = datalen;
+	op->start = start;
+	gen_trace.nops++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : generate_workload
+// Description  : Build the workload: INIT, the READ/WRITE (and TRIM/DELETE,
+//                CLONE/SNAPSHOT) ops with the disk failures placed among
+//                them, the optional
+//                validation pass, then CLOSE.  A shadow copy of every
+//                tagline's data gives the text each read expects.
+//
+// Inputs       : validate - add the validation pass
+// Outputs      : 0 if successful, -1 if failure
+
+int generate_workload(int validate) {
+
+	// Local variables
+	char *shadow = NULL, *frozen = NULL, data[TAGLINE_MAX_XFER];
+	uint32_t *written = NULL, *cursor = NULL, *perm = NULL, *fails = NULL;
+	double *cdf = NULL, sum;
+	uint32_t i, j, f, s, t, n, start, len, lo, hi, next = 0;
+	uint64_t reads = 0, writes = 0, trims = 0, copies = 0;
+	int ret = -1, cmd;
+
+	// The shadow data, the per-tagline lengths, sequential cursors and
+	// which taglines are snapshots
+	shadow = malloc((size_t)gen_tags * gen_blocks);
+	written = calloc(gen_tags, sizeof(uint32_t));
+	cursor = calloc(gen_tags, sizeof(uint32_t));
+	frozen = calloc(gen_tags, sizeof(char));
+	fails = malloc((gen_fails + 1) * sizeof(uint32_t));
+	if ((shadow == NULL) || (written == NULL) || (cursor == NULL) || (frozen == NULL) || (fails == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Out of memory generating the workload");
+		goto out;
+	}
+
+	// Zipf ranks: the cumulative distribution, and a shuffle of the taglines
+	// so the hot ones are not simply the lowest numbered
+	if (gen_pattern == GEN_ZIPF) {
+		cdf = malloc(gen_tags * sizeof(double));
+		perm = malloc(gen_tags * sizeof(uint32_t));
+		if ((cdf == NULL) || (perm == NULL)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Out of memory generating the workload");
+			goto out;
+		}
+		for (sum = 0, i = 0; i < gen_tags; i++) {
+			cdf[i] = (sum += 1.0 / pow(i + 1, gen_theta));
+			perm[i] = i;
+		}
+		for (i = gen_tags - 1; i > 0; i--) {
+			j = gen_uniform(i + 1);
+			t = perm[i];
+			perm[i] = perm[j];
+			perm[j] = t;
+		}
+	}
+
+	// The ops the disk failures go in front of, in order
+	for (f = 0; f < gen_fails; f++) {
+		fails[f] = (gen_placement == GEN_SPREAD) ? (uint32_t)(((uint64_t)f + 1) * gen_ops / (gen_fails + 1)) :
+				(gen_placement == GEN_RANDOM) ? gen_uniform(gen_ops) : gen_ops / 2;
+	}
+	for (i = 1; i < gen_fails; i++) {
+		for (t = fails[i], j = i; (j > 0) && (fails[j-1] > t); j--) {
+			fails[j] = fails[j-1];
+		}
+		fails[j] = t;
+	}
+	fails[gen_fails] = UINT32_MAX;
+
+	// The command texts, then INIT
+	for (cmd = 0; cmd < TAGLINE_OP_MAXVAL; cmd++) {
+		if (gen_text(tagline_trace_opname(cmd), strlen(tagline_trace_opname(cmd)), &gen_names[cmd])) {
+			goto out;
+		}
+	}
+	if (gen_op(TAGLINE_OP_INIT, gen_tags, 0, 0, "X", 1)) {
+		goto out;
+	}
+
+	for (i = 0, f = 0; i < gen_ops; i++) {
+
+		// Disk failures due before this op
+		for (; fails[f] == i; f++) {
+			if (gen_op(TAGLINE_OP_DISKFAIL, (gen_disk < 0) ? gen_uniform(gen_geometry.disks) : gen_disk, 0, 0, "X", 1)) {
+				goto out;
+			}
+		}
+
+		// Pick the tagline
+		if (gen_pattern == GEN_ZIPF) {
+			sum = cdf[gen_tags-1] * (gen_uniform(UINT32_MAX) / (double)UINT32_MAX);
+			for (lo = 0, hi = gen_tags - 1; lo < hi; ) {
+				if (cdf[(lo + hi) / 2] < sum) {
+					lo = (lo + hi) / 2 + 1;
+				} else {
+					hi = (lo + hi) / 2;
+				}
+			}
+			t = perm[lo];
+		} else if (gen_pattern == GEN_SEQUENTIAL) {
+			t = next;
+			next = (next + 1) % gen_tags;
+		} else {
+			t = gen_uniform(gen_tags);
+		}
+		len = written[t];
+
+		// Reads (which an empty tagline turns into a write) check the shadow
+		if ((len > 0) && (gen_uniform(100) < gen_reads)) {
+			n = 1 + gen_uniform((len < gen_maxop) ? len : gen_maxop);
+			if (gen_pattern == GEN_SEQUENTIAL) {
+				start = (cursor[t] + n <= len) ? cursor[t] : 0;
+				cursor[t] = start + n;
+			} else {
+				start = gen_uniform(len - n + 1);
+			}
+			if (gen_op(TAGLINE_OP_READ, t, n, start, &shadow[(size_t)t * gen_blocks + start], n)) {
+				goto out;
+			}
+			reads++;
+			continue;
+		}
+
+		// A snapshot is deleted rather than written or trimmed
+		if (frozen[t]) {
+			if (gen_op(TAGLINE_OP_DELETE, t, 0, 0, "X", 1)) {
+				goto out;
+			}
+			written[t] = cursor[t] = 0;
+			frozen[t] = 0;
+			trims++;
+			continue;
+		}
+
+		// Trims cut the end off the tagline, or all of it (a DELETE)
+		if ((len > 0) && (gen_trims > 0) && (gen_uniform(100) < gen_trims)) {
+			if (gen_uniform(4) == 0) {
+				n = len;
+				if (gen_op(TAGLINE_OP_DELETE, t, 0, 0, "X", 1)) {
+					goto out;
+				}
+			} else {
+				n = 1 + gen_uniform((len < gen_maxop) ? len : gen_maxop);
+				if (gen_op(TAGLINE_OP_TRIM, t, n, len - n, "X", 1)) {
+					goto out;
+				}
+			}
+			written[t] = len - n;
+			cursor[t] = 0;
+			trims++;
+			continue;
+		}
+
+		// Copies put another written tagline over this one, as a clone or
+		// a snapshot
+		if ((gen_copies > 0) && (gen_uniform(100) < gen_copies)) {
+			s = gen_uniform(gen_tags);
+			if ((s != t) && (written[s] > 0)) {
+				cmd = (gen_uniform(2) == 0) ? TAGLINE_OP_CLONE : TAGLINE_OP_SNAPSHOT;
+				if (gen_op(cmd, t, 0, s, "X", 1)) {
+					goto out;
+				}
+				memcpy(&shadow[(size_t)t * gen_blocks], &shadow[(size_t)s * gen_blocks], written[s]);
+				written[t] = written[s];
+				cursor[t] = 0;
+				frozen[t] = (cmd == TAGLINE_OP_SNAPSHOT);
+				copies++;
+				continue;
+			}
+		}
+
+		// Writes grow the tagline, or overwrite what it has
+		if ((len < gen_blocks) && ((len == 0) || (gen_uniform(100) >= gen_overwrites))) {
+			n = 1 + gen_uniform((gen_blocks - len < gen_maxop) ? gen_blocks - len : gen_maxop);
+			start = len;
+			written[t] = len + n;
+		} else {
+			n = 1 + gen_uniform((len < gen_maxop) ? len : gen_maxop);
+			if (gen_pattern == GEN_SEQUENTIAL) {
+				start = (cursor[t] + n <= len) ? cursor[t] : 0;
+				cursor[t] = start + n;
+			} else {
+				start = gen_uniform(len - n + 1);
+			}
+		}
+		for (j = 0; j < n; j++) {
+			data[j] = GEN_ALPHABET[gen_uniform(sizeof(GEN_ALPHABET) - 1)];
+		}
+		memcpy(&shadow[(size_t)t * gen_blocks + start], data, n);
+		if (gen_op(TAGLINE_OP_WRITE, t, n, start, data, n)) {
+			goto out;
+		}
+		writes++;
+	}
+
+	// Failures placed at the very end, then the validation pass and CLOSE
+	for (; f < gen_fails; f++) {
+		if (gen_op(TAGLINE_OP_DISKFAIL, (gen_disk < 0) ? gen_uniform(gen_geometry.disks) : gen_disk, 0, 0, "X", 1)) {
+			goto out;
+		}
+	}
+	for (t = 0; validate && (t < gen_tags); t++) {
+		if ((written[t] > 0) &&
+				gen_op(TAGLINE_OP_VALIDATE, t, written[t], 0, &shadow[(size_t)t * gen_blocks], written[t])) {
+			goto out;
+		}
+	}
+	if (gen_op(TAGLINE_OP_CLOSE, 0, 0, 0, "X", 1)) {
+		goto out;
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Generated %u ops (%llu reads, %llu writes, %llu trims, %llu copies, %u disk failures)",
+			gen_trace.nops, (unsigned long long)reads, (unsigned long long)writes,
+			(unsigned long long)trims, (unsigned long long)copies, gen_fails);
+	ret = 0;
+
+out:
+	free(shadow);
+	free(written);
+	free(cursor);
+	free(frozen);
+	free(fails);
+	free(cdf);
+	free(perm);
+	return( ret );
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_geometry.c
+//  Description   : This is the array geometry of the tagline driver, set on
+//                  the command line of the client and the workload
+//                  generator as comma separated fields:
+//
+//                    disks=<n>      disks in the array (2-255)
+//                    blocks=<n>     blocks per disk (whole tracks, at most 255)
+//                    tagline=<n>    most blocks in one tagline
+//                    cache=<n>      blocks the driver cache holds
+//
+//                  Fields that are left out keep their value.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/22/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_driver.h>
+
+//
+// Global Data
+const TaglineGeometry tagline_geometry_default = {
+	RAID_DISKS, RAID_DISKBLOCKS, MAX_TAGLINE_BLOCK_NUMBER, TAGLINE_CACHE_SIZE
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_geometry_parse
+// Description  : Apply a geometry specification, checking the result
+//
+// Inputs       : spec - the specification
+//                geo - the geometry to change
+// Outputs      : 0 if successful, -1 if failure (geo is unchanged)
+
+int tagline_geometry_parse(const char *spec, TaglineGeometry *geo) {
+	TaglineGeometry g = *geo;
+	char *copy, *field, *save;
+	uint32_t *value;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if (strncmp(field, "disks=", 6) == 0) {
+			value = &g.disks;
+		} else if (strncmp(field, "blocks=", 7) == 0) {
+			value = &g.disk_blocks;
+		} else if (strncmp(field, "tagline=", 8) == 0) {
+			value = &g.tagline_blocks;
+		} else if (strncmp(field, "cache=", 6) == 0) {
+			value = &g.cache_blocks;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Unknown geometry field [%s]", field);
+			ret = -1;
+			break;
+		}
+		if (sscanf(strchr(field, '=') + 1, "%u", value) != 1) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad geometry field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+
+	// The disk count and disk size go over the bus in 8-bit fields
+	if ((ret == 0) && ((g.disks < 2) || (g.disks > TAGLINE_MAX_DISKS))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad geometry, %u disks (2-%u)", g.disks, TAGLINE_MAX_DISKS);
+		ret = -1;
+	}
+	if ((ret == 0) && ((g.disk_blocks == 0) || (g.disk_blocks % RAID_TRACK_BLOCKS) ||
+			(g.disk_blocks / RAID_TRACK_BLOCKS > TAGLINE_MAX_TRACKS))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad geometry, %u blocks per disk (multiples of %u, at most %u)",
+				g.disk_blocks, RAID_TRACK_BLOCKS, RAID_TRACK_BLOCKS*TAGLINE_MAX_TRACKS);
+		ret = -1;
+	}
+	if ((ret == 0) && ((g.tagline_blocks == 0) || (g.cache_blocks == 0))) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad geometry, taglines and the cache need at least one block");
+		ret = -1;
+	}
+	if (ret == 0) {
+		*geo = g;
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_geometry_capacity
+// Description  : Work out how many tagline blocks an array can place
+//
+// Inputs       : geo - the geometry
+// Outputs      : the capacity in blocks (each is mirrored on a disk pair)
+
+uint64_t tagline_geometry_capacity(const TaglineGeometry *geo) {
+	return( (uint64_t)(geo->disks / 2) * geo->disk_blocks );
+}
@@ -0,0 +1,389 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_layout.c
+//  Description   : This is the placement of the copies of every block of
+//                  the tagline driver (see tagline_layout.h).  In the
+//                  declustered layout a block's place in the paired layout
+//                  is first folded into a mirrored block number q (the
+//                  pairs one after the other), q / chunk is its chunk k and
+//                  row t = k / disks.  The primary copy of chunk k is on
+//                  disk k % disks and the mirror on the disk
+//                  1 + t % (disks - 1) after it, so every row puts one
+//                  primary and one mirror chunk on each disk (chunk slots
+//                  2t and 2t + 1) and no disk is its own partner.  The
+//                  chunk slots above the rows are the spare space.  A copy
+//                  moved into the spare space by a rebuild is found through
+//                  a table of the chunk slots, and goes home again once
+//                  the failed disk is copied back.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/30/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_layout.h>
+
+//
+// Global data
+int tagline_layout_declustered = 0;                    // The declustered layout is configured
+uint32_t tagline_layout_chunk = TAGLINE_LAYOUT_CHUNK;  // Blocks per chunk
+static uint32_t layout_spare_blocks = 0;               // Spare blocks per disk asked for (0 auto)
+static uint32_t layout_disks = 0;                      // Disks of the array
+static uint32_t layout_disk_blocks = 0;                // ... blocks of each
+static uint32_t layout_rows = 0;                       // Rows of chunks
+static uint32_t layout_spares = 0;                     // Spare chunks per disk
+static uint32_t *layout_moved = NULL;                  // Spare holding each chunk slot + 1 (0 at home)
+static uint8_t *layout_spare_used = NULL;              // Spare chunks holding a moved copy
+static uint32_t *layout_spare_free = NULL;             // ... free on each disk
+static uint32_t layout_turn = 0;                       // Disk the next spare search starts at
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : layout_chunk_of
+// Description  : Fold a block's place in the paired layout into its chunk
+//                and the offset in it
+//
+// Inputs       : block - the block (paired layout)
+//                offset - the offset in the chunk (out)
+// Outputs      : the chunk
+
+static inline uint64_t layout_chunk_of(uint64_t block, uint32_t *offset) {
+	uint64_t q = (block / layout_disk_blocks / 2) * layout_disk_blocks + block % layout_disk_blocks;
+
+	*offset = (uint32_t)(q % tagline_layout_chunk);
+	return( q / tagline_layout_chunk );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : layout_slot
+// Description  : The disk and chunk slot a copy of a chunk belongs at
+//
+// Inputs       : chunk - the chunk
+//                copy - 0 for the primary, 1 for the mirror
+//                dsk - the disk (out)
+// Outputs      : the chunk slot on the disk
+
+static inline uint32_t layout_slot(uint64_t chunk, int copy, uint32_t *dsk) {
+	uint32_t row = (uint32_t)(chunk / layout_disks), first = (uint32_t)(chunk % layout_disks);
+
+	*dsk = (copy == 0) ? first : (first + 1 + row % (layout_disks - 1)) % layout_disks;
+	return( 2*row + copy );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_configure
+// Description  : Turn the declustered layout on with a configuration
+//
+// Inputs       : spec - the configuration (see tagline_layout.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_layout_configure(const char *spec) {
+	char *copy, *field, *save;
+	unsigned int value;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if ((sscanf(field, "chunk=%u%c", &value, &extra) == 1) && (value > 0) && (value <= RAID_MAX_XFER)) {
+			tagline_layout_chunk = value;
+		} else if (sscanf(field, "spare=%u%c", &value, &extra) == 1) {
+			layout_spare_blocks = value;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad layout field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	tagline_layout_declustered = (ret == 0);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_init
+// Description  : Note the array's geometry and, if declustered, size the
+//                rows and the spare space, enough spare to take every
+//                chunk of one failed disk unless asked for more
+//
+// Inputs       : geo - the array geometry
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_layout_init(const TaglineGeometry *geo) {
+	uint32_t slots = geo->disk_blocks / tagline_layout_chunk;
+
+	tagline_layout_close();
+	layout_disks = geo->disks;
+	layout_disk_blocks = geo->disk_blocks;
+	if (!tagline_layout_declustered) {
+		return( 0 );
+	}
+	if (layout_disks < 3) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LAYOUT : declustering needs at least 3 disks, not %u.", layout_disks);
+		return( -1 );
+	}
+
+	// the most rows whose chunks the other disks' spares can take
+	if (layout_spare_blocks == 0) {
+		for (layout_rows = slots / 2; (layout_rows > 0) &&
+				(2*layout_rows + (2*layout_rows + layout_disks - 2) / (layout_disks - 1) > slots); layout_rows--);
+		layout_spares = slots - 2*layout_rows;
+	} else {
+		layout_spares = (layout_spare_blocks + tagline_layout_chunk - 1) / tagline_layout_chunk;
+		layout_rows = (layout_spares < slots) ? (slots - layout_spares) / 2 : 0;
+	}
+	if ((layout_rows == 0) || ((uint64_t)layout_spares * (layout_disks - 1) < 2*layout_rows)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LAYOUT : %u spare chunks of %u blocks per disk cannot hold a failed disk of %u chunks.",
+				layout_spares, tagline_layout_chunk, 2*layout_rows);
+		return( -1 );
+	}
+	layout_moved = calloc((size_t)layout_disks * 2 * layout_rows, sizeof(uint32_t));
+	layout_spare_used = calloc((size_t)layout_disks * layout_spares, sizeof(uint8_t));
+	layout_spare_free = malloc(layout_disks * sizeof(uint32_t));
+	if ((layout_moved == NULL) || (layout_spare_used == NULL) || (layout_spare_free == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LAYOUT : failed allocating the spare maps.");
+		tagline_layout_close();
+		return( -1 );
+	}
+	for (layout_turn = 0; layout_turn < layout_disks; layout_turn++) {
+		layout_spare_free[layout_turn] = layout_spares;
+	}
+	layout_turn = 0;
+	RAID_LOG(LOG_INFO_LEVEL, "LAYOUT : declustered over %u disks, %u rows of %u block chunks, %u spare chunks per disk, %llu mirrored blocks.",
+			layout_disks, layout_rows, tagline_layout_chunk, layout_spares,
+			(unsigned long long)tagline_layout_capacity());
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_close
+// Description  : Release the spare maps
+//
+// Inputs       : none
+// Outputs      : none
+
+void tagline_layout_close(void) {
+	free(layout_moved);
+	free(layout_spare_used);
+	free(layout_spare_free);
+	layout_moved = NULL;
+	layout_spare_used = NULL;
+	layout_spare_free = NULL;
+	layout_rows = layout_spares = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_capacity
+// Description  : Mirrored blocks the declustered layout holds
+//
+// Inputs       : none
+// Outputs      : the number of blocks
+
+uint64_t tagline_layout_capacity(void) {
+	return( (uint64_t)layout_rows * layout_disks * tagline_layout_chunk );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_copies
+// Description  : Copies a block has, an odd last disk of the paired layout
+//                having no mirror
+//
+// Inputs       : block - the block (paired layout)
+// Outputs      : 1 or 2
+
+int tagline_layout_copies(uint64_t block) {
+	if (tagline_layout_declustered) {
+		return( 2 );
+	}
+	return( (block / layout_disk_blocks + 1 < layout_disks) ? 2 : 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_locate
+// Description  : The disk and block a copy lives at now, in the spare space
+//                if a rebuild moved it there
+//
+// Inputs       : block - the block (paired layout)
+//                copy - 0 for the primary, 1 for the mirror
+//                dsk - the disk (out)
+//                blk - the block on the disk (out)
+// Outputs      : none
+
+void tagline_layout_locate(uint64_t block, int copy, RAIDDiskID *dsk, RAIDBlockID *blk) {
+	uint32_t offset, disk, slot, moved;
+	uint64_t chunk;
+
+	if (!tagline_layout_declustered) {
+		*dsk = (RAIDDiskID)(block / layout_disk_blocks + copy);
+		*blk = (RAIDBlockID)(block % layout_disk_blocks);
+		return;
+	}
+	chunk = layout_chunk_of(block, &offset);
+	slot = layout_slot(chunk, copy, &disk);
+	if ((moved = layout_moved[disk * 2 * layout_rows + slot]) != 0) {
+		disk = (moved - 1) / layout_spares;
+		slot = 2*layout_rows + (moved - 1) % layout_spares;
+	}
+	*dsk = (RAIDDiskID)disk;
+	*blk = (RAIDBlockID)(slot * tagline_layout_chunk + offset);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_home
+// Description  : The disk and block a copy belongs at
+//
+// Inputs       : block - the block (paired layout)
+//                copy - 0 for the primary, 1 for the mirror
+//                dsk - the disk (out)
+//                blk - the block on the disk (out)
+// Outputs      : none
+
+void tagline_layout_home(uint64_t block, int copy, RAIDDiskID *dsk, RAIDBlockID *blk) {
+	uint32_t offset, disk, slot;
+	uint64_t chunk;
+
+	if (!tagline_layout_declustered) {
+		tagline_layout_locate(block, copy, dsk, blk);
+		return;
+	}
+	chunk = layout_chunk_of(block, &offset);
+	slot = layout_slot(chunk, copy, &disk);
+	*dsk = (RAIDDiskID)disk;
+	*blk = (RAIDBlockID)(slot * tagline_layout_chunk + offset);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_split
+// Description  : A run of adjacent blocks cannot go on into this one in one
+//                request (it starts a disk, or a chunk when declustered)
+//
+// Inputs       : block - the block (paired layout)
+// Outputs      : 1 if the run has to end before it, 0 if not
+
+int tagline_layout_split(uint64_t block) {
+	uint32_t offset;
+
+	if (block % layout_disk_blocks == 0) {
+		return( 1 );
+	}
+	if (tagline_layout_declustered) {
+		layout_chunk_of(block, &offset);
+		return( offset == 0 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_lost
+// Description  : List the chunks with a copy on a disk, among those of the
+//                first mirrored blocks used, a primary and a mirror each
+//                row so the other copies are spread over every disk
+//
+// Inputs       : dsk - the disk
+//                used - the mirrored blocks used
+//                chunks - the first block of each chunk (out, room for
+//                         blocks per disk / chunk)
+//                copies - the copy of each that is on the disk (out)
+// Outputs      : the number of chunks
+
+uint32_t tagline_layout_lost(RAIDDiskID dsk, uint64_t used, uint64_t *chunks, int *copies) {
+	uint64_t q, last = (used + tagline_layout_chunk - 1) / tagline_layout_chunk, chunk;
+	uint32_t row, n = 0;
+	int copy;
+
+	for (row = 0; row < layout_rows; row++) {
+		for (copy = 0; copy < 2; copy++) {
+			chunk = (uint64_t)row * layout_disks + ((copy == 0) ? dsk :
+					(dsk + layout_disks - 1 - row % (layout_disks - 1)) % layout_disks);
+			if (chunk < last) {
+				q = chunk * tagline_layout_chunk;
+				chunks[n] = (q / layout_disk_blocks) * 2 * layout_disk_blocks + q % layout_disk_blocks;
+				copies[n++] = copy;
+			}
+		}
+	}
+	return( n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_spare
+// Description  : Move a chunk's copy into a free spare chunk of the disk,
+//                other than the failed one and the one with the other
+//                copy, that has the most left (in turn on a tie)
+//
+// Inputs       : chunk - the first block of the chunk (paired layout)
+//                copy - the copy to move
+//                failed - the failed disk
+// Outputs      : 0 if successful, -1 if no spare is left
+
+int tagline_layout_spare(uint64_t chunk, int copy, RAIDDiskID failed) {
+	uint32_t offset, disk, slot, best = layout_disks, i, j;
+	RAIDDiskID other;
+	RAIDBlockID blk;
+	uint64_t k = layout_chunk_of(chunk, &offset);
+
+	tagline_layout_locate(chunk, 1-copy, &other, &blk);
+	for (i = 0; i < layout_disks; i++) {
+		disk = (layout_turn + i) % layout_disks;
+		if ((disk != failed) && (disk != other) && (layout_spare_free[disk] > 0) &&
+				((best == layout_disks) || (layout_spare_free[disk] > layout_spare_free[best]))) {
+			best = disk;
+		}
+	}
+	if (best == layout_disks) {
+		return( -1 );
+	}
+	layout_turn = (best + 1) % layout_disks;
+	for (j = 0; layout_spare_used[best * layout_spares + j]; j++);
+	layout_spare_used[best * layout_spares + j] = 1;
+	layout_spare_free[best]--;
+	slot = layout_slot(k, copy, &disk);
+	layout_moved[disk * 2 * layout_rows + slot] = best * layout_spares + j + 1;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_layout_restore
+// Description  : Move a chunk's copy back home, freeing its spare
+//
+// Inputs       : chunk - the first block of the chunk (paired layout)
+//                copy - the copy to move back
+// Outputs      : none
+
+void tagline_layout_restore(uint64_t chunk, int copy) {
+	uint32_t offset, disk, slot, moved;
+	uint64_t k = layout_chunk_of(chunk, &offset);
+
+	slot = layout_slot(k, copy, &disk);
+	if ((moved = layout_moved[disk * 2 * layout_rows + slot]) != 0) {
+		layout_spare_used[moved - 1] = 0;
+		layout_spare_free[(moved - 1) / layout_spares]++;
+		layout_moved[disk * 2 * layout_rows + slot] = 0;
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef TAGLINE_LAYOUT_INCLUDED
+#define TAGLINE_LAYOUT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_layout.h
+//  Description   : This is the placement of the two copies of every block
+//                  of the tagline driver.  By default the disks are paired
+//                  and a block lives at the same place on both disks of a
+//                  pair, so a failed disk is rebuilt from its partner alone.
+//                  Once configured (tagline_client -R), the layout is
+//                  declustered instead: the blocks are cut into chunks,
+//                  every row of chunks puts one primary and one mirror
+//                  chunk on each disk (an odd last disk included), and the
+//                  partner of each disk rotates over all the others from
+//                  row to row.  The top of every disk is spare space.  A
+//                  failed disk's chunks are rebuilt from every surviving
+//                  disk into the spare space of every surviving disk, and
+//                  then copied back once the disk is replaced.  The
+//                  spare space comes out of the array's capacity (16272
+//                  mirrored blocks rather than 18432 for 9 disks of 4096
+//                  blocks).  The configuration is comma separated:
+//
+//                    chunk=<blocks>   blocks per chunk (16)
+//                    spare=<blocks>   spare blocks per disk (0 for just
+//                                     enough to rebuild one disk)
+//
+//                  The driver keeps addressing blocks by their place in
+//                  the paired layout (disk * blocks + block on the even
+//                  disk of a pair), and this module turns that into the
+//                  disk and block of either copy.  Declustering needs the
+//                  in-place allocator (no -L) and at least 3 disks.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/30/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <raid_bus.h>
+#include <tagline_driver.h>
+
+// Defines
+#define TAGLINE_LAYOUT_CHUNK 16 // Default blocks per chunk
+
+//
+// Global data
+extern int tagline_layout_declustered; // The declustered layout is configured
+extern uint32_t tagline_layout_chunk;  // Blocks per chunk
+
+//
+// Functional Prototypes
+
+int tagline_layout_configure(const char *spec);
+	// Turn the declustered layout on with a configuration
+
+int tagline_layout_init(const TaglineGeometry *geo);
+	// Note the geometry, size the rows and the spare space if declustered
+
+void tagline_layout_close(void);
+	// Release the spare maps
+
+uint64_t tagline_layout_capacity(void);
+	// Mirrored blocks the declustered layout holds
+
+int tagline_layout_copies(uint64_t block);
+	// Copies a block has (an odd last disk of the paired layout has one)
+
+void tagline_layout_locate(uint64_t block, int copy, RAIDDiskID *dsk, RAIDBlockID *blk);
+	// The disk and block a copy lives at now (in the spare space if moved)
+
+void tagline_layout_home(uint64_t block, int copy, RAIDDiskID *dsk, RAIDBlockID *blk);
+	// The disk and block a copy belongs at
+
+int tagline_layout_split(uint64_t block);
+	// A run of adjacent blocks cannot go on into this one in one request
+
+uint32_t tagline_layout_lost(RAIDDiskID dsk, uint64_t used, uint64_t *chunks, int *copies);
+	// The chunks with a copy on a disk, of the first used mirrored blocks
+
+int tagline_layout_spare(uint64_t chunk, int copy, RAIDDiskID failed);
+	// Move a chunk's copy into the spare space of another disk
+
+void tagline_layout_restore(uint64_t chunk, int copy);
+	// Move a chunk's copy back home, freeing its spare
+
+#endif
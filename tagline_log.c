@@ -0,0 +1,444 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_log.c
+//  Description   : This is the log-structured block allocator of the
+//                  tagline driver (see tagline_log.h).  Segment s covers
+//                  blocks (s % per disk) * segment onwards of disk pair
+//                  s / per disk (an odd last disk counting as a pair of
+//                  its own, unmirrored, whose segments are only opened
+//                  when no other one is free), and lives the whole time in one of four
+//                  states: free (in the FIFO of free segments, so a freed
+//                  segment is the last one reused), open at a head, full,
+//                  or being cleaned.  Every block of the array remembers
+//                  which tagline block it holds, so the cleaner can tell
+//                  whether a block it copies is still the live copy, and a
+//                  segment with reads or writes in flight is neither
+//                  cleaned nor reused, so no read finds other data in a
+//                  block it looked up.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/24/15
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Include Files
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <tagline_log.h>
+
+// Type definitions
+typedef enum {
+	LOG_FREE     = 0, // In the free FIFO
+	LOG_OPEN     = 1, // Being appended to at a head
+	LOG_FULL     = 2, // Appended to the end, may be cleaned
+	LOG_CLEANING = 3, // Its live blocks are being moved
+} LOG_SEGMENT_STATES;
+
+typedef struct {
+	uint32_t live;    // Blocks still mapped by a tagline
+	uint32_t pending; // Blocks with reads or writes in flight
+	uint64_t stamp;   // Log clock of the last append
+	uint8_t  state;   // LOG_SEGMENT_STATES
+} LogSegment;
+
+typedef struct {
+	int64_t  seg; // The open segment, -1 if none
+	uint32_t off; // Blocks appended to it
+} LogHead;
+
+//
+// Global data
+int tagline_log_enabled = 0;                          // Log-structured allocation is configured
+uint32_t tagline_log_segment = TAGLINE_LOG_SEGMENT;   // Blocks per segment
+uint32_t tagline_log_clean = TAGLINE_LOG_CLEAN;       // Free segments the cleaner keeps
+static uint32_t log_disk_blocks = 0;                  // Blocks per disk
+static uint32_t log_per_disk = 0;                     // Segments per disk
+static uint32_t log_nsegs = 0;                        // Segments in the array
+static uint32_t log_mirrored = 0;                     // ... on disk pairs (the rest on an odd last disk)
+static LogSegment *log_segs = NULL;                   // The segments
+static uint64_t *log_owner = NULL;                    // Tagline block of every array block (tag << 32 | block)
+static uint32_t *log_free = NULL;                     // FIFO of free segments
+static uint32_t log_free_first = 0, log_nfree = 0;    // ... its first and number
+static uint32_t log_nfree_mirrored = 0;               // ... of them mirrored
+static LogHead log_heads[TAGLINE_LOG_MAXVAL];         // The open segments
+static uint64_t log_clock = 0;                        // Blocks appended so far
+static uint64_t log_appended[TAGLINE_LOG_MAXVAL];     // ... by each head
+static uint64_t log_released = 0;                     // Blocks released
+static uint64_t log_cleaned = 0;                      // Segments cleaned
+static uint64_t log_reclaimed = 0;                    // Segments that came free
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_index
+// Description  : Turn a physical block (disk * blocks per disk + block,
+//                disk the even one of its pair) into an index of the log
+//
+// Inputs       : block - the physical block
+// Outputs      : the index, segment * blocks per segment + offset
+
+static inline uint64_t log_index(uint64_t block) {
+	return( (block / log_disk_blocks / 2) * log_disk_blocks + block % log_disk_blocks );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_block
+// Description  : Turn an index of the log back into a physical block
+//
+// Inputs       : index - the index
+// Outputs      : the physical block
+
+static inline uint64_t log_block(uint64_t index) {
+	return( (index / log_disk_blocks) * 2 * log_disk_blocks + index % log_disk_blocks );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_reclaim
+// Description  : Put a segment nothing lives in on the back of the free FIFO
+//
+// Inputs       : seg - the segment
+// Outputs      : none
+
+static void log_reclaim(uint32_t seg) {
+	log_segs[seg].state = LOG_FREE;
+	log_free[(log_free_first + log_nfree) % log_nsegs] = seg;
+	log_nfree++;
+	log_nfree_mirrored += (seg < log_mirrored);
+	log_reclaimed++;
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_configure
+// Description  : Turn log-structured allocation on with a configuration
+//
+// Inputs       : spec - the configuration (see tagline_log.h)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_log_configure(const char *spec) {
+	char *copy, *field, *save;
+	unsigned int value;
+	char extra;
+	int ret = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return( -1 );
+	}
+	for (field = strtok_r(copy, ",", &save); (field != NULL) && (ret == 0); field = strtok_r(NULL, ",", &save)) {
+		if ((sscanf(field, "segment=%u%c", &value, &extra) == 1) && (value > 0) && (value <= RAID_TRACK_BLOCKS)) {
+			tagline_log_segment = value;
+		} else if ((sscanf(field, "clean=%u%c", &value, &extra) == 1) && (value > 0)) {
+			tagline_log_clean = value;
+		} else {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad log field [%s]", field);
+			ret = -1;
+		}
+	}
+	free(copy);
+	tagline_log_enabled = (ret == 0);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_init
+// Description  : Cut the array's disk pairs into free segments, and an odd
+//                last disk into unmirrored ones at the back of the FIFO
+//
+// Inputs       : geo - the array geometry
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_log_init(const TaglineGeometry *geo) {
+	uint64_t i;
+
+	tagline_log_close();
+	if (geo->disk_blocks % tagline_log_segment) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LOG : segments of %u blocks do not divide disks of %u blocks.",
+				tagline_log_segment, geo->disk_blocks);
+		return( -1 );
+	}
+	log_disk_blocks = geo->disk_blocks;
+	log_per_disk = geo->disk_blocks / tagline_log_segment;
+	log_nsegs = ((geo->disks + 1) / 2) * log_per_disk;
+	log_mirrored = (geo->disks / 2) * log_per_disk;
+	if (log_nsegs < tagline_log_clean + TAGLINE_LOG_RESERVE) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LOG : %u segments of %u blocks are too few to keep %u free.",
+				log_nsegs, tagline_log_segment, tagline_log_clean + TAGLINE_LOG_RESERVE);
+		return( -1 );
+	}
+	log_segs = calloc(log_nsegs, sizeof(LogSegment));
+	log_owner = malloc((uint64_t)log_nsegs * tagline_log_segment * sizeof(uint64_t));
+	log_free = malloc(log_nsegs * sizeof(uint32_t));
+	if ((log_segs == NULL) || (log_owner == NULL) || (log_free == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "LOG : failed allocating %u segments.", log_nsegs);
+		tagline_log_close();
+		return( -1 );
+	}
+	for (i = 0; i < (uint64_t)log_nsegs * tagline_log_segment; i++) {
+		log_owner[i] = TAGLINE_UNMAPPED;
+	}
+	for (i = 0; i < log_nsegs; i++) {
+		log_free[i] = i;
+	}
+	log_free_first = 0;
+	log_nfree = log_nsegs;
+	log_nfree_mirrored = log_mirrored;
+	for (i = 0; i < TAGLINE_LOG_MAXVAL; i++) {
+		log_heads[i].seg = -1;
+		log_heads[i].off = 0;
+		log_appended[i] = 0;
+	}
+	log_clock = log_released = log_cleaned = log_reclaimed = 0;
+	RAID_LOG(LOG_INFO_LEVEL, "LOG : %u segments of %u blocks (%u unmirrored), cleaning below %u free.",
+			log_nsegs, tagline_log_segment, log_nsegs - log_mirrored, tagline_log_clean);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_close
+// Description  : Log the allocation figures and release the segments
+//
+// Inputs       : none
+// Outputs      : none
+
+void tagline_log_close(void) {
+	uint64_t user = log_appended[TAGLINE_LOG_USER], moved = log_appended[TAGLINE_LOG_CLEANER];
+
+	if (log_segs != NULL) {
+		RAID_LOG(LOG_INFO_LEVEL, "LOG : %llu blocks written, %llu moved by the cleaner (write amplification %.2f), "
+				"%llu released, %llu segments cleaned, %llu freed, %u of %u free.",
+				(unsigned long long)user, (unsigned long long)moved, (user > 0) ? (double)(user + moved) / user : 0.0,
+				(unsigned long long)log_released, (unsigned long long)log_cleaned,
+				(unsigned long long)log_reclaimed, log_nfree, log_nsegs);
+	}
+	free(log_segs);
+	free(log_owner);
+	free(log_free);
+	log_segs = NULL;
+	log_owner = NULL;
+	log_free = NULL;
+	log_nsegs = log_mirrored = log_nfree = log_nfree_mirrored = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_room
+// Description  : Blocks a head can take before the cleaner has to free some
+//                (tagline writes leave the reserve to the cleaner)
+//
+// Inputs       : head - the head
+// Outputs      : the number of blocks
+
+uint64_t tagline_log_room(TAGLINE_LOG_HEADS head) {
+	uint64_t room = (log_heads[head].seg < 0) ? 0 : tagline_log_segment - log_heads[head].off;
+	uint32_t nfree = log_nfree;
+
+	if (head == TAGLINE_LOG_USER) {
+		nfree = (nfree > TAGLINE_LOG_RESERVE) ? nfree - TAGLINE_LOG_RESERVE : 0;
+	}
+	return( room + (uint64_t)nfree * tagline_log_segment );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_free_segments
+// Description  : Mirrored segments nothing is written to, the ones the
+//                cleaner keeps free (an odd last disk's are only overflow)
+//
+// Inputs       : none
+// Outputs      : the number of segments
+
+uint32_t tagline_log_free_segments(void) {
+	return( log_nfree_mirrored );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_alloc
+// Description  : Append a tagline block at a head, opening the next free
+//                segment when the head's is full (tagline_log_room says
+//                there is room)
+//
+// Inputs       : head - the head
+//                tag - the tagline
+//                bnum - the block of the tagline
+// Outputs      : the physical block
+
+uint64_t tagline_log_alloc(TAGLINE_LOG_HEADS head, TagLineNumber tag, TagLineBlockNumber bnum) {
+	LogHead *h = &log_heads[head];
+	LogSegment *s;
+	uint64_t index;
+
+	if (h->seg < 0) {
+		// an unmirrored segment goes to the back while a mirrored one is free
+		while ((log_free[log_free_first] >= log_mirrored) && (log_nfree_mirrored > 0)) {
+			log_free[(log_free_first + log_nfree) % log_nsegs] = log_free[log_free_first];
+			log_free_first = (log_free_first + 1) % log_nsegs;
+		}
+		h->seg = log_free[log_free_first];
+		h->off = 0;
+		log_free_first = (log_free_first + 1) % log_nsegs;
+		log_nfree--;
+		log_nfree_mirrored -= (h->seg < log_mirrored);
+		log_segs[h->seg].state = LOG_OPEN;
+	}
+	s = &log_segs[h->seg];
+	index = (uint64_t)h->seg * tagline_log_segment + h->off;
+	log_owner[index] = ((uint64_t)tag << 32) | bnum;
+	s->live++;
+	s->pending++;
+	s->stamp = log_clock++;
+	log_appended[head]++;
+	if (++h->off == tagline_log_segment) {
+		s->state = LOG_FULL;
+		h->seg = -1;
+	}
+	return( log_block(index) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_release
+// Description  : A physical block is no longer mapped, a full segment
+//                that is left with nothing live comes free without cleaning
+//
+// Inputs       : block - the physical block
+// Outputs      : none
+
+void tagline_log_release(uint64_t block) {
+	uint64_t index = log_index(block);
+	LogSegment *s = &log_segs[index / tagline_log_segment];
+
+	if (log_owner[index] != TAGLINE_UNMAPPED) {
+		log_owner[index] = TAGLINE_UNMAPPED;
+		log_released++;
+		if ((--s->live == 0) && (s->pending == 0) && (s->state == LOG_FULL)) {
+			log_reclaim(index / tagline_log_segment);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_hold
+// Description  : Keep a block's segment from being cleaned or reused while
+//                it is read (tagline_log_alloc holds the blocks it appends)
+//
+// Inputs       : block - the physical block
+// Outputs      : none
+
+void tagline_log_hold(uint64_t block) {
+	log_segs[log_index(block) / tagline_log_segment].pending++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_done
+// Description  : The read or write of a held block is done, a full segment
+//                with nothing live left comes free
+//
+// Inputs       : block - the physical block
+// Outputs      : 1 if that made its segment cleanable, 0 otherwise
+
+int tagline_log_done(uint64_t block) {
+	uint32_t seg = log_index(block) / tagline_log_segment;
+	LogSegment *s = &log_segs[seg];
+
+	if ((--s->pending > 0) || (s->state != LOG_FULL)) {
+		return( 0 );
+	}
+	if (s->live == 0) {
+		log_reclaim(seg);
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_victim
+// Description  : Pick the full segment with the best cost-benefit,
+//                (1 - u) * age / (1 + u) with u the live fraction, and
+//                mark it as being cleaned
+//
+// Inputs       : seg - the segment (out)
+// Outputs      : 0 if one was picked, 1 if the only candidates are still
+//                being written, -1 if no segment would free anything
+
+int tagline_log_victim(uint32_t *seg) {
+	double u, score, best = -1.0;
+	uint32_t i;
+	int busy = 0;
+
+	for (i = 0; i < log_nsegs; i++) {
+		if ((log_segs[i].state != LOG_FULL) || (log_segs[i].live == tagline_log_segment)) {
+			continue;
+		}
+		if (log_segs[i].pending > 0) {
+			busy = 1;
+			continue;
+		}
+		u = (double)log_segs[i].live / tagline_log_segment;
+		score = (1.0 - u) * (double)(log_clock - log_segs[i].stamp + 1) / (1.0 + u);
+		if (score > best) {
+			best = score;
+			*seg = i;
+		}
+	}
+	if (best < 0) {
+		return( busy ? 1 : -1 );
+	}
+	log_segs[*seg].state = LOG_CLEANING;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_live
+// Description  : List the live blocks of a segment, in block order
+//
+// Inputs       : seg - the segment
+//                blocks - their physical blocks (out, a segment's worth)
+//                owners - the tagline blocks they hold (out, tag << 32 | block)
+// Outputs      : the number of live blocks
+
+uint32_t tagline_log_live(uint32_t seg, uint64_t *blocks, uint64_t *owners) {
+	uint64_t index = (uint64_t)seg * tagline_log_segment;
+	uint32_t i, n;
+
+	for (i = 0, n = 0; i < tagline_log_segment; i++) {
+		if (log_owner[index + i] != TAGLINE_UNMAPPED) {
+			blocks[n] = log_block(index + i);
+			owners[n++] = log_owner[index + i];
+		}
+	}
+	return( n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_log_cleaned
+// Description  : Finish cleaning a segment, freeing it if nothing in it is
+//                live or held (it goes back to full otherwise)
+//
+// Inputs       : seg - the segment
+// Outputs      : none
+
+void tagline_log_cleaned(uint32_t seg) {
+	log_cleaned++;
+	log_segs[seg].state = LOG_FULL;
+	if ((log_segs[seg].live == 0) && (log_segs[seg].pending == 0)) {
+		log_reclaim(seg);
+	}
+}
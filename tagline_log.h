@@ -0,0 +1,94 @@
+#ifndef TAGLINE_LOG_INCLUDED
+#define TAGLINE_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_log.h
+//  Description   : This is the log-structured block allocator of the
+//                  tagline driver.  Once configured (tagline_client -L),
+//                  every write, overwrites included, is appended at the
+//                  head of the log instead of going back to where the
+//                  block lived.  The mirrored disk pairs are cut into
+//                  segments that keep a count of the blocks still mapped
+//                  by a tagline (an odd last disk too, its segments
+//                  unmirrored and only used when no other is free), and the driver's cleaner picks the full
+//                  segment worth the most to clean (the LFS cost-benefit
+//                  of free space times age) and copies its live blocks to
+//                  a head of its own, so the array never runs out while
+//                  the live data fits.  The configuration is comma
+//                  separated:
+//
+//                    segment=<blocks>   blocks per segment (128)
+//                    clean=<segments>   free segments the cleaner keeps (8)
+//
+//                  The allocator does no locking of its own, the driver
+//                  calls it with allocLock held.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/24/15
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <tagline_driver.h>
+
+// Defines
+#define TAGLINE_LOG_SEGMENT 128 // Default blocks per segment
+#define TAGLINE_LOG_CLEAN   8   // Default free segments the cleaner keeps
+#define TAGLINE_LOG_RESERVE 2   // Free segments only the cleaner may take
+
+// Type definitions
+typedef enum {
+	TAGLINE_LOG_USER    = 0, // Head for tagline writes
+	TAGLINE_LOG_CLEANER = 1, // Head for the blocks the cleaner moves
+	TAGLINE_LOG_MAXVAL  = 2, // Max value
+} TAGLINE_LOG_HEADS;
+
+//
+// Global data
+extern int tagline_log_enabled;     // Log-structured allocation is configured
+extern uint32_t tagline_log_segment; // Blocks per segment
+extern uint32_t tagline_log_clean;   // Free segments the cleaner keeps
+
+//
+// Functional Prototypes
+
+int tagline_log_configure(const char *spec);
+	// Turn log-structured allocation on with a configuration
+
+int tagline_log_init(const TaglineGeometry *geo);
+	// Cut the array's disk pairs into free segments
+
+void tagline_log_close(void);
+	// Log the allocation figures and release the segments
+
+uint64_t tagline_log_room(TAGLINE_LOG_HEADS head);
+	// Blocks a head can take before the cleaner has to free some
+
+uint32_t tagline_log_free_segments(void);
+	// Mirrored segments nothing is written to
+
+uint64_t tagline_log_alloc(TAGLINE_LOG_HEADS head, TagLineNumber tag, TagLineBlockNumber bnum);
+	// Append a tagline block at a head, returning its physical block
+
+void tagline_log_release(uint64_t block);
+	// A physical block is no longer mapped (overwritten, trimmed or moved)
+
+void tagline_log_hold(uint64_t block);
+	// Keep a block from being moved or reused while it is read
+
+int tagline_log_done(uint64_t block);
+	// The read or write of a held (or appended) block is done, 1 if that freed its segment up
+
+int tagline_log_victim(uint32_t *seg);
+	// Pick the segment to clean (0), 1 if only ones being written, -1 if none
+
+uint32_t tagline_log_live(uint32_t seg, uint64_t *blocks, uint64_t *owners);
+	// List the live blocks of a segment and their owners (tag << 32 | block)
+
+void tagline_log_cleaned(uint32_t seg);
+	// Finish cleaning a segment, freeing it if nothing in it is live
+
+#endif
@@ -0,0 +1,740 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_microbench.c
+//  Description   : This is the microbenchmark suite of the driver (make
+//                  bench).  It times the block cache hit and miss paths at
+//                  several cache sizes, the tagline map lookups, RAID
+//                  opcode creation and decoding, the block checksum, and
+//                  the bus transport at
+//                  several queue depths against the in-process array or a
+//                  server.  Every benchmark is calibrated to a run time,
+//                  warmed up, then run several times; the median run is
+//                  reported in nsec, cycles and allocations per op.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/22/15
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+#include <raid_bus.h>
+#include <raid_cache.h>
+#include <raid_local.h>
+#include <raid_network.h>
+#include <tagline_driver.h>
+#include <tagline_check.h>
+
+// Defines
+#define BENCH_ARGUMENTS "hvbzt:r:c:q:e:f:p:"
+#define BENCH_MAX_SIZES 16      // Most cache sizes or queue depths on the command line
+#define BENCH_MAX_RUNS  101     // Most timed runs per benchmark
+#define BENCH_MAX_DEPTH 1024    // Deepest transport queue
+#define BENCH_MAX_CACHE 1048576 // Largest cache
+#define BENCH_KEYS      4096    // Keys in the lookup sequences (a power of two)
+#define BENCH_TAGLINES  64      // Taglines written for the map benchmarks
+#define USAGE \
+	"USAGE: tagline_microbench [-h] [-v] [-t <msec>] [-r <runs>] [-c <sizes>] [-q <depths>]\n" \
+	"                          [-e <endpoint>] [-b] [-z] [-f <filter>] [-p <cpu>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -t - time of each run in milliseconds (default 50)\n" \
+	"    -r - timed runs per benchmark, the median is reported (default 7)\n" \
+	"    -c - comma separated cache sizes in blocks (default 64,1024,16384)\n" \
+	"    -q - comma separated transport queue depths (default 1,16,64)\n" \
+	"    -e - server endpoint for the transport benchmarks (default mem://)\n" \
+	"    -b - ask the server for batched requests (RAID_BATCH)\n" \
+	"    -z - ask the server to compress payloads on the wire (TCP only)\n" \
+	"    -f - only run the benchmarks whose name contains <filter>\n" \
+	"    -p - pin the benchmarks to a cpu\n" \
+	"\n" \
+
+//
+// Type definitions
+typedef uint64_t (*BenchFunction)(uint32_t arg, uint64_t iters);
+	// Run iters iterations, returning the ops they did
+
+typedef enum {
+	BENCH_CYCLES_NONE = 0, // No cycle counter
+	BENCH_CYCLES_PERF = 1, // Hardware cycles (perf_event_open)
+	BENCH_CYCLES_TSC  = 2, // Time stamp counter (reference cycles)
+} BENCH_CYCLE_SOURCES;
+
+//
+// Global data
+static uint32_t bench_msec = 50;                   // Time of each run
+static int bench_runs = 7;                         // Timed runs per benchmark
+static const char *bench_filter = NULL;            // Benchmarks to run
+static BENCH_CYCLE_SOURCES bench_cycles = BENCH_CYCLES_NONE;
+static int bench_perf_fd = -1;                     // Hardware cycle counter
+static volatile uint64_t bench_sink;               // Keeps results alive
+static uint64_t bench_allocs = 0;                  // malloc/calloc/realloc calls
+static uint32_t bench_keys[BENCH_KEYS];            // Pseudo-random key indices
+static char bench_block[RAID_BLOCK_SIZE];          // A block to put and copy
+static char bench_buf[BENCH_MAX_DEPTH*RAID_BLOCK_SIZE]; // Transport payloads
+static RAIDOpCode bench_ops[BENCH_MAX_DEPTH];      // Transport requests
+static RAIDOpCode bench_resps[BENCH_MAX_DEPTH];    // ... and responses
+static void *bench_bufs[BENCH_MAX_DEPTH];          // ... and their payloads
+
+//
+// Allocation counting, the bench target links with -Wl,--wrap for these
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return( __real_malloc(size) );
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return( __real_calloc(nmemb, size) );
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return( __real_realloc(ptr, size) );
+}
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_now
+// Description  : Read the benchmark clock
+//
+// Inputs       : none
+// Outputs      : the time in nsec
+
+static uint64_t bench_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cycles_open
+// Description  : Find a cycle counter, the hardware one if perf allows it
+//
+// Inputs       : none
+// Outputs      : none
+
+static void bench_cycles_open(void) {
+	struct perf_event_attr attr;
+	int kernel;
+
+	// Count the kernel too (the transports live in it) when allowed
+	for (kernel = 0; (kernel < 2) && (bench_perf_fd == -1); kernel++) {
+		memset(&attr, 0x0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		attr.exclude_kernel = kernel;
+		attr.exclude_hv = 1;
+		bench_perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (bench_perf_fd != -1) {
+		ioctl(bench_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+		bench_cycles = BENCH_CYCLES_PERF;
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	bench_cycles = BENCH_CYCLES_TSC;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cycles_read
+// Description  : Read the cycle counter
+//
+// Inputs       : none
+// Outputs      : the cycle count (0 without a counter)
+
+static uint64_t bench_cycles_read(void) {
+	uint64_t cycles = 0;
+
+	if (bench_cycles == BENCH_CYCLES_PERF) {
+		if (read(bench_perf_fd, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+			cycles = 0;
+		}
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if (bench_cycles == BENCH_CYCLES_TSC) {
+		cycles = __rdtsc();
+	}
+#endif
+	return( cycles );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_compare
+// Description  : Order two per-op figures (for qsort)
+//
+// Inputs       : a, b - the figures
+// Outputs      : <0, 0 or >0
+
+static int bench_compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_run
+// Description  : Calibrate, warm up and time a benchmark, then print it
+//
+// Inputs       : name - the benchmark name
+//                arg - its parameter (cache size, queue depth, ...)
+//                fn - the benchmark
+// Outputs      : 0 if successful, -1 if failure
+
+static int bench_run(const char *name, uint32_t arg, BenchFunction fn) {
+	double ns[BENCH_MAX_RUNS], cycles[BENCH_MAX_RUNS], allocs[BENCH_MAX_RUNS];
+	uint64_t iters, ops, start, elapsed, target, c0, a0;
+	char label[64];
+	int r;
+
+	snprintf(label, sizeof(label), "%s/%u", name, arg);
+	if ((bench_filter != NULL) && (strstr(label, bench_filter) == NULL)) {
+		return( 0 );
+	}
+
+	// Find how many iterations take a run's time, then warm up with a run
+	// of that many, correcting the count from it (the first runs are cold)
+	target = (uint64_t)bench_msec * 1000000ULL;
+	for (iters = 1, r = 0; r < 2; r++) {
+		for (;; iters *= 2) {
+			start = bench_now();
+			if (fn(arg, iters) == 0) {
+				RAID_LOG(LOG_ERROR_LEVEL, "Benchmark %s failed.", label);
+				return( -1 );
+			}
+			if ((elapsed = bench_now() - start) >= target / 16) {
+				break;
+			}
+		}
+		iters = (uint64_t)((double)iters * target / elapsed);
+		iters = (iters == 0) ? 1 : iters;
+	}
+
+	// The timed runs
+	for (r = 0; r < bench_runs; r++) {
+		a0 = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+		c0 = bench_cycles_read();
+		start = bench_now();
+		if ((ops = fn(arg, iters)) == 0) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Benchmark %s failed.", label);
+			return( -1 );
+		}
+		ns[r] = (double)(bench_now() - start) / ops;
+		cycles[r] = (double)(bench_cycles_read() - c0) / ops;
+		allocs[r] = (double)(__atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - a0) / ops;
+	}
+	qsort(ns, bench_runs, sizeof(double), bench_compare);
+	qsort(cycles, bench_runs, sizeof(double), bench_compare);
+	qsort(allocs, bench_runs, sizeof(double), bench_compare);
+
+	printf("%-28s %12lu %12.1f", label, (unsigned long)iters, ns[bench_runs/2]);
+	if (bench_cycles == BENCH_CYCLES_NONE) {
+		printf(" %12s", "-");
+	} else {
+		printf(" %12.1f", cycles[bench_runs/2]);
+	}
+	printf(" %10.3f %7.1f%%\n", allocs[bench_runs/2],
+			(ns[bench_runs/2] > 0) ? 100.0 * (ns[bench_runs-1] - ns[0]) / ns[bench_runs/2] : 0.0);
+	fflush(stdout);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_parse_list
+// Description  : Parse a comma separated list of sizes
+//
+// Inputs       : str - the list
+//                list - the sizes (out)
+//                max - the largest size allowed
+// Outputs      : the number of sizes, or -1 if failure
+
+static int bench_parse_list(const char *str, uint32_t *list, uint32_t max) {
+	const char *p = str;
+	char *end;
+	unsigned long v;
+	int n = 0;
+
+	while (*p != 0x0) {
+		v = strtoul(p, &end, 10);
+		if ((end == p) || (v == 0) || (v > max) || (n == BENCH_MAX_SIZES) || ((*end != ',') && (*end != 0x0))) {
+			return( -1 );
+		}
+		list[n++] = (uint32_t)v;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return( (n > 0) ? n : -1 );
+}
+
+//
+// Benchmarks
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_opcode_create
+// Description  : Build READ opcodes with create_raid_request
+//
+// Inputs       : arg - unused
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_opcode_create(uint32_t arg, uint64_t iters) {
+	RAIDOpCode sum = 0;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		sum += create_raid_request(RAID_READ, 1, (RAIDDiskID)(i & 0x7), (RAIDBlockID)i);
+	}
+	bench_sink = sum;
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_opcode_decode
+// Description  : Pull the fields out of responses as the driver and the
+//                server do, and match them with extract_raid_response
+//
+// Inputs       : arg - unused
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_opcode_decode(uint32_t arg, uint64_t iters) {
+	RAIDOpCode op, resp;
+	uint64_t i, sum = 0;
+
+	op = create_raid_request(RAID_READ, 1, 3, 0);
+	for (i = 0; i < iters; i++) {
+		resp = op | (i & 0xffffffff);
+		sum += ((resp >> 56) & 0xff) + ((resp >> 48) & 0xff) + ((resp >> 40) & 0xff) +
+				((resp >> 32) & 0x1) + (RAIDBlockID)resp;
+		sum += extract_raid_response(op, resp);
+	}
+	bench_sink = sum;
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_crc32c
+// Description  : Checksum blocks as the driver does on every write and
+//                every block read off the array
+//
+// Inputs       : arg - unused
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_crc32c(uint32_t arg, uint64_t iters) {
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < iters; i++) {
+		bench_block[i & (RAID_BLOCK_SIZE-1)]++;
+		sum += tagline_crc32c(bench_block, RAID_BLOCK_SIZE);
+	}
+	bench_sink = sum;
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_fill
+// Description  : Start a cache of arg blocks holding blocks 0..arg-1 (a
+//                block's disk is its number modulo 8)
+//
+// Inputs       : arg - the cache size
+// Outputs      : none
+
+static void bench_cache_fill(uint32_t arg) {
+	uint32_t i;
+
+	init_raid_cache(arg);
+	for (i = 0; i < arg; i++) {
+		put_raid_cache((RAIDDiskID)(i & 0x7), (RAIDBlockID)(i >> 3), bench_block);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_get_hit
+// Description  : Get cached blocks in a pseudo-random order
+//
+// Inputs       : arg - the cache size
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_cache_get_hit(uint32_t arg, uint64_t iters) {
+	uint64_t i;
+	uint32_t k;
+
+	for (i = 0; i < iters; i++) {
+		k = bench_keys[i & (BENCH_KEYS-1)] % arg;
+		if (get_raid_cache((RAIDDiskID)(k & 0x7), (RAIDBlockID)(k >> 3)) == NULL) {
+			return( 0 );
+		}
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_get_miss
+// Description  : Get blocks that are not cached
+//
+// Inputs       : arg - the cache size
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_cache_get_miss(uint32_t arg, uint64_t iters) {
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		if (get_raid_cache((RAIDDiskID)8, (RAIDBlockID)bench_keys[i & (BENCH_KEYS-1)]) != NULL) {
+			return( 0 );
+		}
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_copy_hit
+// Description  : Copy cached blocks out, as tagline_read does
+//
+// Inputs       : arg - the cache size
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_cache_copy_hit(uint32_t arg, uint64_t iters) {
+	char buf[RAID_BLOCK_SIZE];
+	uint64_t i;
+	uint32_t k;
+
+	for (i = 0; i < iters; i++) {
+		k = bench_keys[i & (BENCH_KEYS-1)] % arg;
+		if (copy_raid_cache((RAIDDiskID)(k & 0x7), (RAIDBlockID)(k >> 3), buf)) {
+			return( 0 );
+		}
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_put_hit
+// Description  : Put blocks that are already cached (updates)
+//
+// Inputs       : arg - the cache size
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_cache_put_hit(uint32_t arg, uint64_t iters) {
+	uint64_t i;
+	uint32_t k;
+
+	for (i = 0; i < iters; i++) {
+		k = bench_keys[i & (BENCH_KEYS-1)] % arg;
+		put_raid_cache((RAIDDiskID)(k & 0x7), (RAIDBlockID)(k >> 3), bench_block);
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_put_miss
+// Description  : Put blocks that are not cached, each evicting the least
+//                recently used one
+//
+// Inputs       : arg - the cache size
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_cache_put_miss(uint32_t arg, uint64_t iters) {
+	static uint32_t next = 0;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++, next++) {
+		put_raid_cache((RAIDDiskID)9, (RAIDBlockID)next, bench_block);
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_map_lookup
+// Description  : Look written tagline blocks up in the tagline maps
+//
+// Inputs       : arg - the blocks per tagline
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_map_lookup(uint32_t arg, uint64_t iters) {
+	RAIDDiskID dsk;
+	RAIDBlockID blk;
+	uint64_t i, sum = 0;
+	uint32_t k;
+
+	for (i = 0; i < iters; i++) {
+		k = bench_keys[i & (BENCH_KEYS-1)];
+		if (tagline_map_lookup((TagLineNumber)(k % BENCH_TAGLINES), (k / BENCH_TAGLINES) % arg, &dsk, &blk)) {
+			return( 0 );
+		}
+		sum += dsk + blk;
+	}
+	bench_sink = sum;
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_tagline_read_hit
+// Description  : Read single blocks of the last tagline written, which are
+//                all in the driver cache
+//
+// Inputs       : arg - the blocks per tagline
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_tagline_read_hit(uint32_t arg, uint64_t iters) {
+	char buf[RAID_BLOCK_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		if (tagline_read(BENCH_TAGLINES-1, bench_keys[i & (BENCH_KEYS-1)] % arg, 1, buf)) {
+			return( 0 );
+		}
+	}
+	return( iters );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_bus
+// Description  : Send arg one block requests at a time over the bus
+//
+// Inputs       : req - RAID_READ or RAID_WRITE
+//                arg - the queue depth
+//                iters - the iterations
+// Outputs      : the ops done
+
+static uint64_t bench_bus(RAID_REQUEST_TYPES req, uint32_t arg, uint64_t iters) {
+	uint64_t i;
+	uint32_t j, k;
+
+	for (i = 0; i < iters; i++) {
+		for (j = 0; j < arg; j++) {
+			k = bench_keys[(i*arg + j) & (BENCH_KEYS-1)];
+			bench_ops[j] = create_raid_request(req, 1, (RAIDDiskID)(k & 0x7), (RAIDBlockID)((k >> 3) % RAID_DISKBLOCKS));
+			bench_bufs[j] = &bench_buf[j*RAID_BLOCK_SIZE];
+		}
+		if (client_raid_bus_batch(bench_ops, bench_bufs, bench_resps, arg)) {
+			return( 0 );
+		}
+	}
+	return( iters * arg );
+}
+
+static uint64_t bench_bus_read(uint32_t arg, uint64_t iters) {
+	return( bench_bus(RAID_READ, arg, iters) );
+}
+
+static uint64_t bench_bus_write(uint32_t arg, uint64_t iters) {
+	return( bench_bus(RAID_WRITE, arg, iters) );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the microbenchmarks
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	uint32_t sizes[BENCH_MAX_SIZES] = { 64, 1024, 16384 }, depths[BENCH_MAX_SIZES] = { 1, 16, 64 };
+	int nsizes = 3, ndepths = 3, ch, verbose = 0, cpu = -1, i, ret = 0;
+	TaglineGeometry geo = tagline_geometry_default;
+	cpu_set_t set;
+	uint32_t t, b;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf(stderr, USAGE);
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'b': // Ask for batch frames
+			raid_bus_requested |= RAID_CAP_BATCH;
+			break;
+
+		case 'z': // Ask for compressed payloads
+			raid_bus_requested |= RAID_CAP_COMPRESS;
+			break;
+
+		case 't': // Run time
+			if ((sscanf(optarg, "%u", &bench_msec) != 1) || (bench_msec == 0)) {
+				fprintf(stderr, "Bad run time [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Runs
+			if ((sscanf(optarg, "%d", &bench_runs) != 1) || (bench_runs < 1) || (bench_runs > BENCH_MAX_RUNS)) {
+				fprintf(stderr, "Bad number of runs [%s] (1-%d), aborting.\n", optarg, BENCH_MAX_RUNS);
+				return( -1 );
+			}
+			break;
+
+		case 'c': // Cache sizes
+			if ((nsizes = bench_parse_list(optarg, sizes, BENCH_MAX_CACHE)) == -1) {
+				fprintf(stderr, "Bad cache sizes [%s] (1-%d), aborting.\n", optarg, BENCH_MAX_CACHE);
+				return( -1 );
+			}
+			break;
+
+		case 'q': // Queue depths
+			if ((ndepths = bench_parse_list(optarg, depths, BENCH_MAX_DEPTH)) == -1) {
+				fprintf(stderr, "Bad queue depths [%s] (1-%d), aborting.\n", optarg, BENCH_MAX_DEPTH);
+				return( -1 );
+			}
+			break;
+
+		case 'e': // Set the server endpoint
+			raid_network_endpoint = strdup(optarg);
+			break;
+
+		case 'f': // Filter the benchmarks
+			bench_filter = optarg;
+			break;
+
+		case 'p': // Pin to a cpu
+			if ((sscanf(optarg, "%d", &cpu) != 1) || (cpu < 0) || (cpu >= CPU_SETSIZE)) {
+				fprintf(stderr, "Bad cpu [%s], aborting.\n", optarg);
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+			return( -1 );
+		}
+	}
+	if (optind != argc) {
+		fprintf(stderr, "Unexpected command line parameters, use -h to see usage, aborting.\n");
+		return( -1 );
+	}
+	initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+	if (verbose) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	if (raid_network_endpoint == NULL) {
+		raid_network_endpoint = strdup(RAID_MEM_SCHEME);
+	}
+	if (cpu != -1) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Failed pinning the benchmarks to cpu %d.", cpu);
+			return( -1 );
+		}
+	}
+
+	// The same pseudo-random key sequence every time (xorshift)
+	for (b = 2463534242U, i = 0; i < BENCH_KEYS; i++) {
+		b ^= b << 13;
+		b ^= b >> 17;
+		b ^= b << 5;
+		bench_keys[i] = b & 0x7fffffff;
+	}
+	memset(bench_block, 'B', sizeof(bench_block));
+	bench_cycles_open();
+
+	printf("%-28s %12s %12s %12s %10s %8s\n", "benchmark", "iters/run", "ns/op", "cycles/op", "allocs/op", "spread");
+
+	// Opcodes
+	ret |= bench_run("opcode_create", 0, bench_opcode_create);
+	ret |= bench_run("opcode_decode", 0, bench_opcode_decode);
+	ret |= bench_run("crc32c_block", 0, bench_crc32c);
+	memset(bench_block, 'B', sizeof(bench_block)); // it changed every op
+
+	// The block cache, full of blocks at every size
+	for (i = 0; i < nsizes; i++) {
+		bench_cache_fill(sizes[i]);
+		ret |= bench_run("cache_get_hit", sizes[i], bench_cache_get_hit);
+		ret |= bench_run("cache_get_miss", sizes[i], bench_cache_get_miss);
+		ret |= bench_run("cache_copy_hit", sizes[i], bench_cache_copy_hit);
+		ret |= bench_run("cache_put_hit", sizes[i], bench_cache_put_hit);
+		ret |= bench_run("cache_put_miss", sizes[i], bench_cache_put_miss);
+		close_raid_cache();
+	}
+
+	// The tagline maps, after writing every block of the taglines
+	if (tagline_driver_init_geometry(BENCH_TAGLINES, &geo)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failed initializing the driver on [%s].", raid_network_endpoint);
+		return( -1 );
+	}
+	for (t = 0; t < BENCH_TAGLINES; t++) {
+		for (b = 0; b < geo.tagline_blocks; b++) {
+			if (tagline_write((TagLineNumber)t, b, 1, bench_block)) {
+				return( -1 );
+			}
+		}
+	}
+	ret |= bench_run("map_lookup", geo.tagline_blocks, bench_map_lookup);
+	ret |= bench_run("tagline_read_hit", geo.tagline_blocks, bench_tagline_read_hit);
+
+	// The transport, arg requests at a time
+	for (i = 0; i < ndepths; i++) {
+		ret |= bench_run("bus_read", depths[i], bench_bus_read);
+		ret |= bench_run("bus_write", depths[i], bench_bus_write);
+	}
+	tagline_close();
+
+	printf("endpoint %s, cycles from %s, CRC32C %s, median of %d runs of %u msec, spread is (max-min)/median ns/op\n",
+			raid_network_endpoint, (bench_cycles == BENCH_CYCLES_PERF) ? "the cpu cycle counter" :
+			(bench_cycles == BENCH_CYCLES_TSC) ? "the time stamp counter" : "nowhere", tagline_crc_kernel(),
+			bench_runs, bench_msec);
+	return( ret );
+}
@@ -21,19 +21,34 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
 
 // Project Includes
 #include <cmpsc311_log.h>
+#include <raid_log.h>
 #include <cmpsc311_unittest.h>
 #include <raid_bus.h>
 #include <raid_cache.h>
+#include <raid_victim.h>
 #include <raid_network.h>
 #include <tagline_driver.h>
+#include <tagline_trace.h>
+#include <tagline_bench.h>
+#include <tagline_verify.h>
+#include <raid_trace.h>
+#include <raid_sched.h>
+#include <raid_elevator.h>
+#include <tagline_log.h>
+#include <tagline_check.h>
+#include <tagline_dedup.h>
+#include <tagline_layout.h>
 
 // Defines
-#define TLINE_ARGUMENTS "hvfl:a:p:"
+#define TLINE_ARGUMENTS "hvfbzDl:a:p:e:j:B:T:g:Q:E:L:S:C:R:M:"
+#define TLINE_MAX_JOBS 32
 #define USAGE \
-	"USAGE: tagline_client [-h] [-v] [-l <logfile>] [-a <ip addr>] [-p <port>] [-f] <workload-file>\n" \
+	"USAGE: tagline_client [-h] [-v] [-l <logfile>] [-a <ip addr>] [-p <port>] [-e <endpoint>] [-g <geometry>] [-C <victim>] [-M <sizing>] [-b] [-z] [-j <threads>] [-Q <sched>] [-E <elevator>] [-L <log>] [-S <scrub>] [-D] [-R <layout>] [-B <report>] [-T <bus-trace>] [-f] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
@@ -41,25 +56,83 @@
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -a - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -e - server endpoint, tcp://<ip>:<port>, shm://<socket path>, or an\n" \
+	"         in-process array mem://[?opts] or file://<dir>[?opts] (see raid_local.h)\n" \
+	"    -g - array geometry, disks=<n>,blocks=<n per disk>,tagline=<n per tagline>,\n" \
+	"         cache=<n> (any of them, default disks=9,blocks=4096,tagline=256,cache=1024)\n" \
+	"    -C - keep blocks the cache evicts in a memory-mapped local file,\n" \
+	"         size=<GiB>,dir=<path> (either, default 1,/dev/shm, see raid_victim.h)\n" \
+	"    -M - estimate the hit ratio of every cache size and resize the cache,\n" \
+	"         sample=<n>,target=<pct>,budget=<MiB>,min=<blocks>,interval=<gets>\n" \
+	"         (any of them, default 64,none,none,16,8192, see raid_cache.h)\n" \
+	"    -b - ask the server for batched requests (RAID_BATCH)\n" \
+	"    -z - ask the server to compress payloads on the wire (TCP only)\n" \
+	"    -j - replay with <threads> threads, each owning the taglines equal to\n" \
+	"         its number modulo <threads> (INIT, CLOSE, DISKFAIL, CLONE and\n" \
+	"         SNAPSHOT are barriers)\n" \
+	"    -Q - schedule bus ops fairly between taglines, quantum=<ops>,chunk=<ops>,\n" \
+	"         weight=[<tags>:]<w>,target=[<tags>:]<usec>,rebuild=<usec> (any of\n" \
+	"         them, repeat weight and target as needed, see raid_sched.h)\n" \
+	"    -E - sort and merge bus ops by disk block, deadline=<usec>,depth=<ops>,\n" \
+	"         merge=<blocks> (any of them, default 0,256,255, see raid_elevator.h)\n" \
+	"    -L - log-structured allocation with a cleaner, segment=<blocks>,\n" \
+	"         clean=<segments> (either, default 128,8, see tagline_log.h)\n" \
+	"    -S - scrub both copies of every block against its checksum in the\n" \
+	"         background, rate=<blocks/s>,passes=<n>,hash=<0|1> (any of them,\n" \
+	"         default 1000,0 for no end,1, see tagline_check.h)\n" \
+	"    -D - deduplicate blocks by content, copying shared ones on write\n" \
+	"         (not with -L, see tagline_dedup.h)\n" \
+	"    -R - decluster the mirror copies over all disks with spare space on\n" \
+	"         each, chunk=<blocks>,spare=<blocks> (either, default 16,0 for just\n" \
+	"         enough, not with -L, see tagline_layout.h)\n" \
+	"    -B - benchmark mode, write latency, throughput, bus request and cache\n" \
+	"         figures to the JSON file <report> (- for stdout)\n" \
+	"    -T - record every RAID bus request to <bus-trace> (see raid_replay)\n" \
 	"    -f - disable disk failures\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    <workload-file> - file contain the workload to simulate (text, or a\n" \
+	"                      binary trace from tagline_convert)\n" \
 	"\n" \
 
+//
+// Type definitions
+typedef struct {
+	int       id;     // Worker number (taglines with tag % jobs == id)
+	pthread_t thread; // The replay thread
+	char     *wrbuf;  // Data to write
+	char     *tmbuf;  // Data read back
+	TaglineBench *bench; // Benchmark recorder (NULL unless -B)
+} TaglineWorker;
+
 //
 // Global Data
 int verbose = 0;
 int disk_failures = 1;
-char rdbuf[TAGLINE_BLOCK_SIZE*MAX_TAGLINE_BLOCK_NUMBER]; // workload simulator read buffer
-char wrbuf[TAGLINE_BLOCK_SIZE*MAX_TAGLINE_BLOCK_NUMBER]; // workload simulator write buffer
-char tmbuf[TAGLINE_BLOCK_SIZE*MAX_TAGLINE_BLOCK_NUMBER]; // workload simulator temporary buffer
+int replay_jobs = 1;
+char *bench_report = NULL; // Benchmark report file (-B)
+char *bus_trace = NULL;    // RAID bus trace file (-T)
+TaglineGeometry sim_geometry; // Array geometry (-g)
+char wrbuf[TAGLINE_BLOCK_SIZE*TAGLINE_MAX_XFER]; // workload simulator write buffer
+char tmbuf[TAGLINE_BLOCK_SIZE*TAGLINE_MAX_XFER]; // workload simulator temporary buffer
+TaglineWorker replay_main = { -1, 0, wrbuf, tmbuf, NULL }; // The main thread's buffers
+
+// Parallel replay state, handed over at the barriers
+TaglineTrace *replay_trace;
+uint32_t replay_first, replay_last; // The segment of ops being replayed
+int replay_failed = 0;              // A worker hit an error (atomic)
+int replay_done = 0;                // Workers should exit (atomic)
+pthread_barrier_t replay_start, replay_end;
+pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER; // Held while the workers start
 
 //
 // Functional Prototypes
 
 int simulate_TagLines(char *wload);
-int tagline_read_block_validate(TagLineNumber tagnum, TagLineBlockNumber blocknum,
-		uint16_t num_blocks, char *text);
+int simulate_op(TaglineWorker *w, TaglineTrace *tr, TaglineTraceOp *op);
+int simulate_parallel(TaglineTrace *tr);
+void *simulate_worker(void *arg);
+int tagline_read_block_validate(TaglineWorker *w, TagLineNumber tagnum, TagLineBlockNumber blocknum,
+		uint16_t num_blocks, const char *text);
 int remote_raid_fail_disk(RAIDDiskID dsk);
 
 //
@@ -77,6 +150,8 @@ int remote_raid_fail_disk(RAIDDiskID dsk);
 int main(int argc, char *argv[]) {
 
 	// Local variables
+	char *geometry_spec = NULL, *sched_spec = NULL, *elevator_spec = NULL, *log_spec = NULL, *scrub_spec = NULL;
+	char *victim_spec = NULL, *layout_spec = NULL, *sizing_spec = NULL;
 	int ch, log_initialized = 0;
 
 	// Process the command line parameters
@@ -100,9 +175,21 @@ int main(int argc, char *argv[]) {
 			disk_failures = 0;
 			break;
 
+		case 'b': // Ask for batch frames
+			raid_bus_requested |= RAID_CAP_BATCH;
+			break;
+
+		case 'z': // Ask for compressed payloads
+			raid_bus_requested |= RAID_CAP_COMPRESS;
+			break;
+
+		case 'D': // Deduplicate blocks
+			tagline_dedup_enabled = 1;
+			break;
+
         case 'a': // Get the IP address
             if (inet_addr(optarg) == INADDR_NONE) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+			    RAID_LOG( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
                 return(-1);
             }
             raid_network_address = (unsigned char *)strdup(optarg);
@@ -110,11 +197,63 @@ int main(int argc, char *argv[]) {
 
         case 'p': // Set the network port number
 			if ( sscanf(optarg, "%hu", &raid_network_port) != 1 ) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
+			    RAID_LOG( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
                 return(-1);
 			}
             break;
 
+		case 'e': // Set the server endpoint
+			raid_network_endpoint = strdup(optarg);
+			break;
+
+		case 'B': // Benchmark mode
+			bench_report = strdup(optarg);
+			break;
+
+		case 'T': // Record the RAID bus
+			bus_trace = strdup(optarg);
+			break;
+
+		case 'g': // Set the array geometry
+			geometry_spec = optarg;
+			break;
+
+		case 'C': // Keep cache victims in a local file
+			victim_spec = optarg;
+			break;
+
+		case 'M': // Track the miss ratio curve and size the cache
+			sizing_spec = optarg;
+			break;
+
+		case 'Q': // Schedule the bus between taglines
+			sched_spec = optarg;
+			break;
+
+		case 'E': // Sort and merge the bus ops
+			elevator_spec = optarg;
+			break;
+
+		case 'L': // Allocate blocks from a log
+			log_spec = optarg;
+			break;
+
+		case 'S': // Scrub the array in the background
+			scrub_spec = optarg;
+			break;
+
+		case 'R': // Decluster the mirror copies
+			layout_spec = optarg;
+			break;
+
+		case 'j': // Set the number of replay threads
+			if ((sscanf(optarg, "%d", &replay_jobs) != 1) || (replay_jobs < 1) ||
+					(replay_jobs > TLINE_MAX_JOBS)) {
+				fprintf(stderr, "Bad thread count [%s] (1-%d), aborting.\n", optarg, TLINE_MAX_JOBS);
+				return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
 			return( -1 );
@@ -127,12 +266,57 @@ int main(int argc, char *argv[]) {
 	}
 	if (verbose) {
 		enableLogLevels(LOG_INFO_LEVEL);
-		logMessage(LOG_INFO_LEVEL, "Enabling verbose logging.");
+		RAID_LOG(LOG_INFO_LEVEL, "Enabling verbose logging.");
 	}
 	if (disk_failures == 0) {
-		logMessage(LOG_INFO_LEVEL, "Disabling disk failures.");
+		RAID_LOG(LOG_INFO_LEVEL, "Disabling disk failures.");
+	}
+	sim_geometry = tagline_geometry_default;
+	if ((geometry_spec != NULL) && tagline_geometry_parse(geometry_spec, &sim_geometry)) {
+		fprintf(stderr, "Bad array geometry [%s], aborting.\n", geometry_spec);
+		return( -1 );
+	}
+	if ((victim_spec != NULL) && raid_victim_configure(victim_spec)) {
+		fprintf(stderr, "Bad victim cache configuration [%s], aborting.\n", victim_spec);
+		return( -1 );
+	}
+	if ((sizing_spec != NULL) && configure_raid_cache(sizing_spec)) {
+		fprintf(stderr, "Bad cache sizing configuration [%s], aborting.\n", sizing_spec);
+		return( -1 );
+	}
+	if ((sched_spec != NULL) && raid_sched_configure(sched_spec)) {
+		fprintf(stderr, "Bad scheduler configuration [%s], aborting.\n", sched_spec);
+		return( -1 );
+	}
+	if ((elevator_spec != NULL) && raid_elevator_configure(elevator_spec)) {
+		fprintf(stderr, "Bad elevator configuration [%s], aborting.\n", elevator_spec);
+		return( -1 );
+	}
+	if ((log_spec != NULL) && tagline_log_configure(log_spec)) {
+		fprintf(stderr, "Bad log configuration [%s], aborting.\n", log_spec);
+		return( -1 );
+	}
+	if ((scrub_spec != NULL) && tagline_scrub_configure(scrub_spec)) {
+		fprintf(stderr, "Bad scrub configuration [%s], aborting.\n", scrub_spec);
+		return( -1 );
+	}
+	if ((layout_spec != NULL) && tagline_layout_configure(layout_spec)) {
+		fprintf(stderr, "Bad layout configuration [%s], aborting.\n", layout_spec);
+		return( -1 );
+	}
+	if (tagline_layout_declustered && tagline_log_enabled) {
+		fprintf(stderr, "Declustering needs in-place allocation (no -L), aborting.\n");
+		return( -1 );
+	}
+	if (tagline_dedup_enabled && tagline_log_enabled) {
+		fprintf(stderr, "Deduplication needs in-place allocation (no -L), aborting.\n");
+		return( -1 );
 	}
 
+	// Hand formatting of the log over to the background drainer
+	raid_log_start();
+	RAID_LOG(LOG_INFO_LEVEL, "Validating reads with the %s kernel.", tagline_verify_kernel());
+
 	// The filename should be the next option
 	if (optind >= argc) {
 
@@ -144,10 +328,13 @@ int main(int argc, char *argv[]) {
 
 	// Run the simulation
 	if (simulate_TagLines(argv[optind]) == 0) {
-		logMessage(LOG_INFO_LEVEL, "Tagline simulation completed successfully.\n\n");
+		RAID_LOG(LOG_INFO_LEVEL, "Tagline simulation completed successfully.\n\n");
 	} else {
-		logMessage(LOG_INFO_LEVEL, "Tagline simulation failed.\n\n");
+		RAID_LOG(LOG_INFO_LEVEL, "Tagline simulation failed.\n\n");
+		raid_log_stop();
+		return( -1 );
 	}
+	raid_log_stop();
 
 	// Return successfully
 	return( 0 );
@@ -165,217 +352,399 @@ int main(int argc, char *argv[]) {
 int simulate_TagLines(char *wload) {
 
 	// Local variables
-	char line[1024], command[128], text[1204], txt[5];
-	FILE *fhandle = NULL;
-	int32_t err=0, linecount, i;
-	uint16_t num_blocks;
-	TagLineNumber tagnum;
-	TagLineBlockNumber blocknum;
-
-	// Open the workload file
-	linecount = 0;
-	if ((fhandle=fopen(wload, "r")) == NULL) {
-		logMessage(LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno));
+	TaglineTrace trace;
+	uint32_t opnum;
+	int ret = 0;
+
+	// Map and index the workload (text or binary trace)
+	if (tagline_trace_load(wload, &trace)) {
 		return(-1);
 	}
 
-	// While file not done
-	while (!feof(fhandle)) {
+	// Start the benchmark clock, if asked to
+	if ((bench_report != NULL) && (tagline_bench_begin(trace.nops) ||
+			((replay_main.bench = tagline_bench_alloc()) == NULL))) {
+		tagline_trace_free(&trace);
+		return(-1);
+	}
 
-		// Get the line and bail out on fail
-		if (fgets(line, 1024, fhandle) != NULL) {
+	// Record the bus, if asked to
+	if ((bus_trace != NULL) && raid_trace_open(bus_trace)) {
+		free(replay_main.bench);
+		replay_main.bench = NULL;
+		tagline_trace_free(&trace);
+		return(-1);
+	}
 
-			// Parse out the string
-			linecount ++;
-			if (sscanf(line, "%s %hu %hu %u %s", command, &tagnum, &num_blocks, &blocknum, text) != 5) {
+	// Walk the ops in order, or hand them out to the replay threads
+	if (replay_jobs > 1) {
+		ret = simulate_parallel(&trace);
+	} else {
+		for (opnum = 0; (opnum < trace.nops) && (ret == 0); opnum++) {
+			ret = simulate_op(&replay_main, &trace, &trace.ops[opnum]);
+		}
+	}
 
-				// Bad data, error out
-				logMessage(LOG_ERROR_LEVEL, "Tagline un-parsable workload string, aborting [%s], line %d",
-						line, linecount);
-				fclose(fhandle);
-				return(-1);
+	// Finish the bus trace (the replay threads are done)
+	if ((bus_trace != NULL) && raid_trace_close()) {
+		ret = -1;
+	}
 
-			} else {
+	// Write the benchmark report for a completed replay
+	if (replay_main.bench != NULL) {
+		if ((ret == 0) && tagline_bench_report(bench_report, replay_main.bench, wload, replay_jobs)) {
+			ret = -1;
+		}
+		free(replay_main.bench);
+		replay_main.bench = NULL;
+	}
+
+	// Release the workload
+	tagline_trace_free(&trace);
+	return(ret);
+}
 
-				// Just log the contents
-				logMessage(LOG_INFO_LEVEL, "INPUT cmd=%s tag=%u #blks=%u start-blk=%u data=%s",
-						command, tagnum, num_blocks, blocknum, text);
-
-				// If there is write processing to perform
-				if (strncmp(command, "INIT", 5) == 0) {
-
-					// Call the initialize function for the tagline storae
-					if (tagline_driver_init(tagnum)) {
-						// Error out
-						logMessage(LOG_ERROR_LEVEL, "INIT failed on raid array (%d tags)", tagnum);
-						err = 1;
-					}
-
-				} else if (strncmp(command, "CLOSE", 5) == 0) {
-
-					// Close the tagline storage device
-					if (tagline_close()) {
-						// Error out
-						logMessage(LOG_ERROR_LEVEL, "Close failed on raid array.");
-						err = 1;
-					}
-
-				} else if (strncmp(command, "READ", 6) == 0) {
-
-					// First check to make sure our input is sane
-					if (strlen(text) != num_blocks) {
-						// Error out
-						logMessage(LOG_ERROR_LEVEL, "Text/number blocks mismatch in input data");
-						err = 1;
-					} else {
-
-						// Setup the read block to check against
-						for (i=0; i<num_blocks; i++) {
-							memset(&rdbuf[i*TAGLINE_BLOCK_SIZE], text[i], TAGLINE_BLOCK_SIZE);
-						}
-
-						// Read the blocks from the tagline
-						if (tagline_read(tagnum, blocknum, num_blocks, tmbuf)) {
-							// Error out
-							logMessage(LOG_ERROR_LEVEL, "READ failed on tagline storage device (%u)", tagnum);
-							err = 1;
-						}
-
-						// Now compare the read bytes to see if it is correct
-						if (memcmp(rdbuf, tmbuf, num_blocks*TAGLINE_BLOCK_SIZE)) {
-							// Error out
-							logMessage(LOG_ERROR_LEVEL, "Read blocks data mismatch return from tagline storage.");
-							logMessage(LOG_ERROR_LEVEL, "Mismatch [%d] != [%d]", (int)rdbuf[0], (int)tmbuf[0]);
-							err = 1;
-						}
-
-						// Log the confirmation
-						logMessage(LOG_INFO_LEVEL, "Read confirmation: tagline=%d, start=%d, blocks=%d",
-								tagnum, blocknum, num_blocks);
-
-					}
-
-				}  else if (strncmp(command, "WRITE", 6) == 0) {
-
-					// Setup the write block to send to storage device
-					for (i=0; i<num_blocks; i++) {
-						CMPSC_ASSERT0((text[i]!=0x0), "Bad write data from source files.");
-						memset(&wrbuf[i*TAGLINE_BLOCK_SIZE], text[i], TAGLINE_BLOCK_SIZE);
-					}
-
-					// Call the block write function
-					if (tagline_write(tagnum, blocknum, num_blocks, wrbuf)) {
-						// Error out
-						logMessage(LOG_ERROR_LEVEL, "WRITE failed on tagline storage (%d)");
-						err = 1;
-					}
-
-				} else if (strncmp(command, "DISKFAIL", 8) == 0) {
-
-					// Check if the failure are enabled
-					if (disk_failures) {
-
-						// Call the disk failure in the RAID interface
-						logMessage(LOG_INFO_LEVEL, "Failing disk [%d] on raid array ...", tagnum);
-						if (remote_raid_fail_disk((RAIDDiskID)tagnum) || (raid_disk_signal())) {
-							logMessage(LOG_ERROR_LEVEL, "Simulation failed failing disk [%d] ... WAT?", tagnum);
-							return(-1);
-						}
-
-					} else {
-						// Just log it
-						logMessage(LOG_INFO_LEVEL, "Ignoring disabled disk failure  on disk [%d]", tagnum);
-					}
-
-				} else if (strncmp(command, "tagline", 7) == 0) {
-
-					// Need to save some data here!
-					logMessage(LOG_INFO_LEVEL, "Getting tagline final data (%s)", command);
-
-					// TODO: this single block reads are only for first version
-					// do a bunch of reads to make sure that the data matches workload indicators
-					for (i=0; i<strlen(text); i++) {
-
-						// Setup text, then request validation
-						txt[0] = text[i];
-						txt[1] = 0x0;
-						if (tagline_read_block_validate(tagnum, i, 1, txt)) {
-							logMessage(LOG_ERROR_LEVEL, "Tagline validation failed for tag line [%d], aborting.", tagnum);
-							return(-1);
-						} else {
-							logMessage(LOG_INFO_LEVEL, "Tagline validation successful for tag line [%d]", tagnum);
-						}
-					}
-
-					// Finished validating, success!!!
-					logMessage(LOG_INFO_LEVEL, "Tagline validation successful for all taglines, success!!!!");
-				}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulate_op
+// Description  : Replay one workload op and check its results
+//
+// Inputs       : w - the worker (and buffers) doing the replay
+//                tr - the workload
+//                op - the op
+// Outputs      : 0 if successful, -1 if the simulation should abort
+
+int simulate_op(TaglineWorker *w, TaglineTrace *tr, TaglineTraceOp *op) {
+
+	// Local variables
+	const char *command = tr->patterns + op->name, *text = tr->patterns + op->data;
+	int32_t err=0, i, n;
+	uint16_t num_blocks = op->blocks;
+	TagLineNumber tagnum = op->tag;
+	TagLineBlockNumber blocknum = op->start;
+
+	// Start timing the op
+	if (w->bench != NULL) {
+		tagline_bench_start(w->bench);
+	}
+
+	// Just log the contents
+	RAID_LOG(LOG_INFO_LEVEL, "INPUT cmd=%.*s tag=%u #blks=%u start-blk=%u data=%.*s",
+			(int)op->namelen, command, tagnum, num_blocks, blocknum, (int)op->datalen, text);
+
+	// Reads and writes go through the driver's 8-bit block count
+	if (((op->cmd == TAGLINE_OP_READ) || (op->cmd == TAGLINE_OP_WRITE)) && (num_blocks > TAGLINE_MAX_XFER)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Too many blocks in one op (%u, at most %u)", num_blocks, TAGLINE_MAX_XFER);
+		err = 1;
+
+	// If there is write processing to perform
+	} else if (op->cmd == TAGLINE_OP_INIT) {
+
+		// Call the initialize function for the tagline storae
+		if (tagline_driver_init_geometry(tagnum, &sim_geometry)) {
+			// Error out
+			RAID_LOG(LOG_ERROR_LEVEL, "INIT failed on raid array (%d tags)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_CLOSE) {
+
+		// Close the tagline storage device
+		if (tagline_close()) {
+			// Error out
+			RAID_LOG(LOG_ERROR_LEVEL, "Close failed on raid array.");
+			err = 1;
+		}
 
+	} else if (op->cmd == TAGLINE_OP_READ) {
+
+		// First check to make sure our input is sane
+		if (op->datalen != num_blocks) {
+			// Error out
+			RAID_LOG(LOG_ERROR_LEVEL, "Text/number blocks mismatch in input data");
+			err = 1;
+		} else {
+
+			// Read the blocks from the tagline
+			if (tagline_read(tagnum, blocknum, num_blocks, w->tmbuf)) {
+				// Error out
+				RAID_LOG(LOG_ERROR_LEVEL, "READ failed on tagline storage device (%u)", tagnum);
+				err = 1;
+			}
+
+			// Now check every block is filled with its character
+			if ((i = tagline_verify_fill(w->tmbuf, text, num_blocks)) >= 0) {
+				// Error out, showing the first bad byte
+				for (n = i*TAGLINE_BLOCK_SIZE; w->tmbuf[n] == text[i]; n++);
+				RAID_LOG(LOG_ERROR_LEVEL, "Read blocks data mismatch return from tagline storage.");
+				RAID_LOG(LOG_ERROR_LEVEL, "Mismatch [%d] != [%d]", (int)text[i], (int)w->tmbuf[n]);
+				err = 1;
 			}
 
-			// Check for the virtual level failing
-			if (err) {
-				logMessage(LOG_ERROR_LEVEL, "RAID system failed, aborting [%d]", err);
-				fclose(fhandle);
+			// Log the confirmation
+			RAID_LOG(LOG_INFO_LEVEL, "Read confirmation: tagline=%d, start=%d, blocks=%d",
+					tagnum, blocknum, num_blocks);
+
+		}
+
+	}  else if (op->cmd == TAGLINE_OP_WRITE) {
+
+		// Setup the write block to send to storage device
+		for (i=0; i<num_blocks; i++) {
+			CMPSC_ASSERT0(((i < op->datalen) && (text[i]!=0x0)), "Bad write data from source files.");
+			memset(&w->wrbuf[i*TAGLINE_BLOCK_SIZE], text[i], TAGLINE_BLOCK_SIZE);
+		}
+
+		// Call the block write function
+		if (tagline_write(tagnum, blocknum, num_blocks, w->wrbuf)) {
+			// Error out
+			RAID_LOG(LOG_ERROR_LEVEL, "WRITE failed on tagline storage (%d)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_TRIM) {
+
+		// Unmap the blocks
+		if (tagline_trim(tagnum, blocknum, num_blocks)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "TRIM failed on tagline storage (%d)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_DELETE) {
+
+		// Unmap the whole tagline
+		if (tagline_delete(tagnum)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "DELETE failed on tagline storage (%d)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_CLONE) {
+
+		// Copy the tagline named by the start block, sharing its blocks
+		if (tagline_clone((TagLineNumber)blocknum, tagnum)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "CLONE failed on tagline storage (%d)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_SNAPSHOT) {
+
+		// ... read-only
+		if (tagline_snapshot((TagLineNumber)blocknum, tagnum)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "SNAPSHOT failed on tagline storage (%d)", tagnum);
+			err = 1;
+		}
+
+	} else if (op->cmd == TAGLINE_OP_DISKFAIL) {
+
+		// Check if the failure are enabled
+		if (disk_failures) {
+
+			// Call the disk failure in the RAID interface
+			RAID_LOG(LOG_INFO_LEVEL, "Failing disk [%d] on raid array ...", tagnum);
+			if (remote_raid_fail_disk((RAIDDiskID)tagnum) || (raid_disk_signal())) {
+				RAID_LOG(LOG_ERROR_LEVEL, "Simulation failed failing disk [%d] ... WAT?", tagnum);
 				return(-1);
 			}
+
+		} else {
+			// Just log it
+			RAID_LOG(LOG_INFO_LEVEL, "Ignoring disabled disk failure  on disk [%d]", tagnum);
 		}
+
+	} else if (op->cmd == TAGLINE_OP_VALIDATE) {
+
+		// Need to save some data here!
+		RAID_LOG(LOG_INFO_LEVEL, "Getting tagline final data (%.*s)", (int)op->namelen, command);
+
+		// Check the tagline from the start, as many blocks per read as the
+		// bus allows
+		for (i=0; i<op->datalen; i+=n) {
+			n = (op->datalen - i < RAID_MAX_XFER) ? op->datalen - i : RAID_MAX_XFER;
+			if (tagline_read_block_validate(w, tagnum, i, n, &text[i])) {
+				RAID_LOG(LOG_ERROR_LEVEL, "Tagline validation failed for tag line [%d], aborting.", tagnum);
+				return(-1);
+			} else {
+				RAID_LOG(LOG_INFO_LEVEL, "Tagline validation successful for tag line [%d]", tagnum);
+			}
+		}
+
+		// Finished validating, success!!!
+		RAID_LOG(LOG_INFO_LEVEL, "Tagline validation successful for all taglines, success!!!!");
+	}
+
+	// Check for the virtual level failing
+	if (err) {
+		RAID_LOG(LOG_ERROR_LEVEL, "RAID system failed, aborting [%d]", err);
+		return(-1);
 	}
 
-	// Close the workload file, successfully
-	fclose(fhandle);
+	// Op done, record it
+	if (w->bench != NULL) {
+		tagline_bench_stop(w->bench, op);
+	}
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : tagline_read_block_read
-// Description  : The perform a read and validate the result by extracting the
-//                data and comparing the memory bytes.
+// Function     : simulate_parallel
+// Description  : Replay the workload on replay_jobs threads.  Ops between
+//                barriers (INIT, CLOSE, DISKFAIL, CLONE and SNAPSHOT, which
+//                read another thread's tagline, and unknown commands) are
+//                replayed by the thread owning their tagline, in order;
+//                barrier ops run on this thread once all workers are idle.
 //
-// Inputs       : tagnum - the tag line number
-//                blocknum - the block number of the tagline to read
-//                bum_blocks - the number of blocks to read
-//                text - the block contents to validate
+// Inputs       : tr - the workload
 // Outputs      : 0 if successful test, -1 if failure
 
-int tagline_read_block_validate(TagLineNumber tagnum, TagLineBlockNumber blocknum,
-		uint16_t num_blocks, char *text) {
+int simulate_parallel(TaglineTrace *tr) {
 
 	// Local variables
-	int i;
+	TaglineWorker workers[TLINE_MAX_JOBS];
+	uint32_t opnum, first;
+	int i, started;
+	TAGLINE_OP_TYPES cmd;
+
+	// Start the workers, each with its own buffers (they wait on the lock
+	// until all have started, or exit if any failed to)
+	replay_trace = tr;
+	__atomic_store_n(&replay_failed, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&replay_done, 0, __ATOMIC_RELEASE);
+	pthread_barrier_init(&replay_start, NULL, replay_jobs+1);
+	pthread_barrier_init(&replay_end, NULL, replay_jobs+1);
+	pthread_mutex_lock(&replay_lock);
+	for (started = 0; started < replay_jobs; started++) {
+		workers[started].id = started;
+		workers[started].wrbuf = malloc(TAGLINE_BLOCK_SIZE*TAGLINE_MAX_XFER);
+		workers[started].tmbuf = malloc(TAGLINE_BLOCK_SIZE*TAGLINE_MAX_XFER);
+		workers[started].bench = (replay_main.bench != NULL) ? tagline_bench_alloc() : NULL;
+		if ((workers[started].wrbuf == NULL) ||
+				(workers[started].tmbuf == NULL) ||
+				((replay_main.bench != NULL) && (workers[started].bench == NULL)) ||
+				pthread_create(&workers[started].thread, NULL, simulate_worker, &workers[started])) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Failed starting replay thread %d, aborting.", started);
+			free(workers[started].wrbuf);
+			free(workers[started].tmbuf);
+			free(workers[started].bench);
+			__atomic_store_n(&replay_failed, 1, __ATOMIC_RELEASE);
+			__atomic_store_n(&replay_done, 1, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&replay_lock);
+	RAID_LOG(LOG_INFO_LEVEL, "Replaying on %d threads", started);
+
+	// Cut the workload into segments at the barrier ops
+	first = 0;
+	for (opnum = 0; (opnum <= tr->nops) && !__atomic_load_n(&replay_failed, __ATOMIC_ACQUIRE); opnum++) {
+		cmd = (opnum < tr->nops) ? tr->ops[opnum].cmd : TAGLINE_OP_OTHER;
+		if ((opnum < tr->nops) && ((cmd == TAGLINE_OP_READ) || (cmd == TAGLINE_OP_WRITE) ||
+				(cmd == TAGLINE_OP_VALIDATE) || (cmd == TAGLINE_OP_TRIM) || (cmd == TAGLINE_OP_DELETE))) {
+			continue;
+		}
 
-	// First check to make sure our input is sane
-	if (strlen(text) != num_blocks) {
+		// Replay the segment, then the barrier op on its own
+		if (opnum > first) {
+			replay_first = first;
+			replay_last = opnum;
+			pthread_barrier_wait(&replay_start);
+			pthread_barrier_wait(&replay_end);
+		}
+		if (!__atomic_load_n(&replay_failed, __ATOMIC_ACQUIRE) && (opnum < tr->nops) &&
+				simulate_op(&replay_main, tr, &tr->ops[opnum])) {
+			__atomic_store_n(&replay_failed, 1, __ATOMIC_RELEASE);
+		}
+		first = opnum + 1;
+	}
 
-		// Error out
-		logMessage(LOG_ERROR_LEVEL, "Text/number blocks mismatch in input data");
-		return(-1);
+	// Release the workers and clean up
+	if (! __atomic_load_n(&replay_done, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&replay_done, 1, __ATOMIC_RELEASE);
+		pthread_barrier_wait(&replay_start);
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		free(workers[i].wrbuf);
+		free(workers[i].tmbuf);
+		if (workers[i].bench != NULL) {
+			tagline_bench_merge(replay_main.bench, workers[i].bench);
+			free(workers[i].bench);
+		}
+	}
+	pthread_barrier_destroy(&replay_start);
+	pthread_barrier_destroy(&replay_end);
+	return(__atomic_load_n(&replay_failed, __ATOMIC_ACQUIRE) ? -1 : 0);
+}
 
-	} else {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulate_worker
+// Description  : A replay thread: for each segment, replay the ops of the
+//                taglines it owns
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
 
-		// Setup the read block to check against
-		for (i = 0; i < num_blocks; i++) {
-			memset(&rdbuf[i * TAGLINE_BLOCK_SIZE], text[i], TAGLINE_BLOCK_SIZE);
-		}
+void *simulate_worker(void *arg) {
 
-		// Read the blocks from the tagline
-		if (tagline_read(tagnum, blocknum, num_blocks, tmbuf)) {
-			// Error out
-			logMessage(LOG_ERROR_LEVEL,
-					"READ failed on tagline storage device (%u)", tagnum);
-			return(-1);
-		}
+	// Local variables
+	TaglineWorker *w = arg;
+	TaglineTraceOp *op;
+	uint32_t opnum;
+
+	// Wait for the other workers to start (exit if one of them failed to)
+	pthread_mutex_lock(&replay_lock);
+	pthread_mutex_unlock(&replay_lock);
+	if (__atomic_load_n(&replay_done, __ATOMIC_ACQUIRE)) {
+		return(NULL);
+	}
 
-		// Now compare the read bytes to see if it is correct
-		if (memcmp(rdbuf, tmbuf, num_blocks * TAGLINE_BLOCK_SIZE)) {
-			// Error out
-			logMessage(LOG_ERROR_LEVEL,
-					"Read blocks data mismatch return from tagline storage.");
-			return(-1);
+	for (;;) {
+		pthread_barrier_wait(&replay_start);
+		if (__atomic_load_n(&replay_done, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		for (opnum = replay_first; (opnum < replay_last) && !__atomic_load_n(&replay_failed, __ATOMIC_ACQUIRE); opnum++) {
+			op = &replay_trace->ops[opnum];
+			if (((op->tag % replay_jobs) == w->id) && simulate_op(w, replay_trace, op)) {
+				__atomic_store_n(&replay_failed, 1, __ATOMIC_RELEASE);
+			}
 		}
+		pthread_barrier_wait(&replay_end);
+	}
+	return(NULL);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_read_block_read
+// Description  : The perform a read and validate the result by checking each
+//                block is filled with its character.
+//
+// Inputs       : w - the worker (and buffers) doing the read
+//                tagnum - the tag line number
+//                blocknum - the block number of the tagline to read
+//                bum_blocks - the number of blocks to read
+//                text - the block contents to validate (one per block)
+// Outputs      : 0 if successful test, -1 if failure
+
+int tagline_read_block_validate(TaglineWorker *w, TagLineNumber tagnum, TagLineBlockNumber blocknum,
+		uint16_t num_blocks, const char *text) {
+
+	// Read the blocks from the tagline
+	if (tagline_read(tagnum, blocknum, num_blocks, w->tmbuf)) {
+		// Error out
+		RAID_LOG(LOG_ERROR_LEVEL,
+				"READ failed on tagline storage device (%u)", tagnum);
+		return(-1);
+	}
+
+	// Now check every block is filled with its character
+	if (tagline_verify_fill(w->tmbuf, text, num_blocks) >= 0) {
+		// Error out
+		RAID_LOG(LOG_ERROR_LEVEL,
+				"Read blocks data mismatch return from tagline storage.");
+		return(-1);
 	}
 
 	// Return successfully
@@ -406,11 +775,11 @@ int remote_raid_fail_disk(RAIDDiskID dsk) {
 
 	// Now check the results of the initialization
 	if ((oreq != RAID_DISKFAIL) || (odid != dsk) ) {
-		logMessage(LOG_ERROR_LEVEL, "Remote disk fail failure, bad response values [%x]", response);
+		RAID_LOG(LOG_ERROR_LEVEL, "Remote disk fail failure, bad response values [0x%llx]", (unsigned long long)response);
 		return(-1);
 	}
 
 	// Return successfully
-	logMessage(LOG_INFO_LEVEL, "Disk [%u] remotely failed.", dsk);
+	RAID_LOG(LOG_INFO_LEVEL, "Disk [%u] remotely failed.", dsk);
 	return(0);
 }
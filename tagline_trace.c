@@ -0,0 +1,437 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_trace.c
+//  Description   : This is the workload trace loader for the tagline
+//                  simulator (see tagline_trace.h for the formats).  Text
+//                  workloads are tokenised straight out of the mapping
+//                  with no copies; binary traces are only checked.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/31/15
+//
+
+// Include Files
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <tagline_trace.h>
+#include <cmpsc311_log.h>
+#include <raid_log.h>
+
+// Type definitions
+typedef struct {
+	const char *p;   // Start of the token
+	uint32_t    len; // Its length
+} TraceToken;
+
+//
+// Global data
+static const char *trace_opnames[TAGLINE_OP_MAXVAL] = {
+	"OTHER", "INIT", "CLOSE", "READ", "WRITE", "DISKFAIL", "tagline", "TRIM", "DELETE", "CLONE", "SNAPSHOT"
+};
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_space
+// Description  : Is this a field separator (what scanf skips)?
+//
+// Inputs       : c - the character
+// Outputs      : 1 if whitespace, 0 otherwise
+
+static inline int trace_space(char c) {
+	return( (c == ' ') || (c == '\t') || (c == '\r') || (c == '\v') || (c == '\f') );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_number
+// Description  : Convert a decimal token, as scanf's %u would
+//
+// Inputs       : tok - the token
+//                val - the value (out)
+// Outputs      : 0 if successful, -1 if the token is not a number
+
+static int trace_number(TraceToken *tok, uint32_t *val) {
+	uint32_t i = 0, v = 0;
+	int neg = 0;
+
+	if ((tok->len > 0) && ((tok->p[0] == '+') || (tok->p[0] == '-'))) {
+		neg = (tok->p[0] == '-');
+		i++;
+	}
+	if (i == tok->len) {
+		return( -1 );
+	}
+	for (; i < tok->len; i++) {
+		if ((tok->p[i] < '0') || (tok->p[i] > '9')) {
+			return( -1 );
+		}
+		v = v * 10 + (tok->p[i] - '0');
+	}
+	*val = neg ? -v : v;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_classify
+// Description  : Work out the op type of a command, matching the way the
+//                simulator has always compared them
+//
+// Inputs       : tok - the command token
+// Outputs      : the op type
+
+static TAGLINE_OP_TYPES trace_classify(TraceToken *tok) {
+	if ((tok->len == 4) && (memcmp(tok->p, "INIT", 4) == 0)) {
+		return( TAGLINE_OP_INIT );
+	}
+	if ((tok->len >= 5) && (memcmp(tok->p, "CLOSE", 5) == 0)) {
+		return( TAGLINE_OP_CLOSE );
+	}
+	if ((tok->len == 4) && (memcmp(tok->p, "READ", 4) == 0)) {
+		return( TAGLINE_OP_READ );
+	}
+	if ((tok->len == 5) && (memcmp(tok->p, "WRITE", 5) == 0)) {
+		return( TAGLINE_OP_WRITE );
+	}
+	if ((tok->len >= 8) && (memcmp(tok->p, "DISKFAIL", 8) == 0)) {
+		return( TAGLINE_OP_DISKFAIL );
+	}
+	if ((tok->len >= 7) && (memcmp(tok->p, "tagline", 7) == 0)) {
+		return( TAGLINE_OP_VALIDATE );
+	}
+	if ((tok->len == 4) && (memcmp(tok->p, "TRIM", 4) == 0)) {
+		return( TAGLINE_OP_TRIM );
+	}
+	if ((tok->len == 6) && (memcmp(tok->p, "DELETE", 6) == 0)) {
+		return( TAGLINE_OP_DELETE );
+	}
+	if ((tok->len == 5) && (memcmp(tok->p, "CLONE", 5) == 0)) {
+		return( TAGLINE_OP_CLONE );
+	}
+	if ((tok->len == 8) && (memcmp(tok->p, "SNAPSHOT", 8) == 0)) {
+		return( TAGLINE_OP_SNAPSHOT );
+	}
+	return( TAGLINE_OP_OTHER );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_parse_text
+// Description  : Index the ops of a mapped text workload
+//
+// Inputs       : tr - the trace, with the file mapped
+// Outputs      : 0 if successful, -1 if failure
+
+static int trace_parse_text(TaglineTrace *tr) {
+	const char *p = tr->map, *end = p + tr->maplen, *eol, *bol;
+	TraceToken tok[5];
+	TaglineTraceOp *op;
+	uint32_t cap = 0, line = 0, v[3];
+	int n;
+
+	tr->patterns = tr->map;
+	tr->patbytes = (uint32_t)tr->maplen;
+	while (p < end) {
+
+		// Split the next line into its five fields
+		line++;
+		bol = p;
+		if ((eol = memchr(p, '\n', end - p)) == NULL) {
+			eol = end;
+		}
+		for (n = 0; n < 5; n++) {
+			while ((p < eol) && trace_space(*p)) {
+				p++;
+			}
+			if (p == eol) {
+				break;
+			}
+			tok[n].p = p;
+			while ((p < eol) && !trace_space(*p)) {
+				p++;
+			}
+			tok[n].len = (uint32_t)(p - tok[n].p);
+		}
+		if ((n < 5) || trace_number(&tok[1], &v[0]) || trace_number(&tok[2], &v[1]) ||
+				trace_number(&tok[3], &v[2]) || (tok[4].len > TAGLINE_TRACE_MAXDATA)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Tagline un-parsable workload string, aborting [%.*s], line %u",
+					(int)(eol - bol), bol, line);
+			return( -1 );
+		}
+		p = (eol < end) ? eol + 1 : end;
+
+		// Append the op
+		if (tr->nops == cap) {
+			cap = (cap == 0) ? 4096 : cap * 2;
+			if ((op = realloc(tr->ops, cap * sizeof(TaglineTraceOp))) == NULL) {
+				RAID_LOG(LOG_ERROR_LEVEL, "Out of memory indexing workload (%u ops)", tr->nops);
+				return( -1 );
+			}
+			tr->ops = op;
+		}
+		op = &tr->ops[tr->nops++];
+		op->cmd = trace_classify(&tok[0]);
+		op->namelen = (tok[0].len > 255) ? 255 : (uint8_t)tok[0].len;
+		op->tag = (uint16_t)v[0];
+		op->blocks = (uint16_t)v[1];
+		op->datalen = (uint16_t)tok[4].len;
+		op->start = v[2];
+		op->name = (uint32_t)(tok[0].p - tr->patterns);
+		op->data = (uint32_t)(tok[4].p - tr->patterns);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_check_binary
+// Description  : Validate a mapped binary trace and point at its sections
+//
+// Inputs       : tr - the trace, with the file mapped
+// Outputs      : 0 if successful, -1 if failure
+
+static int trace_check_binary(TaglineTrace *tr) {
+	TaglineTraceHeader *hdr = tr->map;
+	uint32_t i;
+
+	if ((hdr->version != TAGLINE_TRACE_VERSION) || ((uint64_t)sizeof(*hdr) +
+			(uint64_t)hdr->nops * sizeof(TaglineTraceOp) + hdr->patbytes != tr->maplen)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Bad binary trace header (version %u, %u ops, %u pattern bytes)",
+				hdr->version, hdr->nops, hdr->patbytes);
+		return( -1 );
+	}
+	tr->ops = (TaglineTraceOp *)(hdr + 1);
+	tr->nops = hdr->nops;
+	tr->patterns = (const char *)&tr->ops[tr->nops];
+	tr->patbytes = hdr->patbytes;
+	for (i = 0; i < tr->nops; i++) {
+		if ((tr->ops[i].cmd >= TAGLINE_OP_MAXVAL) ||
+				((uint64_t)tr->ops[i].name + tr->ops[i].namelen > tr->patbytes) ||
+				((uint64_t)tr->ops[i].data + tr->ops[i].datalen > tr->patbytes)) {
+			RAID_LOG(LOG_ERROR_LEVEL, "Bad binary trace op %u", i);
+			return( -1 );
+		}
+	}
+	tr->binary = 1;
+	return( 0 );
+}
+
+//
+// Interface Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trace_load
+// Description  : Map a text or binary workload and index its ops
+//
+// Inputs       : path - the workload file
+//                tr - the trace (out)
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_trace_load(const char *path, TaglineTrace *tr) {
+	struct stat st;
+	int fd;
+
+	memset(tr, 0x0, sizeof(*tr));
+	if (((fd = open(path, O_RDONLY)) == -1) || fstat(fd, &st)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return( -1 );
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return( 0 );
+	}
+	if ((uint64_t)st.st_size > UINT32_MAX) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Workload file [%s] is too large", path);
+		close(fd);
+		return( -1 );
+	}
+	tr->maplen = st.st_size;
+	tr->map = mmap(NULL, tr->maplen, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+	close(fd);
+	if (tr->map == MAP_FAILED) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.", path, strerror(errno));
+		tr->map = NULL;
+		return( -1 );
+	}
+	madvise(tr->map, tr->maplen, MADV_SEQUENTIAL);
+
+	// Binary traces start with the magic, anything else is text
+	if ((tr->maplen >= sizeof(TaglineTraceHeader)) &&
+			(memcmp(tr->map, TAGLINE_TRACE_MAGIC, sizeof(TAGLINE_TRACE_MAGIC)) == 0)) {
+		if (trace_check_binary(tr)) {
+			tagline_trace_free(tr);
+			return( -1 );
+		}
+	} else if (trace_parse_text(tr)) {
+		tagline_trace_free(tr);
+		return( -1 );
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Loaded %s workload [%s] (%u ops)", tr->binary ? "binary" : "text", path, tr->nops);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trace_save
+// Description  : Write a loaded workload as a binary trace, storing each
+//                distinct command/data text once
+//
+// Inputs       : path - the output file
+//                tr - the loaded workload
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_trace_save(const char *path, TaglineTrace *tr) {
+	TaglineTraceHeader hdr;
+	TaglineTraceOp *ops = NULL;
+	uint32_t *slots = NULL, nslots, i, j, k, h, *off, len, cap;
+	const char *s;
+	char *pat = NULL;
+	FILE *fh = NULL;
+	int ret = -1;
+
+	// Intern the texts through an open-addressed table of pattern offsets
+	for (nslots = 1024; nslots < 4 * (uint64_t)tr->nops; nslots *= 2);
+	cap = 4096;
+	ops = malloc(tr->nops * sizeof(TaglineTraceOp) + 1);
+	slots = malloc(nslots * sizeof(uint32_t));
+	pat = malloc(cap);
+	if ((ops == NULL) || (slots == NULL) || (pat == NULL)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Out of memory building the binary trace [%s]", path);
+		goto out;
+	}
+	memset(slots, 0xff, nslots * sizeof(uint32_t));
+	memcpy(ops, tr->ops, tr->nops * sizeof(TaglineTraceOp));
+	memset(&hdr, 0x0, sizeof(hdr));
+	for (i = 0; i < tr->nops; i++) {
+		for (k = 0; k < 2; k++) {
+			off = (k == 0) ? &ops[i].name : &ops[i].data;
+			len = (k == 0) ? ops[i].namelen : ops[i].datalen;
+			s = tr->patterns + *off;
+			for (h = 2166136261U, j = 0; j < len; j++) {
+				h = (h ^ (uint8_t)s[j]) * 16777619U;
+			}
+			for (h &= nslots - 1; slots[h] != UINT32_MAX; h = (h + 1) & (nslots - 1)) {
+				if ((memcmp(pat + slots[h], s, len) == 0) && (pat[slots[h] + len] == 0x0)) {
+					break;
+				}
+			}
+			if (slots[h] == UINT32_MAX) {
+				if (hdr.patbytes + len + 1 > cap) {
+					for (; hdr.patbytes + len + 1 > cap; cap *= 2);
+					if ((s = realloc(pat, cap)) == NULL) {
+						RAID_LOG(LOG_ERROR_LEVEL, "Out of memory building the binary trace [%s]", path);
+						goto out;
+					}
+					pat = (char *)s;
+					s = tr->patterns + *off;
+				}
+				slots[h] = hdr.patbytes;
+				memcpy(pat + hdr.patbytes, s, len);
+				pat[hdr.patbytes + len] = 0x0;
+				hdr.patbytes += len + 1;
+			}
+			*off = slots[h];
+		}
+	}
+
+	// Header, ops, patterns
+	memcpy(hdr.magic, TAGLINE_TRACE_MAGIC, sizeof(TAGLINE_TRACE_MAGIC));
+	hdr.version = TAGLINE_TRACE_VERSION;
+	hdr.nops = tr->nops;
+	if (((fh = fopen(path, "w")) == NULL) || (fwrite(&hdr, sizeof(hdr), 1, fh) != 1) ||
+			(fwrite(ops, sizeof(TaglineTraceOp), tr->nops, fh) != tr->nops) ||
+			(fwrite(pat, 1, hdr.patbytes, fh) != hdr.patbytes)) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure writing the binary trace [%s], error: %s.", path, strerror(errno));
+		goto out;
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Wrote binary trace [%s] (%u ops, %u pattern bytes)", path, hdr.nops, hdr.patbytes);
+	ret = 0;
+
+out:
+	if ((fh != NULL) && fclose(fh)) {
+		ret = -1;
+	}
+	free(ops);
+	free(slots);
+	free(pat);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trace_save_text
+// Description  : Write a loaded workload in the text format
+//
+// Inputs       : path - the output file
+//                tr - the loaded workload
+// Outputs      : 0 if successful, -1 if failure
+
+int tagline_trace_save_text(const char *path, TaglineTrace *tr) {
+	TaglineTraceOp *op;
+	FILE *fh;
+	uint32_t i;
+	int err = 0;
+
+	if ((fh = fopen(path, "w")) == NULL) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure opening the output file [%s]", path);
+		return( -1 );
+	}
+	for (i = 0; i < tr->nops; i++) {
+		op = &tr->ops[i];
+		fprintf(fh, "%.*s %u %u %u %.*s\n", (int)op->namelen, tr->patterns + op->name,
+				op->tag, op->blocks, op->start, (int)op->datalen, tr->patterns + op->data);
+	}
+	err = ferror(fh);
+	if (fclose(fh) || err) {
+		RAID_LOG(LOG_ERROR_LEVEL, "Failure writing the output file [%s]", path);
+		return( -1 );
+	}
+	RAID_LOG(LOG_INFO_LEVEL, "Wrote text workload [%s] (%u ops)", path, tr->nops);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trace_free
+// Description  : Release a loaded workload
+//
+// Inputs       : tr - the trace
+// Outputs      : none
+
+void tagline_trace_free(TaglineTrace *tr) {
+	if (!tr->binary) {
+		free(tr->ops);
+	}
+	if (tr->map != NULL) {
+		munmap(tr->map, tr->maplen);
+	}
+	memset(tr, 0x0, sizeof(*tr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_trace_opname
+// Description  : The canonical command text of an op type
+//
+// Inputs       : cmd - the op type
+// Outputs      : the command text
+
+const char *tagline_trace_opname(TAGLINE_OP_TYPES cmd) {
+	return( (cmd < TAGLINE_OP_MAXVAL) ? trace_opnames[cmd] : trace_opnames[TAGLINE_OP_OTHER] );
+}
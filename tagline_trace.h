@@ -0,0 +1,100 @@
+#ifndef TAGLINE_TRACE_INCLUDED
+#define TAGLINE_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_trace.h
+//  Description   : This is the workload trace loader for the tagline
+//                  simulator.  A workload is either the text format
+//
+//                    <command> <tag> <blocks> <start block> <data>
+//
+//                  (one op per line; CLONE and SNAPSHOT copy the tagline
+//                  given as the start block onto <tag>), parsed in place
+//                  from an mmap of the
+//                  file, or the binary trace format written by
+//                  tagline_convert, which is mapped and used as is:
+//
+//                    header | ops (TaglineTraceOp[nops]) | pattern table
+//
+//                  Every op refers to its command and data text by offset
+//                  and length into the pattern table (for text workloads,
+//                  the file itself).  Binary traces are in host byte order.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/31/15
+//
+
+// Include Files
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+#define TAGLINE_TRACE_MAGIC   "TLTRACE"  // First 8 bytes of a binary trace
+#define TAGLINE_TRACE_VERSION 1          // Binary trace layout version
+#define TAGLINE_TRACE_MAXDATA 1203       // Longest data text (as in the old parser)
+
+// Type definitions
+typedef enum {
+	TAGLINE_OP_OTHER    = 0, // Unrecognised command (logged, otherwise ignored)
+	TAGLINE_OP_INIT     = 1, // Initialize the driver
+	TAGLINE_OP_CLOSE    = 2, // Close the driver
+	TAGLINE_OP_READ     = 3, // Read and check blocks
+	TAGLINE_OP_WRITE    = 4, // Write blocks
+	TAGLINE_OP_DISKFAIL = 5, // Fail a disk
+	TAGLINE_OP_VALIDATE = 6, // Final per-block validation of a tagline
+	TAGLINE_OP_TRIM     = 7, // Unmap blocks of a tagline
+	TAGLINE_OP_DELETE   = 8, // Unmap a whole tagline
+	TAGLINE_OP_CLONE    = 9, // Copy a tagline, writable
+	TAGLINE_OP_SNAPSHOT = 10, // Copy a tagline, read-only
+	TAGLINE_OP_MAXVAL   = 11, // Max value
+} TAGLINE_OP_TYPES;
+
+typedef struct {
+	uint8_t  cmd;     // The op type (TAGLINE_OP_TYPES)
+	uint8_t  namelen; // Length of the command text
+	uint16_t tag;     // Tagline (disk for DISKFAIL, tag count for INIT)
+	uint16_t blocks;  // Number of blocks
+	uint16_t datalen; // Length of the data text
+	uint32_t start;   // Starting block
+	uint32_t name;    // Offset of the command text
+	uint32_t data;    // Offset of the data text
+} TaglineTraceOp;
+
+typedef struct {
+	char     magic[8]; // TAGLINE_TRACE_MAGIC
+	uint32_t version;  // TAGLINE_TRACE_VERSION
+	uint32_t nops;     // Number of ops
+	uint32_t patbytes; // Size of the pattern table
+	uint32_t reserved; // Zero
+} TaglineTraceHeader;
+
+typedef struct {
+	TaglineTraceOp *ops;      // The ops
+	uint32_t        nops;     // Number of ops
+	const char     *patterns; // The pattern table
+	uint32_t        patbytes; // Size of the pattern table
+	void           *map;      // The mapped file
+	size_t          maplen;   // Size of the mapping
+	int             binary;   // Loaded from a binary trace
+} TaglineTrace;
+
+//
+// Functional Prototypes
+
+int tagline_trace_load(const char *path, TaglineTrace *tr);
+	// Map a text or binary workload and index its ops
+
+int tagline_trace_save(const char *path, TaglineTrace *tr);
+	// Write a loaded workload as a binary trace
+
+int tagline_trace_save_text(const char *path, TaglineTrace *tr);
+	// Write a loaded workload in the text format
+
+void tagline_trace_free(TaglineTrace *tr);
+	// Release a loaded workload
+
+const char *tagline_trace_opname(TAGLINE_OP_TYPES cmd);
+	// The canonical command text of an op type
+
+#endif
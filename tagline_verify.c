@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_verify.c
+//  Description   : This is the read validation kernel for the tagline
+//                  simulator.  Each kernel XORs a block against its
+//                  broadcast character and ORs the results together, so a
+//                  block costs one pass of wide loads and a single test.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/21/15
+//
+
+// Include Files
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERIFY_X86 1
+#endif
+
+// Project Include Files
+#include <tagline_driver.h>
+#include <tagline_verify.h>
+
+// Type definitions
+typedef int (*TaglineVerifyFn)(const char *buf, const char *expect, uint32_t blocks);
+
+//
+// Global data
+static TaglineVerifyFn verify_fn = NULL;    // The kernel in use
+static const char *verify_name = "scalar";  // Its name
+static pthread_once_t verify_once = PTHREAD_ONCE_INIT;
+
+//
+// Local Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : verify_scalar
+// Description  : The portable kernel, eight bytes at a time
+//
+// Inputs       : buf - the blocks read
+//                expect - the character of each block
+//                blocks - the number of blocks
+// Outputs      : the first bad block, or -1 if all match
+
+static int verify_scalar(const char *buf, const char *expect, uint32_t blocks) {
+	uint64_t fill, acc, word;
+	uint32_t i, j;
+
+	for (i = 0; i < blocks; i++, buf += TAGLINE_BLOCK_SIZE) {
+		fill = 0x0101010101010101ULL * (uint8_t)expect[i];
+		for (acc = 0, j = 0; j < TAGLINE_BLOCK_SIZE; j += sizeof(word)) {
+			memcpy(&word, buf + j, sizeof(word));
+			acc |= word ^ fill;
+		}
+		if (acc) {
+			return( (int)i );
+		}
+	}
+	return( -1 );
+}
+
+#ifdef VERIFY_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : verify_sse2
+// Description  : The SSE2 kernel, 64 bytes per step
+//
+// Inputs       : buf - the blocks read
+//                expect - the character of each block
+//                blocks - the number of blocks
+// Outputs      : the first bad block, or -1 if all match
+
+__attribute__((target("sse2")))
+static int verify_sse2(const char *buf, const char *expect, uint32_t blocks) {
+	__m128i fill, a0, a1, a2, a3;
+	const __m128i *p;
+	uint32_t i, j;
+
+	for (i = 0; i < blocks; i++, buf += TAGLINE_BLOCK_SIZE) {
+		fill = _mm_set1_epi8(expect[i]);
+		a0 = a1 = a2 = a3 = _mm_setzero_si128();
+		p = (const __m128i *)buf;
+		for (j = 0; j < TAGLINE_BLOCK_SIZE / sizeof(__m128i); j += 4) {
+			a0 = _mm_or_si128(a0, _mm_xor_si128(_mm_loadu_si128(p + j), fill));
+			a1 = _mm_or_si128(a1, _mm_xor_si128(_mm_loadu_si128(p + j + 1), fill));
+			a2 = _mm_or_si128(a2, _mm_xor_si128(_mm_loadu_si128(p + j + 2), fill));
+			a3 = _mm_or_si128(a3, _mm_xor_si128(_mm_loadu_si128(p + j + 3), fill));
+		}
+		a0 = _mm_or_si128(_mm_or_si128(a0, a1), _mm_or_si128(a2, a3));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a0, _mm_setzero_si128())) != 0xffff) {
+			return( (int)i );
+		}
+	}
+	return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : verify_avx2
+// Description  : The AVX2 kernel, 128 bytes per step
+//
+// Inputs       : buf - the blocks read
+//                expect - the character of each block
+//                blocks - the number of blocks
+// Outputs      : the first bad block, or -1 if all match
+
+__attribute__((target("avx2")))
+static int verify_avx2(const char *buf, const char *expect, uint32_t blocks) {
+	__m256i fill, a0, a1, a2, a3;
+	const __m256i *p;
+	uint32_t i, j;
+
+	for (i = 0; i < blocks; i++, buf += TAGLINE_BLOCK_SIZE) {
+		fill = _mm256_set1_epi8(expect[i]);
+		a0 = a1 = a2 = a3 = _mm256_setzero_si256();
+		p = (const __m256i *)buf;
+		for (j = 0; j < TAGLINE_BLOCK_SIZE / sizeof(__m256i); j += 4) {
+			a0 = _mm256_or_si256(a0, _mm256_xor_si256(_mm256_loadu_si256(p + j), fill));
+			a1 = _mm256_or_si256(a1, _mm256_xor_si256(_mm256_loadu_si256(p + j + 1), fill));
+			a2 = _mm256_or_si256(a2, _mm256_xor_si256(_mm256_loadu_si256(p + j + 2), fill));
+			a3 = _mm256_or_si256(a3, _mm256_xor_si256(_mm256_loadu_si256(p + j + 3), fill));
+		}
+		a0 = _mm256_or_si256(_mm256_or_si256(a0, a1), _mm256_or_si256(a2, a3));
+		if (!_mm256_testz_si256(a0, a0)) {
+			return( (int)i );
+		}
+	}
+	return( -1 );
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : verify_select
+// Description  : Pick the widest kernel the CPU supports
+//
+// Inputs       : none
+// Outputs      : none
+
+static void verify_select(void) {
+	verify_fn = verify_scalar;
+#ifdef VERIFY_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		verify_fn = verify_avx2;
+		verify_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		verify_fn = verify_sse2;
+		verify_name = "sse2";
+	}
+#endif
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_verify_fill
+// Description  : Check each block of a read is filled with its character
+//
+// Inputs       : buf - the blocks read
+//                expect - the character of each block
+//                blocks - the number of blocks
+// Outputs      : the first bad block, or -1 if all match
+
+int tagline_verify_fill(const char *buf, const char *expect, uint32_t blocks) {
+	pthread_once(&verify_once, verify_select);
+	return( verify_fn(buf, expect, blocks) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagline_verify_kernel
+// Description  : The name of the kernel in use
+//
+// Inputs       : none
+// Outputs      : "avx2", "sse2" or "scalar"
+
+const char *tagline_verify_kernel(void) {
+	pthread_once(&verify_once, verify_select);
+	return( verify_name );
+}
@@ -0,0 +1,32 @@
+#ifndef TAGLINE_VERIFY_INCLUDED
+#define TAGLINE_VERIFY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : tagline_verify.h
+//  Description   : This is the read validation kernel for the tagline
+//                  simulator.  Workload data is one character per block, so
+//                  a read is checked by testing that every block is filled
+//                  with its character, in a single pass over the data and
+//                  without building an expected buffer.  The widest kernel
+//                  the CPU supports (AVX2, SSE2 or 64-bit scalar) is picked
+//                  at run time.
+//
+//  Author        : Dhruva Seelin
+//  Last Modified : 12/21/15
+//
+
+// Include Files
+#include <stdint.h>
+
+//
+// Functional Prototypes
+
+int tagline_verify_fill(const char *buf, const char *expect, uint32_t blocks);
+	// Check each block of buf is filled with its expect character, returning
+	// the first block that is not, or -1 if all are
+
+const char *tagline_verify_kernel(void);
+	// The name of the kernel in use
+
+#endif